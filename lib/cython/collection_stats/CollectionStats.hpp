@@ -1,27 +1,51 @@
 #ifndef COLLECTION_STATS_HPP
 #define COLLECTION_STATS_HPP
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <unordered_map>
 #include <unordered_set>
 #include <parallel/algorithm>
 
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <queue>
+#include <type_traits>
+#include <vector>
 
 #include "pattern_matching/AhoCorasickAutomaton.hpp"
 #include "buffered_stream/BufferedReader.hpp"
 #include "buffered_stream/BufferedWriter.hpp"
 #include "pattern_matching/PatternMatcher.hpp"
+#include "NumaTopology.hpp"
 
 typedef uint64_t key_frequency_t;
 typedef uint32_t document_frequency_t;
 typedef uint16_t distance_t;
 
 
+/**
+ * True when the asynchronous operation of the future has completed
+ */
+template<typename T>
+inline bool
+is_future_ready(
+        const std::shared_future<T> &future
+) {
+    return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+
 template<typename KeyType>
 class KeyPair {
 private:
@@ -42,12 +66,10 @@ public:
         }
     }
 
+    // defaulted to keep the pairs trivially copyable
     KeyPair(
             const KeyPair &keyPair
-    ) :
-            _first(keyPair._first),
-            _second(keyPair._second) {
-    }
+    ) = default;
 
     inline const KeyType &
     first() const {
@@ -132,13 +154,10 @@ public:
         }
     }
 
+    // defaulted to keep the triples trivially copyable
     KeyTriple(
             const KeyTriple &keyTriple
-    ) :
-            _first(keyTriple._first),
-            _second(keyTriple._second),
-            _third(keyTriple._third) {
-    }
+    ) = default;
 
     inline const KeyType &
     first() const {
@@ -250,6 +269,18 @@ public:
         this->frequency += other.frequency;
         this->frequency_square += other.frequency_square;
     }
+
+    inline void
+    subtract(const StatsKey &other) {
+        this->document_frequency -= other.document_frequency;
+        this->frequency -= other.frequency;
+        this->frequency_square -= other.frequency_square;
+    }
+
+    inline bool
+    is_zero() const {
+        return this->document_frequency == 0;
+    }
 };
 
 
@@ -299,6 +330,26 @@ public:
             this->window_min_dist = other.window_min_dist;
         }
     }
+
+    /**
+     * Subtract the stats of a removed document. The minimum distance cannot be restored, hence it is kept as a lower
+     * bound of the real one until no window co-occurrence remains
+     */
+    inline void
+    subtract(const StatsKeyPair &other) {
+        this->document_frequency -= other.document_frequency;
+        this->window_document_frequency -= other.window_document_frequency;
+        this->window_frequency -= other.window_frequency;
+        this->window_frequency_square -= other.window_frequency_square;
+        if (this->window_document_frequency == 0) {
+            this->window_min_dist = (distance_t) -1;
+        }
+    }
+
+    inline bool
+    is_zero() const {
+        return this->document_frequency == 0 && this->window_document_frequency == 0;
+    }
 };
 
 
@@ -348,411 +399,1832 @@ public:
             this->window_min_dist = other.window_min_dist;
         }
     }
-};
 
+    /**
+     * Subtract the stats of a removed document. The minimum distance cannot be restored, hence it is kept as a lower
+     * bound of the real one until no window co-occurrence remains
+     */
+    inline void
+    subtract(const StatsKeyTriple &other) {
+        this->document_frequency -= other.document_frequency;
+        this->window_document_frequency -= other.window_document_frequency;
+        this->window_frequency -= other.window_frequency;
+        this->window_frequency_square -= other.window_frequency_square;
+        if (this->window_document_frequency == 0) {
+            this->window_min_dist = (distance_t) -1;
+        }
+    }
 
-template<
-        typename KeyType,
-        bool B_DISABLE_UNWINDOWED = false,
-        bool B_RESTRICTED = true,
-        bool B_BUFFERED_WORKER = false,
-        bool B_BUFFERED_COLLECTOR = false
->
-class CollectionStatsFiller;
+    inline bool
+    is_zero() const {
+        return this->document_frequency == 0 && this->window_document_frequency == 0;
+    }
+};
 
 
 /**
- * Collection Stats class, used to collect statistic about collections and query them
- * @tparam KeyType The elements type
- * @tparam B_RESTRICTED A boolean saying if the statistics must be restricted to only certain keys
+ * Window counters of a pair or a triple for one of the additional windows of a CollectionStats.
+ * The minimum distance is not repeated: the keys have fixed lengths, hence the closest occurrence of a pair or a
+ * triple falls in every window that contains some of its occurrences
  */
-template<
-        typename KeyType,
-        bool B_DISABLE_UNWINDOWED = false,
-        bool B_RESTRICTED = true
->
-class CollectionStats {
-private:
-    using _Key = KeyType;
-    using _KeyPair = KeyPair<KeyType>;
-    using _KeyTriple = KeyTriple<KeyType>;
-
+class StatsWindow {
 public:
+    document_frequency_t window_document_frequency;
+    key_frequency_t window_frequency;
+    key_frequency_t window_frequency_square;
+
+    StatsWindow() {
+        this->window_document_frequency = 0;
+        this->window_frequency = this->window_frequency_square = 0;
+    }
+
+    StatsWindow(
+            document_frequency_t window_document_frequency,
+            key_frequency_t window_frequency,
+            key_frequency_t window_frequency_square
+    ) {
+        this->window_document_frequency = window_document_frequency;
+        this->window_frequency = window_frequency;
+        this->window_frequency_square = window_frequency_square;
+    }
+
+    inline void
+    update(const StatsWindow &other) {
+        this->window_document_frequency += other.window_document_frequency;
+        this->window_frequency += other.window_frequency;
+        this->window_frequency_square += other.window_frequency_square;
+    }
+
+    inline void
+    subtract(const StatsWindow &other) {
+        this->window_document_frequency -= other.window_document_frequency;
+        this->window_frequency -= other.window_frequency;
+        this->window_frequency_square -= other.window_frequency_square;
+    }
+
+    inline bool
+    is_zero() const {
+        return this->window_document_frequency == 0;
+    }
+};
+
+
 /**
- * Object fields
+ * Estimate of a count over the whole collection from the sampled documents, with the estimated variance
  */
-public:
-    const distance_t window_size_key_pairs_co_occ;
-    const distance_t window_size_key_triples_co_occ;
+struct StatsEstimate {
+    double value;
+    double variance;
 
-private:
-    // the following fields are used as zero elements
-    const StatsKey zero_stats_key = StatsKey();
-    const StatsKeyPair zero_stats_key_pair = StatsKeyPair();
-    const StatsKeyTriple zero_stats_key_triple = StatsKeyTriple();
+    /**
+     * Horvitz-Thompson estimate of the sum over the documents, each one sampled with probability sampling_rate, given
+     * the sum and the sum of the squares over the sampled documents
+     */
+    static StatsEstimate
+    from_sample(
+            key_frequency_t sum,
+            key_frequency_t sum_square,
+            double sampling_rate
+    ) {
+        return {sum / sampling_rate, (1 - sampling_rate) * sum_square / (sampling_rate * sampling_rate)};
+    }
+};
 
-    document_frequency_t num_docs;  // number of documents
-    key_frequency_t key_frequency_sum;  // sum of the key frequencies
-    key_frequency_t key_pair_window_co_occ_sum;  // sum of the windowed pair co_occ
-    key_frequency_t key_triple_window_co_occ_sum;  // sum of the windowed triple co_occ
+struct EstimatedStatsKey {
+    StatsEstimate document_frequency;
+    StatsEstimate frequency;
+};
 
-    std::unordered_map<_Key, StatsKey> stats_key;  // key to stats_key
-    std::unordered_map<_KeyPair, StatsKeyPair> stats_key_pair;  // key_pair to stats_key_pair
-    std::unordered_map<_KeyTriple, StatsKeyTriple> stats_key_triple;  // key_triple to stats_key_triple
+struct EstimatedStatsKeyPair {
+    StatsEstimate document_frequency;
+    StatsEstimate window_document_frequency;
+    StatsEstimate window_frequency;
+};
 
-public:
-    friend class CollectionStatsFiller<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED, false, false>;
-    friend class CollectionStatsFiller<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED, false, true>;
-    friend class CollectionStatsFiller<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED, true, false>;
-    friend class CollectionStatsFiller<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED, true, true>;
+struct EstimatedStatsKeyTriple {
+    StatsEstimate document_frequency;
+    StatsEstimate window_document_frequency;
+    StatsEstimate window_frequency;
+};
 
-    CollectionStats(
-            distance_t window_size_key_pairs_co_occ = 12,
-            distance_t window_size_key_triples_co_occ = 15
+
+/**
+ * Appendable array of trivially copyable records, used by the buffered workers.
+ * The memory is never zero-initialized and it is kept between documents: its size follows the largest recent
+ * documents, hence it is shrunk only when it is far bigger than what they need
+ */
+template<typename _T>
+class RecordArena {
+    static_assert(std::is_trivially_copyable<_T>::value, "The records must be trivially copyable");
+
+private:
+    _T *records;
+    size_t num_records;
+    size_t capacity;
+    size_t learned_capacity;  // slowly decaying maximum of the number of records per document
+
+public:
+    RecordArena(
+            size_t initial_capacity
     ) :
-            window_size_key_pairs_co_occ(window_size_key_pairs_co_occ),
-            window_size_key_triples_co_occ(window_size_key_triples_co_occ),
-            num_docs(0),
-            key_frequency_sum(0),
-            key_pair_window_co_occ_sum(0),
-            key_triple_window_co_occ_sum(0) {};
+            records(nullptr),
+            num_records(0),
+            capacity(0),
+            learned_capacity(initial_capacity) {
+        this->reallocate(initial_capacity);
+    }
 
-    /**
-     * Reset the collection stats and all the restrictions
-     */
-    void clear() {
-        this->num_docs = 0;
-        this->key_frequency_sum = 0;
-        this->key_pair_window_co_occ_sum = 0;
-        this->key_triple_window_co_occ_sum = 0;
+    RecordArena(const RecordArena &other) = delete;
 
-        this->stats_key.clear();
-        this->stats_key_pair.clear();
-        this->stats_key_triple.clear();
+    RecordArena &operator=(const RecordArena &other) = delete;
+
+    ~RecordArena() {
+        std::free(this->records);
     }
 
-    void
-    dump(
-            const std::string &filename
-    ) const {
-        std::ofstream outfile(filename, std::fstream::trunc | std::fstream::binary);
-        try {
-            this->dumps(&outfile);
-            outfile.close();
-        } catch (...) {
-            outfile.close();
-            throw;
+    inline void
+    push_back(
+            const _T &record
+    ) {
+        if (this->num_records == this->capacity) {
+            this->reallocate(this->capacity * 2);
         }
+        this->records[this->num_records++] = record;
     }
 
-    void
-    dumps(
-            std::ostream *os
-    ) const {
-        BufferedWriter<false> writer(os, 8192);
-        this->dumps(writer);
-        writer.flush();
+    inline _T *
+    begin() noexcept {
+        return this->records;
     }
 
-    void
-    dumps(
-            BufferedWriter<false> &writer
-    ) const {
-        if (is_pointer<_Key>::value) {
-            throw std::runtime_error("Unable to serialize this CollectionStats type");
-        }
+    inline _T *
+    end() noexcept {
+        return this->records + this->num_records;
+    }
 
-        // write the size of the type
-        writer.put<size_t>(sizeof(_Key));
-        // write if this collection is restricted
-        writer.put<bool>(B_DISABLE_UNWINDOWED);
-        // write if this collection is restricted
-        writer.put<bool>(B_RESTRICTED);
-        // write pair window size
-        writer.put<distance_t>(this->window_size_key_pairs_co_occ);
-        // write triple window size
-        writer.put<distance_t>(this->window_size_key_triples_co_occ);
-        // write num_docs
-        writer.put<document_frequency_t>(this->num_docs);
-        // write key_frequency_sum
-        writer.put<key_frequency_t>(this->key_frequency_sum);
-        // write key_pair_window_co_occ_sum
-        writer.put<key_frequency_t>(this->key_pair_window_co_occ_sum);
-        // write key_triple_window_co_occ_sum
-        writer.put<key_frequency_t>(this->key_triple_window_co_occ_sum);
+    inline _T &
+    operator[](
+            size_t i
+    ) noexcept {
+        return this->records[i];
+    }
 
-        // write stats_key, which type is unordered_map<_Key, StatsKey>
-        writer.put<size_t>(this->stats_key.size());
-        for (auto it: this->stats_key) {
-            writer.put<_Key>(it.first);
-            writer.put<StatsKey>(it.second);
-        }
-        // write stats_key_pair, which type is unordered_map<_KeyPair, StatsKeyPair>
-        writer.put<size_t>(this->stats_key_pair.size());
-        for (auto it: this->stats_key_pair) {
-            writer.put<_KeyPair>(it.first);
-            writer.put<StatsKeyPair>(it.second);
-        }
-        // write stats_key_triple, which type is unordered_map<_KeyTriple, StatsKeyTriple>
-        writer.put<size_t>(this->stats_key_triple.size());
-        for (auto it: this->stats_key_triple) {
-            writer.put<_KeyTriple>(it.first);
-            writer.put<StatsKeyTriple>(it.second);
+    inline const _T &
+    operator[](
+            size_t i
+    ) const noexcept {
+        return this->records[i];
+    }
+
+    inline size_t
+    size() const noexcept {
+        return this->num_records;
+    }
+
+    /**
+     * Remove all the records, learning the capacity needed by the documents
+     */
+    inline void
+    clear() {
+        this->learned_capacity = std::max(this->num_records,
+                                          this->learned_capacity - this->learned_capacity / 16);
+        this->num_records = 0;
+        if (this->capacity > 4 * this->learned_capacity && this->capacity > 1024) {
+            this->reallocate(std::max((size_t) 1024, 2 * this->learned_capacity));
         }
     }
 
-    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
-    load(
-            const std::string &filename
+private:
+    void
+    reallocate(
+            size_t new_capacity
     ) {
-        std::ifstream infile(filename, std::ifstream::binary);
-        if (infile.fail() or !infile.is_open()) {
-            throw std::runtime_error("The file cannot be opened");
-        }
-        try {
-            BufferedReader<false> reader(&infile, 8 * 1024 * 1024);
-            CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED> *result = CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED>::loads(reader);
-            infile.close();
-            return result;
-        } catch (...) {
-            infile.close();
-            throw;
+        new_capacity = std::max((size_t) 1, new_capacity);
+        _T *new_records = (_T *) std::realloc(this->records, new_capacity * sizeof(_T));
+        if (new_records == nullptr) {
+            throw std::bad_alloc();
         }
+        this->records = new_records;
+        this->capacity = new_capacity;
     }
+};
 
-    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
-    loads(
-            std::istream *is
-    ) {
-        BufferedReader<true> reader(is, 8 * 1024 * 1024, 0);
-        return CollectionStats::loads(reader);
+
+/**
+ * Hash table of the stats of a single document, used by the unbuffered workers in place of an unordered_map.
+ * The entries are appended to a flat vector indexed by open addressing slots tagged with the generation that filled
+ * them, hence clear() is O(1), nothing is allocated once the table has grown and the entries are iterated in
+ * insertion order
+ */
+template<typename _Key, typename _Value>
+class LocalStatsTable {
+public:
+    using Entry = std::pair<_Key, _Value>;
+
+private:
+    struct Slot {
+        uint32_t generation;
+        uint32_t entry_index;
     };
 
-    template<bool use_read_constraint = true>
-    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
-    loads(
-            BufferedReader<use_read_constraint> &reader
+    std::vector<Slot> slots;  // a power of two, at least twice the number of entries
+    unsigned int slot_shift;  // 64 - log2(slots.size())
+    uint32_t generation;
+    std::vector<Entry> entries;
+
+public:
+    explicit LocalStatsTable(
+            size_t initial_capacity
+    ) :
+            generation(1) {
+        this->entries.reserve(initial_capacity);
+        this->reset_slots(2 * initial_capacity);
+    }
+
+    /**
+     * Insert the entry if its key is not in the table. Return the entry of the key, valid until the next insert, and
+     * true if it has been inserted
+     */
+    inline std::pair<Entry *, bool>
+    insert(
+            const Entry &entry
     ) {
-        if (is_pointer<_Key>::value) {
-            throw std::runtime_error("Unable to deserialize this CollectionStats type");
+        if (2 * (this->entries.size() + 1) > this->slots.size()) {
+            this->grow();
         }
+        const size_t slot_mask = this->slots.size() - 1;
+        for (size_t i = this->slot_of(entry.first);; i = (i + 1) & slot_mask) {
+            Slot &slot = this->slots[i];
+            if (slot.generation != this->generation) {
+                slot.generation = this->generation;
+                slot.entry_index = (uint32_t) this->entries.size();
+                this->entries.push_back(entry);
+                return {&this->entries.back(), true};
+            }
+            Entry &other = this->entries[slot.entry_index];
+            if (std::equal_to<_Key>()(other.first, entry.first)) {
+                return {&other, false};
+            }
+        }
+    }
 
-        // temporary size and read buffer used in the following code
-        size_t tmp_size;
-        if (use_read_constraint) {
-            const size_t initial_buffer_limit =
-                    sizeof(size_t)  // type size
-                    + sizeof(bool)  // disable unwindowed type
-                    + sizeof(bool)  // restriction type
-                    + sizeof(distance_t)  // window_size_key_pairs_co_occ
-                    + sizeof(distance_t)  // window_size_key_triples_co_occ
-                    + sizeof(document_frequency_t)  // num_docs
-                    + sizeof(key_frequency_t)  // key_frequency_sum
-                    + sizeof(key_frequency_t)  // key_pair_window_co_occ_sum
-                    + sizeof(key_frequency_t)  // key_triple_window_co_occ_sum
-                    + sizeof(size_t)  // stats_key size
-                    + sizeof(size_t)  // stats_key_pair size
-                    + sizeof(size_t);  // stats_key_triple size
-            reader.increase_num_bytes_constraint(initial_buffer_limit);
-        }
-
-        // read the size of the type
-        tmp_size = reader.template get<size_t>();
-        if (tmp_size != sizeof(_Key)) {
-            throw std::runtime_error("The type of the collection to load is not compatible with the one given");
-        }
-        bool restricted = reader.template get<bool>();
-        if (restricted != B_DISABLE_UNWINDOWED) {
-            throw std::runtime_error("The collection to load is has not the same type B_DISABLE_UNWINDOWED of this one");
-        }
-        restricted = reader.template get<bool>();
-        if (restricted != B_RESTRICTED) {
-            throw std::runtime_error("The collection to load is has not the same type B_RESTRICTED of this one");
+    /**
+     * Return the entry of the key, or nullptr if it is not in the table
+     */
+    inline const Entry *
+    find(
+            const _Key &key
+    ) const {
+        const size_t slot_mask = this->slots.size() - 1;
+        for (size_t i = this->slot_of(key);; i = (i + 1) & slot_mask) {
+            const Slot &slot = this->slots[i];
+            if (slot.generation != this->generation) {
+                return nullptr;
+            }
+            const Entry &entry = this->entries[slot.entry_index];
+            if (std::equal_to<_Key>()(entry.first, key)) {
+                return &entry;
+            }
         }
-        // create the collection stats to return
-        CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED> *result = new CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED>(
-                reader.template get<distance_t>(),
-                reader.template get<distance_t>()
-        );
+    }
 
-        // read num_docs
-        result->num_docs = reader.template get<document_frequency_t>();
-        // read key_frequency_sum
-        result->key_frequency_sum = reader.template get<key_frequency_t>();
-        // read key_pair_window_co_occ_sum
-        result->key_pair_window_co_occ_sum = reader.template get<key_frequency_t>();
-        // read key_triple_window_co_occ_sum
-        result->key_triple_window_co_occ_sum = reader.template get<key_frequency_t>();
+    inline Entry *
+    begin() noexcept {
+        return this->entries.data();
+    }
 
-        // read stats_key, which type is unordered_map<_Key, StatsKey>
-        tmp_size = reader.template get<size_t>();
-        if (use_read_constraint) {
-            reader.increase_num_bytes_constraint(tmp_size * (sizeof(_Key) + sizeof(StatsKey)));
-        }
-        result->stats_key.reserve(tmp_size);
+    inline Entry *
+    end() noexcept {
+        return this->entries.data() + this->entries.size();
+    }
 
-        for (size_t i = 0; i < tmp_size; ++i) {
-            _Key key(reader.template get<_Key>());
-            StatsKey value(reader.template get<StatsKey>());
+    inline size_t
+    size() const noexcept {
+        return this->entries.size();
+    }
 
-            result->stats_key.insert({key, value});
+    /**
+     * Remove all the entries: the slots of the previous generations are free
+     */
+    inline void
+    clear() {
+        this->entries.clear();
+        if (++this->generation == 0) {
+            // the tags wrapped around, the old ones could be taken for current ones
+            std::fill(this->slots.begin(), this->slots.end(), Slot{0, 0});
+            this->generation = 1;
         }
+    }
 
-        // read stats_key_pair, which type is unordered_map<_KeyPair, StatsKeyPair>
-        tmp_size = reader.template get<size_t>();
-        if (use_read_constraint) {
-            reader.increase_num_bytes_constraint(tmp_size * (sizeof(_KeyPair) + sizeof(StatsKeyPair)));
-        }
-        result->stats_key_pair.reserve(tmp_size);
+private:
+    inline size_t
+    slot_of(
+            const _Key &key
+    ) const {
+        // the hashes of the integers are the identity, the high bits of the product depend on all of them
+        return (size_t) (((uint64_t) std::hash<_Key>()(key) * 0x9E3779B97F4A7C15ull) >> this->slot_shift);
+    }
 
-        for (size_t i = 0; i < tmp_size; ++i) {
-            _KeyPair key(reader.template get<_KeyPair>());
-            StatsKeyPair value(reader.template get<StatsKeyPair>());
+    void
+    reset_slots(
+            size_t min_num_slots
+    ) {
+        size_t num_slots = 16;
+        unsigned int slot_shift = 60;
+        for (; num_slots < min_num_slots; num_slots *= 2, --slot_shift);
+        this->slots.assign(num_slots, Slot{0, 0});
+        this->slot_shift = slot_shift;
+    }
 
-            result->stats_key_pair.insert({key, value});
+    void
+    grow() {
+        this->reset_slots(2 * this->slots.size());
+        const size_t slot_mask = this->slots.size() - 1;
+        for (size_t entry_index = 0; entry_index < this->entries.size(); ++entry_index) {
+            size_t i = this->slot_of(this->entries[entry_index].first);
+            for (; this->slots[i].generation == this->generation; i = (i + 1) & slot_mask);
+            this->slots[i] = Slot{this->generation, (uint32_t) entry_index};
         }
+    }
+};
 
-        // read stats_key_triple, which type is unordered_map<_KeyTriple, StatsKeyTriple>
-        tmp_size = reader.template get<size_t>();
-        if (use_read_constraint) {
-            reader.increase_num_bytes_constraint(tmp_size * (sizeof(_KeyTriple) + sizeof(StatsKeyTriple)));
-        }
-        result->stats_key_triple.reserve(tmp_size);
 
-        for (size_t i = 0; i < tmp_size; ++i) {
-            _KeyTriple key(reader.template get<_KeyTriple>());
-            StatsKeyTriple value(reader.template get<StatsKeyTriple>());
+/**
+ * Lengths of the patterns of a PatternMatcher. When the keys are unsigned integers not much larger than the number of
+ * patterns the lengths are stored in a flat array indexed by key, otherwise they are looked up in the map of the matcher
+ */
+template<typename KeyType>
+class PatternLengthTable {
+private:
+    const std::unordered_map<KeyType, uint16_t> &length_map;
+    std::vector<uint16_t> lengths;  // 0 for the keys that are not patterns
 
-            result->stats_key_triple.insert({key, value});
-        }
+public:
+    explicit PatternLengthTable(
+            const std::unordered_map<KeyType, uint16_t> &length_map
+    ) :
+            length_map(length_map) {
+        this->build(std::is_unsigned<KeyType>());
+    }
 
-        return result;
+    inline uint16_t
+    get(
+            const KeyType &key
+    ) const {
+        return this->get(key, std::is_unsigned<KeyType>());
     }
 
-    document_frequency_t
-    get_num_docs() const noexcept {
-        return this->num_docs;
+private:
+    void
+    build(std::false_type) {
     }
 
-    size_t
-    get_num_keys() const noexcept {
-        return this->stats_key.size();
+    void
+    build(std::true_type) {
+        uint64_t max_key = 0;
+        for (auto length_it: this->length_map) {
+            max_key = std::max(max_key, (uint64_t) length_it.first);
+        }
+        if (this->length_map.empty() || max_key >= 4 * this->length_map.size() + 65536) {
+            return;
+        }
+        this->lengths.assign(max_key + 1, 0);
+        for (auto length_it: this->length_map) {
+            this->lengths[length_it.first] = length_it.second;
+        }
     }
 
-    size_t
-    get_num_key_pairs() const noexcept {
-        return this->stats_key_pair.size();
+    inline uint16_t
+    get(
+            const KeyType &key,
+            std::false_type
+    ) const {
+        return this->length_map.at(key);
     }
 
-    size_t
-    get_num_key_triples() const noexcept {
-        return this->stats_key_triple.size();
+    inline uint16_t
+    get(
+            const KeyType &key,
+            std::true_type
+    ) const {
+        if ((uint64_t) key < this->lengths.size() && this->lengths[key] != 0) {
+            return this->lengths[key];
+        }
+        return this->length_map.at(key);
     }
+};
 
-    key_frequency_t
-    get_key_frequency_sum() const noexcept {
-        return this->key_frequency_sum;
+
+/**
+ * Suitability masks of a restricted filler, i.e. which counts a key or a pair of keys can take part in. The masks of
+ * the unsigned keys not much larger than the number of keys are stored in a flat array indexed by key, the other ones
+ * in a map. The masks of the pairs, both the restricted ones and the ones that are only part of restricted triples,
+ * are stored in a compact open addressing table. The index is written only while adding the restrictions, hence the
+ * workers read it without locks
+ */
+template<typename KeyType>
+class RestrictionIndex {
+private:
+    using _Key = KeyType;
+    using _KeyPair = KeyPair<KeyType>;
+
+    std::vector<char> key_masks;  // 0 for the keys without a mask
+    std::unordered_map<_Key, char> sparse_key_masks;
+    size_t num_keys;
+    LocalStatsTable<_KeyPair, char> key_pair_masks;
+
+public:
+    RestrictionIndex() :
+            num_keys(0),
+            key_pair_masks(0) {};
+
+    void
+    update_key_mask(
+            const _Key &key,
+            char mask
+    ) {
+        this->update_key_mask(key, mask, std::is_unsigned<KeyType>());
     }
 
-    key_frequency_t
-    get_key_pair_window_co_occ_sum() const noexcept {
-        return this->key_pair_window_co_occ_sum;
+    void
+    update_key_pair_mask(
+            const _KeyPair &keyPair,
+            char mask
+    ) {
+        auto entry = this->key_pair_masks.insert({keyPair, mask});
+        if (!entry.second) {
+            entry.first->second |= mask;
+        }
     }
 
-    key_frequency_t
-    get_key_triple_window_co_occ_sum() const noexcept {
-        return this->key_triple_window_co_occ_sum;
+    inline char
+    get_key_mask(
+            const _Key &key
+    ) const {
+        return this->get_key_mask(key, std::is_unsigned<KeyType>());
     }
 
-    StatsKey
-    get_stats_key(
-            const KeyType &key
+    inline char
+    get_key_pair_mask(
+            const _KeyPair &keyPair
     ) const {
-        auto stats_1_key_it = this->stats_key.find(key);
-        if (stats_1_key_it == this->stats_key.end()) {
-            if (B_RESTRICTED) {
-//                throw std::runtime_error("The given key is not among the restrictions");
-            }
-            return this->zero_stats_key;
+        const std::pair<_KeyPair, char> *entry = this->key_pair_masks.find(keyPair);
+        return entry != nullptr ? entry->second : 0;
+    }
+
+private:
+    void
+    update_sparse_key_mask(
+            const _Key &key,
+            char mask
+    ) {
+        auto entry = this->sparse_key_masks.insert({key, mask});
+        if (!entry.second) {
+            entry.first->second |= mask;
         } else {
-            return stats_1_key_it->second;
+            ++this->num_keys;
         }
     }
 
-    StatsKeyPair
-    get_stats_key_pair(
-            const KeyPair<KeyType> &keyPair
-    ) const {
-        auto stats_2_key_it = this->stats_key_pair.find(keyPair);
-        if (B_DISABLE_UNWINDOWED) {
-            if (stats_2_key_it == this->stats_key_pair.end()) {
-                if (B_RESTRICTED) {
-//                    throw std::runtime_error("The given pair of keys is not among the restrictions");
-                }
-                return this->zero_stats_key_pair;
-            } else {
-                return stats_2_key_it->second;
-            }
-        } else {
-            if (stats_2_key_it == this->stats_key_pair.end()) {
-                if (B_RESTRICTED) {
-//                    throw std::runtime_error("The given pair of keys is not among the restrictions");
-                }
-                document_frequency_t document_co_occ = 0;
-                if (std::equal_to<_Key>()(keyPair.first(), keyPair.second())) {
-                    document_co_occ = this->get_stats_key(keyPair.first()).document_frequency;
-                }
+    void
+    update_key_mask(
+            const _Key &key,
+            char mask,
+            std::false_type
+    ) {
+        this->update_sparse_key_mask(key, mask);
+    }
 
-                if (document_co_occ == 0) {
-                    return this->zero_stats_key_pair;
+    void
+    update_key_mask(
+            const _Key &key,
+            char mask,
+            std::true_type
+    ) {
+        // the same bound of PatternLengthTable, the array grows while the keys are dense enough
+        if ((uint64_t) key >= this->key_masks.size() && (uint64_t) key < 4 * (this->num_keys + 1) + 65536) {
+            this->key_masks.resize((size_t) key + 1, 0);
+            // the keys added when the array was shorter move into it, the lookups below its size read only the array
+            for (auto it = this->sparse_key_masks.begin(); it != this->sparse_key_masks.end();) {
+                if ((uint64_t) it->first < this->key_masks.size()) {
+                    this->key_masks[it->first] = it->second;
+                    it = this->sparse_key_masks.erase(it);
                 } else {
-                    StatsKeyPair statsKeyPair = this->zero_stats_key_pair;
-                    statsKeyPair.document_frequency = document_co_occ;
-                    return statsKeyPair;
+                    ++it;
                 }
-            } else {
-                StatsKeyPair statsKeyPair = stats_2_key_it->second;
-                if (std::equal_to<_Key>()(keyPair.first(), keyPair.second())) {
-                    statsKeyPair.document_frequency = this->get_stats_key(keyPair.first()).document_frequency;
-                }
-                return statsKeyPair;
             }
         }
+        if ((uint64_t) key < this->key_masks.size()) {
+            if (this->key_masks[key] == 0) {
+                ++this->num_keys;
+            }
+            this->key_masks[key] |= mask;
+        } else {
+            this->update_sparse_key_mask(key, mask);
+        }
     }
 
-    StatsKeyPair
-    get_stats_key_pair(
-            const KeyType &first,
-            const KeyType &second
+    inline char
+    get_key_mask(
+            const _Key &key,
+            std::false_type
     ) const {
-        return this->get_stats_key_pair(_KeyPair(first, second));
+        auto entry = this->sparse_key_masks.find(key);
+        return entry != this->sparse_key_masks.end() ? entry->second : 0;
     }
 
-    StatsKeyTriple
-    get_stats_key_triple(
-            const KeyTriple<KeyType> &keyTriple
+    inline char
+    get_key_mask(
+            const _Key &key,
+            std::true_type
     ) const {
-        auto stats_3_key_it = this->stats_key_triple.find(keyTriple);
-        if (B_DISABLE_UNWINDOWED) {
-            if (stats_3_key_it == this->stats_key_triple.end()) {
-                if (B_RESTRICTED) {
-//                    throw std::runtime_error("The given triple of keys is not among the restrictions");
-                }
-                return this->zero_stats_key_triple;
-            } else {
-                return stats_3_key_it->second;
-            }
-        } else {
-            if (stats_3_key_it == this->stats_key_triple.end()) {
-                if (B_RESTRICTED) {
-//                    throw std::runtime_error("The given triple of keys is not among the restrictions");
-                }
-                document_frequency_t document_co_occ = 0;
-                if (std::equal_to<_Key>()(keyTriple.first(), keyTriple.third())) {
-                    // all the keys are the same, because they are ordered
-                    document_co_occ = this->get_stats_key(keyTriple.first()).document_frequency;
-                } else if (std::equal_to<_Key>()(keyTriple.first(), keyTriple.second())) {
-                    // the first key is equal to the second one, but it is different from the third one
+        if ((uint64_t) key < this->key_masks.size()) {
+            return this->key_masks[key];
+        }
+        return this->get_key_mask(key, std::false_type());
+    }
+};
+
+
+/**
+ * Selection of the entries to load from a dump: the selected keys, the pairs and the triples made only of selected
+ * keys, and the pairs and the triples added explicitly as in the restrictions of a filler
+ */
+template<typename KeyType>
+class CollectionStatsFilter {
+private:
+    using _Key = KeyType;
+    using _KeyPair = KeyPair<KeyType>;
+    using _KeyTriple = KeyTriple<KeyType>;
+
+    std::unordered_set<_Key> keys;
+    std::unordered_set<_KeyPair> key_pairs;
+    std::unordered_set<_KeyTriple> key_triples;
+
+public:
+    CollectionStatsFilter() = default;
+
+    CollectionStatsFilter(
+            const std::vector<_Key> &keys
+    ) :
+            keys(keys.begin(), keys.end()) {};
+
+    void
+    add_key(
+            const _Key &key
+    ) {
+        this->keys.insert(key);
+    }
+
+    void
+    add_key_pair(
+            const _Key &first,
+            const _Key &second
+    ) {
+        this->key_pairs.insert(_KeyPair(first, second));
+    }
+
+    void
+    add_key_triple(
+            const _Key &first,
+            const _Key &second,
+            const _Key &third
+    ) {
+        this->key_triples.insert(_KeyTriple(first, second, third));
+    }
+
+    inline bool
+    contains(
+            const _Key &key
+    ) const {
+        return this->keys.find(key) != this->keys.end();
+    }
+
+    inline bool
+    contains(
+            const _KeyPair &keyPair
+    ) const {
+        return (this->contains(keyPair.first()) && this->contains(keyPair.second())) ||
+               this->key_pairs.find(keyPair) != this->key_pairs.end();
+    }
+
+    inline bool
+    contains(
+            const _KeyTriple &keyTriple
+    ) const {
+        return (this->contains(keyTriple.first()) && this->contains(keyTriple.second()) &&
+                this->contains(keyTriple.third())) ||
+               this->key_triples.find(keyTriple) != this->key_triples.end();
+    }
+
+    /**
+     * The sorted first keys of the entries that can be selected, used to skip the blocks of a compressed dump
+     */
+    std::vector<_Key>
+    get_first_keys(
+            const _Key *
+    ) const {
+        return sorted(this->keys);
+    }
+
+    std::vector<_Key>
+    get_first_keys(
+            const _KeyPair *
+    ) const {
+        std::vector<_Key> first_keys(this->keys.begin(), this->keys.end());
+        for (const _KeyPair &keyPair: this->key_pairs) {
+            first_keys.push_back(keyPair.first());
+        }
+        return sorted(first_keys);
+    }
+
+    std::vector<_Key>
+    get_first_keys(
+            const _KeyTriple *
+    ) const {
+        std::vector<_Key> first_keys(this->keys.begin(), this->keys.end());
+        for (const _KeyTriple &keyTriple: this->key_triples) {
+            first_keys.push_back(keyTriple.first());
+        }
+        return sorted(first_keys);
+    }
+
+private:
+    template<typename _Container>
+    static std::vector<_Key>
+    sorted(
+            const _Container &container
+    ) {
+        std::vector<_Key> result(container.begin(), container.end());
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+};
+
+
+/**
+ * Encoding of the compressed dumps of CollectionStats. Every section of the dump is a sorted list of (key, stats)
+ * entries cut in blocks: the keys of a block are delta encoded from the previous one and every integer is a LEB128
+ * varint, so each block is encoded and decoded on its own thread. Since the version 2 the block index holds the first
+ * key of each block, hence a filtered load reads only the blocks which can contain the selected keys
+ */
+class StatsArchive {
+public:
+    // the magic of the format, followed by a byte with the version
+    static constexpr const char *MAGIC = "CSTATSZ";
+    static const size_t MAGIC_SIZE = 7;
+    static const int VERSION = 2;
+    static const size_t BLOCK_NUM_ENTRIES = 1 << 12;
+
+    static inline void
+    put_varint(
+            std::string &out,
+            uint64_t value
+    ) {
+        while (value >= 0x80) {
+            out.push_back((char) (value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((char) value);
+    }
+
+    static inline uint64_t
+    get_varint(
+            const char *&it,
+            const char *end
+    ) {
+        uint64_t value = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7) {
+            if (it == end) {
+                throw std::runtime_error("The compressed collection stats are truncated");
+            }
+            const uint8_t byte = (uint8_t) *(it++);
+            value |= (uint64_t) (byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::runtime_error("The compressed collection stats are corrupted");
+    }
+
+    static uint64_t
+    read_varint(
+            std::istream &is
+    ) {
+        uint64_t value = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7) {
+            const int byte = is.get();
+            if (byte == std::char_traits<char>::eof()) {
+                throw std::runtime_error("The compressed collection stats are truncated");
+            }
+            value |= (uint64_t) (byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::runtime_error("The compressed collection stats are corrupted");
+    }
+
+    static void
+    write_varint(
+            std::ostream &os,
+            uint64_t value
+    ) {
+        std::string out;
+        put_varint(out, value);
+        os.write(out.data(), out.size());
+    }
+
+    /**
+     * True when the stream starts with the magic of the compressed format, the stream is left at its beginning
+     */
+    static bool
+    is_compressed(
+            std::istream &is
+    ) {
+        char magic[MAGIC_SIZE];
+        const std::istream::pos_type begin = is.tellg();
+        if (begin == std::istream::pos_type(-1)) {
+            // a stream which cannot be rewound holds the raw format
+            return false;
+        }
+        is.read(magic, MAGIC_SIZE);
+        const bool result = is.gcount() == (std::streamsize) MAGIC_SIZE && std::equal(magic, magic + MAGIC_SIZE, MAGIC);
+        is.clear();
+        is.seekg(begin);
+        return result;
+    }
+
+    /**
+     * Call task(i) for each i in [0, num_tasks) on num_threads threads, 0 means all the cores.
+     * The first exception is rethrown once all the threads are joined
+     */
+    template<typename _Task>
+    static void
+    run_parallel(
+            size_t num_tasks,
+            uint32_t num_threads,
+            const _Task &task
+    ) {
+        if (num_threads == 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        num_threads = std::min<size_t>(num_threads, std::max<size_t>(1, num_tasks));
+
+        std::atomic<size_t> next_task(0);
+        std::exception_ptr error;
+        std::atomic<bool> failed(false);
+        auto worker = [&]() {
+            try {
+                for (size_t i = next_task++; i < num_tasks && !failed; i = next_task++) {
+                    task(i);
+                }
+            } catch (...) {
+                if (!failed.exchange(true)) {
+                    error = std::current_exception();
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (uint32_t i = 1; i < num_threads; ++i) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (std::thread &thread: threads) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    /**
+     * Encode the sorted entries [begin, end) in a block, the first key is delta encoded from zero
+     */
+    template<typename _Key, typename _Value>
+    static std::string
+    encode_block(
+            const std::pair<_Key, _Value> *begin,
+            const std::pair<_Key, _Value> *end
+    ) {
+        std::string out;
+        uint64_t previous[3] = {0, 0, 0};
+        uint64_t components[3];
+        for (const std::pair<_Key, _Value> *it = begin; it != end; ++it) {
+            const size_t num_components = get_components(it->first, components);
+            // the components after the first different one are not ordered, hence they are written as they are
+            bool same_prefix = true;
+            for (size_t i = 0; i < num_components; ++i) {
+                put_varint(out, same_prefix ? components[i] - previous[i] : components[i]);
+                same_prefix = same_prefix && components[i] == previous[i];
+                previous[i] = components[i];
+            }
+            put_stats(out, it->second);
+        }
+        return out;
+    }
+
+    /**
+     * Decode a block of num_entries entries and append them to out, the block must be consumed exactly
+     */
+    template<typename _Key, typename _Value>
+    static void
+    decode_block(
+            const char *it,
+            const char *end,
+            size_t num_entries,
+            std::vector<std::pair<_Key, _Value>> &out
+    ) {
+        out.reserve(out.size() + num_entries);
+        uint64_t previous[3] = {0, 0, 0};
+        uint64_t components[3];
+        const size_t num_components = get_num_components((_Key *) nullptr);
+        for (size_t entry = 0; entry < num_entries; ++entry) {
+            bool same_prefix = true;
+            for (size_t i = 0; i < num_components; ++i) {
+                const uint64_t value = get_varint(it, end);
+                components[i] = same_prefix ? previous[i] + value : value;
+                same_prefix = same_prefix && value == 0;
+                previous[i] = components[i];
+            }
+            _Value stats;
+            get_stats(it, end, stats);
+            out.emplace_back(make_key((_Key *) nullptr, components), stats);
+        }
+        if (it != end) {
+            throw std::runtime_error("The compressed collection stats are corrupted");
+        }
+    }
+
+    template<typename _Key>
+    static inline size_t
+    get_num_components(
+            const _Key *
+    ) {
+        return 1;
+    }
+
+    template<typename _Key>
+    static inline size_t
+    get_num_components(
+            const KeyPair<_Key> *
+    ) {
+        return 2;
+    }
+
+    template<typename _Key>
+    static inline size_t
+    get_num_components(
+            const KeyTriple<_Key> *
+    ) {
+        return 3;
+    }
+
+    template<typename _Key>
+    static inline size_t
+    get_components(
+            const _Key &key,
+            uint64_t *components
+    ) {
+        components[0] = (uint64_t) key;
+        return 1;
+    }
+
+    template<typename _Key>
+    static inline size_t
+    get_components(
+            const KeyPair<_Key> &key,
+            uint64_t *components
+    ) {
+        components[0] = (uint64_t) key.first();
+        components[1] = (uint64_t) key.second();
+        return 2;
+    }
+
+    template<typename _Key>
+    static inline size_t
+    get_components(
+            const KeyTriple<_Key> &key,
+            uint64_t *components
+    ) {
+        components[0] = (uint64_t) key.first();
+        components[1] = (uint64_t) key.second();
+        components[2] = (uint64_t) key.third();
+        return 3;
+    }
+
+private:
+    template<typename _Key>
+    static inline _Key
+    make_key(
+            const _Key *,
+            const uint64_t *components
+    ) {
+        return (_Key) components[0];
+    }
+
+    template<typename _Key>
+    static inline KeyPair<_Key>
+    make_key(
+            const KeyPair<_Key> *,
+            const uint64_t *components
+    ) {
+        return KeyPair<_Key>((_Key) components[0], (_Key) components[1]);
+    }
+
+    template<typename _Key>
+    static inline KeyTriple<_Key>
+    make_key(
+            const KeyTriple<_Key> *,
+            const uint64_t *components
+    ) {
+        return KeyTriple<_Key>((_Key) components[0], (_Key) components[1], (_Key) components[2]);
+    }
+
+    static inline void
+    put_stats(
+            std::string &out,
+            const StatsKey &stats
+    ) {
+        put_varint(out, stats.document_frequency);
+        put_varint(out, stats.frequency);
+        put_varint(out, stats.frequency_square);
+    }
+
+    static inline void
+    get_stats(
+            const char *&it,
+            const char *end,
+            StatsKey &stats
+    ) {
+        stats.document_frequency = (document_frequency_t) get_varint(it, end);
+        stats.frequency = get_varint(it, end);
+        stats.frequency_square = get_varint(it, end);
+    }
+
+    // StatsKeyPair and StatsKeyTriple have the same fields
+    template<typename _Stats>
+    static inline void
+    put_co_occ_stats(
+            std::string &out,
+            const _Stats &stats
+    ) {
+        put_varint(out, stats.document_frequency);
+        put_varint(out, stats.window_document_frequency);
+        put_varint(out, stats.window_frequency);
+        put_varint(out, stats.window_frequency_square);
+        put_varint(out, stats.window_min_dist);
+    }
+
+    template<typename _Stats>
+    static inline void
+    get_co_occ_stats(
+            const char *&it,
+            const char *end,
+            _Stats &stats
+    ) {
+        stats.document_frequency = (document_frequency_t) get_varint(it, end);
+        stats.window_document_frequency = (document_frequency_t) get_varint(it, end);
+        stats.window_frequency = get_varint(it, end);
+        stats.window_frequency_square = get_varint(it, end);
+        stats.window_min_dist = (distance_t) get_varint(it, end);
+    }
+
+    static inline void
+    put_stats(
+            std::string &out,
+            const StatsKeyPair &stats
+    ) {
+        put_co_occ_stats(out, stats);
+    }
+
+    static inline void
+    get_stats(
+            const char *&it,
+            const char *end,
+            StatsKeyPair &stats
+    ) {
+        get_co_occ_stats(it, end, stats);
+    }
+
+    static inline void
+    put_stats(
+            std::string &out,
+            const StatsKeyTriple &stats
+    ) {
+        put_co_occ_stats(out, stats);
+    }
+
+    static inline void
+    get_stats(
+            const char *&it,
+            const char *end,
+            StatsKeyTriple &stats
+    ) {
+        get_co_occ_stats(it, end, stats);
+    }
+
+    static inline void
+    put_stats(
+            std::string &out,
+            const std::vector<StatsWindow> &stats
+    ) {
+        put_varint(out, stats.size());
+        for (const StatsWindow &window_stats: stats) {
+            put_varint(out, window_stats.window_document_frequency);
+            put_varint(out, window_stats.window_frequency);
+            put_varint(out, window_stats.window_frequency_square);
+        }
+    }
+
+    static inline void
+    get_stats(
+            const char *&it,
+            const char *end,
+            std::vector<StatsWindow> &stats
+    ) {
+        const uint64_t num_windows = get_varint(it, end);
+        if (num_windows > (uint64_t) (end - it)) {
+            throw std::runtime_error("The compressed collection stats are corrupted");
+        }
+        stats.resize(num_windows);
+        for (StatsWindow &window_stats: stats) {
+            window_stats.window_document_frequency = (document_frequency_t) get_varint(it, end);
+            window_stats.window_frequency = get_varint(it, end);
+            window_stats.window_frequency_square = get_varint(it, end);
+        }
+    }
+};
+
+
+template<
+        typename KeyType,
+        bool B_DISABLE_UNWINDOWED = false,
+        bool B_RESTRICTED = true,
+        bool B_BUFFERED_WORKER = false,
+        bool B_BUFFERED_COLLECTOR = false
+>
+class CollectionStatsFiller;
+
+
+template<
+        typename KeyType,
+        bool B_DISABLE_UNWINDOWED,
+        bool B_BUFFERED_WORKER,
+        bool B_BUFFERED_COLLECTOR
+>
+class CollectionStatsMultiFiller;
+
+
+/**
+ * Placement of the filler workers: floating, pinned to one core each, or pinned to the cores of a NUMA node.
+ * In both pinned modes the workers are spread over the nodes in round robin
+ */
+enum WorkerPlacement {
+    WORKER_PLACEMENT_NONE = 0,
+    WORKER_PLACEMENT_CORE = 1,
+    WORKER_PLACEMENT_NODE = 2
+};
+
+
+/**
+ * Collection Stats class, used to collect statistic about collections and query them
+ * @tparam KeyType The elements type
+ * @tparam B_RESTRICTED A boolean saying if the statistics must be restricted to only certain keys
+ */
+template<
+        typename KeyType,
+        bool B_DISABLE_UNWINDOWED = false,
+        bool B_RESTRICTED = true
+>
+class CollectionStats {
+private:
+    using _Key = KeyType;
+    using _KeyPair = KeyPair<KeyType>;
+    using _KeyTriple = KeyTriple<KeyType>;
+
+public:
+/**
+ * Object fields
+ */
+public:
+    const distance_t window_size_key_pairs_co_occ;
+    const distance_t window_size_key_triples_co_occ;
+    // all the window sizes in decreasing order, the first ones are the two above and the others are additional windows
+    const std::vector<distance_t> window_sizes_key_pairs_co_occ;
+    const std::vector<distance_t> window_sizes_key_triples_co_occ;
+
+private:
+    // the following fields are used as zero elements
+    const StatsKey zero_stats_key = StatsKey();
+    const StatsKeyPair zero_stats_key_pair = StatsKeyPair();
+    const StatsKeyTriple zero_stats_key_triple = StatsKeyTriple();
+    const StatsWindow zero_stats_window = StatsWindow();
+
+    document_frequency_t num_docs;  // number of documents
+    // probability of a document to be counted, and the seed of the hash that samples the documents
+    double sampling_rate;
+    uint64_t sampling_seed;
+    key_frequency_t key_frequency_sum;  // sum of the key frequencies
+    key_frequency_t key_pair_window_co_occ_sum;  // sum of the windowed pair co_occ
+    key_frequency_t key_triple_window_co_occ_sum;  // sum of the windowed triple co_occ
+
+    std::unordered_map<_Key, StatsKey> stats_key;  // key to stats_key
+    std::unordered_map<_KeyPair, StatsKeyPair> stats_key_pair;  // key_pair to stats_key_pair
+    std::unordered_map<_KeyTriple, StatsKeyTriple> stats_key_triple;  // key_triple to stats_key_triple
+
+    // the same sums and window stats for the additional windows, with one StatsWindow per additional window.
+    // The entries are created by the first occurrence in an additional window
+    std::vector<key_frequency_t> key_pair_windows_co_occ_sum;
+    std::vector<key_frequency_t> key_triple_windows_co_occ_sum;
+    std::unordered_map<_KeyPair, std::vector<StatsWindow>> windows_stats_key_pair;
+    std::unordered_map<_KeyTriple, std::vector<StatsWindow>> windows_stats_key_triple;
+
+public:
+    friend class CollectionStatsFiller<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED, false, false>;
+    friend class CollectionStatsFiller<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED, false, true>;
+    friend class CollectionStatsFiller<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED, true, false>;
+    friend class CollectionStatsFiller<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED, true, true>;
+    template<typename, bool, bool, bool> friend
+    class CollectionStatsMultiFiller;
+
+    CollectionStats(
+            distance_t window_size_key_pairs_co_occ = 12,
+            distance_t window_size_key_triples_co_occ = 15
+    ) :
+            CollectionStats(
+                    std::vector<distance_t>({window_size_key_pairs_co_occ}),
+                    std::vector<distance_t>({window_size_key_triples_co_occ})
+            ) {};
+
+    /**
+     * Collection stats of several windows, filled in a single pass: the stats of the pairs and the triples use the
+     * largest window of each list, the other windows are additional counters selected by the window index of the
+     * getters, where 0 is the largest window
+     */
+    CollectionStats(
+            const std::vector<distance_t> &window_sizes_key_pairs_co_occ,
+            const std::vector<distance_t> &window_sizes_key_triples_co_occ
+    ) :
+            window_size_key_pairs_co_occ(sorted_window_sizes(window_sizes_key_pairs_co_occ)[0]),
+            window_size_key_triples_co_occ(sorted_window_sizes(window_sizes_key_triples_co_occ)[0]),
+            window_sizes_key_pairs_co_occ(sorted_window_sizes(window_sizes_key_pairs_co_occ)),
+            window_sizes_key_triples_co_occ(sorted_window_sizes(window_sizes_key_triples_co_occ)),
+            num_docs(0),
+            sampling_rate(1),
+            sampling_seed(0),
+            key_frequency_sum(0),
+            key_pair_window_co_occ_sum(0),
+            key_triple_window_co_occ_sum(0),
+            key_pair_windows_co_occ_sum(this->window_sizes_key_pairs_co_occ.size() - 1, 0),
+            key_triple_windows_co_occ_sum(this->window_sizes_key_triples_co_occ.size() - 1, 0) {};
+
+    /**
+     * Reset the collection stats and all the restrictions
+     */
+    void clear() {
+        this->num_docs = 0;
+        this->key_frequency_sum = 0;
+        this->key_pair_window_co_occ_sum = 0;
+        this->key_triple_window_co_occ_sum = 0;
+        std::fill(this->key_pair_windows_co_occ_sum.begin(), this->key_pair_windows_co_occ_sum.end(), 0);
+        std::fill(this->key_triple_windows_co_occ_sum.begin(), this->key_triple_windows_co_occ_sum.end(), 0);
+
+        this->stats_key.clear();
+        this->stats_key_pair.clear();
+        this->stats_key_triple.clear();
+        this->windows_stats_key_pair.clear();
+        this->windows_stats_key_triple.clear();
+    }
+
+    void
+    dump(
+            const std::string &filename
+    ) const {
+        std::ofstream outfile(filename, std::fstream::trunc | std::fstream::binary);
+        try {
+            this->dumps(&outfile);
+            outfile.close();
+        } catch (...) {
+            outfile.close();
+            throw;
+        }
+    }
+
+    void
+    dumps(
+            std::ostream *os
+    ) const {
+        BufferedWriter<false> writer(os, 8192);
+        this->dumps(writer);
+        writer.flush();
+    }
+
+    void
+    dumps(
+            BufferedWriter<false> &writer
+    ) const {
+        if (is_pointer<_Key>::value) {
+            throw std::runtime_error("Unable to serialize this CollectionStats type");
+        }
+        if (this->window_sizes_key_pairs_co_occ.size() > 1 || this->window_sizes_key_triples_co_occ.size() > 1) {
+            throw std::runtime_error(
+                    "Unable to serialize a CollectionStats with additional windows, use get_window_collection_stats");
+        }
+        if (this->sampling_rate < 1) {
+            throw std::runtime_error("Unable to serialize a CollectionStats of sampled documents");
+        }
+
+        // write the size of the type
+        writer.put<size_t>(sizeof(_Key));
+        // write if this collection is restricted
+        writer.put<bool>(B_DISABLE_UNWINDOWED);
+        // write if this collection is restricted
+        writer.put<bool>(B_RESTRICTED);
+        // write pair window size
+        writer.put<distance_t>(this->window_size_key_pairs_co_occ);
+        // write triple window size
+        writer.put<distance_t>(this->window_size_key_triples_co_occ);
+        // write num_docs
+        writer.put<document_frequency_t>(this->num_docs);
+        // write key_frequency_sum
+        writer.put<key_frequency_t>(this->key_frequency_sum);
+        // write key_pair_window_co_occ_sum
+        writer.put<key_frequency_t>(this->key_pair_window_co_occ_sum);
+        // write key_triple_window_co_occ_sum
+        writer.put<key_frequency_t>(this->key_triple_window_co_occ_sum);
+
+        // write stats_key, which type is unordered_map<_Key, StatsKey>
+        writer.put<size_t>(this->stats_key.size());
+        for (auto it: this->stats_key) {
+            writer.put<_Key>(it.first);
+            writer.put<StatsKey>(it.second);
+        }
+        // write stats_key_pair, which type is unordered_map<_KeyPair, StatsKeyPair>
+        writer.put<size_t>(this->stats_key_pair.size());
+        for (auto it: this->stats_key_pair) {
+            writer.put<_KeyPair>(it.first);
+            writer.put<StatsKeyPair>(it.second);
+        }
+        // write stats_key_triple, which type is unordered_map<_KeyTriple, StatsKeyTriple>
+        writer.put<size_t>(this->stats_key_triple.size());
+        for (auto it: this->stats_key_triple) {
+            writer.put<_KeyTriple>(it.first);
+            writer.put<StatsKeyTriple>(it.second);
+        }
+    }
+
+    /**
+     * Load a dump of either format, the compressed one is decoded on num_threads threads, 0 means all the cores
+     */
+    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
+    load(
+            const std::string &filename,
+            uint32_t num_threads = 0
+    ) {
+        return CollectionStats::load(filename, nullptr, num_threads);
+    }
+
+    /**
+     * Load only the entries selected by the filter, the sums and the number of documents are the ones of the whole
+     * dump. A compressed dump is read only in the blocks which can contain the selected entries, the raw one is read
+     * whole
+     */
+    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
+    load(
+            const std::string &filename,
+            const CollectionStatsFilter<KeyType> &filter,
+            uint32_t num_threads = 0
+    ) {
+        return CollectionStats::load(filename, &filter, num_threads);
+    }
+
+    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
+    loads(
+            std::istream *is
+    ) {
+        if (StatsArchive::is_compressed(*is)) {
+            return CollectionStats::loads_compressed(is);
+        }
+        BufferedReader<true> reader(is, 8 * 1024 * 1024, 0);
+        return CollectionStats::loads(reader);
+    };
+
+    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
+    loads(
+            std::istream *is,
+            const CollectionStatsFilter<KeyType> &filter,
+            uint32_t num_threads = 0
+    ) {
+        if (StatsArchive::is_compressed(*is)) {
+            return CollectionStats::loads_compressed(is, &filter, num_threads);
+        }
+        BufferedReader<true> reader(is, 8 * 1024 * 1024, 0);
+        CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED> *result = CollectionStats::loads(reader);
+        result->retain(filter);
+        return result;
+    };
+
+    template<bool use_read_constraint = true>
+    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
+    loads(
+            BufferedReader<use_read_constraint> &reader
+    ) {
+        if (is_pointer<_Key>::value) {
+            throw std::runtime_error("Unable to deserialize this CollectionStats type");
+        }
+
+        // temporary size and read buffer used in the following code
+        size_t tmp_size;
+        if (use_read_constraint) {
+            const size_t initial_buffer_limit =
+                    sizeof(size_t)  // type size
+                    + sizeof(bool)  // disable unwindowed type
+                    + sizeof(bool)  // restriction type
+                    + sizeof(distance_t)  // window_size_key_pairs_co_occ
+                    + sizeof(distance_t)  // window_size_key_triples_co_occ
+                    + sizeof(document_frequency_t)  // num_docs
+                    + sizeof(key_frequency_t)  // key_frequency_sum
+                    + sizeof(key_frequency_t)  // key_pair_window_co_occ_sum
+                    + sizeof(key_frequency_t)  // key_triple_window_co_occ_sum
+                    + sizeof(size_t)  // stats_key size
+                    + sizeof(size_t)  // stats_key_pair size
+                    + sizeof(size_t);  // stats_key_triple size
+            reader.increase_num_bytes_constraint(initial_buffer_limit);
+        }
+
+        // read the size of the type
+        tmp_size = reader.template get<size_t>();
+        if (tmp_size != sizeof(_Key)) {
+            throw std::runtime_error("The type of the collection to load is not compatible with the one given");
+        }
+        bool restricted = reader.template get<bool>();
+        if (restricted != B_DISABLE_UNWINDOWED) {
+            throw std::runtime_error("The collection to load is has not the same type B_DISABLE_UNWINDOWED of this one");
+        }
+        restricted = reader.template get<bool>();
+        if (restricted != B_RESTRICTED) {
+            throw std::runtime_error("The collection to load is has not the same type B_RESTRICTED of this one");
+        }
+        // create the collection stats to return
+        CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED> *result = new CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED>(
+                reader.template get<distance_t>(),
+                reader.template get<distance_t>()
+        );
+
+        // read num_docs
+        result->num_docs = reader.template get<document_frequency_t>();
+        // read key_frequency_sum
+        result->key_frequency_sum = reader.template get<key_frequency_t>();
+        // read key_pair_window_co_occ_sum
+        result->key_pair_window_co_occ_sum = reader.template get<key_frequency_t>();
+        // read key_triple_window_co_occ_sum
+        result->key_triple_window_co_occ_sum = reader.template get<key_frequency_t>();
+
+        // read stats_key, which type is unordered_map<_Key, StatsKey>
+        tmp_size = reader.template get<size_t>();
+        if (use_read_constraint) {
+            reader.increase_num_bytes_constraint(tmp_size * (sizeof(_Key) + sizeof(StatsKey)));
+        }
+        result->stats_key.reserve(tmp_size);
+
+        for (size_t i = 0; i < tmp_size; ++i) {
+            _Key key(reader.template get<_Key>());
+            StatsKey value(reader.template get<StatsKey>());
+
+            result->stats_key.insert({key, value});
+        }
+
+        // read stats_key_pair, which type is unordered_map<_KeyPair, StatsKeyPair>
+        tmp_size = reader.template get<size_t>();
+        if (use_read_constraint) {
+            reader.increase_num_bytes_constraint(tmp_size * (sizeof(_KeyPair) + sizeof(StatsKeyPair)));
+        }
+        result->stats_key_pair.reserve(tmp_size);
+
+        for (size_t i = 0; i < tmp_size; ++i) {
+            _KeyPair key(reader.template get<_KeyPair>());
+            StatsKeyPair value(reader.template get<StatsKeyPair>());
+
+            result->stats_key_pair.insert({key, value});
+        }
+
+        // read stats_key_triple, which type is unordered_map<_KeyTriple, StatsKeyTriple>
+        tmp_size = reader.template get<size_t>();
+        if (use_read_constraint) {
+            reader.increase_num_bytes_constraint(tmp_size * (sizeof(_KeyTriple) + sizeof(StatsKeyTriple)));
+        }
+        result->stats_key_triple.reserve(tmp_size);
+
+        for (size_t i = 0; i < tmp_size; ++i) {
+            _KeyTriple key(reader.template get<_KeyTriple>());
+            StatsKeyTriple value(reader.template get<StatsKeyTriple>());
+
+            result->stats_key_triple.insert({key, value});
+        }
+
+        return result;
+    }
+
+    /**
+     * Dump in the compressed format, which also keeps the additional windows and the sampling.
+     * The blocks are encoded on num_threads threads, 0 means all the cores
+     */
+    void
+    dump_compressed(
+            const std::string &filename,
+            uint32_t num_threads = 0
+    ) const {
+        std::ofstream outfile(filename, std::fstream::trunc | std::fstream::binary);
+        try {
+            this->dumps_compressed(&outfile, num_threads);
+            outfile.close();
+        } catch (...) {
+            outfile.close();
+            throw;
+        }
+    }
+
+    void
+    dumps_compressed(
+            std::ostream *os,
+            uint32_t num_threads = 0
+    ) const {
+        if (!std::is_integral<_Key>::value) {
+            throw std::runtime_error("Unable to compress this CollectionStats type");
+        }
+
+        std::string header(StatsArchive::MAGIC, StatsArchive::MAGIC_SIZE);
+        header.push_back((char) StatsArchive::VERSION);
+        StatsArchive::put_varint(header, sizeof(_Key));
+        header.push_back((char) B_DISABLE_UNWINDOWED);
+        header.push_back((char) B_RESTRICTED);
+        StatsArchive::put_varint(header, this->window_sizes_key_pairs_co_occ.size());
+        for (distance_t window_size: this->window_sizes_key_pairs_co_occ) {
+            StatsArchive::put_varint(header, window_size);
+        }
+        StatsArchive::put_varint(header, this->window_sizes_key_triples_co_occ.size());
+        for (distance_t window_size: this->window_sizes_key_triples_co_occ) {
+            StatsArchive::put_varint(header, window_size);
+        }
+        // the sampling rate is written through its bits
+        uint64_t sampling_rate_bits;
+        std::memcpy(&sampling_rate_bits, &this->sampling_rate, sizeof(sampling_rate_bits));
+        StatsArchive::put_varint(header, sampling_rate_bits);
+        StatsArchive::put_varint(header, this->sampling_seed);
+        StatsArchive::put_varint(header, this->num_docs);
+        StatsArchive::put_varint(header, this->key_frequency_sum);
+        StatsArchive::put_varint(header, this->key_pair_window_co_occ_sum);
+        StatsArchive::put_varint(header, this->key_triple_window_co_occ_sum);
+        for (key_frequency_t sum: this->key_pair_windows_co_occ_sum) {
+            StatsArchive::put_varint(header, sum);
+        }
+        for (key_frequency_t sum: this->key_triple_windows_co_occ_sum) {
+            StatsArchive::put_varint(header, sum);
+        }
+        os->write(header.data(), header.size());
+
+        dumps_compressed_section(*os, this->stats_key, num_threads);
+        dumps_compressed_section(*os, this->stats_key_pair, num_threads);
+        dumps_compressed_section(*os, this->stats_key_triple, num_threads);
+        dumps_compressed_section(*os, this->windows_stats_key_pair, num_threads);
+        dumps_compressed_section(*os, this->windows_stats_key_triple, num_threads);
+        if (os->fail()) {
+            throw std::runtime_error("Unable to write the compressed collection stats");
+        }
+    }
+
+    /**
+     * Load a dump in the compressed format: the blocks are decoded on num_threads threads, 0 means all the cores,
+     * and then the maps are rebuilt concurrently
+     */
+    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
+    loads_compressed(
+            std::istream *is,
+            uint32_t num_threads = 0
+    ) {
+        return CollectionStats::loads_compressed(is, nullptr, num_threads);
+    }
+
+private:
+    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
+    load(
+            const std::string &filename,
+            const CollectionStatsFilter<KeyType> *filter,
+            uint32_t num_threads
+    ) {
+        std::ifstream infile(filename, std::ifstream::binary);
+        if (infile.fail() or !infile.is_open()) {
+            throw std::runtime_error("The file cannot be opened");
+        }
+        try {
+            CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED> *result;
+            if (StatsArchive::is_compressed(infile)) {
+                result = CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED>::loads_compressed(&infile, filter,
+                                                                                                   num_threads);
+            } else {
+                BufferedReader<false> reader(&infile, 8 * 1024 * 1024);
+                result = CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED>::loads(reader);
+                if (filter != nullptr) {
+                    result->retain(*filter);
+                }
+            }
+            infile.close();
+            return result;
+        } catch (...) {
+            infile.close();
+            throw;
+        }
+    }
+
+    static CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
+    loads_compressed(
+            std::istream *is,
+            const CollectionStatsFilter<KeyType> *filter,
+            uint32_t num_threads
+    ) {
+        if (!std::is_integral<_Key>::value) {
+            throw std::runtime_error("Unable to decompress this CollectionStats type");
+        }
+
+        char magic[StatsArchive::MAGIC_SIZE];
+        is->read(magic, StatsArchive::MAGIC_SIZE);
+        if (is->gcount() != (std::streamsize) StatsArchive::MAGIC_SIZE ||
+            !std::equal(magic, magic + StatsArchive::MAGIC_SIZE, StatsArchive::MAGIC)) {
+            throw std::runtime_error("The stream is not a compressed collection stats");
+        }
+        const int version = is->get();
+        if (version < 1 || version > StatsArchive::VERSION) {
+            throw std::runtime_error("The version of the compressed collection stats is not supported");
+        }
+        if (StatsArchive::read_varint(*is) != sizeof(_Key)) {
+            throw std::runtime_error("The type of the collection to load is not compatible with the one given");
+        }
+        if (is->get() != (int) B_DISABLE_UNWINDOWED) {
+            throw std::runtime_error("The collection to load is has not the same type B_DISABLE_UNWINDOWED of this one");
+        }
+        if (is->get() != (int) B_RESTRICTED) {
+            throw std::runtime_error("The collection to load is has not the same type B_RESTRICTED of this one");
+        }
+        std::vector<distance_t> window_sizes_key_pairs_co_occ = read_compressed_window_sizes(*is);
+        std::vector<distance_t> window_sizes_key_triples_co_occ = read_compressed_window_sizes(*is);
+
+        std::unique_ptr<CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED>> result(
+                new CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED>(
+                        window_sizes_key_pairs_co_occ,
+                        window_sizes_key_triples_co_occ
+                )
+        );
+        const uint64_t sampling_rate_bits = StatsArchive::read_varint(*is);
+        std::memcpy(&result->sampling_rate, &sampling_rate_bits, sizeof(sampling_rate_bits));
+        result->sampling_seed = StatsArchive::read_varint(*is);
+        result->num_docs = (document_frequency_t) StatsArchive::read_varint(*is);
+        result->key_frequency_sum = StatsArchive::read_varint(*is);
+        result->key_pair_window_co_occ_sum = StatsArchive::read_varint(*is);
+        result->key_triple_window_co_occ_sum = StatsArchive::read_varint(*is);
+        for (key_frequency_t &sum: result->key_pair_windows_co_occ_sum) {
+            sum = StatsArchive::read_varint(*is);
+        }
+        for (key_frequency_t &sum: result->key_triple_windows_co_occ_sum) {
+            sum = StatsArchive::read_varint(*is);
+        }
+
+        // read all the sections, then decode them block by block and rebuild one map per thread
+        CompressedSection<_Key, StatsKey> stats_key;
+        CompressedSection<_KeyPair, StatsKeyPair> stats_key_pair;
+        CompressedSection<_KeyTriple, StatsKeyTriple> stats_key_triple;
+        CompressedSection<_KeyPair, std::vector<StatsWindow>> windows_stats_key_pair;
+        CompressedSection<_KeyTriple, std::vector<StatsWindow>> windows_stats_key_triple;
+        stats_key.read(*is, version, filter);
+        stats_key_pair.read(*is, version, filter);
+        stats_key_triple.read(*is, version, filter);
+        windows_stats_key_pair.read(*is, version, filter);
+        windows_stats_key_triple.read(*is, version, filter);
+
+        stats_key.decode(num_threads, filter);
+        stats_key_pair.decode(num_threads, filter);
+        stats_key_triple.decode(num_threads, filter);
+        windows_stats_key_pair.decode(num_threads, filter);
+        windows_stats_key_triple.decode(num_threads, filter);
+
+        CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED> &collection_stats = *result;
+        StatsArchive::run_parallel(5, num_threads, [&](size_t section) {
+            switch (section) {
+                case 0:
+                    stats_key.rebuild(collection_stats.stats_key);
+                    break;
+                case 1:
+                    stats_key_pair.rebuild(collection_stats.stats_key_pair);
+                    break;
+                case 2:
+                    stats_key_triple.rebuild(collection_stats.stats_key_triple);
+                    break;
+                case 3:
+                    windows_stats_key_pair.rebuild(collection_stats.windows_stats_key_pair);
+                    break;
+                default:
+                    windows_stats_key_triple.rebuild(collection_stats.windows_stats_key_triple);
+            }
+        });
+
+        return result.release();
+    }
+
+    /**
+     * Erase the entries not selected by the filter
+     */
+    void
+    retain(
+            const CollectionStatsFilter<KeyType> &filter
+    ) {
+        retain_entries(this->stats_key, filter);
+        retain_entries(this->stats_key_pair, filter);
+        retain_entries(this->stats_key_triple, filter);
+        retain_entries(this->windows_stats_key_pair, filter);
+        retain_entries(this->windows_stats_key_triple, filter);
+    }
+
+    template<typename _MapKey, typename _MapValue>
+    static void
+    retain_entries(
+            std::unordered_map<_MapKey, _MapValue> &map,
+            const CollectionStatsFilter<KeyType> &filter
+    ) {
+        for (auto it = map.begin(); it != map.end();) {
+            it = filter.contains(it->first) ? std::next(it) : map.erase(it);
+        }
+    }
+
+public:
+    document_frequency_t
+    get_num_docs() const noexcept {
+        return this->num_docs;
+    }
+
+    size_t
+    get_num_keys() const noexcept {
+        return this->stats_key.size();
+    }
+
+    size_t
+    get_num_key_pairs() const noexcept {
+        return this->stats_key_pair.size();
+    }
+
+    size_t
+    get_num_key_triples() const noexcept {
+        return this->stats_key_triple.size();
+    }
+
+    key_frequency_t
+    get_key_frequency_sum() const noexcept {
+        return this->key_frequency_sum;
+    }
+
+    key_frequency_t
+    get_key_pair_window_co_occ_sum() const noexcept {
+        return this->key_pair_window_co_occ_sum;
+    }
+
+    key_frequency_t
+    get_key_triple_window_co_occ_sum() const noexcept {
+        return this->key_triple_window_co_occ_sum;
+    }
+
+    key_frequency_t
+    get_key_pair_window_co_occ_sum(
+            size_t window_index
+    ) const {
+        check_window_index(window_index, this->window_sizes_key_pairs_co_occ);
+        return window_index == 0 ? this->key_pair_window_co_occ_sum
+                                 : this->key_pair_windows_co_occ_sum[window_index - 1];
+    }
+
+    key_frequency_t
+    get_key_triple_window_co_occ_sum(
+            size_t window_index
+    ) const {
+        check_window_index(window_index, this->window_sizes_key_triples_co_occ);
+        return window_index == 0 ? this->key_triple_window_co_occ_sum
+                                 : this->key_triple_windows_co_occ_sum[window_index - 1];
+    }
+
+    StatsKey
+    get_stats_key(
+            const KeyType &key
+    ) const {
+        auto stats_1_key_it = this->stats_key.find(key);
+        if (stats_1_key_it == this->stats_key.end()) {
+            if (B_RESTRICTED) {
+//                throw std::runtime_error("The given key is not among the restrictions");
+            }
+            return this->zero_stats_key;
+        } else {
+            return stats_1_key_it->second;
+        }
+    }
+
+    StatsKeyPair
+    get_stats_key_pair(
+            const KeyPair<KeyType> &keyPair
+    ) const {
+        auto stats_2_key_it = this->stats_key_pair.find(keyPair);
+        if (B_DISABLE_UNWINDOWED) {
+            if (stats_2_key_it == this->stats_key_pair.end()) {
+                if (B_RESTRICTED) {
+//                    throw std::runtime_error("The given pair of keys is not among the restrictions");
+                }
+                return this->zero_stats_key_pair;
+            } else {
+                return stats_2_key_it->second;
+            }
+        } else {
+            if (stats_2_key_it == this->stats_key_pair.end()) {
+                if (B_RESTRICTED) {
+//                    throw std::runtime_error("The given pair of keys is not among the restrictions");
+                }
+                document_frequency_t document_co_occ = 0;
+                if (std::equal_to<_Key>()(keyPair.first(), keyPair.second())) {
+                    document_co_occ = this->get_stats_key(keyPair.first()).document_frequency;
+                }
+
+                if (document_co_occ == 0) {
+                    return this->zero_stats_key_pair;
+                } else {
+                    StatsKeyPair statsKeyPair = this->zero_stats_key_pair;
+                    statsKeyPair.document_frequency = document_co_occ;
+                    return statsKeyPair;
+                }
+            } else {
+                StatsKeyPair statsKeyPair = stats_2_key_it->second;
+                if (std::equal_to<_Key>()(keyPair.first(), keyPair.second())) {
+                    statsKeyPair.document_frequency = this->get_stats_key(keyPair.first()).document_frequency;
+                }
+                return statsKeyPair;
+            }
+        }
+    }
+
+    StatsKeyPair
+    get_stats_key_pair(
+            const KeyType &first,
+            const KeyType &second
+    ) const {
+        return this->get_stats_key_pair(_KeyPair(first, second));
+    }
+
+    /**
+     * Stats of the pair where the window stats are the ones of the window with the given index
+     */
+    StatsKeyPair
+    get_stats_key_pair(
+            const KeyPair<KeyType> &keyPair,
+            size_t window_index
+    ) const {
+        check_window_index(window_index, this->window_sizes_key_pairs_co_occ);
+        StatsKeyPair statsKeyPair = this->get_stats_key_pair(keyPair);
+        if (window_index > 0) {
+            set_window_stats(statsKeyPair, this->get_stats_window(keyPair, window_index, this->windows_stats_key_pair));
+        }
+        return statsKeyPair;
+    }
+
+    StatsKeyPair
+    get_stats_key_pair(
+            const KeyType &first,
+            const KeyType &second,
+            size_t window_index
+    ) const {
+        return this->get_stats_key_pair(_KeyPair(first, second), window_index);
+    }
+
+    StatsKeyTriple
+    get_stats_key_triple(
+            const KeyTriple<KeyType> &keyTriple
+    ) const {
+        auto stats_3_key_it = this->stats_key_triple.find(keyTriple);
+        if (B_DISABLE_UNWINDOWED) {
+            if (stats_3_key_it == this->stats_key_triple.end()) {
+                if (B_RESTRICTED) {
+//                    throw std::runtime_error("The given triple of keys is not among the restrictions");
+                }
+                return this->zero_stats_key_triple;
+            } else {
+                return stats_3_key_it->second;
+            }
+        } else {
+            if (stats_3_key_it == this->stats_key_triple.end()) {
+                if (B_RESTRICTED) {
+//                    throw std::runtime_error("The given triple of keys is not among the restrictions");
+                }
+                document_frequency_t document_co_occ = 0;
+                if (std::equal_to<_Key>()(keyTriple.first(), keyTriple.third())) {
+                    // all the keys are the same, because they are ordered
+                    document_co_occ = this->get_stats_key(keyTriple.first()).document_frequency;
+                } else if (std::equal_to<_Key>()(keyTriple.first(), keyTriple.second())) {
+                    // the first key is equal to the second one, but it is different from the third one
                     document_co_occ = this->get_stats_key_pair(
                             _KeyPair(keyTriple.first(), keyTriple.third())).document_frequency;
                 } else if (std::equal_to<_Key>()(keyTriple.second(), keyTriple.third())) {
@@ -783,65 +2255,518 @@ public:
                     statsKeyTriple.document_frequency = this->get_stats_key_pair(
                             _KeyPair(keyTriple.second(), keyTriple.first())).document_frequency;
                 }
-                return statsKeyTriple;
+                return statsKeyTriple;
+            }
+        }
+    }
+
+    StatsKeyTriple
+    get_stats_key_triple(
+            const KeyType &first,
+            const KeyType &second,
+            const KeyType &third
+    ) const {
+        return this->get_stats_key_triple(_KeyTriple(first, second, third));
+    }
+
+    /**
+     * Stats of the triple where the window stats are the ones of the window with the given index
+     */
+    StatsKeyTriple
+    get_stats_key_triple(
+            const KeyTriple<KeyType> &keyTriple,
+            size_t window_index
+    ) const {
+        check_window_index(window_index, this->window_sizes_key_triples_co_occ);
+        StatsKeyTriple statsKeyTriple = this->get_stats_key_triple(keyTriple);
+        if (window_index > 0) {
+            set_window_stats(statsKeyTriple,
+                             this->get_stats_window(keyTriple, window_index, this->windows_stats_key_triple));
+        }
+        return statsKeyTriple;
+    }
+
+    StatsKeyTriple
+    get_stats_key_triple(
+            const KeyType &first,
+            const KeyType &second,
+            const KeyType &third,
+            size_t window_index
+    ) const {
+        return this->get_stats_key_triple(_KeyTriple(first, second, third), window_index);
+    }
+
+    /**
+     * Probability of a document to be counted, 1 when the stats are not sampled
+     */
+    double
+    get_sampling_rate() const noexcept {
+        return this->sampling_rate;
+    }
+
+    uint64_t
+    get_sampling_seed() const noexcept {
+        return this->sampling_seed;
+    }
+
+    /**
+     * The estimates of the whole collection scale the counts of the sampled documents by the sampling rate. They are
+     * exact, with zero variance, when the stats are not sampled
+     */
+    StatsEstimate
+    estimate_num_docs() const {
+        return StatsEstimate::from_sample(this->num_docs, this->num_docs, this->sampling_rate);
+    }
+
+    EstimatedStatsKey
+    estimate_stats_key(
+            const KeyType &key
+    ) const {
+        const StatsKey statsKey = this->get_stats_key(key);
+        return {
+                StatsEstimate::from_sample(statsKey.document_frequency, statsKey.document_frequency, this->sampling_rate),
+                StatsEstimate::from_sample(statsKey.frequency, statsKey.frequency_square, this->sampling_rate)
+        };
+    }
+
+    EstimatedStatsKeyPair
+    estimate_stats_key_pair(
+            const KeyType &first,
+            const KeyType &second,
+            size_t window_index = 0
+    ) const {
+        const StatsKeyPair statsKeyPair = this->get_stats_key_pair(first, second, window_index);
+        return {
+                StatsEstimate::from_sample(statsKeyPair.document_frequency, statsKeyPair.document_frequency,
+                                           this->sampling_rate),
+                StatsEstimate::from_sample(statsKeyPair.window_document_frequency,
+                                           statsKeyPair.window_document_frequency, this->sampling_rate),
+                StatsEstimate::from_sample(statsKeyPair.window_frequency, statsKeyPair.window_frequency_square,
+                                           this->sampling_rate)
+        };
+    }
+
+    EstimatedStatsKeyTriple
+    estimate_stats_key_triple(
+            const KeyType &first,
+            const KeyType &second,
+            const KeyType &third,
+            size_t window_index = 0
+    ) const {
+        const StatsKeyTriple statsKeyTriple = this->get_stats_key_triple(first, second, third, window_index);
+        return {
+                StatsEstimate::from_sample(statsKeyTriple.document_frequency, statsKeyTriple.document_frequency,
+                                           this->sampling_rate),
+                StatsEstimate::from_sample(statsKeyTriple.window_document_frequency,
+                                           statsKeyTriple.window_document_frequency, this->sampling_rate),
+                StatsEstimate::from_sample(statsKeyTriple.window_frequency, statsKeyTriple.window_frequency_square,
+                                           this->sampling_rate)
+        };
+    }
+
+    /**
+     * Return a new CollectionStats with only the given pair and triple windows, equal to the one filled with those
+     * window sizes. It can be serialized, while this one cannot when it has additional windows
+     */
+    CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
+    get_window_collection_stats(
+            size_t pair_window_index,
+            size_t triple_window_index
+    ) const {
+        check_window_index(pair_window_index, this->window_sizes_key_pairs_co_occ);
+        check_window_index(triple_window_index, this->window_sizes_key_triples_co_occ);
+
+        CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED> *result = new CollectionStats<_Key, B_DISABLE_UNWINDOWED, B_RESTRICTED>(
+                this->window_sizes_key_pairs_co_occ[pair_window_index],
+                this->window_sizes_key_triples_co_occ[triple_window_index]
+        );
+        result->num_docs = this->num_docs;
+        result->sampling_rate = this->sampling_rate;
+        result->sampling_seed = this->sampling_seed;
+        result->key_frequency_sum = this->key_frequency_sum;
+        result->key_pair_window_co_occ_sum = this->get_key_pair_window_co_occ_sum(pair_window_index);
+        result->key_triple_window_co_occ_sum = this->get_key_triple_window_co_occ_sum(triple_window_index);
+        result->stats_key = this->stats_key;
+
+        // the entries without co-occurrences in the window are dropped as the filler does, but for the restrictions.
+        // The entries with repeated keys are counted by the window co-occurrences only, also in document_frequency
+        for (auto stats_key_pair_it: this->stats_key_pair) {
+            StatsKeyPair statsKeyPair = stats_key_pair_it.second;
+            if (pair_window_index > 0) {
+                set_window_stats(statsKeyPair, this->get_stats_window(stats_key_pair_it.first, pair_window_index,
+                                                                      this->windows_stats_key_pair));
+                if (!B_DISABLE_UNWINDOWED &&
+                    std::equal_to<_Key>()(stats_key_pair_it.first.first(), stats_key_pair_it.first.second())) {
+                    statsKeyPair.document_frequency = statsKeyPair.window_document_frequency;
+                }
+            }
+            if (B_RESTRICTED || !statsKeyPair.is_zero()) {
+                result->stats_key_pair.insert({stats_key_pair_it.first, statsKeyPair});
+            }
+        }
+        for (auto stats_key_triple_it: this->stats_key_triple) {
+            StatsKeyTriple statsKeyTriple = stats_key_triple_it.second;
+            if (triple_window_index > 0) {
+                const _KeyTriple &keyTriple = stats_key_triple_it.first;
+                set_window_stats(statsKeyTriple, this->get_stats_window(keyTriple, triple_window_index,
+                                                                        this->windows_stats_key_triple));
+                if (!B_DISABLE_UNWINDOWED && (std::equal_to<_Key>()(keyTriple.first(), keyTriple.second()) ||
+                                              std::equal_to<_Key>()(keyTriple.second(), keyTriple.third()))) {
+                    statsKeyTriple.document_frequency = statsKeyTriple.window_document_frequency;
+                }
+            }
+            if (B_RESTRICTED || !statsKeyTriple.is_zero()) {
+                result->stats_key_triple.insert({stats_key_triple_it.first, statsKeyTriple});
+            }
+        }
+        return result;
+    }
+
+    void
+    update(
+            const CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> &other
+    ) {
+        if (this->window_sizes_key_pairs_co_occ != other.window_sizes_key_pairs_co_occ ||
+            this->window_sizes_key_triples_co_occ != other.window_sizes_key_triples_co_occ) {
+            throw std::runtime_error("The two collection stats must be based on the same windows");
+        }
+        if (this->sampling_rate != other.sampling_rate || this->sampling_seed != other.sampling_seed) {
+            throw std::runtime_error("The two collection stats must be based on the same document sampling");
+        }
+
+        // update num_docs, key_frequency_sum, key_pair_window_co_occ_sum, key_triple_window_co_occ_sum
+        this->num_docs += other.num_docs;
+        this->key_frequency_sum += other.key_frequency_sum;
+        this->key_pair_window_co_occ_sum += other.key_pair_window_co_occ_sum;
+        this->key_triple_window_co_occ_sum += other.key_triple_window_co_occ_sum;
+
+        // update stats_key
+        for (auto other_stats_key_it: other.stats_key) {
+            auto stats_key_it = this->stats_key.find(other_stats_key_it.first);
+            if (stats_key_it != this->stats_key.end()) {
+                stats_key_it->second.update(other_stats_key_it.second);
+            } else if (!B_RESTRICTED) {
+                this->stats_key.insert(other_stats_key_it);
+            }
+        }
+        // update stats_key_pair
+        for (auto other_stats_key_pair_it: other.stats_key_pair) {
+            auto stats_key_pair_it = this->stats_key_pair.find(other_stats_key_pair_it.first);
+            if (stats_key_pair_it != this->stats_key_pair.end()) {
+                stats_key_pair_it->second.update(other_stats_key_pair_it.second);
+            } else if (!B_RESTRICTED) {
+                this->stats_key_pair.insert(other_stats_key_pair_it);
+            }
+        }
+        // update stats_key_triple
+        for (auto other_stats_key_triple_it: other.stats_key_triple) {
+            auto stats_key_triple_it = this->stats_key_triple.find(other_stats_key_triple_it.first);
+            if (stats_key_triple_it != this->stats_key_triple.end()) {
+                stats_key_triple_it->second.update(other_stats_key_triple_it.second);
+            } else if (!B_RESTRICTED) {
+                this->stats_key_triple.insert(other_stats_key_triple_it);
+            }
+        }
+
+        // update the additional windows
+        for (size_t i = 0; i < this->key_pair_windows_co_occ_sum.size(); ++i) {
+            this->key_pair_windows_co_occ_sum[i] += other.key_pair_windows_co_occ_sum[i];
+        }
+        for (size_t i = 0; i < this->key_triple_windows_co_occ_sum.size(); ++i) {
+            this->key_triple_windows_co_occ_sum[i] += other.key_triple_windows_co_occ_sum[i];
+        }
+        update_windows_stats(this->windows_stats_key_pair, other.windows_stats_key_pair, this->stats_key_pair);
+        update_windows_stats(this->windows_stats_key_triple, other.windows_stats_key_triple, this->stats_key_triple);
+    }
+
+private:
+    static std::vector<distance_t>
+    sorted_window_sizes(
+            const std::vector<distance_t> &window_sizes
+    ) {
+        if (window_sizes.empty()) {
+            throw std::runtime_error("At least one window size is required");
+        }
+        std::vector<distance_t> result(window_sizes);
+        std::sort(result.begin(), result.end(), std::greater<distance_t>());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+    static inline void
+    check_window_index(
+            size_t window_index,
+            const std::vector<distance_t> &window_sizes
+    ) {
+        if (window_index >= window_sizes.size()) {
+            throw std::runtime_error("The window index is out of range");
+        }
+    }
+
+    template<typename Key>
+    inline const StatsWindow &
+    get_stats_window(
+            const Key &key,
+            size_t window_index,
+            const std::unordered_map<Key, std::vector<StatsWindow>> &windows_stats
+    ) const {
+        auto windows_stats_it = windows_stats.find(key);
+        if (windows_stats_it == windows_stats.end()) {
+            return this->zero_stats_window;
+        }
+        return windows_stats_it->second[window_index - 1];
+    }
+
+    /**
+     * Replace the window stats of a pair or a triple with the ones of an additional window
+     */
+    template<typename Value>
+    static inline void
+    set_window_stats(
+            Value &stats,
+            const StatsWindow &statsWindow
+    ) {
+        stats.window_document_frequency = statsWindow.window_document_frequency;
+        stats.window_frequency = statsWindow.window_frequency;
+        stats.window_frequency_square = statsWindow.window_frequency_square;
+        if (statsWindow.is_zero()) {
+            stats.window_min_dist = (distance_t) -1;
+        }
+    }
+
+    template<typename Key, typename Value>
+    static void
+    update_windows_stats(
+            std::unordered_map<Key, std::vector<StatsWindow>> &windows_stats,
+            const std::unordered_map<Key, std::vector<StatsWindow>> &other_windows_stats,
+            const std::unordered_map<Key, Value> &stats
+    ) {
+        for (const auto &other_windows_stats_it: other_windows_stats) {
+            auto windows_stats_it = windows_stats.find(other_windows_stats_it.first);
+            if (windows_stats_it != windows_stats.end()) {
+                for (size_t i = 0; i < windows_stats_it->second.size(); ++i) {
+                    windows_stats_it->second[i].update(other_windows_stats_it.second[i]);
+                }
+            } else if (!B_RESTRICTED || stats.find(other_windows_stats_it.first) != stats.end()) {
+                windows_stats.insert(other_windows_stats_it);
+            }
+        }
+    }
+
+    /**
+     * A section of a compressed dump: the block index, the encoded blocks to load and their decoded entries
+     */
+    template<typename _SectionKey, typename _SectionValue>
+    struct CompressedSection {
+        std::vector<size_t> block_num_entries;
+        std::vector<size_t> block_offsets;  // offsets of the blocks to load in the payload, plus the payload size
+        std::string payload;
+        std::vector<std::vector<std::pair<_SectionKey, _SectionValue>>> blocks;
+
+        void
+        read(
+                std::istream &is,
+                int version,
+                const CollectionStatsFilter<KeyType> *filter
+        ) {
+            const uint64_t num_entries = StatsArchive::read_varint(is);
+            const uint64_t num_blocks = StatsArchive::read_varint(is);
+            if (num_blocks > num_entries) {
+                throw std::runtime_error("The compressed collection stats are corrupted");
+            }
+            const size_t num_components = StatsArchive::get_num_components((_SectionKey *) nullptr);
+            std::vector<size_t> block_num_entries;
+            std::vector<size_t> block_sizes;
+            std::vector<_Key> block_first_keys;
+            uint64_t total_entries = 0;
+            for (uint64_t block = 0; block < num_blocks; ++block) {
+                block_num_entries.push_back(StatsArchive::read_varint(is));
+                block_sizes.push_back(StatsArchive::read_varint(is));
+                total_entries += block_num_entries.back();
+                // the key index, only the first component orders the blocks
+                for (size_t i = 0; version >= 2 && i < num_components; ++i) {
+                    const uint64_t component = StatsArchive::read_varint(is);
+                    if (i == 0) {
+                        block_first_keys.push_back((_Key) component);
+                    }
+                }
+            }
+            if (total_entries != num_entries) {
+                throw std::runtime_error("The compressed collection stats are corrupted");
+            }
+
+            // a block is loaded when a selected first key falls between its first key and the one of the next block
+            std::vector<_Key> first_keys;
+            const bool use_key_index = filter != nullptr && version >= 2;
+            if (use_key_index) {
+                first_keys = filter->get_first_keys((_SectionKey *) nullptr);
+            }
+            this->block_offsets.push_back(0);
+            uint64_t skipped_size = 0;
+            for (size_t block = 0; block < num_blocks; ++block) {
+                if (use_key_index) {
+                    auto first_key_it = std::lower_bound(first_keys.begin(), first_keys.end(),
+                                                         block_first_keys[block]);
+                    if (first_key_it == first_keys.end() ||
+                        (block + 1 < num_blocks && block_first_keys[block + 1] < *first_key_it)) {
+                        skipped_size += block_sizes[block];
+                        continue;
+                    }
+                }
+                skip(is, skipped_size);
+                skipped_size = 0;
+                this->read_block(is, block_sizes[block]);
+                this->block_num_entries.push_back(block_num_entries[block]);
+                this->block_offsets.push_back(this->payload.size());
+            }
+            skip(is, skipped_size);
+        }
+
+        void
+        decode(
+                uint32_t num_threads,
+                const CollectionStatsFilter<KeyType> *filter
+        ) {
+            this->blocks.resize(this->block_num_entries.size());
+            StatsArchive::run_parallel(this->blocks.size(), num_threads, [this, filter](size_t block) {
+                std::vector<std::pair<_SectionKey, _SectionValue>> &entries = this->blocks[block];
+                StatsArchive::decode_block(
+                        this->payload.data() + this->block_offsets[block],
+                        this->payload.data() + this->block_offsets[block + 1],
+                        this->block_num_entries[block],
+                        entries
+                );
+                if (filter != nullptr) {
+                    entries.erase(
+                            std::remove_if(entries.begin(), entries.end(),
+                                           [filter](const std::pair<_SectionKey, _SectionValue> &entry) {
+                                               return !filter->contains(entry.first);
+                                           }),
+                            entries.end()
+                    );
+                }
+            });
+            std::string().swap(this->payload);
+        }
+
+        void
+        rebuild(
+                std::unordered_map<_SectionKey, _SectionValue> &map
+        ) {
+            size_t num_entries = 0;
+            for (const auto &block: this->blocks) {
+                num_entries += block.size();
+            }
+            map.reserve(num_entries);
+            for (auto &block: this->blocks) {
+                for (auto &entry: block) {
+                    map.emplace(entry.first, std::move(entry.second));
+                }
+                std::vector<std::pair<_SectionKey, _SectionValue>>().swap(block);
             }
         }
-    }
 
-    StatsKeyTriple
-    get_stats_key_triple(
-            const KeyType &first,
-            const KeyType &second,
-            const KeyType &third
-    ) const {
-        return this->get_stats_key_triple(_KeyTriple(first, second, third));
-    }
+    private:
+        void
+        read_block(
+                std::istream &is,
+                size_t block_size
+        ) {
+            // read in pieces, a corrupted size fails on the end of the stream instead of the allocation
+            const size_t payload_size = this->payload.size() + block_size;
+            while (this->payload.size() < payload_size) {
+                const size_t piece_size = std::min<size_t>(payload_size - this->payload.size(), 8 * 1024 * 1024);
+                const size_t offset = this->payload.size();
+                this->payload.resize(offset + piece_size);
+                is.read(&this->payload[offset], piece_size);
+                if ((size_t) is.gcount() != piece_size) {
+                    throw std::runtime_error("The compressed collection stats are truncated");
+                }
+            }
+        }
 
-    void
-    update(
-            const CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> &other
+        static void
+        skip(
+                std::istream &is,
+                uint64_t size
+        ) {
+            if (size == 0) {
+                return;
+            }
+            // the streams which cannot seek read the skipped bytes
+            if (is.tellg() != std::istream::pos_type(-1)) {
+                is.seekg((std::istream::off_type) size, std::istream::cur);
+            } else {
+                is.ignore((std::streamsize) size);
+            }
+            if (!is) {
+                throw std::runtime_error("The compressed collection stats are truncated");
+            }
+        }
+    };
+
+    static std::vector<distance_t>
+    read_compressed_window_sizes(
+            std::istream &is
     ) {
-        if (this->window_size_key_pairs_co_occ != other.window_size_key_pairs_co_occ ||
-            this->window_size_key_triples_co_occ != other.window_size_key_triples_co_occ) {
-            throw std::runtime_error("The two collection stats must be based on the same windows");
+        const uint64_t num_windows = StatsArchive::read_varint(is);
+        if (num_windows == 0 || num_windows > std::numeric_limits<distance_t>::max()) {
+            throw std::runtime_error("The compressed collection stats are corrupted");
         }
+        std::vector<distance_t> window_sizes;
+        for (uint64_t i = 0; i < num_windows; ++i) {
+            window_sizes.push_back((distance_t) StatsArchive::read_varint(is));
+        }
+        return window_sizes;
+    }
 
-        // update num_docs, key_frequency_sum, key_pair_window_co_occ_sum, key_triple_window_co_occ_sum
-        this->num_docs += other.num_docs;
-        this->key_frequency_sum += other.key_frequency_sum;
-        this->key_pair_window_co_occ_sum += other.key_pair_window_co_occ_sum;
-        this->key_triple_window_co_occ_sum += other.key_triple_window_co_occ_sum;
+    /**
+     * Write the entries of the map sorted by key: the block index, i.e. the number of entries, the bytes and the first
+     * key of each block, then the blocks, which are encoded in parallel
+     */
+    template<typename _SectionKey, typename _SectionValue>
+    static void
+    dumps_compressed_section(
+            std::ostream &os,
+            const std::unordered_map<_SectionKey, _SectionValue> &map,
+            uint32_t num_threads
+    ) {
+        std::vector<std::pair<_SectionKey, _SectionValue>> entries(map.begin(), map.end());
+        std::sort(
+                entries.begin(), entries.end(),
+                [](const std::pair<_SectionKey, _SectionValue> &a, const std::pair<_SectionKey, _SectionValue> &b) {
+                    return std::less<_SectionKey>()(a.first, b.first);
+                }
+        );
 
-        // update stats_key
-        for (auto other_stats_key_it: other.stats_key) {
-            auto stats_key_it = this->stats_key.find(other_stats_key_it.first);
-            if (stats_key_it != this->stats_key.end()) {
-                stats_key_it->second.update(other_stats_key_it.second);
-            } else if (!B_RESTRICTED) {
-                this->stats_key.insert(other_stats_key_it);
-            }
-        }
-        // update stats_key_pair
-        for (auto other_stats_key_pair_it: other.stats_key_pair) {
-            auto stats_key_pair_it = this->stats_key_pair.find(other_stats_key_pair_it.first);
-            if (stats_key_pair_it != this->stats_key_pair.end()) {
-                stats_key_pair_it->second.update(other_stats_key_pair_it.second);
-            } else if (!B_RESTRICTED) {
-                this->stats_key_pair.insert(other_stats_key_pair_it);
+        const size_t block_num_entries = StatsArchive::BLOCK_NUM_ENTRIES;
+        const size_t num_blocks = (entries.size() + block_num_entries - 1) / block_num_entries;
+        std::vector<std::string> blocks(num_blocks);
+        StatsArchive::run_parallel(num_blocks, num_threads, [&](size_t block) {
+            const size_t begin = block * block_num_entries;
+            const size_t end = std::min(begin + block_num_entries, entries.size());
+            blocks[block] = StatsArchive::encode_block(entries.data() + begin, entries.data() + end);
+        });
+
+        std::string index;
+        StatsArchive::put_varint(index, entries.size());
+        StatsArchive::put_varint(index, num_blocks);
+        for (size_t block = 0; block < num_blocks; ++block) {
+            StatsArchive::put_varint(index, std::min(block_num_entries, entries.size() - block * block_num_entries));
+            StatsArchive::put_varint(index, blocks[block].size());
+            uint64_t components[3];
+            const size_t num_components = StatsArchive::get_components(entries[block * block_num_entries].first,
+                                                                        components);
+            for (size_t i = 0; i < num_components; ++i) {
+                StatsArchive::put_varint(index, components[i]);
             }
         }
-        // update stats_key_triple
-        for (auto other_stats_key_triple_it: other.stats_key_triple) {
-            auto stats_key_triple_it = this->stats_key_triple.find(other_stats_key_triple_it.first);
-            if (stats_key_triple_it != this->stats_key_triple.end()) {
-                stats_key_triple_it->second.update(other_stats_key_triple_it.second);
-            } else if (!B_RESTRICTED) {
-                this->stats_key_triple.insert(other_stats_key_triple_it);
-            }
+        os.write(index.data(), index.size());
+        for (const std::string &block: blocks) {
+            os.write(block.data(), block.size());
         }
     }
 
-private:
     template<typename _T>
     struct is_pointer {
         static const bool value = false;
@@ -877,20 +2802,78 @@ private:
     using KeyTripleEntry = std::pair<_KeyTriple, StatsKeyTriple>;
 
     /**
-     * Struct used by sort algorithm to internally sort a buffer of pairs
+     * Record of the buffered workers: a pair or a triple with the gap between its keys in one occurrence
      */
     template<typename _Key>
-    struct PositionsLessThanPred : public std::binary_function<size_t, size_t, bool> {
-    private:
-        const char *buffer;
-    public:
-        PositionsLessThanPred(const char *buffer) : buffer(buffer) {}
+    struct GapRecord {
+        _Key key;
+        distance_t gap;
 
         bool
-        operator()(const size_t l, const size_t r) const {
-            return std::less<_Key>()(*(_Key *) (buffer + l), *(_Key *) (buffer + r));
+        operator<(const GapRecord &other) const {
+            return std::less<_Key>()(this->key, other.key);
         }
     };
+    using KeyPairRecord = GapRecord<_KeyPair>;
+    using KeyTripleRecord = GapRecord<_KeyTriple>;
+    // the occurrences that fall in some additional window are recorded with the window size in place of the gap
+    using KeyPairWindowRecord = GapRecord<_KeyPair>;
+    using KeyTripleWindowRecord = GapRecord<_KeyTriple>;
+
+    /**
+     * Match kept in the sliding window of a worker, with its span and its restriction mask
+     */
+    struct WindowMatch {
+        _Key pattern;
+        size_t start_pos;
+        size_t end_pos;
+        char mask;
+    };
+
+    /**
+     * Local structures of a chunk of the matches of a long field. A chunk is filled by any worker and then merged into
+     * the local structures of the worker that owns the document
+     */
+    struct FieldChunk {
+        size_t matches_begin;
+        size_t matches_end;
+        std::vector<WindowMatch> window;
+
+        RecordArena<_Key> keys;
+        RecordArena<KeyPairRecord> key_pairs;
+        RecordArena<KeyTripleRecord> key_triples;
+
+        LocalStatsTable<_Key, size_t> stats_key;
+        LocalStatsTable<_KeyPair, std::pair<size_t, distance_t>> stats_key_pair;
+        LocalStatsTable<_KeyTriple, std::pair<size_t, distance_t>> stats_key_triple;
+
+        RecordArena<KeyPairWindowRecord> window_key_pairs;
+        RecordArena<KeyTripleWindowRecord> window_key_triples;
+
+        FieldChunk() :
+                matches_begin(0),
+                matches_end(0),
+                keys(B_BUFFERED_WORKER ? 1024 : 0),
+                key_pairs(B_BUFFERED_WORKER ? 2048 : 0),
+                key_triples(B_BUFFERED_WORKER ? 4096 : 0),
+                stats_key(B_BUFFERED_WORKER ? 0 : 1024),
+                stats_key_pair(B_BUFFERED_WORKER ? 0 : 2048),
+                stats_key_triple(B_BUFFERED_WORKER ? 0 : 4096),
+                window_key_pairs(0),
+                window_key_triples(0) {}
+    };
+
+    /**
+     * Long field split into chunks, published to the idle workers by the worker that owns the document.
+     * The counters are modified holding the job_queue_mutex
+     */
+    struct FieldChunksJob {
+        const PatternMatches<_Key> *matches;
+        std::vector<std::unique_ptr<FieldChunk>> *chunks;
+        size_t num_chunks;
+        size_t next_chunk;
+        size_t num_done_chunks;
+    };
 
     /**
      * Struct used by sort algorithm to internally sort a buffer of pairs or triple
@@ -917,11 +2900,28 @@ private:
 private:
     CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *collection_stats;
     const PatternMatcher<KeyType> *pattern_matcher;
+    const PatternLengthTable<KeyType> pattern_lengths;
     const distance_t max_window_size_co_occ;
+    // size of the largest additional window, 0 when there are none
+    const distance_t max_additional_window_size_key_pairs_co_occ;
+    const distance_t max_additional_window_size_key_triples_co_occ;
     bool add_restrictions_enabled;
+    // documents moved out of collection_stats by a CollectionStatsMultiFiller flush, they can still be removed
+    document_frequency_t flushed_num_docs;
 
-    std::vector<std::thread> threads;
-    std::queue<std::vector<std::string>> job_queue;
+    std::vector<std::thread> threads;  // indexed by worker id, the ids of the removed workers are not joinable
+    std::vector<uint32_t> exited_workers;  // workers removed by set_num_threads, under job_queue_mutex
+    std::condition_variable exited_workers_condition_variable;
+    std::mutex threads_mutex;  // serializes the changes of the number of workers
+
+    std::vector<std::shared_future<void>> pending_flushes;
+    std::mutex pending_flushes_mutex;
+    struct Job {
+        std::vector<std::string> doc_fields;
+        bool removal;
+        size_t doc_hash;  // hash of the document fields, see wait_pending_updates
+    };
+    std::queue<Job> job_queue;
     size_t job_queue_limit;
     std::mutex job_queue_mutex;
     std::condition_variable job_queue_condition_variable;
@@ -929,6 +2929,16 @@ private:
 
     uint32_t job_queue_num_working_threads;
     std::condition_variable job_queue_num_working_threads_condition_variable;
+    uint32_t num_active_threads;  // workers not removed by set_num_threads, modified under job_queue_mutex
+    // hash of the document fields to its updates pushed and not applied yet, the removals of the same
+    // document wait for them. Modified under job_queue_mutex
+    std::unordered_map<size_t, uint32_t> pending_updates;
+    std::condition_variable pending_updates_condition_variable;
+
+    // the fields with more matches than field_chunk_size are split into chunks of that many matches, 0 to disable
+    std::atomic<size_t> field_chunk_size;
+    std::deque<FieldChunksJob *> field_chunks_jobs;  // jobs with chunks left, under job_queue_mutex
+    std::condition_variable field_chunks_condition_variable;
 
     std::vector<char> buffer_stats;
     std::size_t buffer_stats_end;
@@ -942,29 +2952,67 @@ private:
     std::mutex buffer_stats_mutex;
     std::condition_variable buffer_stats_condition_variable;
 
+    // read-only views of the collection stats published for concurrent readers
+    std::shared_ptr<CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED>> published_snapshot;
+    uint64_t stats_version = 0;  // number of documents applied, modified under update_lock
+    uint64_t published_snapshot_version = 0;
+    std::atomic<document_frequency_t> snapshot_interval;  // publish every snapshot_interval documents, 0 to disable
+    std::mutex snapshot_mutex;  // serializes the publishers, held for the whole copy
+    // while a snapshot is copied the workers apply the documents here instead of collection_stats, under update_lock
+    std::unique_ptr<CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED>> snapshot_delta;
+
+    // worker placement and node-local stats partitions, merged into collection_stats by flush()
+    struct StatsPartition {
+        std::mutex mutex;
+        std::unique_ptr<CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED>> stats;
+    };
+    const NumaTopology topology;
+    const WorkerPlacement worker_placement;
+    std::vector<std::unique_ptr<StatsPartition>> partitions;  // one per node, empty when disabled
+    // empty copy of the restrictions, used to create the restricted partitions
+    std::unique_ptr<CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED>> partition_template;
+
     // suitable keys/pairs for the restricted version of this class
-    std::unordered_map<_Key, char> suitable_keys;  // key to bit mask.
-    std::unordered_map<_KeyPair, char> suitable_key_pairs;  // key_pair to bit mask.
-    // mask used by the mappings above
+    RestrictionIndex<KeyType> suitable_index;
+    // mask used by the index above
     static const char SUITABLE_FOR_TERM_MASK = (1 << 0);
     static const char SUITABLE_FOR_TERM_PAIR_MASK = (1 << 1);
     static const char SUITABLE_FOR_TERM_TRIPLE_MASK = (1 << 2);
 
+    static const size_t DEFAULT_FIELD_CHUNK_SIZE = 1 << 15;
+
 public:
+    template<typename, bool, bool, bool> friend
+    class CollectionStatsMultiFiller;
+
     CollectionStatsFiller(
             CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *collection_stats,
             const PatternMatcher<KeyType> *pattern_matcher,
             std::size_t buffer_size_in_bytes,
             uint32_t num_threads = 1,
-            uint32_t queue_max_size = 1
+            uint32_t queue_max_size = 1,
+            WorkerPlacement worker_placement = WORKER_PLACEMENT_NONE,
+            bool node_local_stats = false
     ) :
             collection_stats(collection_stats),
             pattern_matcher(pattern_matcher),
+            pattern_lengths(pattern_matcher->get_pattern_length_map()),
             max_window_size_co_occ(std::max(collection_stats->window_size_key_pairs_co_occ,
                                             collection_stats->window_size_key_triples_co_occ)),
+            max_additional_window_size_key_pairs_co_occ(
+                    collection_stats->window_sizes_key_pairs_co_occ.size() > 1
+                    ? collection_stats->window_sizes_key_pairs_co_occ[1] : 0),
+            max_additional_window_size_key_triples_co_occ(
+                    collection_stats->window_sizes_key_triples_co_occ.size() > 1
+                    ? collection_stats->window_sizes_key_triples_co_occ[1] : 0),
             add_restrictions_enabled(collection_stats->num_docs == 0),
+            flushed_num_docs(0),
             job_queue_limit(queue_max_size),
-            job_queue_num_working_threads(num_threads) {
+            job_queue_num_working_threads(num_threads),
+            num_active_threads(num_threads),
+            field_chunk_size(num_threads > 1 ? DEFAULT_FIELD_CHUNK_SIZE : 0),
+            snapshot_interval(0),
+            worker_placement(worker_placement) {
         if (num_threads <= 0) {
             throw std::runtime_error("num_threads must be greater than 0");
         }
@@ -1023,16 +3071,23 @@ public:
             this->buffer_stats_remaining = 0;
         }
 
+        if (node_local_stats) {
+            for (size_t node = 0; node < this->topology.get_num_nodes(); ++node) {
+                this->partitions.emplace_back(new StatsPartition());
+            }
+        }
+
         for (uint32_t i = 0; i < num_threads; ++i) {
-            threads.push_back(std::thread(&CollectionStatsFiller::update_worker_loop, this));
+            threads.push_back(std::thread(&CollectionStatsFiller::update_worker_loop, this, i));
         }
     }
 
     ~CollectionStatsFiller() {
+        std::lock_guard<std::mutex> threads_lock(this->threads_mutex);
         // send an exit message to all threads
         {
             std::unique_lock<std::mutex> lock(this->job_queue_mutex);
-            for (uint32_t i = 0; i < this->threads.size(); ++i) {
+            for (uint32_t i = 0; i < this->num_active_threads; ++i) {
                 this->job_queue.push({});
             }
             this->job_queue_condition_variable.notify_all();
@@ -1042,7 +3097,14 @@ public:
 
         // join all threads
         for (uint32_t i = 0; i < this->threads.size(); ++i) {
-            this->threads[i].join();
+            if (this->threads[i].joinable()) {
+                this->threads[i].join();
+            }
+        }
+
+        // the asynchronous flushes use this object
+        for (std::shared_future<void> &pending_flush: this->pending_flushes) {
+            pending_flush.wait();
         }
     }
 
@@ -1093,60 +3155,436 @@ public:
     void
     update(
             const std::vector<std::string> &doc_fields
+    ) {
+        this->push_job(doc_fields, false);
+    }
+
+    void
+    update(
+            std::vector<std::string> &doc_fields
+    ) {
+        this->push_job(doc_fields, false);
+    }
+
+    /**
+     * Subtract the contribution of a document previously given to update, which must be passed with the same fields.
+     * The removal waits until the pending updates of the same document are applied, hence it never runs ahead of the
+     * update of its document; a removal from a collection without documents is ignored.
+     * The window_min_dist of pairs and triples is kept as a lower bound of the real one (see StatsKeyPair::subtract),
+     * while all the other stats are exactly the ones of a collection that never contained the document
+     */
+    void
+    remove(
+            const std::vector<std::string> &doc_fields
+    ) {
+        this->push_job(doc_fields, true);
+    }
+
+    void
+    remove(
+            std::vector<std::string> &doc_fields
+    ) {
+        this->push_job(doc_fields, true);
+    }
+
+    void
+    flush() {
+        {
+            // wait until no jobs are available
+            std::unique_lock<std::mutex> lock(this->job_queue_mutex);
+            while (this->job_queue.size() > 0 || this->job_queue_num_working_threads > 0) {
+                this->job_queue_num_working_threads_condition_variable.wait(lock);
+            }
+        }
+
+        // a snapshot being copied keeps the last documents in its delta until it is published
+        std::lock_guard<std::mutex> snapshot_lock(this->snapshot_mutex);
+        if (B_BUFFERED_COLLECTOR || !this->partitions.empty()) {
+            this->update_lock();
+        }
+
+        if (!this->partitions.empty()) {
+            // merge the node-local stats
+            this->merge_partitions_impl();
+        }
+        if (B_BUFFERED_COLLECTOR) {
+            // flush the internal buffer
+            this->flush_impl();
+        }
+        if (B_BUFFERED_COLLECTOR || !this->partitions.empty()) {
+            this->update_unlock();
+        }
+    }
+
+    /**
+     * Run flush on a separate thread and return its future, so that the producer can keep pushing documents while the
+     * workers drain the queue. The documents pushed meanwhile may or may not be flushed by it
+     */
+    std::shared_future<void>
+    flush_async() {
+        std::shared_future<void> result = std::async(std::launch::async, [this]() {
+            this->flush();
+        }).share();
+
+        std::lock_guard<std::mutex> lock(this->pending_flushes_mutex);
+        this->pending_flushes.erase(
+                std::remove_if(this->pending_flushes.begin(), this->pending_flushes.end(), is_future_ready<void>),
+                this->pending_flushes.end()
+        );
+        this->pending_flushes.push_back(result);
+        return result;
+    }
+
+    uint32_t
+    get_num_threads() {
+        std::lock_guard<std::mutex> lock(this->job_queue_mutex);
+        return this->num_active_threads;
+    }
+
+    /**
+     * Add or remove workers. The removed workers exit after the documents queued before the call, which waits for them
+     */
+    void
+    set_num_threads(
+            uint32_t num_threads
+    ) {
+        if (num_threads <= 0) {
+            throw std::runtime_error("num_threads must be greater than 0");
+        }
+
+        std::lock_guard<std::mutex> threads_lock(this->threads_mutex);
+        std::unique_lock<std::mutex> lock(this->job_queue_mutex);
+        for (uint32_t worker_id = 0; this->num_active_threads < num_threads; ++worker_id) {
+            if (worker_id < this->threads.size() && this->threads[worker_id].joinable()) {
+                continue;
+            }
+            if (worker_id == this->threads.size()) {
+                this->threads.emplace_back();
+            }
+            // a new worker is working until it finds the job_queue empty
+            ++this->job_queue_num_working_threads;
+            ++this->num_active_threads;
+            this->threads[worker_id] = std::thread(&CollectionStatsFiller::update_worker_loop, this, worker_id);
+        }
+
+        if (this->num_active_threads > num_threads) {
+            const uint32_t num_exiting_threads = this->num_active_threads - num_threads;
+            for (uint32_t i = 0; i < num_exiting_threads; ++i) {
+                this->job_queue.push({});
+            }
+            this->job_queue_condition_variable.notify_all();
+            while (this->exited_workers.size() < num_exiting_threads) {
+                this->exited_workers_condition_variable.wait(lock);
+            }
+            this->num_active_threads = num_threads;
+
+            std::vector<uint32_t> exited_workers;
+            std::swap(exited_workers, this->exited_workers);
+            lock.unlock();
+            for (uint32_t worker_id: exited_workers) {
+                this->threads[worker_id].join();
+            }
+        }
+    }
+
+    /**
+     * Publish a read-only copy of the collection stats that contains only whole documents.
+     * The copy is made without the update lock: meanwhile the workers apply the documents to a delta, which is merged
+     * into the collection stats at the end, hence they wait only for that merge. The removals wait for the whole copy
+     */
+    void
+    publish_snapshot() {
+        std::lock_guard<std::mutex> snapshot_lock(this->snapshot_mutex);
+        this->publish_snapshot_impl();
+    }
+
+    /**
+     * Return the last published snapshot, publishing a new one only if some document has been applied since then.
+     * The returned object can be queried from any thread without blocking the workers, and it must not be modified
+     */
+    std::shared_ptr<CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED>>
+    snapshot() {
+        {
+            std::lock_guard<std::mutex> snapshot_lock(this->snapshot_mutex);
+            this->update_lock();
+            bool outdated = !this->published_snapshot || this->published_snapshot_version != this->stats_version;
+            this->update_unlock();
+            if (outdated) {
+                this->publish_snapshot_impl();
+            }
+        }
+
+        return this->get_published_snapshot();
+    }
+
+    /**
+     * Return the last published snapshot without taking any lock, or nullptr if nothing has been published yet
+     */
+    std::shared_ptr<CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED>>
+    get_published_snapshot() const {
+        return std::atomic_load(&this->published_snapshot);
+    }
+
+    /**
+     * Let the workers publish a new snapshot every num_docs applied documents (0 disables the periodic publishing)
+     */
+    void
+    set_snapshot_interval(
+            document_frequency_t num_docs
+    ) {
+        this->snapshot_interval = num_docs;
+    }
+
+    /**
+     * Count only a sample of the documents, each one chosen with probability sampling_rate by a hash of its fields
+     * and of the seed, so that an update and the remove of the same document agree. It must be called before the
+     * first document, and the collection stats keep the rate for the estimates of the whole collection
+     */
+    void
+    set_sampling_rate(
+            double sampling_rate,
+            uint64_t sampling_seed = 0
+    ) {
+        if (!this->add_restrictions_enabled) {
+            throw std::runtime_error("The sampling rate must be set before the first document");
+        }
+        if (!(sampling_rate > 0 && sampling_rate <= 1)) {
+            throw std::runtime_error("The sampling rate must be in (0, 1]");
+        }
+        this->collection_stats->sampling_rate = sampling_rate;
+        this->collection_stats->sampling_seed = sampling_seed;
+    }
+
+    /**
+     * Split the fields with more than num_matches matches into chunks of num_matches matches, processed by all the idle
+     * workers (0 disables the splitting). The default is 32768 when there is more than one worker
+     */
+    void
+    set_field_chunk_size(
+            size_t num_matches
+    ) {
+        this->field_chunk_size = num_matches;
+    }
+
+private:
+    void
+    push_job(
+            const std::vector<std::string> &doc_fields,
+            bool removal
     ) {
         this->add_restrictions_enabled = false;
         if (doc_fields.size() == 0)
             return;
+        if (!this->partitions.empty() && !this->partition_template) {
+            this->init_partition_template();
+        }
 
         {
             std::unique_lock<std::mutex> lock(this->job_queue_mutex);
-            this->job_queue.push(doc_fields);
+            size_t doc_hash = document_hash(doc_fields);
+            this->wait_pending_updates(lock, removal, doc_hash);
+            this->job_queue.push({doc_fields, removal, doc_hash});
             this->job_queue_condition_variable.notify_one();
         }
     }
 
     void
-    update(
-            std::vector<std::string> &doc_fields
+    push_job(
+            std::vector<std::string> &doc_fields,
+            bool removal
     ) {
         this->add_restrictions_enabled = false;
         if (doc_fields.size() == 0)
             return;
+        if (!this->partitions.empty() && !this->partition_template) {
+            this->init_partition_template();
+        }
 
+        size_t doc_hash = document_hash(doc_fields);
         {
             std::unique_lock<std::mutex> lock(this->job_queue_mutex);
+            this->wait_pending_updates(lock, removal, doc_hash);
             while (this->job_queue.size() > this->job_queue_limit) {
                 this->job_queue_wait_condition_variable.wait(lock);
             }
-            this->job_queue.push({});
-            std::swap(this->job_queue.back(), doc_fields);
-            this->job_queue_condition_variable.notify_one();
+            this->job_queue.push({{}, removal, doc_hash});
+            std::swap(this->job_queue.back().doc_fields, doc_fields);
+            this->job_queue_condition_variable.notify_one();
+        }
+    }
+
+    static inline size_t
+    document_hash(
+            const std::vector<std::string> &doc_fields
+    ) {
+        size_t hash = doc_fields.size();
+        for (const std::string &field : doc_fields) {
+            hash ^= std::hash<std::string>()(field) + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+        }
+        return hash;
+    }
+
+    /**
+     * Wait until the pending updates of the same document are applied before a removal, otherwise count the new
+     * update. A hash collision only makes the removal wait for an unrelated document
+     */
+    inline void
+    wait_pending_updates(
+            std::unique_lock<std::mutex> &lock,
+            bool removal,
+            size_t doc_hash
+    ) {
+        if (removal) {
+            while (this->pending_updates.count(doc_hash) > 0) {
+                this->pending_updates_condition_variable.wait(lock);
+            }
+        } else {
+            ++this->pending_updates[doc_hash];
+        }
+    }
+
+    inline void
+    update_applied(
+            bool removal,
+            size_t doc_hash
+    ) {
+        if (!removal) {
+            std::lock_guard<std::mutex> lock(this->job_queue_mutex);
+            auto it = this->pending_updates.find(doc_hash);
+            if (--it->second == 0) {
+                this->pending_updates.erase(it);
+                this->pending_updates_condition_variable.notify_all();
+            }
+        }
+    }
+
+    void
+    publish_snapshot_impl() {
+        // THIS CODE MUST BE CALLED HOLDING snapshot_mutex, WITHOUT THE UPDATE LOCK
+        using _CollectionStats = CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+
+        // before the first document there are no workers to keep going, otherwise the restrictions are final and the
+        // delta is created from the partition template (built by push_job if the partitions are enabled)
+        this->update_lock();
+        bool frozen = this->stats_version > 0;
+        if (frozen && !this->partition_template) {
+            try {
+                this->init_partition_template();
+            } catch (...) {
+                this->update_unlock();
+                throw;
+            }
+        }
+        this->update_unlock();
+        std::unique_ptr<_CollectionStats> delta(frozen ? new _CollectionStats(*this->partition_template) : nullptr);
+
+        std::shared_ptr<_CollectionStats> snapshot;
+        this->update_lock();
+        try {
+            // the documents applied to the node-local stats must be part of the snapshot
+            if (!this->partitions.empty()) {
+                this->merge_partitions_impl();
+            }
+            // the entries waiting in the collector buffer belong to documents already counted in num_docs
+            if (B_BUFFERED_COLLECTOR) {
+                this->flush_impl();
+            }
+            if (!frozen) {
+                snapshot.reset(new _CollectionStats(*this->collection_stats));
+            }
+        } catch (...) {
+            this->update_unlock();
+            throw;
+        }
+        uint64_t version = this->stats_version;
+
+        if (frozen) {
+            std::swap(this->snapshot_delta, delta);
+            this->update_unlock();
+
+            std::exception_ptr error;
+            try {
+                snapshot.reset(new _CollectionStats(*this->collection_stats));
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            this->update_lock();
+            this->collection_stats->update(*this->snapshot_delta);
+            this->snapshot_delta.reset();
+            if (error) {
+                this->update_unlock();
+                std::rethrow_exception(error);
+            }
         }
+
+        std::atomic_store(&this->published_snapshot, snapshot);
+        this->published_snapshot_version = version;
+        this->update_unlock();
     }
 
     void
-    flush() {
-        {
-            // wait until no jobs are available
-            std::unique_lock<std::mutex> lock(this->job_queue_mutex);
-            while (this->job_queue.size() > 0 || this->job_queue_num_working_threads > 0) {
-                this->job_queue_num_working_threads_condition_variable.wait(lock);
+    publish_snapshot_periodic() {
+        // the workers do not wait for a snapshot being published by someone else, it covers their documents
+        std::unique_lock<std::mutex> snapshot_lock(this->snapshot_mutex, std::try_to_lock);
+        if (snapshot_lock.owns_lock()) {
+            this->update_lock();
+            document_frequency_t interval = this->snapshot_interval;
+            bool due = interval > 0 && this->stats_version - this->published_snapshot_version >= interval;
+            this->update_unlock();
+            if (due) {
+                this->publish_snapshot_impl();
             }
+        }
+    }
 
-            // lock before ending
-            if (B_BUFFERED_COLLECTOR) {
-                this->update_lock();
+    void
+    init_partition_template() {
+        // the restrictions cannot change anymore, hence the partitions can be created from this copy
+        this->partition_template.reset(new CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED>(
+                this->collection_stats->window_sizes_key_pairs_co_occ,
+                this->collection_stats->window_sizes_key_triples_co_occ
+        ));
+        this->partition_template->sampling_rate = this->collection_stats->sampling_rate;
+        this->partition_template->sampling_seed = this->collection_stats->sampling_seed;
+        if (B_RESTRICTED) {
+            for (auto stats_key_it: this->collection_stats->stats_key) {
+                this->partition_template->stats_key.insert({stats_key_it.first, StatsKey()});
+            }
+            for (auto stats_key_pair_it: this->collection_stats->stats_key_pair) {
+                this->partition_template->stats_key_pair.insert({stats_key_pair_it.first, StatsKeyPair()});
+            }
+            for (auto stats_key_triple_it: this->collection_stats->stats_key_triple) {
+                this->partition_template->stats_key_triple.insert({stats_key_triple_it.first, StatsKeyTriple()});
             }
         }
+    }
 
-        if (B_BUFFERED_COLLECTOR) {
-            // flush the internal buffer
-            this->flush_impl();
-            this->update_unlock();
+    void
+    merge_partitions_impl() {
+        // THIS CODE MUST BE CALLED INSIDE A THREAD SAFE AREA
+        for (auto &partition: this->partitions) {
+            std::lock_guard<std::mutex> lock(partition->mutex);
+            if (partition->stats) {
+                this->collection_stats->update(*partition->stats);
+                // recreated by the next document of the node
+                partition->stats.reset();
+            }
         }
     }
 
-private:
+    /**
+     * Count the applied document, return true if a snapshot must be published (after releasing the update lock)
+     */
+    inline bool
+    document_applied() {
+        // THIS CODE MUST BE CALLED INSIDE A THREAD SAFE AREA
+        this->stats_version += 1;
+
+        document_frequency_t interval = this->snapshot_interval;
+        return interval > 0 && this->stats_version - this->published_snapshot_version >= interval;
+    }
+
     inline void
     add_key_into_buffer(
             const _Key &key,
@@ -1182,7 +3620,8 @@ private:
             const Value &stats,
             std::vector<size_t> &positions
     ) {
-        if (this->buffer_stats_remaining < sizeof(Key) + sizeof(Value)) {
+        // the entry size includes the padding of the pair, otherwise the next entry would overwrite its tail
+        if (this->buffer_stats_remaining < sizeof(std::pair<Key, Value>)) {
             this->flush_impl();
         }
 
@@ -1193,17 +3632,145 @@ private:
         // update the positions vector
         positions.push_back(this->buffer_stats_end);
         // update buffer_stats properties
-        this->buffer_stats_end += sizeof(Key) + sizeof(Value);
-        this->buffer_stats_remaining -= sizeof(Key) + sizeof(Value);
+        this->buffer_stats_end += sizeof(std::pair<Key, Value>);
+        this->buffer_stats_remaining -= sizeof(std::pair<Key, Value>);
+    }
+
+    /**
+     * Lock the stats the document is applied to and return them: the partition of the worker node if the node-local
+     * stats are enabled, the delta of the snapshot being copied or collection_stats otherwise. Removals are always
+     * applied to collection_stats, after the snapshot copy and after merging the partitions that may contain the document
+     */
+    inline CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *
+    document_lock(
+            StatsPartition *partition,
+            bool removal
+    ) {
+        if (removal) {
+            std::lock_guard<std::mutex> snapshot_lock(this->snapshot_mutex);
+            this->update_lock();
+            if (!this->partitions.empty()) {
+                this->merge_partitions_impl();
+            }
+            return this->collection_stats;
+        }
+        if (partition == nullptr) {
+            this->update_lock();
+            return this->snapshot_delta ? this->snapshot_delta.get() : this->collection_stats;
+        }
+
+        partition->mutex.lock();
+        if (!partition->stats) {
+            // created by the worker, hence on its node
+            partition->stats.reset(
+                    new CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED>(*this->partition_template));
+        }
+        return partition->stats.get();
+    }
+
+    inline void
+    document_unlock(
+            StatsPartition *partition,
+            bool removal
+    ) {
+        if (partition != nullptr && !removal) {
+            partition->mutex.unlock();
+            // the version is shared by all the partitions
+            this->update_lock();
+        }
+        bool publish = this->document_applied();
+        this->update_unlock();
+        if (publish) {
+            this->publish_snapshot_periodic();
+        }
+    }
+
+    /**
+     * Count the document, return false for a removal from a collection without documents, which must be ignored
+     */
+    inline bool
+    document_begin(
+            CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> &stats,
+            bool removal
+    ) {
+        // THIS CODE MUST BE CALLED INSIDE A THREAD SAFE AREA
+        if (removal) {
+            if (stats.num_docs + this->flushed_num_docs == 0) {
+                return false;
+            }
+            // the pending additions must reach the stats before subtracting from them
+            if (B_BUFFERED_COLLECTOR && this->buffer_stats_end > 0) {
+                this->flush_impl();
+            }
+            stats.num_docs -= 1;
+        } else {
+            stats.num_docs += 1;
+        }
+        return true;
+    }
+
+    inline void
+    apply_key(
+            CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> &stats,
+            const _Key &key,
+            const StatsKey &statsKey,
+            bool removal
+    ) {
+        if (removal) {
+            if (this->subtract(key, statsKey, stats.stats_key)) {
+                stats.key_frequency_sum -= statsKey.frequency;
+            }
+        } else if (B_BUFFERED_COLLECTOR && &stats == this->collection_stats) {
+            this->add_key_into_buffer(key, statsKey);
+        } else {
+            this->add_key(stats, key, statsKey);
+        }
+    }
+
+    inline void
+    apply_key_pair(
+            CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> &stats,
+            const _KeyPair &keyPair,
+            const StatsKeyPair &statsKeyPair,
+            bool removal
+    ) {
+        if (removal) {
+            if (this->subtract(keyPair, statsKeyPair, stats.stats_key_pair)) {
+                stats.key_pair_window_co_occ_sum -= statsKeyPair.window_frequency;
+            }
+        } else if (B_BUFFERED_COLLECTOR && &stats == this->collection_stats) {
+            this->add_key_pair_into_buffer(keyPair, statsKeyPair);
+        } else {
+            this->add_key_pair(stats, keyPair, statsKeyPair);
+        }
+    }
+
+    inline void
+    apply_key_triple(
+            CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> &stats,
+            const _KeyTriple &keyTriple,
+            const StatsKeyTriple &statsKeyTriple,
+            bool removal
+    ) {
+        if (removal) {
+            if (this->subtract(keyTriple, statsKeyTriple, stats.stats_key_triple)) {
+                stats.key_triple_window_co_occ_sum -= statsKeyTriple.window_frequency;
+            }
+        } else if (B_BUFFERED_COLLECTOR && &stats == this->collection_stats) {
+            this->add_key_triple_into_buffer(keyTriple, statsKeyTriple);
+        } else {
+            this->add_key_triple(stats, keyTriple, statsKeyTriple);
+        }
     }
 
     inline bool
     add_key(
+            CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> &stats,
             const _Key &key,
             const StatsKey &statsKey
     ) {
-        if (this->add(key, statsKey, this->collection_stats->stats_key)) {
-            this->collection_stats->key_frequency_sum += statsKey.frequency;
+        if (this->add(key, statsKey, stats.stats_key)) {
+            stats.key_frequency_sum += statsKey.frequency;
             return true;
         } else {
             return false;
@@ -1212,11 +3779,12 @@ private:
 
     inline bool
     add_key_pair(
+            CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> &stats,
             const _KeyPair &keyPair,
             const StatsKeyPair &statsKeyPair
     ) {
-        if (this->add(keyPair, statsKeyPair, this->collection_stats->stats_key_pair)) {
-            this->collection_stats->key_pair_window_co_occ_sum += statsKeyPair.window_frequency;
+        if (this->add(keyPair, statsKeyPair, stats.stats_key_pair)) {
+            stats.key_pair_window_co_occ_sum += statsKeyPair.window_frequency;
             return true;
         } else {
             return false;
@@ -1225,11 +3793,12 @@ private:
 
     inline bool
     add_key_triple(
+            CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> &stats,
             const _KeyTriple &keyTriple,
             const StatsKeyTriple &statsKeyTriple
     ) {
-        if (this->add(keyTriple, statsKeyTriple, this->collection_stats->stats_key_triple)) {
-            this->collection_stats->key_triple_window_co_occ_sum += statsKeyTriple.window_frequency;
+        if (this->add(keyTriple, statsKeyTriple, stats.stats_key_triple)) {
+            stats.key_triple_window_co_occ_sum += statsKeyTriple.window_frequency;
             return true;
         } else {
             return false;
@@ -1255,6 +3824,26 @@ private:
         return false;
     }
 
+    template<typename Key, typename Value>
+    inline bool
+    subtract(
+            const Key &key,
+            const Value &value,
+            std::unordered_map<Key, Value> &stats
+    ) {
+        // update this key inside the stats
+        typename std::unordered_map<Key, Value>::iterator stats_it = stats.find(key);
+        if (stats_it == stats.end()) {
+            return false;
+        }
+        stats_it->second.subtract(value);
+        // the restrictions are kept, the other entries are removed as if they were never inserted
+        if (!B_RESTRICTED && stats_it->second.is_zero()) {
+            stats.erase(stats_it);
+        }
+        return true;
+    }
+
     inline void
     check_add_restriction() const {
         if (!B_RESTRICTED) {
@@ -1418,12 +4007,7 @@ private:
             const _Key &key,
             char mask
     ) {
-        auto found = this->suitable_keys.find(key);
-        if (found != this->suitable_keys.end()) {
-            found->second |= mask;
-        } else {
-            this->suitable_keys[key] = mask;
-        }
+        this->suitable_index.update_key_mask(key, mask);
     }
 
     inline void
@@ -1431,58 +4015,62 @@ private:
             const _KeyPair &key,
             char mask
     ) {
-        auto found = this->suitable_key_pairs.find(key);
-        if (found != this->suitable_key_pairs.end()) {
-            found->second |= mask;
-        } else {
-            this->suitable_key_pairs[key] = mask;
-        }
+        this->suitable_index.update_key_pair_mask(key, mask);
     }
 
     void
-    update_worker_loop() {
+    update_worker_loop(
+            uint32_t worker_id
+    ) {
+        // pin the worker before allocating its local structures, so that they are placed on its node
+        const size_t node = worker_id % this->topology.get_num_nodes();
+        if (this->worker_placement == WORKER_PLACEMENT_CORE) {
+            NumaTopology::pin_current_thread(this->topology.get_cpu_round_robin(worker_id));
+        } else if (this->worker_placement == WORKER_PLACEMENT_NODE) {
+            NumaTopology::pin_current_thread(this->topology.get_node_cpus(node));
+        }
+        StatsPartition *partition = this->partitions.empty() ? nullptr : this->partitions[node].get();
+
         // element of the job_queue
         std::vector<std::string> doc_fields;
-
-        // map with the patterns length
-        const std::unordered_map<KeyType, uint16_t> &pattern_to_length = this->pattern_matcher->get_pattern_length_map();
+        bool removal = false;
+        size_t doc_hash = 0;
 
         // local buffers and data structures
         PatternMatches<KeyType> matches(true);
-        std::vector<size_t> matches_start_pos;
+        std::vector<WindowMatch> window;
 
-        std::unordered_map<_Key, size_t> local_stats_key;
-        std::unordered_map<_KeyPair, std::pair<size_t, distance_t>> local_stats_key_pair;
-        std::unordered_map<_KeyTriple, std::pair<size_t, distance_t>> local_stats_key_triple;
-        if (!B_BUFFERED_WORKER) {
-            local_stats_key.reserve(1024);
-            local_stats_key_pair.reserve(2048);
-            local_stats_key_triple.reserve(4096);
-        }
+        LocalStatsTable<_Key, size_t> local_stats_key(B_BUFFERED_WORKER ? 0 : 1024);
+        LocalStatsTable<_KeyPair, std::pair<size_t, distance_t>> local_stats_key_pair(B_BUFFERED_WORKER ? 0 : 2048);
+        LocalStatsTable<_KeyTriple, std::pair<size_t, distance_t>> local_stats_key_triple(B_BUFFERED_WORKER ? 0 : 4096);
 
-        // buffered version
-        size_t local_buffer_end = 0;
-        size_t local_buffer_size = 0;
-        std::vector<char> local_buffer;
+        // buffered version, one record arena per entry kind
+        RecordArena<_Key> local_keys(B_BUFFERED_WORKER ? 1024 : 0);
+        RecordArena<KeyPairRecord> local_key_pairs(B_BUFFERED_WORKER ? 2048 : 0);
+        RecordArena<KeyTripleRecord> local_key_triples(B_BUFFERED_WORKER ? 4096 : 0);
+        std::vector<key_frequency_t> local_keys_frequencies;
 
-        std::vector<size_t> local_keys_positions;
-        std::vector<size_t> local_key_pairs_positions;
-        std::vector<size_t> local_key_triples_positions;
-        if (B_BUFFERED_WORKER) {
-            local_buffer_size = 8192;
-            local_buffer.resize(local_buffer_size);
-            local_keys_positions.reserve(1024);
-            local_key_pairs_positions.reserve(2048);
-            local_key_triples_positions.reserve(4096);
-        }
+        // occurrences in the additional windows
+        RecordArena<KeyPairWindowRecord> local_window_key_pairs(
+                this->max_additional_window_size_key_pairs_co_occ > 0 ? 1024 : 0);
+        RecordArena<KeyTripleWindowRecord> local_window_key_triples(
+                this->max_additional_window_size_key_triples_co_occ > 0 ? 1024 : 0);
+        std::vector<key_frequency_t> local_windows_co_occ;
+
+        // chunks of the long fields, allocated by the first long field
+        std::vector<std::unique_ptr<FieldChunk>> field_chunks;
 
         // MAIN LOOP
         while (true) {
             {
                 std::unique_lock<std::mutex> lock(this->job_queue_mutex);
 
-                // wait untill a job is available
+                // wait untill a job is available, helping with the chunks of the long fields in the meantime
                 while (this->job_queue.empty()) {
+                    if (!this->field_chunks_jobs.empty()) {
+                        this->fill_field_chunk(this->field_chunks_jobs.front(), lock);
+                        continue;
+                    }
                     if (--this->job_queue_num_working_threads == 0) {
                         this->job_queue_num_working_threads_condition_variable.notify_all();
                     }
@@ -1491,7 +4079,9 @@ private:
                 }
 
                 // swap the two vectors to avoid the copy
-                std::swap(this->job_queue.front(), doc_fields);
+                std::swap(this->job_queue.front().doc_fields, doc_fields);
+                removal = this->job_queue.front().removal;
+                doc_hash = this->job_queue.front().doc_hash;
                 // remove the element from the job_queue
                 this->job_queue.pop();
 
@@ -1500,6 +4090,8 @@ private:
                     if (--this->job_queue_num_working_threads == 0) {
                         this->job_queue_num_working_threads_condition_variable.notify_all();
                     }
+                    this->exited_workers.push_back(worker_id);
+                    this->exited_workers_condition_variable.notify_all();
                     break;
                 }
 
@@ -1507,25 +4099,35 @@ private:
                 this->job_queue_wait_condition_variable.notify_one();
             }
 
+            // the documents out of the sample are skipped, num_docs included
+            if (!this->is_document_sampled(doc_fields)) {
+                doc_fields.clear();
+                this->update_applied(removal, doc_hash);
+                continue;
+            }
+
             // iterate over the matches and aggregate the matchings into the local buffers
             for (size_t i = 0, end = doc_fields.size(); i < end; ++i) {
                 // find the patterns
                 this->pattern_matcher->find_patterns(doc_fields[i], matches);
 
-                // initialize starting positions
-                matches_start_pos.resize(matches.size());
-                for (size_t i = 0, i_end = matches.size(); i < i_end; ++i) {
-                    const PatternMatch<_Key> match = matches.at(i);
-                    matches_start_pos[i] = match.end_pos + 1 - pattern_to_length.at(match.pattern);
-                }
-
                 // update the buffer
-                this->update_fill_local_structures(
-                        &matches, pattern_to_length, matches_start_pos,
-                        local_buffer, local_buffer_end, local_buffer_size,
-                        local_keys_positions, local_key_pairs_positions, local_key_triples_positions,
-                        local_stats_key, local_stats_key_pair, local_stats_key_triple
-                );
+                const size_t chunk_size = this->field_chunk_size;
+                if (chunk_size > 0 && matches.size() > chunk_size) {
+                    this->update_fill_field_chunks(
+                            matches, chunk_size, field_chunks,
+                            local_keys, local_key_pairs, local_key_triples,
+                            local_stats_key, local_stats_key_pair, local_stats_key_triple,
+                            local_window_key_pairs, local_window_key_triples
+                    );
+                } else {
+                    this->update_fill_local_structures(
+                            matches, 0, matches.size(), window,
+                            local_keys, local_key_pairs, local_key_triples,
+                            local_stats_key, local_stats_key_pair, local_stats_key_triple,
+                            local_window_key_pairs, local_window_key_triples
+                    );
+                }
 
                 // clear the matches buffer
                 matches.clear();
@@ -1534,144 +4136,158 @@ private:
             // update from the local buffers
             if (B_BUFFERED_WORKER) {
                 this->update_from_local_buffer(
-                        local_buffer, local_buffer_end, local_buffer_size,
-                        local_keys_positions, local_key_pairs_positions, local_key_triples_positions
+                        local_keys, local_key_pairs, local_key_triples,
+                        local_keys_frequencies,
+                        local_window_key_pairs, local_window_key_triples, local_windows_co_occ,
+                        partition, removal
                 );
             } else {
                 this->update_from_local_maps(
-                        local_stats_key, local_stats_key_pair, local_stats_key_triple
+                        local_stats_key, local_stats_key_pair, local_stats_key_triple,
+                        local_window_key_pairs, local_window_key_triples, local_windows_co_occ,
+                        partition, removal
                 );
             }
 
             // clear all the local buffers
             doc_fields.clear();
             if (B_BUFFERED_WORKER) {
-                local_buffer_end = 0;
-                local_keys_positions.clear();
-                local_key_pairs_positions.clear();
-                local_key_triples_positions.clear();
+                local_keys.clear();
+                local_key_pairs.clear();
+                local_key_triples.clear();
+                local_keys_frequencies.clear();
             } else {
                 local_stats_key.clear();
                 local_stats_key_pair.clear();
                 local_stats_key_triple.clear();
             }
+            local_window_key_pairs.clear();
+            local_window_key_triples.clear();
+            this->update_applied(removal, doc_hash);
         }
     }
 
+    /**
+     * Stream the matches of a field, in order of end position, into a sliding window: each match is counted as a key and
+     * paired with the previous matches of the window that end before it starts, so the pairs and the triples are
+     * enumerated in a single pass. The window holds only the matches that can still start a co-occurrence window,
+     * hence it stays small on long fields, and the pattern lengths come from the flat pattern_lengths table.
+     * Only the matches in [matches_begin, matches_end) are counted as keys and as right delimiters, the previous matches
+     * that can share a co-occurrence window with them only enter the window, so the chunks of a field can be processed
+     * independently
+     */
     inline void
     update_fill_local_structures(
-            const PatternMatches<_Key> *matches_it,
-            const std::unordered_map<_Key, uint16_t> &pattern_to_length,
-            const std::vector<size_t> &matches_start_pos,
-
-            std::vector<char> &local_buffer,
-            size_t &local_buffer_end,
-            size_t &local_buffer_size,
-            std::vector<size_t> &local_keys_positions,
-            std::vector<size_t> &local_key_pairs_positions,
-            std::vector<size_t> &local_key_triples_positions,
-
-            std::unordered_map<_Key, size_t> &local_stats_key,
-            std::unordered_map<_KeyPair, std::pair<size_t, distance_t>> &local_stats_key_pair,
-            std::unordered_map<_KeyTriple, std::pair<size_t, distance_t>> &local_stats_key_triple
-    ) const {
-        const size_t match_size = matches_it->size();
+            const PatternMatches<_Key> &matches,
+            size_t matches_begin,
+            size_t matches_end,
+            std::vector<WindowMatch> &window,
 
-        // left delimiter loop
-        for (size_t l = 0, min_m = 1; l < match_size; ++l) {
-            const PatternMatch<_Key> l_match = matches_it->at(l);
+            RecordArena<_Key> &local_keys,
+            RecordArena<KeyPairRecord> &local_key_pairs,
+            RecordArena<KeyTripleRecord> &local_key_triples,
 
-            // compute the mask related to the key l
-            char l_mask = ~0;
-            if (B_RESTRICTED) {
-                auto st_it = this->suitable_keys.find(l_match.pattern);
-                if (st_it != this->suitable_keys.end()) {
-                    l_mask = st_it->second;
-                } else {
-                    l_mask = 0;
-                }
+            LocalStatsTable<_Key, size_t> &local_stats_key,
+            LocalStatsTable<_KeyPair, std::pair<size_t, distance_t>> &local_stats_key_pair,
+            LocalStatsTable<_KeyTriple, std::pair<size_t, distance_t>> &local_stats_key_triple,
+
+            RecordArena<KeyPairWindowRecord> &local_window_key_pairs,
+            RecordArena<KeyTripleWindowRecord> &local_window_key_triples
+    ) const {
+        window.clear();
+        size_t window_begin = 0;
+
+        // the end positions never decrease, so a match that ends too far before the first one starts even farther
+        size_t i = matches_begin;
+        if (matches_begin < matches_end) {
+            const size_t first_end_pos = matches.at(matches_begin).end_pos;
+            while (i > 0 && matches.at(i - 1).end_pos + this->max_window_size_co_occ > first_end_pos) {
+                --i;
             }
+        }
 
-            // put the key into a buffer if it can be used as singleton
-            //if (!B_RESTRICTED || l_mask & SUITABLE_FOR_TERM_MASK) {
-            // UPDATE: put the key inside the buffer if it can partecipate to some count
+        for (; i < matches_end; ++i) {
+            const PatternMatch<_Key> match = matches.at(i);
+            const bool overlap = i < matches_begin;
+            const WindowMatch r_match{
+                    match.pattern,
+                    match.end_pos + 1 - this->pattern_lengths.get(match.pattern),
+                    match.end_pos,
+                    B_RESTRICTED ? this->get_suitable_key_mask(match.pattern) : (char) ~0
+            };
+
+            // put the key inside the buffer if it can partecipate to some count
             // then it will be ignored if it isn't helpful to any key, pair or triple
-            if (!B_RESTRICTED || l_mask) {
+            if (!overlap && (!B_RESTRICTED || r_match.mask)) {
                 if (B_BUFFERED_WORKER) {
-                    this->update_fill_local_buffer_push(
-                            l_match.pattern,
-                            local_keys_positions,
-                            local_buffer, &local_buffer_end, &local_buffer_size
-                    );
+                    local_keys.push_back(r_match.pattern);
                 } else {
-                    auto stats_entry_it = local_stats_key.find(l_match.pattern);
-                    if (stats_entry_it == local_stats_key.end()) {
-                        local_stats_key.insert({l_match.pattern, 1});
-                    } else {
-                        stats_entry_it->second += 1;
+                    auto stats_entry = local_stats_key.insert({r_match.pattern, 1});
+                    if (!stats_entry.second) {
+                        stats_entry.first->second += 1;
                     }
                 }
             }
 
-            // check if there is at least one pair or triple that can be updated
-            if (B_RESTRICTED && !(l_mask & (SUITABLE_FOR_TERM_PAIR_MASK | SUITABLE_FOR_TERM_TRIPLE_MASK))) {
-                continue;
+            // the end positions never decrease, so the matches too far from this one are too far from the next ones
+            while (window_begin < window.size() &&
+                   r_match.end_pos - window[window_begin].start_pos + 1 > this->max_window_size_co_occ) {
+                ++window_begin;
             }
-
-            while (min_m < match_size && l_match.end_pos >= matches_start_pos[min_m]) {
-                ++min_m;
+            if (window_begin == window.size()) {
+                window.clear();
+                window_begin = 0;
+            } else if (window_begin >= 64 && 2 * window_begin >= window.size()) {
+                window.erase(window.begin(), window.begin() + window_begin);
+                window_begin = 0;
             }
-            // right delimiter loop
-            // NOTE: the matches are ordered by increasing end_position, and when a tie occurs by decreasing pattern length
-            for (size_t r = min_m; r < match_size; ++r) {
+
+            // left delimiter loop, r_match is the right delimiter
+            for (size_t l = window_begin, window_end = overlap ? 0 : window.size(); l < window_end; ++l) {
+                const WindowMatch &l_match = window[l];
+
+                // check if there is at least one pair or triple that can be updated
+                if (B_RESTRICTED && !(l_match.mask & (SUITABLE_FOR_TERM_PAIR_MASK | SUITABLE_FOR_TERM_TRIPLE_MASK))) {
+                    continue;
+                }
                 // check if the two patterns overlap
-                if (l_match.end_pos >= matches_start_pos[r]) {
+                if (l_match.end_pos >= r_match.start_pos) {
                     continue;
                 }
-                const PatternMatch<_Key> r_match = matches_it->at(r);
 
                 // compute the window size
                 const size_t window_size =
-                        r_match.end_pos - matches_start_pos[l] + 1;  // the + 1 is because the end_pos is included
+                        r_match.end_pos - l_match.start_pos + 1;  // the + 1 is because the end_pos is included
 
                 // nothing to windowize
                 if (window_size > this->max_window_size_co_occ) {
-                    break;
+                    continue;
                 }
 
                 // compute the mask related to the pair of keys l, r
                 char r_mask = ~0;
                 if (B_RESTRICTED) {
-                    _KeyPair keyPair(l_match.pattern, r_match.pattern);
-                    auto st_it = this->suitable_key_pairs.find(keyPair);
-                    if (st_it != this->suitable_key_pairs.end()) {
-                        r_mask = st_it->second;
-                    } else {
-                        r_mask = 0;
-                    }
+                    r_mask = this->suitable_index.get_key_pair_mask(_KeyPair(l_match.pattern, r_match.pattern));
                 }
 
                 // update doc_key_pairs
                 if (window_size <= this->collection_stats->window_size_key_pairs_co_occ &&
                     (!B_RESTRICTED || (r_mask & SUITABLE_FOR_TERM_PAIR_MASK))) {
-                    const distance_t pair_gap = (distance_t) (matches_start_pos[r] - l_match.end_pos - 1);
+                    const distance_t pair_gap = (distance_t) (r_match.start_pos - l_match.end_pos - 1);
                     // the - 1 is because the end_pos is included and we want to know the number of words in the middle
                     _KeyPair keyPair(l_match.pattern, r_match.pattern);
+                    if (window_size <= this->max_additional_window_size_key_pairs_co_occ) {
+                        local_window_key_pairs.push_back({keyPair, (distance_t) window_size});
+                    }
 
                     if (B_BUFFERED_WORKER) {
-                        this->update_fill_local_buffer_push<std::pair<_KeyPair, distance_t>>(
-                                {keyPair, pair_gap},
-                                local_key_pairs_positions,
-                                local_buffer, &local_buffer_end, &local_buffer_size
-                        );
+                        local_key_pairs.push_back({keyPair, pair_gap});
                     } else {
-                        auto stats_entry_it = local_stats_key_pair.find(keyPair);
-                        if (stats_entry_it == local_stats_key_pair.end()) {
-                            local_stats_key_pair.insert({keyPair, {1, pair_gap}});
-                        } else {
-                            stats_entry_it->second.first += 1;
-                            if (pair_gap < stats_entry_it->second.second) {
-                                stats_entry_it->second.second = pair_gap;
+                        auto stats_entry = local_stats_key_pair.insert({keyPair, {1, pair_gap}});
+                        if (!stats_entry.second) {
+                            stats_entry.first->second.first += 1;
+                            if (pair_gap < stats_entry.first->second.second) {
+                                stats_entry.first->second.second = pair_gap;
                             }
                         }
                     }
@@ -1681,53 +4297,225 @@ private:
                 if (window_size <= this->collection_stats->window_size_key_triples_co_occ &&
                     (!B_RESTRICTED || (r_mask & SUITABLE_FOR_TERM_TRIPLE_MASK))) {
                     _KeyPair keyPair(l_match.pattern, r_match.pattern);
+                    const bool additional_window = window_size <= this->max_additional_window_size_key_triples_co_occ;
 
-                    // middle indicator loop
-                    for (size_t m = min_m; m < r; ++m) {
-                        const PatternMatch<_Key> m_match = matches_it->at(m);
+                    // middle indicator loop, the middle matches follow l_match in the window
+                    for (size_t m = l + 1; m < window_end; ++m) {
+                        const WindowMatch &m_match = window[m];
                         // check if part of the pattern overlaps the siblings
-                        // The condition matches_start_pos[m] <= l_match.end_pos is already satisfied by starting from min_m
-                        if (l_match.end_pos >= matches_start_pos[m]) {
+                        if (l_match.end_pos >= m_match.start_pos) {
                             continue;
                         }
-                        if (m_match.end_pos >= matches_start_pos[r]) {
+                        if (m_match.end_pos >= r_match.start_pos) {
                             break;
                         }
 
-                        const distance_t triple_gap = (distance_t) ((matches_start_pos[r] - m_match.end_pos) +
-                                                                    (matches_start_pos[m] - l_match.end_pos) - 2);
+                        const distance_t triple_gap = (distance_t) ((r_match.start_pos - m_match.end_pos) +
+                                                                    (m_match.start_pos - l_match.end_pos) - 2);
                         // the - 2 is because the end_pos is included and we want to know the number of words in the middle
 
                         // this triple will be checked at the end
                         _KeyTriple keyTriple(keyPair, m_match.pattern);
+                        if (additional_window) {
+                            local_window_key_triples.push_back({keyTriple, (distance_t) window_size});
+                        }
                         if (B_BUFFERED_WORKER) {
-                            this->update_fill_local_buffer_push<std::pair<_KeyTriple, distance_t>>(
-                                    {_KeyTriple(keyPair, m_match.pattern), triple_gap},
-                                    local_key_triples_positions,
-                                    local_buffer, &local_buffer_end, &local_buffer_size
-                            );
+                            local_key_triples.push_back({keyTriple, triple_gap});
                         } else {
-                            auto stats_entry_it = local_stats_key_triple.find(keyTriple);
-                            if (stats_entry_it == local_stats_key_triple.end()) {
-                                local_stats_key_triple.insert({keyTriple, {1, triple_gap}});
-                            } else {
-                                stats_entry_it->second.first += 1;
-                                if (triple_gap < stats_entry_it->second.second) {
-                                    stats_entry_it->second.second = triple_gap;
+                            auto stats_entry = local_stats_key_triple.insert({keyTriple, {1, triple_gap}});
+                            if (!stats_entry.second) {
+                                stats_entry.first->second.first += 1;
+                                if (triple_gap < stats_entry.first->second.second) {
+                                    stats_entry.first->second.second = triple_gap;
                                 }
                             }
                         }
                     }
                 }
             }
+
+            window.push_back(r_match);
+        }
+    }
+
+    /**
+     * FNV-1a of the fields followed by the splitmix64 finalizer, stable across processes and runs
+     */
+    inline bool
+    is_document_sampled(
+            const std::vector<std::string> &doc_fields
+    ) const {
+        const double sampling_rate = this->collection_stats->sampling_rate;
+        if (sampling_rate >= 1) {
+            return true;
+        }
+
+        uint64_t h = 0xcbf29ce484222325ull ^ this->collection_stats->sampling_seed;
+        for (const std::string &field: doc_fields) {
+            for (const char c: field) {
+                h = (h ^ (unsigned char) c) * 0x100000001b3ull;
+            }
+            // field separator, so that the same text split differently has a different hash
+            h = (h ^ 0xff) * 0x100000001b3ull;
+        }
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return (h >> 11) * (1.0 / (1ull << 53)) < sampling_rate;
+    }
+
+    inline char
+    get_suitable_key_mask(
+            const _Key &key
+    ) const {
+        return this->suitable_index.get_key_mask(key);
+    }
+
+    /**
+     * update_fill_local_structures of a long field split into chunks of chunk_size matches. The chunks are published to
+     * the idle workers and processed by this worker too, then their local structures are merged into the ones of the
+     * document: every key, pair and triple is counted by the chunk of its last match, hence the merged structures are
+     * exactly the ones of a single pass over the field
+     */
+    void
+    update_fill_field_chunks(
+            const PatternMatches<_Key> &matches,
+            size_t chunk_size,
+            std::vector<std::unique_ptr<FieldChunk>> &field_chunks,
+
+            RecordArena<_Key> &local_keys,
+            RecordArena<KeyPairRecord> &local_key_pairs,
+            RecordArena<KeyTripleRecord> &local_key_triples,
+
+            LocalStatsTable<_Key, size_t> &local_stats_key,
+            LocalStatsTable<_KeyPair, std::pair<size_t, distance_t>> &local_stats_key_pair,
+            LocalStatsTable<_KeyTriple, std::pair<size_t, distance_t>> &local_stats_key_triple,
+
+            RecordArena<KeyPairWindowRecord> &local_window_key_pairs,
+            RecordArena<KeyTripleWindowRecord> &local_window_key_triples
+    ) {
+        const size_t num_chunks = (matches.size() + chunk_size - 1) / chunk_size;
+        while (field_chunks.size() < num_chunks) {
+            field_chunks.emplace_back(new FieldChunk());
+        }
+        for (size_t i = 0; i < num_chunks; ++i) {
+            field_chunks[i]->matches_begin = i * chunk_size;
+            field_chunks[i]->matches_end = std::min(matches.size(), (i + 1) * chunk_size);
+        }
+
+        FieldChunksJob job{&matches, &field_chunks, num_chunks, 0, 0};
+        {
+            std::unique_lock<std::mutex> lock(this->job_queue_mutex);
+            this->field_chunks_jobs.push_back(&job);
+            this->job_queue_condition_variable.notify_all();
+
+            while (job.next_chunk < job.num_chunks) {
+                this->fill_field_chunk(&job, lock);
+            }
+            // the job cannot be released while some worker is still filling one of its chunks
+            while (job.num_done_chunks < job.num_chunks) {
+                this->field_chunks_condition_variable.wait(lock);
+            }
+        }
+
+        for (size_t i = 0; i < num_chunks; ++i) {
+            FieldChunk &chunk = *field_chunks[i];
+            if (B_BUFFERED_WORKER) {
+                for (const _Key &key: chunk.keys) {
+                    local_keys.push_back(key);
+                }
+                for (const KeyPairRecord &record: chunk.key_pairs) {
+                    local_key_pairs.push_back(record);
+                }
+                for (const KeyTripleRecord &record: chunk.key_triples) {
+                    local_key_triples.push_back(record);
+                }
+                chunk.keys.clear();
+                chunk.key_pairs.clear();
+                chunk.key_triples.clear();
+            } else {
+                for (const auto &stats_entry: chunk.stats_key) {
+                    auto local_stats_entry = local_stats_key.insert(stats_entry);
+                    if (!local_stats_entry.second) {
+                        local_stats_entry.first->second += stats_entry.second;
+                    }
+                }
+                merge_local_stats(chunk.stats_key_pair, local_stats_key_pair);
+                merge_local_stats(chunk.stats_key_triple, local_stats_key_triple);
+                chunk.stats_key.clear();
+                chunk.stats_key_pair.clear();
+                chunk.stats_key_triple.clear();
+            }
+            for (const KeyPairWindowRecord &record: chunk.window_key_pairs) {
+                local_window_key_pairs.push_back(record);
+            }
+            for (const KeyTripleWindowRecord &record: chunk.window_key_triples) {
+                local_window_key_triples.push_back(record);
+            }
+            chunk.window_key_pairs.clear();
+            chunk.window_key_triples.clear();
+        }
+    }
+
+    /**
+     * Claim the next chunk of the job and fill it, the lock on the job_queue_mutex is released while filling
+     */
+    void
+    fill_field_chunk(
+            FieldChunksJob *job,
+            std::unique_lock<std::mutex> &lock
+    ) {
+        const size_t chunk_index = job->next_chunk++;
+        if (job->next_chunk == job->num_chunks) {
+            this->field_chunks_jobs.erase(
+                    std::find(this->field_chunks_jobs.begin(), this->field_chunks_jobs.end(), job));
+        }
+
+        lock.unlock();
+        FieldChunk &chunk = *(*job->chunks)[chunk_index];
+        this->update_fill_local_structures(
+                *job->matches, chunk.matches_begin, chunk.matches_end, chunk.window,
+                chunk.keys, chunk.key_pairs, chunk.key_triples,
+                chunk.stats_key, chunk.stats_key_pair, chunk.stats_key_triple,
+                chunk.window_key_pairs, chunk.window_key_triples
+        );
+        lock.lock();
+
+        if (++job->num_done_chunks == job->num_chunks) {
+            this->field_chunks_condition_variable.notify_all();
+        }
+    }
+
+    /**
+     * Add the local stats of a chunk to the ones of the document, keeping the minimum gap
+     */
+    template<typename _K>
+    static inline void
+    merge_local_stats(
+            LocalStatsTable<_K, std::pair<size_t, distance_t>> &chunk_stats,
+            LocalStatsTable<_K, std::pair<size_t, distance_t>> &local_stats
+    ) {
+        for (const auto &stats_entry: chunk_stats) {
+            auto local_stats_entry = local_stats.insert(stats_entry);
+            if (!local_stats_entry.second) {
+                local_stats_entry.first->second.first += stats_entry.second.first;
+                if (stats_entry.second.second < local_stats_entry.first->second.second) {
+                    local_stats_entry.first->second.second = stats_entry.second.second;
+                }
+            }
         }
     }
 
     inline void
     update_from_local_maps(
-            std::unordered_map<_Key, size_t> &local_stats_key,
-            std::unordered_map<_KeyPair, std::pair<size_t, distance_t>> &local_stats_key_pair,
-            std::unordered_map<_KeyTriple, std::pair<size_t, distance_t>> &local_stats_key_triple
+            LocalStatsTable<_Key, size_t> &local_stats_key,
+            LocalStatsTable<_KeyPair, std::pair<size_t, distance_t>> &local_stats_key_pair,
+            LocalStatsTable<_KeyTriple, std::pair<size_t, distance_t>> &local_stats_key_triple,
+            RecordArena<KeyPairWindowRecord> &local_window_key_pairs,
+            RecordArena<KeyTripleWindowRecord> &local_window_key_triples,
+            std::vector<key_frequency_t> &local_windows_co_occ,
+            StatsPartition *partition,
+            bool removal
     ) {
         // NOTE: doc_keys and doc_key_pairs are already filtered using the suitable dictionary
 
@@ -1739,54 +4527,49 @@ private:
                     _KeyPair keyPair(l_it->first, r_it->first);
 
                     if (B_RESTRICTED) {
-                        auto st_it = this->suitable_key_pairs.find(keyPair);
-                        if (st_it != this->suitable_key_pairs.end()) {
-                            char mask = st_it->second;
+                        const char mask = this->suitable_index.get_key_pair_mask(keyPair);
+                        if (mask != 0) {
                             if (mask & SUITABLE_FOR_TERM_PAIR_MASK) {
-                                if (local_stats_key_pair.find(keyPair) == local_stats_key_pair.end()) {
-                                    local_stats_key_pair.insert({keyPair, {0, (distance_t) -1}});
-                                }
+                                local_stats_key_pair.insert({keyPair, {0, (distance_t) -1}});
                             }
                             if (mask & SUITABLE_FOR_TERM_TRIPLE_MASK) {
                                 for (auto m_it = l_it; ++m_it != r_it;) {
                                     _KeyTriple keyTriple(keyPair, m_it->first);
-                                    if (local_stats_key_triple.find(keyTriple) == local_stats_key_triple.end()) {
-                                        local_stats_key_triple.insert({keyTriple, {0, (distance_t) -1}});
-                                    }
+                                    local_stats_key_triple.insert({keyTriple, {0, (distance_t) -1}});
                                 }
                             }
                         } else {
                             continue;
                         }
                     } else {
-                        if (local_stats_key_pair.find(keyPair) == local_stats_key_pair.end()) {
-                            local_stats_key_pair.insert({keyPair, {0, (distance_t) -1}});
-                        }
+                        local_stats_key_pair.insert({keyPair, {0, (distance_t) -1}});
                         for (auto m_it = l_it; ++m_it != r_it;) {
                             _KeyTriple keyTriple(keyPair, m_it->first);
-                            if (local_stats_key_triple.find(keyTriple) == local_stats_key_triple.end()) {
-                                local_stats_key_triple.insert({keyTriple, {0, (distance_t) -1}});
-                            }
+                            local_stats_key_triple.insert({keyTriple, {0, (distance_t) -1}});
                         }
                     }
                 }
             }
         }
 
+        // sort the occurrences in the additional windows outside the critical section
+        std::sort(local_window_key_pairs.begin(), local_window_key_pairs.end());
+        std::sort(local_window_key_triples.begin(), local_window_key_triples.end());
+
         // update keys
-        this->update_lock();
-        this->collection_stats->num_docs += 1;
+        CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *stats = this->document_lock(partition, removal);
+        if (!this->document_begin(*stats, removal)) {
+            // the removals hold only the update lock
+            this->update_unlock();
+            return;
+        }
         {
             for (auto stats_entry_it: local_stats_key) {
                 key_frequency_t kf = stats_entry_it.second;
                 StatsKey statsKey(1, kf, kf * kf);
 
                 // I must check if this key should be considered after the update in the policy used to fill doc_keys
-                if (B_BUFFERED_COLLECTOR) {
-                    this->add_key_into_buffer(stats_entry_it.first, statsKey);
-                } else {
-                    this->add_key(stats_entry_it.first, statsKey);
-                }
+                this->apply_key(*stats, stats_entry_it.first, statsKey, removal);
             }
         }
 
@@ -1803,11 +4586,7 @@ private:
                 );
 
                 // I don't need to check if this keyPair must be considered because I know this from r_mask
-                if (B_BUFFERED_COLLECTOR) {
-                    this->add_key_pair_into_buffer(stats_entry_it.first, statsKeyPair);
-                } else {
-                    this->add_key_pair(stats_entry_it.first, statsKeyPair);
-                }
+                this->apply_key_pair(*stats, stats_entry_it.first, statsKeyPair, removal);
             }
         }
 
@@ -1824,239 +4603,227 @@ private:
                 );
 
                 // I must check if this triple should be considered, because from r_mask I know only that two of its keys partecipate to some triple, no more
-                if (B_BUFFERED_COLLECTOR) {
-                    this->add_key_triple_into_buffer(stats_entry_it.first, statsKeyTriple);
-                } else {
-                    this->add_key_triple(stats_entry_it.first, statsKeyTriple);
-                }
+                this->apply_key_triple(*stats, stats_entry_it.first, statsKeyTriple, removal);
             }
         }
-        this->update_unlock();
+        this->apply_windows(*stats, local_window_key_pairs, local_window_key_triples, local_windows_co_occ, removal);
+        this->document_unlock(partition, removal);
     }
 
     inline void
     update_from_local_buffer(
-            std::vector<char> &local_buffer,
-            size_t &local_buffer_end,
-            size_t &local_buffer_size,
-            std::vector<size_t> &local_keys_positions,
-            std::vector<size_t> &local_key_pairs_positions,
-            std::vector<size_t> &local_key_triples_positions
+            RecordArena<_Key> &local_keys,
+            RecordArena<KeyPairRecord> &local_key_pairs,
+            RecordArena<KeyTripleRecord> &local_key_triples,
+            std::vector<key_frequency_t> &local_keys_frequencies,
+            RecordArena<KeyPairWindowRecord> &local_window_key_pairs,
+            RecordArena<KeyTripleWindowRecord> &local_window_key_triples,
+            std::vector<key_frequency_t> &local_windows_co_occ,
+            StatsPartition *partition,
+            bool removal
     ) {
         // NOTE: doc_keys and doc_key_pairs are already filtered using the suitable dictionary
 
-        // update keys
-        std::sort(
-                local_keys_positions.begin(),
-                local_keys_positions.end(),
-                PositionsLessThanPred<_Key>(local_buffer.data())
-        );
+        // aggregate keys, moving the unique ones at the beginning of the arena
+        std::sort(local_keys.begin(), local_keys.end(), std::less<_Key>());
         size_t cursor_end = 0;
-        this->update_lock();
-        this->collection_stats->num_docs += 1;
-
-        {
-            const char *data = local_buffer.data();
-            for (size_t l = 0, r = 0, end = local_keys_positions.size(); l < end; l = r) {
-                const _Key *l_key = buffer_get<_Key>(local_keys_positions[l], data);
-                r = l + 1;
-                while (r < end) {
-                    const _Key *r_key = buffer_get<_Key>(local_keys_positions[r], data);
-                    if (!std::equal_to<_Key>()(*l_key, *r_key)) {
-                        break;
-                    }
-                    ++r;
-                }
-                // move the unique keys at the beginning of this buffer
-                local_keys_positions[cursor_end++] = local_keys_positions[l];
-
-                key_frequency_t kf = r - l;
-                StatsKey statsKey(1, kf, kf * kf);
-
-                // I must check if this key should be considered after the update in the policy used to fill doc_keys
-                if (B_BUFFERED_COLLECTOR) {
-                    this->add_key_into_buffer(*l_key, statsKey);
-                } else {
-                    this->add_key(*l_key, statsKey);
-                }
+        for (size_t l = 0, r = 0, end = local_keys.size(); l < end; l = r) {
+            r = l + 1;
+            while (r < end && std::equal_to<_Key>()(local_keys[l], local_keys[r])) {
+                ++r;
             }
+            local_keys[cursor_end++] = local_keys[l];
+            local_keys_frequencies.push_back(r - l);
         }
-        this->update_unlock();
+
         // update key pairs and triples according to the presence inside the document
         if (!B_DISABLE_UNWINDOWED) {
-            const StatsKeyPair statsKeyPair(1, 0, 0, 0, 0);
-            const StatsKeyTriple statsKeyTriple(1, 0, 0, 0, 0);
             for (size_t l = 0; l < cursor_end; ++l) {
                 for (size_t r = l + 1; r < cursor_end; ++r) {
-                    _KeyPair keyPair(
-                            *buffer_get<_Key>(local_keys_positions[l], local_buffer.data()),
-                            *buffer_get<_Key>(local_keys_positions[r], local_buffer.data())
-                    );
+                    _KeyPair keyPair(local_keys[l], local_keys[r]);
 
                     if (B_RESTRICTED) {
-                        auto st_it = this->suitable_key_pairs.find(keyPair);
-                        if (st_it != this->suitable_key_pairs.end()) {
-                            char mask = st_it->second;
+                        const char mask = this->suitable_index.get_key_pair_mask(keyPair);
+                        if (mask != 0) {
                             if (mask & SUITABLE_FOR_TERM_PAIR_MASK) {
-                                this->update_fill_local_buffer_push<std::pair<_KeyPair, distance_t>>(
-                                        {keyPair, (distance_t) -1},
-                                        local_key_pairs_positions,
-                                        local_buffer, &local_buffer_end, &local_buffer_size
-                                );
+                                local_key_pairs.push_back({keyPair, (distance_t) -1});
                             }
                             if (mask & SUITABLE_FOR_TERM_TRIPLE_MASK) {
                                 for (size_t m = l + 1; m < r; ++m) {
-                                    const _Key *_m = buffer_get<_Key>(local_keys_positions[m], local_buffer.data());
-                                    this->update_fill_local_buffer_push<std::pair<_KeyTriple, distance_t>>(
-                                            {_KeyTriple(keyPair, *_m), (distance_t) -1},
-                                            local_key_triples_positions,
-                                            local_buffer, &local_buffer_end, &local_buffer_size
-                                    );
+                                    local_key_triples.push_back({_KeyTriple(keyPair, local_keys[m]), (distance_t) -1});
                                 }
                             }
                         } else {
                             continue;
                         }
                     } else {
-                        this->update_fill_local_buffer_push<std::pair<_KeyPair, distance_t>>(
-                                {keyPair, (distance_t) -1},
-                                local_key_pairs_positions,
-                                local_buffer, &local_buffer_end, &local_buffer_size
-                        );
+                        local_key_pairs.push_back({keyPair, (distance_t) -1});
                         for (size_t m = l + 1; m < r; ++m) {
-                            const _Key *_m = buffer_get<_Key>(local_keys_positions[m], local_buffer.data());
-                            this->update_fill_local_buffer_push<std::pair<_KeyTriple, distance_t>>(
-                                    {_KeyTriple(keyPair, *_m), (distance_t) -1},
-                                    local_key_triples_positions,
-                                    local_buffer, &local_buffer_end, &local_buffer_size
-                            );
+                            local_key_triples.push_back({_KeyTriple(keyPair, local_keys[m]), (distance_t) -1});
                         }
                     }
                 }
             }
         }
 
+        // sort the key pairs and triples records in place, outside the critical section
+        std::sort(local_key_pairs.begin(), local_key_pairs.end());
+        std::sort(local_key_triples.begin(), local_key_triples.end());
+        std::sort(local_window_key_pairs.begin(), local_window_key_pairs.end());
+        std::sort(local_window_key_triples.begin(), local_window_key_triples.end());
+
+        // the whole document is applied inside a single critical section, hence snapshots never contain part of it
+        CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> *stats = this->document_lock(partition, removal);
+        if (!this->document_begin(*stats, removal)) {
+            // the removals hold only the update lock
+            this->update_unlock();
+            return;
+        }
+
+        // update keys
+        for (size_t i = 0; i < cursor_end; ++i) {
+            key_frequency_t kf = local_keys_frequencies[i];
+            StatsKey statsKey(1, kf, kf * kf);
+
+            // I must check if this key should be considered after the update in the policy used to fill doc_keys
+            this->apply_key(*stats, local_keys[i], statsKey, removal);
+        }
+
         // update key pairs
-        std::sort(
-                local_key_pairs_positions.begin(),
-                local_key_pairs_positions.end(),
-                PositionsKeyValueLessThanPred<_KeyPair, distance_t>(local_buffer.data())
-        );
-        this->update_lock();
-        {
-            const char *data = local_buffer.data();
-
-            for (size_t l = 0, r = 0, end = local_key_pairs_positions.size(); l < end; l = r) {
-                const std::pair<_KeyPair, distance_t> *l_pair = buffer_get<std::pair<_KeyPair, distance_t>>(
-                        local_key_pairs_positions[l], data);
-                r = l + 1;
-
-                distance_t min_gap = l_pair->second;
-                while (r < end) {
-                    const std::pair<_KeyPair, distance_t> *r_pair = buffer_get<std::pair<_KeyPair, distance_t>>(
-                            local_key_pairs_positions[r], data);
-                    if (!std::equal_to<_KeyPair>()(l_pair->first, r_pair->first)) {
-                        break;
-                    }
-                    if (min_gap > r_pair->second) {
-                        min_gap = r_pair->second;
-                    }
-                    ++r;
-                }
+        for (size_t l = 0, r = 0, end = local_key_pairs.size(); l < end; l = r) {
+            const KeyPairRecord &l_record = local_key_pairs[l];
+            r = l + 1;
 
-                // I don't need to check if this keyPair must be considered because I know this from r_mask
-                key_frequency_t window_co_occ = r - l;
-                // if the two components are different, one of the occurrences has been added to count the document_frequency by the previous code
-                if (l_pair->first.first() != l_pair->first.second()) {
-                    window_co_occ -= 1;
-                }
-                StatsKeyPair statsKeyPair(
-                        (B_DISABLE_UNWINDOWED ? 0 : 1),
-                        (window_co_occ > 0 ? 1 : 0),
-                        window_co_occ,
-                        window_co_occ * window_co_occ,
-                        min_gap
-                );
-                if (B_BUFFERED_COLLECTOR) {
-                    this->add_key_pair_into_buffer(l_pair->first, statsKeyPair);
-                } else {
-                    this->add_key_pair(l_pair->first, statsKeyPair);
+            distance_t min_gap = l_record.gap;
+            while (r < end && std::equal_to<_KeyPair>()(l_record.key, local_key_pairs[r].key)) {
+                if (min_gap > local_key_pairs[r].gap) {
+                    min_gap = local_key_pairs[r].gap;
                 }
+                ++r;
+            }
+
+            // I don't need to check if this keyPair must be considered because I know this from r_mask
+            key_frequency_t window_co_occ = r - l;
+            // if the two components are different, one of the occurrences has been added to count the document_frequency by the previous code
+            if (!B_DISABLE_UNWINDOWED && l_record.key.first() != l_record.key.second()) {
+                window_co_occ -= 1;
             }
+            StatsKeyPair statsKeyPair(
+                    (B_DISABLE_UNWINDOWED ? 0 : 1),
+                    (window_co_occ > 0 ? 1 : 0),
+                    window_co_occ,
+                    window_co_occ * window_co_occ,
+                    min_gap
+            );
+            this->apply_key_pair(*stats, l_record.key, statsKeyPair, removal);
         }
-        this->update_unlock();
 
         // update key triples
-        std::sort(
-                local_key_triples_positions.begin(),
-                local_key_triples_positions.end(),
-                PositionsKeyValueLessThanPred<_KeyTriple, distance_t>(local_buffer.data())
-        );
-        this->update_lock();
-        {
-            const char *data = local_buffer.data();
-            for (size_t l = 0, r = 0, end = local_key_triples_positions.size(); l < end; l = r) {
-                const std::pair<_KeyTriple, distance_t> *l_pair = buffer_get<std::pair<_KeyTriple, distance_t>>(
-                        local_key_triples_positions[l], data);
-                r = l + 1;
-
-                distance_t min_gap = l_pair->second;
-                while (r < end) {
-                    const std::pair<_KeyTriple, distance_t> *r_pair = buffer_get<std::pair<_KeyTriple, distance_t>>(
-                            local_key_triples_positions[r], data);
-                    if (!std::equal_to<_KeyTriple>()(l_pair->first, r_pair->first)) {
-                        break;
-                    }
-                    if (min_gap > r_pair->second) {
-                        min_gap = r_pair->second;
-                    }
-                    ++r;
-                }
+        for (size_t l = 0, r = 0, end = local_key_triples.size(); l < end; l = r) {
+            const KeyTripleRecord &l_record = local_key_triples[l];
+            r = l + 1;
 
-                key_frequency_t window_co_occ = r - l;
-                // if the three components are different, one of the occurrences has been added to count the document_frequency by the previous code
-                if (l_pair->first.first() != l_pair->first.second() &&
-                    l_pair->first.second() != l_pair->first.third()) {
-                    window_co_occ -= 1;
-                }
-                StatsKeyTriple statsKey(
-                        (B_DISABLE_UNWINDOWED ? 0 : 1),
-                        (window_co_occ > 0 ? 1 : 0),
-                        window_co_occ,
-                        window_co_occ * window_co_occ,
-                        min_gap
-                );
-                // I must check if this triple should be considered, because from r_mask I know only that two of its keys partecipate to some triple, no more
-                if (B_BUFFERED_COLLECTOR) {
-                    this->add_key_triple_into_buffer(l_pair->first, statsKey);
-                } else {
-                    this->add_key_triple(l_pair->first, statsKey);
+            distance_t min_gap = l_record.gap;
+            while (r < end && std::equal_to<_KeyTriple>()(l_record.key, local_key_triples[r].key)) {
+                if (min_gap > local_key_triples[r].gap) {
+                    min_gap = local_key_triples[r].gap;
                 }
+                ++r;
+            }
+
+            key_frequency_t window_co_occ = r - l;
+            // if the three components are different, one of the occurrences has been added to count the document_frequency by the previous code
+            if (!B_DISABLE_UNWINDOWED && l_record.key.first() != l_record.key.second() &&
+                l_record.key.second() != l_record.key.third()) {
+                window_co_occ -= 1;
             }
+            StatsKeyTriple statsKey(
+                    (B_DISABLE_UNWINDOWED ? 0 : 1),
+                    (window_co_occ > 0 ? 1 : 0),
+                    window_co_occ,
+                    window_co_occ * window_co_occ,
+                    min_gap
+            );
+            // I must check if this triple should be considered, because from r_mask I know only that two of its keys partecipate to some triple, no more
+            this->apply_key_triple(*stats, l_record.key, statsKey, removal);
         }
-        this->update_unlock();
+        this->apply_windows(*stats, local_window_key_pairs, local_window_key_triples, local_windows_co_occ, removal);
+        this->document_unlock(partition, removal);
     }
 
-    template<typename _T>
     inline void
-    update_fill_local_buffer_push(
-            const _T &value,
-            std::vector<size_t> &positions,
-            std::vector<char> &local_buffer,
-            size_t *local_buffer_end,
-            size_t *local_buffer_size
-    ) const {
-        // increase the buffer size if it is not enough
-        while (*local_buffer_end + sizeof(_T) > *local_buffer_size) {
-            *local_buffer_size = *local_buffer_size * 2;
-            local_buffer.resize(*local_buffer_size);
+    apply_windows(
+            CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED> &stats,
+            const RecordArena<KeyPairWindowRecord> &local_window_key_pairs,
+            const RecordArena<KeyTripleWindowRecord> &local_window_key_triples,
+            std::vector<key_frequency_t> &local_windows_co_occ,
+            bool removal
+    ) {
+        // THIS CODE MUST BE CALLED INSIDE A THREAD SAFE AREA
+        this->apply_windows_stats(
+                local_window_key_pairs, stats.window_sizes_key_pairs_co_occ, local_windows_co_occ,
+                stats.key_pair_windows_co_occ_sum, stats.windows_stats_key_pair, stats.stats_key_pair, removal
+        );
+        this->apply_windows_stats(
+                local_window_key_triples, stats.window_sizes_key_triples_co_occ, local_windows_co_occ,
+                stats.key_triple_windows_co_occ_sum, stats.windows_stats_key_triple, stats.stats_key_triple, removal
+        );
+    }
+
+    /**
+     * Count the sorted occurrences of each pair or triple in every additional window and add them to (or subtract
+     * them from) the window stats. They are applied directly even with the buffered collector, since they are few
+     */
+    template<typename Key, typename Value>
+    inline void
+    apply_windows_stats(
+            const RecordArena<GapRecord<Key>> &records,
+            const std::vector<distance_t> &window_sizes,
+            std::vector<key_frequency_t> &windows_co_occ,
+            std::vector<key_frequency_t> &windows_co_occ_sum,
+            std::unordered_map<Key, std::vector<StatsWindow>> &windows_stats,
+            const std::unordered_map<Key, Value> &stats,
+            bool removal
+    ) {
+        const size_t num_windows = window_sizes.size() - 1;
+        for (size_t l = 0, r = 0, end = records.size(); l < end; l = r) {
+            const GapRecord<Key> &l_record = records[l];
+
+            // the window sizes are decreasing, hence each occurrence falls in a prefix of the additional windows
+            windows_co_occ.assign(num_windows, 0);
+            for (r = l; r < end && std::equal_to<Key>()(l_record.key, records[r].key); ++r) {
+                for (size_t i = 0; i < num_windows && records[r].gap <= window_sizes[i + 1]; ++i) {
+                    windows_co_occ[i] += 1;
+                }
+            }
+
+            // the restricted entries are subtracted even when missing, as the restrictions of the main maps are
+            auto windows_stats_it = windows_stats.find(l_record.key);
+            if (windows_stats_it == windows_stats.end()) {
+                if (B_RESTRICTED ? stats.find(l_record.key) == stats.end() : removal) {
+                    continue;
+                }
+                windows_stats_it = windows_stats.insert({l_record.key, std::vector<StatsWindow>(num_windows)}).first;
+            }
+
+            bool is_zero = true;
+            for (size_t i = 0; i < num_windows; ++i) {
+                const key_frequency_t window_co_occ = windows_co_occ[i];
+                const StatsWindow statsWindow((window_co_occ > 0 ? 1 : 0), window_co_occ, window_co_occ * window_co_occ);
+                if (removal) {
+                    windows_stats_it->second[i].subtract(statsWindow);
+                    windows_co_occ_sum[i] -= window_co_occ;
+                } else {
+                    windows_stats_it->second[i].update(statsWindow);
+                    windows_co_occ_sum[i] += window_co_occ;
+                }
+                is_zero = is_zero && windows_stats_it->second[i].is_zero();
+            }
+            // the entries are created on demand, hence they are removed as if they were never inserted
+            if (is_zero) {
+                windows_stats.erase(windows_stats_it);
+            }
         }
-        // put the value into the buffer
-        *(_T *) (local_buffer.data() + *local_buffer_end) = value;
-        // put the position into the related position vector
-        positions.push_back(*local_buffer_end);
-        // increase the end position
-        *local_buffer_end += sizeof(_T);
     }
 
     inline void
@@ -2085,6 +4852,400 @@ private:
     }
 };
 
+/**
+ * Filler of several restricted CollectionStats (the tenants) that matches and enumerates each document once.
+ * A single restricted filler works on the union of the restrictions of all the tenants, since the stats of a key, a
+ * pair or a triple do not depend on the other restrictions, and flush routes what it collected to the tenants that
+ * hold each entry, found with a per-tenant bitmask. The tenants are updated only by flush
+ * @tparam KeyType The elements type
+ */
+template<
+        typename KeyType,
+        bool B_DISABLE_UNWINDOWED = false,
+        bool B_BUFFERED_WORKER = false,
+        bool B_BUFFERED_COLLECTOR = false
+>
+class CollectionStatsMultiFiller {
+private:
+    using _Key = KeyType;
+    using _KeyPair = KeyPair<KeyType>;
+    using _KeyTriple = KeyTriple<KeyType>;
+    using _CollectionStats = CollectionStats<KeyType, B_DISABLE_UNWINDOWED, true>;
+    using _CollectionStatsFiller = CollectionStatsFiller<KeyType, B_DISABLE_UNWINDOWED, true, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+    using tenant_mask_t = uint64_t;
+
+/**
+ * Object fields
+ */
+private:
+    const std::vector<_CollectionStats *> tenants;
+    // stats of the union of the restrictions, they hold what has been collected since the last flush
+    std::unique_ptr<_CollectionStats> union_stats;
+    std::unique_ptr<_CollectionStatsFiller> union_filler;
+
+    // entry to the bitmask of the tenants that are restricted to it
+    std::unordered_map<_Key, tenant_mask_t> tenants_key;
+    std::unordered_map<_KeyPair, tenant_mask_t> tenants_key_pair;
+    std::unordered_map<_KeyTriple, tenant_mask_t> tenants_key_triple;
+
+public:
+    CollectionStatsMultiFiller(
+            const std::vector<CollectionStats<KeyType, B_DISABLE_UNWINDOWED, true> *> &tenants,
+            const PatternMatcher<KeyType> *pattern_matcher,
+            std::size_t buffer_size_in_bytes,
+            uint32_t num_threads = 1,
+            uint32_t queue_max_size = 1,
+            WorkerPlacement worker_placement = WORKER_PLACEMENT_NONE,
+            bool node_local_stats = false
+    ) :
+            tenants(tenants) {
+        if (tenants.empty() || tenants.size() > 8 * sizeof(tenant_mask_t)) {
+            throw std::runtime_error("The number of collection stats must be between 1 and 64");
+        }
+        for (_CollectionStats *tenant: tenants) {
+            if (tenant->window_sizes_key_pairs_co_occ != tenants[0]->window_sizes_key_pairs_co_occ ||
+                tenant->window_sizes_key_triples_co_occ != tenants[0]->window_sizes_key_triples_co_occ) {
+                throw std::runtime_error("The collection stats must be based on the same windows");
+            }
+            if (tenant->sampling_rate != tenants[0]->sampling_rate ||
+                tenant->sampling_seed != tenants[0]->sampling_seed) {
+                throw std::runtime_error("The collection stats must be based on the same document sampling");
+            }
+        }
+
+        this->union_stats.reset(new _CollectionStats(
+                tenants[0]->window_sizes_key_pairs_co_occ,
+                tenants[0]->window_sizes_key_triples_co_occ
+        ));
+        // the union filler samples the documents as the tenants did
+        this->union_stats->sampling_rate = tenants[0]->sampling_rate;
+        this->union_stats->sampling_seed = tenants[0]->sampling_seed;
+        // the restrictions already in the tenants, the filler reads them from the union
+        for (size_t tenant = 0; tenant < tenants.size(); ++tenant) {
+            for (auto stats_key_it: tenants[tenant]->stats_key) {
+                this->add_tenant_entry(tenant, stats_key_it.first, &_CollectionStats::stats_key, this->tenants_key);
+            }
+            for (auto stats_key_pair_it: tenants[tenant]->stats_key_pair) {
+                this->add_tenant_entry(tenant, stats_key_pair_it.first, &_CollectionStats::stats_key_pair,
+                                       this->tenants_key_pair);
+            }
+            for (auto stats_key_triple_it: tenants[tenant]->stats_key_triple) {
+                this->add_tenant_entry(tenant, stats_key_triple_it.first, &_CollectionStats::stats_key_triple,
+                                       this->tenants_key_triple);
+            }
+        }
+
+        this->union_filler.reset(new _CollectionStatsFiller(
+                this->union_stats.get(), pattern_matcher, buffer_size_in_bytes, num_threads, queue_max_size,
+                worker_placement, node_local_stats
+        ));
+    }
+
+    ~CollectionStatsMultiFiller() {
+        this->flush();
+    }
+
+    size_t
+    get_num_tenants() const noexcept {
+        return this->tenants.size();
+    }
+
+    uint32_t
+    get_num_threads() {
+        return this->union_filler->get_num_threads();
+    }
+
+    void
+    set_num_threads(
+            uint32_t num_threads
+    ) {
+        this->union_filler->set_num_threads(num_threads);
+    }
+
+    void
+    add_restriction(
+            size_t tenant,
+            const KeyType &key
+    ) {
+        this->check_add_restriction(tenant);
+        this->union_filler->add_restriction(key);
+        this->add_tenant_restriction(tenant, key);
+    }
+
+    void
+    add_restriction(
+            size_t tenant,
+            const KeyPair<KeyType> &keyPair
+    ) {
+        this->check_add_restriction(tenant);
+        this->union_filler->add_restriction(keyPair);
+        this->add_tenant_restriction(tenant, keyPair);
+    }
+
+    void
+    add_restriction(
+            size_t tenant,
+            const KeyType &first,
+            const KeyType &second
+    ) {
+        this->add_restriction(tenant, _KeyPair(first, second));
+    }
+
+    void
+    add_restriction(
+            size_t tenant,
+            const KeyTriple<KeyType> &keyTriple
+    ) {
+        this->check_add_restriction(tenant);
+        this->union_filler->add_restriction(keyTriple);
+        this->add_tenant_restriction(tenant, keyTriple);
+    }
+
+    void
+    add_restriction(
+            size_t tenant,
+            const KeyType &first,
+            const KeyType &second,
+            const KeyType &third
+    ) {
+        this->add_restriction(tenant, _KeyTriple(first, second, third));
+    }
+
+    void
+    update(
+            const std::vector<std::string> &doc_fields
+    ) {
+        this->union_filler->update(doc_fields);
+    }
+
+    void
+    update(
+            std::vector<std::string> &doc_fields
+    ) {
+        this->union_filler->update(doc_fields);
+    }
+
+    /**
+     * Subtract a document previously given to update, waiting for the pending updates of the same document,
+     * see CollectionStatsFiller::remove
+     */
+    void
+    remove(
+            const std::vector<std::string> &doc_fields
+    ) {
+        this->union_filler->remove(doc_fields);
+    }
+
+    void
+    remove(
+            std::vector<std::string> &doc_fields
+    ) {
+        this->union_filler->remove(doc_fields);
+    }
+
+    /**
+     * Wait for the pending documents and add what has been collected since the last flush to the tenants
+     */
+    void
+    flush() {
+        this->union_filler->flush();
+
+        // the documents applied meanwhile by other threads wait, otherwise their counts could be lost or routed twice
+        this->union_filler->update_lock();
+        try {
+            this->route_union_stats();
+        } catch (...) {
+            this->union_filler->update_unlock();
+            throw;
+        }
+        this->union_filler->update_unlock();
+    }
+
+private:
+    /**
+     * Add the union stats to the tenants and reset them, holding the update lock of the union filler
+     */
+    void
+    route_union_stats() {
+        // the documents applied after the flush of the union filler are routed whole
+        if (!this->union_filler->partitions.empty()) {
+            this->union_filler->merge_partitions_impl();
+        }
+        if (B_BUFFERED_COLLECTOR) {
+            this->union_filler->flush_impl();
+        }
+
+        _CollectionStats &union_stats = *this->union_stats;
+        for (_CollectionStats *tenant: this->tenants) {
+            tenant->num_docs += union_stats.num_docs;
+        }
+        // the removals of the flushed documents must not be ignored by the union filler
+        this->union_filler->flushed_num_docs += union_stats.num_docs;
+        union_stats.num_docs = 0;
+        union_stats.key_frequency_sum = 0;
+        union_stats.key_pair_window_co_occ_sum = 0;
+        union_stats.key_triple_window_co_occ_sum = 0;
+
+        // a removal of a document collected by a previous flush leaves negative values, that wrap around and are
+        // subtracted by the unsigned additions below
+        for (auto &stats_key_it: union_stats.stats_key) {
+            const StatsKey &statsKey = stats_key_it.second;
+            this->for_each_tenant(stats_key_it.first, this->tenants_key, [&](_CollectionStats &tenant) {
+                tenant.stats_key.find(stats_key_it.first)->second.update(statsKey);
+                tenant.key_frequency_sum += statsKey.frequency;
+            });
+            stats_key_it.second = union_stats.zero_stats_key;
+        }
+        for (auto &stats_key_pair_it: union_stats.stats_key_pair) {
+            const StatsKeyPair &statsKeyPair = stats_key_pair_it.second;
+            this->for_each_tenant(stats_key_pair_it.first, this->tenants_key_pair, [&](_CollectionStats &tenant) {
+                route_window_stats(tenant.stats_key_pair.find(stats_key_pair_it.first)->second, statsKeyPair);
+                tenant.key_pair_window_co_occ_sum += statsKeyPair.window_frequency;
+            });
+            stats_key_pair_it.second = union_stats.zero_stats_key_pair;
+        }
+        for (auto &stats_key_triple_it: union_stats.stats_key_triple) {
+            const StatsKeyTriple &statsKeyTriple = stats_key_triple_it.second;
+            this->for_each_tenant(stats_key_triple_it.first, this->tenants_key_triple, [&](_CollectionStats &tenant) {
+                route_window_stats(tenant.stats_key_triple.find(stats_key_triple_it.first)->second, statsKeyTriple);
+                tenant.key_triple_window_co_occ_sum += statsKeyTriple.window_frequency;
+            });
+            stats_key_triple_it.second = union_stats.zero_stats_key_triple;
+        }
+
+        // the additional windows
+        this->route_windows_stats(union_stats.windows_stats_key_pair, this->tenants_key_pair,
+                                  &_CollectionStats::windows_stats_key_pair,
+                                  &_CollectionStats::key_pair_windows_co_occ_sum);
+        this->route_windows_stats(union_stats.windows_stats_key_triple, this->tenants_key_triple,
+                                  &_CollectionStats::windows_stats_key_triple,
+                                  &_CollectionStats::key_triple_windows_co_occ_sum);
+        std::fill(union_stats.key_pair_windows_co_occ_sum.begin(), union_stats.key_pair_windows_co_occ_sum.end(), 0);
+        std::fill(union_stats.key_triple_windows_co_occ_sum.begin(), union_stats.key_triple_windows_co_occ_sum.end(),
+                  0);
+    }
+
+    inline void
+    check_add_restriction(
+            size_t tenant
+    ) const {
+        if (tenant >= this->tenants.size()) {
+            throw std::runtime_error("The collection stats index is out of range");
+        }
+        if (this->tenants[tenant]->num_docs > 0) {
+            throw std::runtime_error("Operation not permitted when the CollectionStats has been already updated");
+        }
+    }
+
+    template<typename Key, typename Value>
+    inline void
+    add_tenant_entry(
+            size_t tenant,
+            const Key &key,
+            std::unordered_map<Key, Value> _CollectionStats::*stats,
+            std::unordered_map<Key, tenant_mask_t> &tenants_mask
+    ) {
+        // the insert doesn't modify the maps if the key is already in
+        ((*this->union_stats).*stats).insert({key, Value()});
+        ((*this->tenants[tenant]).*stats).insert({key, Value()});
+        tenants_mask[key] |= ((tenant_mask_t) 1) << tenant;
+    }
+
+    /**
+     * Register the restriction in the tenant, with the entries implied by its repeated keys as the filler does
+     */
+    inline void
+    add_tenant_restriction(
+            size_t tenant,
+            const _Key &key
+    ) {
+        this->add_tenant_entry(tenant, key, &_CollectionStats::stats_key, this->tenants_key);
+    }
+
+    inline void
+    add_tenant_restriction(
+            size_t tenant,
+            const _KeyPair &keyPair
+    ) {
+        this->add_tenant_entry(tenant, keyPair, &_CollectionStats::stats_key_pair, this->tenants_key_pair);
+        if (std::equal_to<_Key>()(keyPair.first(), keyPair.second())) {
+            this->add_tenant_restriction(tenant, keyPair.first());
+        }
+    }
+
+    inline void
+    add_tenant_restriction(
+            size_t tenant,
+            const _KeyTriple &keyTriple
+    ) {
+        this->add_tenant_entry(tenant, keyTriple, &_CollectionStats::stats_key_triple, this->tenants_key_triple);
+        if (std::equal_to<_Key>()(keyTriple.first(), keyTriple.third())) {
+            this->add_tenant_restriction(tenant, keyTriple.first());
+        } else if (std::equal_to<_Key>()(keyTriple.first(), keyTriple.second())) {
+            this->add_tenant_restriction(tenant, _KeyPair(keyTriple.first(), keyTriple.third()));
+        } else if (std::equal_to<_Key>()(keyTriple.second(), keyTriple.third())) {
+            this->add_tenant_restriction(tenant, _KeyPair(keyTriple.second(), keyTriple.first()));
+        }
+    }
+
+    template<typename Key, typename Function>
+    inline void
+    for_each_tenant(
+            const Key &key,
+            const std::unordered_map<Key, tenant_mask_t> &tenants_mask,
+            Function function
+    ) const {
+        for (tenant_mask_t mask = tenants_mask.at(key); mask != 0; mask &= mask - 1) {
+            function(*this->tenants[__builtin_ctzll(mask)]);
+        }
+    }
+
+    /**
+     * Add the stats collected for a pair or a triple. The minimum distance follows the subtract of the stats when
+     * the removals leave no window co-occurrence
+     */
+    template<typename Value>
+    static inline void
+    route_window_stats(
+            Value &stats,
+            const Value &collected
+    ) {
+        stats.update(collected);
+        if (stats.window_document_frequency == 0) {
+            stats.window_min_dist = (distance_t) -1;
+        }
+    }
+
+    template<typename Key>
+    void
+    route_windows_stats(
+            std::unordered_map<Key, std::vector<StatsWindow>> &union_windows_stats,
+            const std::unordered_map<Key, tenant_mask_t> &tenants_mask,
+            std::unordered_map<Key, std::vector<StatsWindow>> _CollectionStats::*windows_stats,
+            std::vector<key_frequency_t> _CollectionStats::*windows_co_occ_sum
+    ) {
+        for (const auto &windows_stats_it: union_windows_stats) {
+            this->for_each_tenant(windows_stats_it.first, tenants_mask, [&](_CollectionStats &tenant) {
+                auto tenant_windows_stats_it = (tenant.*windows_stats).find(windows_stats_it.first);
+                if (tenant_windows_stats_it == (tenant.*windows_stats).end()) {
+                    tenant_windows_stats_it = (tenant.*windows_stats).insert(
+                            {windows_stats_it.first, std::vector<StatsWindow>(windows_stats_it.second.size())}).first;
+                }
+                bool is_zero = true;
+                for (size_t i = 0; i < windows_stats_it.second.size(); ++i) {
+                    tenant_windows_stats_it->second[i].update(windows_stats_it.second[i]);
+                    (tenant.*windows_co_occ_sum)[i] += windows_stats_it.second[i].window_frequency;
+                    is_zero = is_zero && tenant_windows_stats_it->second[i].is_zero();
+                }
+                if (is_zero) {
+                    (tenant.*windows_stats).erase(tenant_windows_stats_it);
+                }
+            });
+        }
+        union_windows_stats.clear();
+    }
+};
+
 template<typename Value>
 size_t
 get_frequency(
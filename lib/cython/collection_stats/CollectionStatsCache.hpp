@@ -0,0 +1,248 @@
+#ifndef COLLECTION_STATS_CACHE_HPP
+#define COLLECTION_STATS_CACHE_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "CollectionStats.hpp"
+
+
+/**
+ * Bounded and thread safe map with CLOCK eviction, split in shards each protected by its own mutex
+ * @tparam _Key The key type, it must be hashable with std::hash
+ * @tparam _Value The value type
+ */
+template<typename _Key, typename _Value>
+class ClockCache {
+private:
+    struct Entry {
+        _Key key;
+        _Value value;
+        bool referenced;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::vector<Entry> entries;
+        std::unordered_map<_Key, size_t> positions;  // key to its position in entries
+        size_t hand = 0;  // the CLOCK hand
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t shard_capacity;
+
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+
+public:
+    ClockCache(
+            size_t capacity,
+            size_t num_shards = 16
+    ) :
+            hits(0),
+            misses(0) {
+        if (num_shards == 0) {
+            throw std::runtime_error("num_shards must be greater than 0");
+        }
+        this->shard_capacity = std::max<size_t>(1, capacity / num_shards);
+        for (size_t i = 0; i < num_shards; ++i) {
+            this->shards.emplace_back(new Shard());
+        }
+    }
+
+    /**
+     * Return the value of key, computing it with compute(key) and caching it when it is missing.
+     * compute is called outside the locks, so it must be thread safe
+     */
+    template<typename Function>
+    _Value
+    get(
+            const _Key &key,
+            Function compute
+    ) {
+        Shard &shard = *this->shards[shard_of(key)];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto position_it = shard.positions.find(key);
+            if (position_it != shard.positions.end()) {
+                Entry &entry = shard.entries[position_it->second];
+                entry.referenced = true;
+                ++this->hits;
+                return entry.value;
+            }
+        }
+        ++this->misses;
+
+        _Value value = compute(key);
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.positions.find(key) != shard.positions.end()) {
+            // another thread has already added the key
+            return value;
+        }
+        if (shard.entries.size() < this->shard_capacity) {
+            shard.positions[key] = shard.entries.size();
+            shard.entries.push_back(Entry{key, value, false});
+        } else {
+            // move the hand until a non referenced entry is found, giving a second chance to the referenced ones
+            while (shard.entries[shard.hand].referenced) {
+                shard.entries[shard.hand].referenced = false;
+                shard.hand = (shard.hand + 1) % shard.entries.size();
+            }
+            Entry &entry = shard.entries[shard.hand];
+            shard.positions.erase(entry.key);
+            shard.positions[key] = shard.hand;
+            entry.key = key;
+            entry.value = value;
+            shard.hand = (shard.hand + 1) % shard.entries.size();
+        }
+        return value;
+    }
+
+    void
+    clear() {
+        for (auto &shard: this->shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->entries.clear();
+            shard->positions.clear();
+            shard->hand = 0;
+        }
+        this->hits = 0;
+        this->misses = 0;
+    }
+
+    size_t
+    size() const {
+        size_t result = 0;
+        for (auto &shard: this->shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            result += shard->entries.size();
+        }
+        return result;
+    }
+
+    uint64_t
+    get_hits() const noexcept {
+        return this->hits;
+    }
+
+    uint64_t
+    get_misses() const noexcept {
+        return this->misses;
+    }
+
+private:
+    inline size_t
+    shard_of(
+            const _Key &key
+    ) const {
+        // the hash of the keys can be weak, so it is mixed before choosing the shard
+        uint64_t h = std::hash<_Key>()(key) * 0x9E3779B97F4A7C15ull;
+        return (h >> 32) % this->shards.size();
+    }
+};
+
+
+/**
+ * Read-only view over a CollectionStats that caches the lookups of key pairs and key triples.
+ * The keys are canonicalized by KeyPair and KeyTriple, so the cache is shared among all the permutations of the keys.
+ * The cached values are not invalidated, so the underlying statistics must not change while the cache is in use
+ * (e.g. a published snapshot), or clear must be called after each change
+ */
+template<
+        typename KeyType,
+        bool B_DISABLE_UNWINDOWED = false,
+        bool B_RESTRICTED = true
+>
+class CollectionStatsCache {
+private:
+    using _KeyPair = KeyPair<KeyType>;
+    using _KeyTriple = KeyTriple<KeyType>;
+    using _CollectionStats = CollectionStats<KeyType, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+
+    const _CollectionStats *collection_stats;
+    mutable ClockCache<_KeyPair, StatsKeyPair> cache_key_pair;
+    mutable ClockCache<_KeyTriple, StatsKeyTriple> cache_key_triple;
+
+public:
+    CollectionStatsCache(
+            const _CollectionStats *collection_stats,
+            size_t key_pairs_capacity = 1 << 20,
+            size_t key_triples_capacity = 1 << 20
+    ) :
+            collection_stats(collection_stats),
+            cache_key_pair(key_pairs_capacity),
+            cache_key_triple(key_triples_capacity) {
+    }
+
+    const _CollectionStats &
+    get_collection_stats() const noexcept {
+        return *this->collection_stats;
+    }
+
+    document_frequency_t
+    get_num_docs() const noexcept {
+        return this->collection_stats->get_num_docs();
+    }
+
+    key_frequency_t
+    get_key_frequency_sum() const noexcept {
+        return this->collection_stats->get_key_frequency_sum();
+    }
+
+    StatsKey
+    get_stats_key(
+            const KeyType &key
+    ) const {
+        // a single probe, not worth caching
+        return this->collection_stats->get_stats_key(key);
+    }
+
+    StatsKeyPair
+    get_stats_key_pair(
+            const KeyType &first,
+            const KeyType &second
+    ) const {
+        return this->cache_key_pair.get(_KeyPair(first, second), [this](const _KeyPair &keyPair) {
+            return this->collection_stats->get_stats_key_pair(keyPair);
+        });
+    }
+
+    StatsKeyTriple
+    get_stats_key_triple(
+            const KeyType &first,
+            const KeyType &second,
+            const KeyType &third
+    ) const {
+        return this->cache_key_triple.get(_KeyTriple(first, second, third), [this](const _KeyTriple &keyTriple) {
+            return this->collection_stats->get_stats_key_triple(keyTriple);
+        });
+    }
+
+    void
+    clear() {
+        this->cache_key_pair.clear();
+        this->cache_key_triple.clear();
+    }
+
+    uint64_t
+    get_hits() const noexcept {
+        return this->cache_key_pair.get_hits() + this->cache_key_triple.get_hits();
+    }
+
+    uint64_t
+    get_misses() const noexcept {
+        return this->cache_key_pair.get_misses() + this->cache_key_triple.get_misses();
+    }
+
+    size_t
+    size() const {
+        return this->cache_key_pair.size() + this->cache_key_triple.size();
+    }
+};
+
+#endif //COLLECTION_STATS_CACHE_HPP
@@ -0,0 +1,140 @@
+#ifndef NUMA_TOPOLOGY_HPP
+#define NUMA_TOPOLOGY_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+/**
+ * NUMA topology of the machine, read from sysfs without depending on libnuma.
+ * Memory placement relies on the first-touch policy of the kernel: the memory touched by a thread pinned to a node
+ * is allocated on that node
+ */
+class NumaTopology {
+private:
+    std::vector<std::vector<int>> node_cpus;  // node to the list of its cpus
+
+    static const int MAX_NUM_NODES = 1024;  // bound of the node ids scanned when the online list is not available
+
+public:
+    NumaTopology() {
+#ifdef __linux__
+        // the node ids can be sparse, e.g. "0,2-3", the missing ones are skipped
+        std::vector<int> nodes;
+        std::ifstream online_file("/sys/devices/system/node/online");
+        if (online_file.is_open()) {
+            std::string online;
+            std::getline(online_file, online);
+            nodes = parse_cpulist(online);
+        } else {
+            for (int node = 0; node < MAX_NUM_NODES; ++node) {
+                nodes.push_back(node);
+            }
+        }
+        for (int node: nodes) {
+            std::ifstream infile("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!infile.is_open()) {
+                continue;
+            }
+            std::string cpulist;
+            std::getline(infile, cpulist);
+            std::vector<int> cpus = parse_cpulist(cpulist);
+            if (!cpus.empty()) {
+                this->node_cpus.push_back(cpus);
+            }
+        }
+#endif
+        // fallback: a single node containing all the cpus
+        if (this->node_cpus.empty()) {
+            std::vector<int> cpus;
+            for (unsigned int cpu = 0, end = std::max(1u, std::thread::hardware_concurrency()); cpu < end; ++cpu) {
+                cpus.push_back(cpu);
+            }
+            this->node_cpus.push_back(cpus);
+        }
+    }
+
+    size_t
+    get_num_nodes() const noexcept {
+        return this->node_cpus.size();
+    }
+
+    const std::vector<int> &
+    get_node_cpus(
+            size_t node
+    ) const {
+        return this->node_cpus.at(node % this->node_cpus.size());
+    }
+
+    /**
+     * Return the cpu assigned to the i-th thread when the threads are spread node by node (round robin)
+     */
+    int
+    get_cpu_round_robin(
+            size_t i
+    ) const {
+        const std::vector<int> &cpus = this->get_node_cpus(i);
+        return cpus[(i / this->node_cpus.size()) % cpus.size()];
+    }
+
+    /**
+     * Pin the calling thread to the given cpus, returning false if the operation is not supported or it fails
+     */
+    static bool
+    pin_current_thread(
+            const std::vector<int> &cpus
+    ) {
+#ifdef __linux__
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (int cpu: cpus) {
+            CPU_SET(cpu, &cpu_set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    static bool
+    pin_current_thread(
+            int cpu
+    ) {
+        return pin_current_thread(std::vector<int>({cpu}));
+    }
+
+    /**
+     * Parse a list in the sysfs format, e.g. "0-3,8,10-11", used for both the cpus and the nodes
+     */
+    static std::vector<int>
+    parse_cpulist(
+            const std::string &cpulist
+    ) {
+        std::vector<int> cpus;
+        std::stringstream ss(cpulist);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+            if (range.empty()) {
+                continue;
+            }
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+};
+
+#endif //NUMA_TOPOLOGY_HPP
@@ -1,6 +1,7 @@
 from libc.stdint cimport uint16_t, uint32_t, uint64_t
 from libcpp.utility cimport pair
 from libcpp.string cimport string
+from libcpp.memory cimport shared_ptr
 from libcpp.unordered_map cimport unordered_map
 from libcpp.vector cimport vector
 
@@ -60,24 +61,66 @@ cdef extern from "CollectionStats.hpp":
         key_frequency_t window_frequency_square;
         distance_t window_min_dist;
 
+    cdef struct StatsEstimate:
+        double value
+        double variance
+
+    cdef struct EstimatedStatsKey:
+        StatsEstimate document_frequency
+        StatsEstimate frequency
+
+    cdef struct EstimatedStatsKeyPair:
+        StatsEstimate document_frequency
+        StatsEstimate window_document_frequency
+        StatsEstimate window_frequency
+
+    cdef struct EstimatedStatsKeyTriple:
+        StatsEstimate document_frequency
+        StatsEstimate window_document_frequency
+        StatsEstimate window_frequency
+
+
+    cdef cppclass CollectionStatsFilter[T]:
+        CollectionStatsFilter()
+
+        void                                                        add_key(const T &)
+        void                                                        add_key_pair(const T &, const T &)
+        void                                                        add_key_triple(const T &, const T &, const T &)
+
 
     cdef cppclass CollectionStats[T, BU, BR]:
         const distance_t window_size_key_pairs_co_occ
         const distance_t window_size_key_triples_co_occ
+        const vector[distance_t] window_sizes_key_pairs_co_occ
+        const vector[distance_t] window_sizes_key_triples_co_occ
 
         CollectionStats ()
         CollectionStats (distance_t, distance_t)
+        CollectionStats (const vector[distance_t] &, const vector[distance_t] &) except +
 
         void                                                        clear()
 
         const StatsKey                                              get_stats_key(const T &) except +
         const StatsKeyPair                                          get_stats_key_pair(const T &, const T &) except +
+        const StatsKeyPair                                          get_stats_key_pair(const T &, const T &, size_t) except +
         const StatsKeyTriple                                        get_stats_key_triple(const T &, const T &, const T &) except +
+        const StatsKeyTriple                                        get_stats_key_triple(const T &, const T &, const T &, size_t) except +
 
         document_frequency_t                                        get_num_docs() const
         key_frequency_t                                             get_key_frequency_sum() const
         key_frequency_t                                             get_key_pair_window_co_occ_sum() const
+        key_frequency_t                                             get_key_pair_window_co_occ_sum(size_t) except +
         key_frequency_t                                             get_key_triple_window_co_occ_sum() const
+        key_frequency_t                                             get_key_triple_window_co_occ_sum(size_t) except +
+
+        CollectionStats[T, BU, BR] *                                get_window_collection_stats(size_t, size_t) except +
+
+        double                                                      get_sampling_rate() const
+        uint64_t                                                    get_sampling_seed() const
+        StatsEstimate                                               estimate_num_docs() const
+        EstimatedStatsKey                                           estimate_stats_key(const T &) except +
+        EstimatedStatsKeyPair                                       estimate_stats_key_pair(const T &, const T &, size_t) except +
+        EstimatedStatsKeyTriple                                     estimate_stats_key_triple(const T &, const T &, const T &, size_t) except +
 
         size_t                                                      get_num_keys() const
         size_t                                                      get_num_key_pairs() const
@@ -87,27 +130,84 @@ cdef extern from "CollectionStats.hpp":
 
         void                                                        dump(const string &) except +
         void                                                        dumps(ostream *) except +
+        void                                                        dump_compressed(const string &, uint32_t) except + nogil
+        void                                                        dumps_compressed(ostream *, uint32_t) except + nogil
 
         @staticmethod
-        CollectionStats[T, BU, BR] *                                load(const string &) nogil except +
+        CollectionStats[T, BU, BR] *                                load(const string &, uint32_t) except + nogil
+        @staticmethod
+        CollectionStats[T, BU, BR] *                                load(const string &, const CollectionStatsFilter[T] &, uint32_t) except + nogil
+        @staticmethod
+        CollectionStats[T, BU, BR] *                                loads(istream *) except + nogil
         @staticmethod
-        CollectionStats[T, BU, BR] *                                loads(istream *) nogil except +
+        CollectionStats[T, BU, BR] *                                loads(istream *, const CollectionStatsFilter[T] &, uint32_t) except + nogil
+
+
+    cdef enum WorkerPlacement:
+        WORKER_PLACEMENT_NONE
+        WORKER_PLACEMENT_CORE
+        WORKER_PLACEMENT_NODE
+
+    cdef cppclass FlushFuture "std::shared_future<void>":
+        void                                                        wait() nogil
+        void                                                        get() except + nogil
 
+    bint                                                            is_future_ready(const FlushFuture &)
 
     cdef cppclass CollectionStatsFiller[T, BU, BR, BW, BC]:
 
         CollectionStatsFiller (CollectionStats*, PatternMatcher*, size_t, uint32_t, uint32_t)
+        CollectionStatsFiller (CollectionStats*, PatternMatcher*, size_t, uint32_t, uint32_t, WorkerPlacement, bint)
 
         void                                                        add_restriction(const T&)
         void                                                        add_restriction(const T&, const T&)
         void                                                        add_restriction(const T&, const T&, const T&)
 
-        void                                                        update(vector[string])
-        void                                                        flush()
+        void                                                        update(vector[string]) except + nogil
+        void                                                        remove(vector[string]) except + nogil
+        void                                                        flush() except + nogil
+        FlushFuture                                                 flush_async() except +
+
+        uint32_t                                                    get_num_threads() nogil
+        void                                                        set_num_threads(uint32_t) except + nogil
+
+        void                                                        publish_snapshot() except + nogil
+        shared_ptr[CollectionStats[T, BU, BR]]                      snapshot() except + nogil
+        shared_ptr[CollectionStats[T, BU, BR]]                      get_published_snapshot()
+        void                                                        set_snapshot_interval(document_frequency_t)
+        void                                                        set_field_chunk_size(size_t)
+        void                                                        set_sampling_rate(double, uint64_t) except +
+
+
+
+ctypedef CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE] * CollectionStatsPtr
+
+cdef extern from "CollectionStats.hpp":
+    cdef cppclass CollectionStatsMultiFiller[T, BU, BW, BC]:
+
+        CollectionStatsMultiFiller (const vector[CollectionStatsPtr] &, PatternMatcher*, size_t, uint32_t, uint32_t, WorkerPlacement, bint) except +
+
+        size_t                                                      get_num_tenants()
+
+        void                                                        add_restriction(size_t, const T&) except +
+        void                                                        add_restriction(size_t, const T&, const T&) except +
+        void                                                        add_restriction(size_t, const T&, const T&, const T&) except +
+
+        uint32_t                                                    get_num_threads() nogil
+        void                                                        set_num_threads(uint32_t) except + nogil
+
+        void                                                        update(vector[string]) except + nogil
+        void                                                        remove(vector[string]) except + nogil
+        void                                                        flush() except + nogil
 
 
 cdef class _PyCollectionStats:
     cdef CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE] * c_collection_stats
+    # set only when this object is a read-only snapshot, which owns c_collection_stats
+    cdef shared_ptr[CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE]] c_snapshot
 
 cdef class _PyCollectionStatsFiller:
     cdef CollectionStatsFiller[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE, CSF_BUFFERED_WORKER_TYPE, CSF_BUFFERED_COLLECTOR_TYPE] * c_collection_stats_filler
+    cdef object collection_stats_type
+
+    cdef _wrap_snapshot(self, shared_ptr[CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE]] c_snapshot)
@@ -28,56 +28,126 @@ cdef extern from "<sstream>" namespace "std":
 StatsTerm = collections.namedtuple('StatsTerm', ["df", "tf", "tf_square"])
 StatsTermPair = collections.namedtuple('StatsTermPair', ["df", "window_df", "window_tf", "window_tf_square", "window_min_dist"])
 StatsTermTriple = collections.namedtuple('StatsTermTriple', ["df", "window_df", "window_tf", "window_tf_square", "window_min_dist"])
+Estimate = collections.namedtuple('Estimate', ["value", "variance"])
+EstimatedStatsTerm = collections.namedtuple('EstimatedStatsTerm', ["df", "tf"])
+EstimatedStatsTermPair = collections.namedtuple('EstimatedStatsTermPair', ["df", "window_df", "window_tf"])
+EstimatedStatsTermTriple = collections.namedtuple('EstimatedStatsTermTriple', ["df", "window_df", "window_tf"])
+
+
+cdef inline _estimate(const StatsEstimate &estimate):
+    return Estimate(estimate.value, estimate.variance)
 
 
 cdef class _PyCollectionStats:
-    def __cinit__(self, distance_t window_size_co_occ2=12, distance_t window_size_co_occ3=15, str filename=None, str dump_str=None):
+    def __cinit__(self, window_size_co_occ2=12, window_size_co_occ3=15, str filename=None, str dump_str=None, uint32_t num_threads=0,
+                  keys=None, key_pairs=None, key_triples=None):
+        """The window sizes can be lists, to fill the stats of several windows in a single pass: the largest ones are
+        the windows of index 0, see get_window_collection_stats. The dumps of both formats are loaded, the compressed
+        one is decoded on num_threads threads (0 means all the cores).
+        When keys, key_pairs or key_triples are given only their stats are loaded, the pairs and the triples made of
+        the given keys included"""
         if filename and dump_str:
             raise ValueError("filename and dump cannot be set at the same time")
         cdef string _filename
         cdef istringstream ss
+        cdef CollectionStatsFilter[uint32_t] c_filter
+        cdef bint filtered = keys is not None or key_pairs is not None or key_triples is not None
+        for key in keys or ():
+            c_filter.add_key(key)
+        for first, second in key_pairs or ():
+            c_filter.add_key_pair(first, second)
+        for first, second, third in key_triples or ():
+            c_filter.add_key_triple(first, second, third)
+        cdef vector[distance_t] window_sizes_co_occ2 = window_size_co_occ2 if isinstance(window_size_co_occ2, (list, tuple)) else [window_size_co_occ2]
+        cdef vector[distance_t] window_sizes_co_occ3 = window_size_co_occ3 if isinstance(window_size_co_occ3, (list, tuple)) else [window_size_co_occ3]
 
         if filename or dump_str:
             if filename:
                 _filename = filename
                 with nogil:
-                    self.c_collection_stats = CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE].load(_filename)
+                    if filtered:
+                        self.c_collection_stats = CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE].load(_filename, c_filter, num_threads)
+                    else:
+                        self.c_collection_stats = CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE].load(_filename, num_threads)
             else:
                 ss = istringstream(dump_str)
                 with nogil:
-                    self.c_collection_stats = CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE].loads(&ss)
+                    if filtered:
+                        self.c_collection_stats = CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE].loads(&ss, c_filter, num_threads)
+                    else:
+                        self.c_collection_stats = CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE].loads(&ss)
         else:
-            self.c_collection_stats = new CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE](window_size_co_occ2, window_size_co_occ3)
+            self.c_collection_stats = new CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE](window_sizes_co_occ2, window_sizes_co_occ3)
 
     def __dealloc__(self):
-        del self.c_collection_stats
+        if self.c_snapshot.get() == NULL:
+            del self.c_collection_stats
 
     def clear(self):
+        if self.c_snapshot.get() != NULL:
+            raise RuntimeError("A snapshot is read-only")
         self.c_collection_stats.clear()
 
+    def is_snapshot(self):
+        return self.c_snapshot.get() != NULL
+
     def get_stats_term(self, uint32_t pattern_id):
         cdef StatsKey stats = self.c_collection_stats.get_stats_key(pattern_id)
         return StatsTerm(stats.document_frequency, stats.frequency, stats.frequency_square)
 
-    def get_stats_term_pair(self, uint32_t pattern_id1, uint32_t pattern_id2):
-        cdef StatsKeyPair stats = self.c_collection_stats.get_stats_key_pair(pattern_id1, pattern_id2)
+    def get_stats_term_pair(self, uint32_t pattern_id1, uint32_t pattern_id2, size_t window_index=0):
+        cdef StatsKeyPair stats = self.c_collection_stats.get_stats_key_pair(pattern_id1, pattern_id2, window_index)
         return StatsTermPair(stats.document_frequency, stats.window_document_frequency, stats.window_frequency, stats.window_frequency_square, stats.window_min_dist)
 
-    def get_stats_term_triple(self, uint32_t pattern_id1, uint32_t pattern_id2, uint32_t pattern_id3):
-        cdef StatsKeyTriple stats = self.c_collection_stats.get_stats_key_triple(pattern_id1, pattern_id2, pattern_id3)
+    def get_stats_term_triple(self, uint32_t pattern_id1, uint32_t pattern_id2, uint32_t pattern_id3, size_t window_index=0):
+        cdef StatsKeyTriple stats = self.c_collection_stats.get_stats_key_triple(pattern_id1, pattern_id2, pattern_id3, window_index)
         return StatsTermTriple(stats.document_frequency, stats.window_document_frequency, stats.window_frequency, stats.window_frequency_square, stats.window_min_dist)
 
+    def get_window_sizes_term_pairs(self):
+        return list(self.c_collection_stats.window_sizes_key_pairs_co_occ)
+
+    def get_window_sizes_term_triples(self):
+        return list(self.c_collection_stats.window_sizes_key_triples_co_occ)
+
+    def get_window_collection_stats(self, size_t pair_window_index, size_t triple_window_index):
+        """Return the stats of only the given windows, as if they were filled with those window sizes"""
+        cdef CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE] * c_window_stats = self.c_collection_stats.get_window_collection_stats(pair_window_index, triple_window_index)
+        cdef _PyCollectionStats result = type(self).__new__(type(self))
+        del result.c_collection_stats
+        result.c_collection_stats = c_window_stats
+        return result
+
     def get_num_docs(self):
         return self.c_collection_stats.get_num_docs()
 
+    def get_sampling_rate(self):
+        return self.c_collection_stats.get_sampling_rate()
+
+    def estimate_num_docs(self):
+        """The estimates scale the counts of the sampled documents to the whole collection, see
+        PyCollectionStatsFiller.set_sampling_rate. Each one is an Estimate(value, variance)"""
+        return _estimate(self.c_collection_stats.estimate_num_docs())
+
+    def estimate_stats_term(self, uint32_t pattern_id):
+        cdef EstimatedStatsKey stats = self.c_collection_stats.estimate_stats_key(pattern_id)
+        return EstimatedStatsTerm(_estimate(stats.document_frequency), _estimate(stats.frequency))
+
+    def estimate_stats_term_pair(self, uint32_t pattern_id1, uint32_t pattern_id2, size_t window_index=0):
+        cdef EstimatedStatsKeyPair stats = self.c_collection_stats.estimate_stats_key_pair(pattern_id1, pattern_id2, window_index)
+        return EstimatedStatsTermPair(_estimate(stats.document_frequency), _estimate(stats.window_document_frequency), _estimate(stats.window_frequency))
+
+    def estimate_stats_term_triple(self, uint32_t pattern_id1, uint32_t pattern_id2, uint32_t pattern_id3, size_t window_index=0):
+        cdef EstimatedStatsKeyTriple stats = self.c_collection_stats.estimate_stats_key_triple(pattern_id1, pattern_id2, pattern_id3, window_index)
+        return EstimatedStatsTermTriple(_estimate(stats.document_frequency), _estimate(stats.window_document_frequency), _estimate(stats.window_frequency))
+
     def get_term_frequency_sum(self):
         return self.c_collection_stats.get_key_frequency_sum()
 
-    def get_term_pair_window_co_occ_sum(self):
-        return self.c_collection_stats.get_key_pair_window_co_occ_sum()
+    def get_term_pair_window_co_occ_sum(self, size_t window_index=0):
+        return self.c_collection_stats.get_key_pair_window_co_occ_sum(window_index)
 
-    def get_term_triple_window_co_occ_sum(self):
-        return self.c_collection_stats.get_key_triple_window_co_occ_sum()
+    def get_term_triple_window_co_occ_sum(self, size_t window_index=0):
+        return self.c_collection_stats.get_key_triple_window_co_occ_sum(window_index)
 
     def get_num_terms(self):
         return self.c_collection_stats.get_num_keys()
@@ -89,6 +159,8 @@ cdef class _PyCollectionStats:
         return self.c_collection_stats.get_num_key_triples()
 
     def update(self, _PyCollectionStats other):
+        if self.c_snapshot.get() != NULL:
+            raise RuntimeError("A snapshot is read-only")
         self.c_collection_stats.update(dereference(other.c_collection_stats))
 
     def dump(self, str filename):
@@ -99,6 +171,18 @@ cdef class _PyCollectionStats:
         self.c_collection_stats.dumps(&ss)
         return ss.str()
 
+    def dump_compressed(self, str filename, uint32_t num_threads=0):
+        """Dump in the compressed format, which also keeps the additional windows and the sampling"""
+        cdef string _filename = filename
+        with nogil:
+            self.c_collection_stats.dump_compressed(_filename, num_threads)
+
+    def dumps_compressed(self, uint32_t num_threads=0):
+        cdef ostringstream ss
+        with nogil:
+            self.c_collection_stats.dumps_compressed(&ss, num_threads)
+        return ss.str()
+
 #    @staticmethod
 #    def load(str filename):
 #        return _PyCollectionStats(filename=filename)
@@ -108,6 +192,30 @@ cdef class _PyCollectionStats:
 #        return _PyCollectionStats(dump_str=dump_str)
 
 
+cdef WorkerPlacement _worker_placement(str worker_placement) except *:
+    if worker_placement == "none":
+        return WORKER_PLACEMENT_NONE
+    elif worker_placement == "core":
+        return WORKER_PLACEMENT_CORE
+    elif worker_placement == "node":
+        return WORKER_PLACEMENT_NODE
+    raise ValueError("worker_placement must be one between 'none', 'core' and 'node'")
+
+
+cdef class PyFlushHandle:
+    """Waitable handle of an asynchronous flush of a filler"""
+    cdef FlushFuture c_future
+
+    def done(self):
+        return is_future_ready(self.c_future)
+
+    def wait(self):
+        """Wait for the flush without holding the GIL, and raise its error if any"""
+        with nogil:
+            self.c_future.wait()
+            self.c_future.get()
+
+
 cdef class _PyCollectionStatsFiller:
     def __cinit__(
             self,
@@ -116,14 +224,23 @@ cdef class _PyCollectionStatsFiller:
             size_t buffer_size_in_bytes,
             uint32_t num_threads,
             uint32_t queue_max_size,
+            str worker_placement="none",
+            bint node_local_stats=False,
     ):
+        """worker_placement is one between "none", "core" and "node"; node_local_stats keeps a partition of the
+        stats for each NUMA node, merged into collection_stats by flush"""
+        cdef WorkerPlacement c_worker_placement = _worker_placement(worker_placement)
+
         self.c_collection_stats_filler = new CollectionStatsFiller[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE, CSF_BUFFERED_WORKER_TYPE, CSF_BUFFERED_COLLECTOR_TYPE](
             collection_stats.c_collection_stats,
             pattern_matcher.c_matcher,
             buffer_size_in_bytes,
             num_threads,
-            queue_max_size
+            queue_max_size,
+            c_worker_placement,
+            node_local_stats
         )
+        self.collection_stats_type = type(collection_stats)
 
     def __dealloc__(self):
         del self.c_collection_stats_filler
@@ -141,10 +258,82 @@ cdef class _PyCollectionStatsFiller:
         for i in range(len(doc_fields)):
             c_doc_fields.push_back(doc_fields[i])
 
-        # update call
-        self.c_collection_stats_filler.update(
-            c_doc_fields
-        )
+        # update call, it can wait for a slot in the queue
+        with nogil:
+            self.c_collection_stats_filler.update(
+                c_doc_fields
+            )
+
+    @cython.boundscheck(False)
+    def remove(
+            self,
+            list doc_fields
+    ):
+        """Subtract a document previously given to update, passing the same fields.
+        The removal waits for the pending updates of the same document, a removal from empty stats is ignored"""
+        if len(doc_fields) == 0:
+            return
+        cdef vector[string] c_doc_fields
+
+        # fill the vector
+        for i in range(len(doc_fields)):
+            c_doc_fields.push_back(doc_fields[i])
+
+        # remove call, it can wait for a slot in the queue
+        with nogil:
+            self.c_collection_stats_filler.remove(
+                c_doc_fields
+            )
 
     def flush(self):
-        self.c_collection_stats_filler.flush()
+        with nogil:
+            self.c_collection_stats_filler.flush()
+
+    def flush_async(self):
+        """Flush on a separate thread while this thread can keep calling update, return a PyFlushHandle"""
+        cdef PyFlushHandle handle = PyFlushHandle.__new__(PyFlushHandle)
+        handle.c_future = self.c_collection_stats_filler.flush_async()
+        return handle
+
+    def get_num_threads(self):
+        return self.c_collection_stats_filler.get_num_threads()
+
+    def set_num_threads(self, uint32_t num_threads):
+        """Add or remove workers, the removed ones exit after the documents already queued"""
+        with nogil:
+            self.c_collection_stats_filler.set_num_threads(num_threads)
+
+    cdef _wrap_snapshot(self, shared_ptr[CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE]] c_snapshot):
+        if c_snapshot.get() == NULL:
+            return None
+        cdef _PyCollectionStats result = self.collection_stats_type.__new__(self.collection_stats_type)
+        del result.c_collection_stats
+        result.c_snapshot = c_snapshot
+        result.c_collection_stats = c_snapshot.get()
+        return result
+
+    def publish_snapshot(self):
+        with nogil:
+            self.c_collection_stats_filler.publish_snapshot()
+
+    def snapshot(self):
+        """Return a read-only copy of the statistics that can be queried while the filler is running"""
+        cdef shared_ptr[CollectionStats[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CS_RESTRICTED_TYPE]] c_snapshot
+        with nogil:
+            c_snapshot = self.c_collection_stats_filler.snapshot()
+        return self._wrap_snapshot(c_snapshot)
+
+    def get_published_snapshot(self):
+        """Return the last published read-only copy of the statistics, or None"""
+        return self._wrap_snapshot(self.c_collection_stats_filler.get_published_snapshot())
+
+    def set_snapshot_interval(self, document_frequency_t num_docs):
+        self.c_collection_stats_filler.set_snapshot_interval(num_docs)
+
+    def set_sampling_rate(self, double sampling_rate, uint64_t sampling_seed=0):
+        """Count only a deterministic sample of the documents, to be called before the first document"""
+        self.c_collection_stats_filler.set_sampling_rate(sampling_rate, sampling_seed)
+
+    def set_field_chunk_size(self, size_t num_matches):
+        """Split the fields with more than num_matches matches among the idle workers, 0 disables the splitting"""
+        self.c_collection_stats_filler.set_field_chunk_size(num_matches)
@@ -4,6 +4,8 @@ include "_collection_stats.pyx"
 
 cdef class PyCollectionStats(_PyCollectionStats):
     def update(self, PyCollectionStats other):
+        if self.c_snapshot.get() != NULL:
+            raise RuntimeError("A snapshot is read-only")
         self.c_collection_stats.update(dereference(other.c_collection_stats))
 
     @staticmethod
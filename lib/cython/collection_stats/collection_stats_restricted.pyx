@@ -4,6 +4,8 @@ include "_collection_stats.pyx"
 
 cdef class PyCollectionStatsRestricted(_PyCollectionStats):
     def update(self, PyCollectionStatsRestricted other):
+        if self.c_snapshot.get() != NULL:
+            raise RuntimeError("A snapshot is read-only")
         self.c_collection_stats.update(dereference(other.c_collection_stats))
 
     @staticmethod
@@ -31,3 +33,91 @@ cdef class PyCollectionStatsRestrictedFiller(_PyCollectionStatsFiller):
             _second = second
             _third = third
             self.c_collection_stats_filler.add_restriction(first, _second, _third)
+
+
+cdef class PyCollectionStatsRestrictedMultiFiller:
+    """
+    Filler of several PyCollectionStatsRestricted that matches and enumerates each document once, the restrictions of
+    each collection stats are added with its index. The collection stats are updated only by flush
+    """
+    cdef CollectionStatsMultiFiller[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CSF_BUFFERED_WORKER_TYPE, CSF_BUFFERED_COLLECTOR_TYPE] * c_multi_filler
+    cdef list collection_stats
+
+    def __cinit__(
+            self,
+            list collection_stats,
+            PyPatternMatcher pattern_matcher,
+            size_t buffer_size_in_bytes,
+            uint32_t num_threads,
+            uint32_t queue_max_size,
+            str worker_placement="none",
+            bint node_local_stats=False,
+    ):
+        cdef vector[CollectionStatsPtr] c_collection_stats
+        cdef PyCollectionStatsRestricted stats
+        for stats in collection_stats:
+            if stats.c_snapshot.get() != NULL:
+                raise RuntimeError("A snapshot is read-only")
+            c_collection_stats.push_back(stats.c_collection_stats)
+
+        self.c_multi_filler = new CollectionStatsMultiFiller[uint32_t, CSF_DISABLE_UNWINDOWED_TYPE, CSF_BUFFERED_WORKER_TYPE, CSF_BUFFERED_COLLECTOR_TYPE](
+            c_collection_stats,
+            pattern_matcher.c_matcher,
+            buffer_size_in_bytes,
+            num_threads,
+            queue_max_size,
+            _worker_placement(worker_placement),
+            node_local_stats
+        )
+        # the collection stats must outlive the filler
+        self.collection_stats = list(collection_stats)
+
+    def __dealloc__(self):
+        del self.c_multi_filler
+
+    def get_num_collection_stats(self):
+        return self.c_multi_filler.get_num_tenants()
+
+    def add_restriction(self, size_t index, size_t first, second=None, third=None):
+        assert first is not None
+        assert third is None or second is not None
+
+        cdef size_t _second
+        cdef size_t _third
+
+        if second is None:
+            self.c_multi_filler.add_restriction(index, first)
+        elif third is None:
+            _second = second
+            self.c_multi_filler.add_restriction(index, first, _second)
+        else:
+            _second = second
+            _third = third
+            self.c_multi_filler.add_restriction(index, first, _second, _third)
+
+    def get_num_threads(self):
+        return self.c_multi_filler.get_num_threads()
+
+    def set_num_threads(self, uint32_t num_threads):
+        with nogil:
+            self.c_multi_filler.set_num_threads(num_threads)
+
+    def update(self, list doc_fields):
+        if len(doc_fields) == 0:
+            return
+        cdef vector[string] c_doc_fields = doc_fields
+        with nogil:
+            self.c_multi_filler.update(c_doc_fields)
+
+    def remove(self, list doc_fields):
+        """Subtract a document previously given to update, passing the same fields.
+        The removal waits for the pending updates of the same document, a removal from empty stats is ignored"""
+        if len(doc_fields) == 0:
+            return
+        cdef vector[string] c_doc_fields = doc_fields
+        with nogil:
+            self.c_multi_filler.remove(c_doc_fields)
+
+    def flush(self):
+        with nogil:
+            self.c_multi_filler.flush()
@@ -1,10 +1,14 @@
 #include <assert.h>
+#include <chrono>
+#include <cmath>
+#include <functional>
 #include <sstream>
 #include <sys/time.h>
 #include "buffered_stream/BufferedReader.hpp"
 #include "buffered_stream/BufferedWriter.hpp"
 #include "pattern_matching/PatternMatcher.hpp"
 #include "CollectionStats.hpp"
+#include "CollectionStatsCache.hpp"
 
 
 template<typename T=uint32_t>
@@ -451,11 +455,1325 @@ void testCollectionStats() {
 }
 
 
+template<bool B_BUFFERED_WORKER, bool B_BUFFERED_COLLECTOR, typename T=uint16_t>
+void testCollectionStatsSnapshot_impl() {
+    using _CollectionStats = CollectionStats<T, false, false>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, false, false, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+
+    PatternMatcher<T> matcher;
+    matcher.add_pattern(0, "a");
+    matcher.add_pattern(1, "b");
+    matcher.add_pattern(2, "c");
+    matcher.compile();
+
+    _CollectionStats stats(12, 15);
+    _CollectionStatsFiller filler(&stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2);
+    assert(!filler.get_published_snapshot());
+
+    // the snapshot of an empty collection is empty
+    std::shared_ptr<_CollectionStats> empty_snapshot = filler.snapshot();
+    assert(empty_snapshot->get_num_docs() == 0);
+    assert(filler.get_published_snapshot() == empty_snapshot);
+
+    // concurrent readers must always see whole documents
+    filler.set_snapshot_interval(3);
+    std::atomic<bool> reading(true);
+    std::thread reader([&filler, &reading]() {
+        while (reading) {
+            std::shared_ptr<_CollectionStats> snapshot = filler.get_published_snapshot();
+            if (snapshot) {
+                document_frequency_t num_docs = snapshot->get_num_docs();
+                assert(snapshot->get_stats_key(0).document_frequency == num_docs);
+                assert(snapshot->get_stats_key(0).frequency == 2 * num_docs);
+                assert(snapshot->get_stats_key_pair(0, 1).window_frequency == 4 * num_docs);
+                assert(snapshot->get_stats_key_triple(0, 1, 2).document_frequency == num_docs);
+            }
+        }
+    });
+    for (size_t i = 0; i < 100; ++i) {
+        filler.update({"a b c a b"});
+    }
+    filler.flush();
+    reading = false;
+    reader.join();
+
+    std::shared_ptr<_CollectionStats> snapshot = filler.snapshot();
+    assert(snapshot->get_num_docs() == 100);
+    assert(snapshot->get_num_keys() == stats.get_num_keys());
+    assert(snapshot->get_num_key_pairs() == stats.get_num_key_pairs());
+    assert(snapshot->get_num_key_triples() == stats.get_num_key_triples());
+    assert(snapshot->get_key_frequency_sum() == stats.get_key_frequency_sum());
+    assert(snapshot->get_key_pair_window_co_occ_sum() == stats.get_key_pair_window_co_occ_sum());
+    assert(snapshot->get_key_triple_window_co_occ_sum() == stats.get_key_triple_window_co_occ_sum());
+
+    // nothing changed, hence the same snapshot is returned
+    assert(filler.snapshot() == snapshot);
+
+    // the snapshot is not affected by the following updates
+    filler.update({"a"});
+    filler.flush();
+    assert(snapshot->get_num_docs() == 100);
+    assert(filler.snapshot()->get_num_docs() == 101);
+    assert(empty_snapshot->get_num_docs() == 0);
+}
+
+
+void testCollectionStatsSnapshot() {
+    testCollectionStatsSnapshot_impl<false, false>();
+    testCollectionStatsSnapshot_impl<true, false>();
+    testCollectionStatsSnapshot_impl<false, true>();
+    testCollectionStatsSnapshot_impl<true, true>();
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED, typename T>
+void _test_testCollectionStatsEqual(
+        const CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED> &stats1,
+        const CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED> &stats2,
+        const T num_keys,
+        const bool check_min_dist = true
+) {
+    assert(stats1.get_num_docs() == stats2.get_num_docs());
+    assert(stats1.get_num_keys() == stats2.get_num_keys());
+    assert(stats1.get_num_key_pairs() == stats2.get_num_key_pairs());
+    assert(stats1.get_num_key_triples() == stats2.get_num_key_triples());
+    assert(stats1.get_key_frequency_sum() == stats2.get_key_frequency_sum());
+    assert(stats1.get_key_pair_window_co_occ_sum() == stats2.get_key_pair_window_co_occ_sum());
+    assert(stats1.get_key_triple_window_co_occ_sum() == stats2.get_key_triple_window_co_occ_sum());
+
+    for (T i = 0; i < num_keys; ++i) {
+        const StatsKey statsKey1 = stats1.get_stats_key(i);
+        const StatsKey statsKey2 = stats2.get_stats_key(i);
+        assert(statsKey1.document_frequency == statsKey2.document_frequency);
+        assert(statsKey1.frequency == statsKey2.frequency);
+        assert(statsKey1.frequency_square == statsKey2.frequency_square);
+
+        for (T j = i; j < num_keys; ++j) {
+            const StatsKeyPair statsKeyPair1 = stats1.get_stats_key_pair(i, j);
+            const StatsKeyPair statsKeyPair2 = stats2.get_stats_key_pair(i, j);
+            assert(statsKeyPair1.document_frequency == statsKeyPair2.document_frequency);
+            assert(statsKeyPair1.window_document_frequency == statsKeyPair2.window_document_frequency);
+            assert(statsKeyPair1.window_frequency == statsKeyPair2.window_frequency);
+            assert(statsKeyPair1.window_frequency_square == statsKeyPair2.window_frequency_square);
+            assert(!check_min_dist || statsKeyPair1.window_min_dist == statsKeyPair2.window_min_dist);
+
+            for (T k = j; k < num_keys; ++k) {
+                const StatsKeyTriple statsKeyTriple1 = stats1.get_stats_key_triple(i, j, k);
+                const StatsKeyTriple statsKeyTriple2 = stats2.get_stats_key_triple(i, j, k);
+                assert(statsKeyTriple1.document_frequency == statsKeyTriple2.document_frequency);
+                assert(statsKeyTriple1.window_document_frequency == statsKeyTriple2.window_document_frequency);
+                assert(statsKeyTriple1.window_frequency == statsKeyTriple2.window_frequency);
+                assert(statsKeyTriple1.window_frequency_square == statsKeyTriple2.window_frequency_square);
+                assert(!check_min_dist || statsKeyTriple1.window_min_dist == statsKeyTriple2.window_min_dist);
+            }
+        }
+    }
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED, bool B_BUFFERED_WORKER, bool B_BUFFERED_COLLECTOR, typename T=uint16_t>
+void testCollectionStatsRemove_impl() {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, B_RESTRICTED, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+
+    PatternMatcher<T> matcher;
+    matcher.add_pattern(0, "a");
+    matcher.add_pattern(1, "b");
+    matcher.add_pattern(2, "c");
+    matcher.add_pattern(3, "d");
+    matcher.compile();
+
+    const std::vector<std::string> kept_docs({"a b c d a", "d c b", "a a a", "b x c x d"});
+    const std::vector<std::string> removed_docs({"a b c", "d d c b a", "x"});
+
+    auto add_restrictions = [](_CollectionStatsFiller &filler) {
+        if (B_RESTRICTED) {
+            for (T i = 0; i < 4; ++i) {
+                filler.add_restriction(i);
+                filler.add_restriction(i, (i + 1) % 4);
+                filler.add_restriction(i, (i + 1) % 4, (i + 2) % 4);
+            }
+        }
+    };
+
+    _CollectionStats expected_stats(4, 5);
+    _CollectionStats stats(4, 5);
+    _CollectionStats empty_stats(4, 5);
+    {
+        _CollectionStatsFiller expected_filler(&expected_stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2);
+        _CollectionStatsFiller filler(&stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2);
+        _CollectionStatsFiller empty_filler(&empty_stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2);
+        add_restrictions(expected_filler);
+        add_restrictions(filler);
+        add_restrictions(empty_filler);
+
+        for (const std::string &doc: kept_docs) {
+            expected_filler.update({doc});
+            filler.update({doc});
+        }
+        for (const std::string &doc: removed_docs) {
+            filler.update({doc});
+        }
+        filler.flush();
+        for (const std::string &doc: removed_docs) {
+            filler.remove({doc});
+        }
+    }
+
+    // the removed documents are closer than the kept ones, hence the min distances are only lower bounds
+    _test_testCollectionStatsEqual(expected_stats, stats, (T) 4, false);
+
+    // an interleaved stream removing the document updated one step before, without draining the workers in between
+    _CollectionStats interleaved_stats(4, 5);
+    {
+        _CollectionStatsFiller filler(&interleaved_stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 4);
+        add_restrictions(filler);
+        for (const std::string &doc: kept_docs) {
+            filler.update({doc});
+        }
+        filler.update({removed_docs[0]});
+        for (size_t n = 1; n < 300; ++n) {
+            filler.update({removed_docs[n % removed_docs.size()]});
+            filler.remove({removed_docs[(n - 1) % removed_docs.size()]});
+        }
+        filler.remove({removed_docs[299 % removed_docs.size()]});
+    }
+    _test_testCollectionStatsEqual(expected_stats, interleaved_stats, (T) 4, false);
+
+    // removing everything must lead to an empty collection (but for the restrictions)
+    {
+        _CollectionStatsFiller filler(&stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2);
+        for (const std::string &doc: kept_docs) {
+            filler.remove({doc});
+        }
+    }
+    _test_testCollectionStatsEqual(empty_stats, stats, (T) 4, true);
+
+    // a removal waits for the pending updates, a removal from an empty collection is ignored
+    {
+        _CollectionStatsFiller filler(&stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 4);
+        for (size_t n = 0; n < 50; ++n) {
+            for (const std::string &doc: removed_docs) {
+                filler.update({doc});
+            }
+            for (const std::string &doc: removed_docs) {
+                filler.remove({doc});
+            }
+        }
+        filler.flush();
+        filler.remove({kept_docs[0]});
+    }
+    assert(stats.get_num_docs() == 0);
+    _test_testCollectionStatsEqual(empty_stats, stats, (T) 4, false);
+}
+
+
+void testCollectionStatsRemove() {
+    testCollectionStatsRemove_impl<false, false, false, false>();
+    testCollectionStatsRemove_impl<true, false, false, false>();
+    testCollectionStatsRemove_impl<false, true, false, false>();
+    testCollectionStatsRemove_impl<true, true, false, false>();
+    testCollectionStatsRemove_impl<false, false, true, true>();
+    testCollectionStatsRemove_impl<true, false, true, true>();
+    testCollectionStatsRemove_impl<false, true, true, true>();
+    testCollectionStatsRemove_impl<true, true, true, true>();
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED, bool B_BUFFERED_WORKER, bool B_BUFFERED_COLLECTOR, typename T=uint16_t>
+void testCollectionStatsPlacement_impl(WorkerPlacement worker_placement) {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, B_RESTRICTED, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+
+    PatternMatcher<T> matcher;
+    matcher.add_pattern(0, "a");
+    matcher.add_pattern(1, "b");
+    matcher.add_pattern(2, "c");
+    matcher.add_pattern(3, "d");
+    matcher.compile();
+
+    const std::vector<std::string> docs({"a b c d a", "d c b", "a a a", "b x c x d", "a b c", "d d c b a"});
+
+    auto add_restrictions = [](_CollectionStatsFiller &filler) {
+        if (B_RESTRICTED) {
+            for (T i = 0; i < 4; ++i) {
+                filler.add_restriction(i);
+                filler.add_restriction(i, (i + 1) % 4);
+                filler.add_restriction(i, (i + 1) % 4, (i + 2) % 4);
+            }
+        }
+    };
+
+    _CollectionStats expected_stats(4, 5);
+    _CollectionStats stats(4, 5);
+    {
+        _CollectionStatsFiller expected_filler(&expected_stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 4);
+        _CollectionStatsFiller filler(&stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 4, 1, worker_placement, true);
+        add_restrictions(expected_filler);
+        add_restrictions(filler);
+
+        for (size_t n = 0; n < 10; ++n) {
+            for (const std::string &doc: docs) {
+                expected_filler.update({doc});
+                filler.update({doc});
+            }
+        }
+        expected_filler.flush();
+        filler.flush();
+
+        // the snapshot contains the documents applied to the node-local stats
+        assert(filler.snapshot()->get_num_docs() == 10 * docs.size());
+
+        // the removals see the documents still in the node-local stats
+        expected_filler.update({docs[0]});
+        filler.update({docs[0]});
+        expected_filler.remove({docs[1]});
+        filler.remove({docs[1]});
+    }
+
+    _test_testCollectionStatsEqual(expected_stats, stats, (T) 4, false);
+}
+
+
+void testCollectionStatsPlacement() {
+    testCollectionStatsPlacement_impl<false, false, false, false>(WORKER_PLACEMENT_NONE);
+    testCollectionStatsPlacement_impl<true, false, false, false>(WORKER_PLACEMENT_NODE);
+    testCollectionStatsPlacement_impl<false, true, false, false>(WORKER_PLACEMENT_CORE);
+    testCollectionStatsPlacement_impl<true, true, false, false>(WORKER_PLACEMENT_NODE);
+    testCollectionStatsPlacement_impl<false, false, true, true>(WORKER_PLACEMENT_CORE);
+    testCollectionStatsPlacement_impl<true, false, true, true>(WORKER_PLACEMENT_NODE);
+    testCollectionStatsPlacement_impl<false, true, true, true>(WORKER_PLACEMENT_NONE);
+    testCollectionStatsPlacement_impl<true, true, true, true>(WORKER_PLACEMENT_NODE);
+}
+
+
+void testRecordArena() {
+    RecordArena<KeyPair<uint32_t>> arena(2);
+    for (uint32_t i = 0; i < 1000; ++i) {
+        arena.push_back(KeyPair<uint32_t>(1000 - i, i));
+    }
+    assert(arena.size() == 1000);
+    std::sort(arena.begin(), arena.end(), std::less<KeyPair<uint32_t>>());
+    for (uint32_t i = 1; i < 1000; ++i) {
+        assert(!std::less<KeyPair<uint32_t>>()(arena[i], arena[i - 1]));
+    }
+
+    // the records are kept across clear, and the arena stays usable after shrinking
+    for (size_t doc = 0; doc < 200; ++doc) {
+        arena.clear();
+        assert(arena.size() == 0);
+        arena.push_back(KeyPair<uint32_t>(1, 2));
+    }
+    assert(arena.size() == 1);
+    assert(arena[0].first() == 1 && arena[0].second() == 2);
+}
+
+
+void testLocalStatsTable() {
+    LocalStatsTable<KeyPair<uint32_t>, size_t> table(2);
+    for (size_t doc = 0; doc < 5; ++doc) {
+        // the keys of the previous documents must not be found after clear, also when the table grows
+        std::unordered_map<KeyPair<uint32_t>, size_t> expected;
+        for (uint32_t i = 0; i < 300 * (doc + 1); ++i) {
+            const KeyPair<uint32_t> keyPair(i % 97 + doc, i % 13);
+            auto entry = table.insert({keyPair, 1});
+            if (!entry.second) {
+                entry.first->second += 1;
+            }
+            expected[keyPair] += 1;
+        }
+        assert(table.size() == expected.size());
+        for (const auto &entry: table) {
+            assert(expected.at(entry.first) == entry.second);
+        }
+        for (const auto &entry: expected) {
+            assert(table.find(entry.first) != nullptr && table.find(entry.first)->second == entry.second);
+        }
+        assert(table.find(KeyPair<uint32_t>(1000, 1000)) == nullptr);
+        table.clear();
+        assert(table.size() == 0 && table.begin() == table.end());
+        assert(table.find(expected.begin()->first) == nullptr);
+    }
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED, typename T=uint16_t>
+void testCollectionStatsCache_impl() {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, B_RESTRICTED, false, false>;
+
+    PatternMatcher<T> matcher;
+    for (T i = 0; i < 6; ++i) {
+        matcher.add_pattern(i, std::string(1, 'a' + i));
+    }
+    matcher.compile();
+
+    _CollectionStats stats(4, 5);
+    {
+        _CollectionStatsFiller filler(&stats, &matcher, 0, 2);
+        if (B_RESTRICTED) {
+            for (T i = 0; i < 6; ++i) {
+                filler.add_restriction(i);
+                filler.add_restriction(i, (i + 1) % 6);
+                filler.add_restriction(i, (i + 1) % 6, (i + 2) % 6);
+            }
+        }
+        for (const std::string &doc: std::vector<std::string>({"a b c d e f", "f e d", "a a b", "c x d x e", "b c f a", "e e a c"})) {
+            filler.update({doc});
+        }
+        filler.flush();
+    }
+
+    // a small capacity forces the evictions
+    CollectionStatsCache<T, B_DISABLE_UNWINDOWED, B_RESTRICTED> cache(&stats, 32, 32);
+    auto check = [&]() {
+        for (T i = 0; i < 6; ++i) {
+            for (T j = 0; j < 6; ++j) {
+                StatsKeyPair expected_pair = stats.get_stats_key_pair(i, j);
+                StatsKeyPair pair = cache.get_stats_key_pair(j, i);
+                assert(expected_pair.document_frequency == pair.document_frequency);
+                assert(expected_pair.window_frequency == pair.window_frequency);
+                assert(expected_pair.window_min_dist == pair.window_min_dist);
+                for (T k = 0; k < 6; ++k) {
+                    StatsKeyTriple expected_triple = stats.get_stats_key_triple(i, j, k);
+                    StatsKeyTriple triple = cache.get_stats_key_triple(k, i, j);
+                    assert(expected_triple.document_frequency == triple.document_frequency);
+                    assert(expected_triple.window_frequency == triple.window_frequency);
+                    assert(expected_triple.window_min_dist == triple.window_min_dist);
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 4; ++i) {
+        threads.emplace_back(check);
+    }
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+    assert(cache.size() <= 64);
+    assert(cache.get_hits() > 0);
+    assert(cache.get_hits() + cache.get_misses() == 4 * (6 * 6 + 6 * 6 * 6));
+
+    cache.clear();
+    assert(cache.size() == 0 && cache.get_hits() == 0 && cache.get_misses() == 0);
+    check();
+}
+
+
+void testCollectionStatsCache() {
+    testCollectionStatsCache_impl<false, false>();
+    testCollectionStatsCache_impl<true, false>();
+    testCollectionStatsCache_impl<false, true>();
+    testCollectionStatsCache_impl<true, true>();
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED, bool B_BUFFERED_WORKER, bool B_BUFFERED_COLLECTOR, typename T=uint16_t>
+void testCollectionStatsWindows_impl(bool node_local_stats) {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, B_RESTRICTED, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+
+    PatternMatcher<T> matcher;
+    matcher.add_pattern(0, "a");
+    matcher.add_pattern(1, "b");
+    matcher.add_pattern(2, "cc");
+    matcher.add_pattern(3, "d d");
+    matcher.compile();
+
+    const std::vector<std::string> docs({"a b cc d d a", "d d cc b", "a a a", "b x cc x d d", "a b cc", "d d d d cc b a"});
+    const std::vector<distance_t> pair_windows({3, 9, 5, 7});
+    const std::vector<distance_t> triple_windows({11, 6});
+
+    auto add_restrictions = [](_CollectionStatsFiller &filler) {
+        if (B_RESTRICTED) {
+            for (T i = 0; i < 4; ++i) {
+                filler.add_restriction(i);
+                filler.add_restriction(i, (i + 1) % 4);
+                filler.add_restriction(i, (i + 1) % 4, (i + 2) % 4);
+            }
+        }
+    };
+    auto fill = [&](_CollectionStats &stats) {
+        _CollectionStatsFiller filler(&stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2, 1,
+                                      WORKER_PLACEMENT_NONE, node_local_stats);
+        add_restrictions(filler);
+        for (const std::string &doc: docs) {
+            filler.update({doc});
+        }
+        // the removals must subtract the additional windows too
+        filler.flush();
+        filler.remove({docs[0]});
+        filler.update({docs[0]});
+    };
+
+    _CollectionStats stats(pair_windows, triple_windows);
+    fill(stats);
+    assert(stats.window_size_key_pairs_co_occ == 9 && stats.window_sizes_key_pairs_co_occ.size() == 4);
+    assert(stats.window_size_key_triples_co_occ == 11 && stats.window_sizes_key_triples_co_occ.size() == 2);
+
+    // each window must be equal to a fill with only that window
+    for (size_t i = 0; i < stats.window_sizes_key_pairs_co_occ.size(); ++i) {
+        for (size_t j = 0; j < stats.window_sizes_key_triples_co_occ.size(); ++j) {
+            _CollectionStats expected_stats(stats.window_sizes_key_pairs_co_occ[i],
+                                            stats.window_sizes_key_triples_co_occ[j]);
+            fill(expected_stats);
+
+            std::unique_ptr<_CollectionStats> window_stats(stats.get_window_collection_stats(i, j));
+            _test_testCollectionStatsEqual(expected_stats, *window_stats, (T) 4, true);
+
+            assert(expected_stats.get_key_pair_window_co_occ_sum() == stats.get_key_pair_window_co_occ_sum(i));
+            assert(expected_stats.get_key_triple_window_co_occ_sum() == stats.get_key_triple_window_co_occ_sum(j));
+            for (T k = 0; k < 4; ++k) {
+                for (T l = 0; l < 4; ++l) {
+                    assert(expected_stats.get_stats_key_pair(k, l).window_frequency ==
+                           stats.get_stats_key_pair(k, l, i).window_frequency);
+                    assert(expected_stats.get_stats_key_triple(k, l, 1).window_frequency ==
+                           stats.get_stats_key_triple(k, l, 1, j).window_frequency);
+                }
+            }
+        }
+    }
+
+    // only the collection stats of a single window can be serialized
+    std::stringstream sstream;
+    try {
+        stats.dumps(&sstream);
+        assert(false);
+    } catch (const std::runtime_error &) {}
+}
+
+
+void testCollectionStatsWindows() {
+    testCollectionStatsWindows_impl<false, false, false, false>(false);
+    testCollectionStatsWindows_impl<true, false, false, false>(true);
+    testCollectionStatsWindows_impl<false, true, false, false>(false);
+    testCollectionStatsWindows_impl<true, true, false, false>(true);
+    testCollectionStatsWindows_impl<false, false, true, true>(true);
+    testCollectionStatsWindows_impl<true, false, true, true>(false);
+    testCollectionStatsWindows_impl<false, true, true, true>(true);
+    testCollectionStatsWindows_impl<true, true, true, true>(false);
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_BUFFERED_WORKER, bool B_BUFFERED_COLLECTOR, typename T=uint16_t>
+void testCollectionStatsMultiFiller_impl() {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, true>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, true, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+    using _CollectionStatsMultiFiller = CollectionStatsMultiFiller<T, B_DISABLE_UNWINDOWED, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+
+    PatternMatcher<T> matcher;
+    matcher.add_pattern(0, "a");
+    matcher.add_pattern(1, "b");
+    matcher.add_pattern(2, "cc");
+    matcher.add_pattern(3, "d d");
+    matcher.compile();
+
+    const std::vector<std::string> docs({"a b cc d d a", "d d cc b", "a a a", "b x cc x d d", "a b cc", "d d d d cc b a"});
+    const std::vector<distance_t> pair_windows({3, 7});
+    const std::vector<distance_t> triple_windows({9, 5});
+
+    // the restrictions of the tenants overlap, and some of them have repeated keys
+    const size_t num_tenants = 3;
+    auto add_restrictions = [](size_t tenant, std::function<void(const std::vector<T> &)> add_restriction) {
+        for (T i = 0; i < 4; ++i) {
+            if ((i + tenant) % 2 == 0) {
+                add_restriction({i});
+            }
+            add_restriction({i, (T) ((i + tenant) % 4)});
+            if (tenant != 1) {
+                add_restriction({i, (T) ((i + 1) % 4), (T) ((i + tenant) % 4)});
+            }
+        }
+    };
+    auto apply_documents = [&](std::function<void(const std::string &, bool)> apply, std::function<void()> flush) {
+        for (size_t i = 0; i < docs.size(); ++i) {
+            apply(docs[i], false);
+            if (i == 2) {
+                flush();
+            }
+        }
+        // the removed document has been given to the tenants by the previous flush
+        flush();
+        apply(docs[1], true);
+        apply(docs[0], false);
+    };
+
+    std::vector<std::unique_ptr<_CollectionStats>> tenants;
+    for (size_t tenant = 0; tenant < num_tenants; ++tenant) {
+        tenants.emplace_back(new _CollectionStats(pair_windows, triple_windows));
+    }
+    {
+        std::vector<_CollectionStats *> tenant_pointers;
+        for (auto &tenant: tenants) {
+            tenant_pointers.push_back(tenant.get());
+        }
+        _CollectionStatsMultiFiller filler(tenant_pointers, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2);
+        assert(filler.get_num_tenants() == num_tenants);
+        for (size_t tenant = 0; tenant < num_tenants; ++tenant) {
+            add_restrictions(tenant, [&](const std::vector<T> &keys) {
+                if (keys.size() == 1) {
+                    filler.add_restriction(tenant, keys[0]);
+                } else if (keys.size() == 2) {
+                    filler.add_restriction(tenant, keys[0], keys[1]);
+                } else {
+                    filler.add_restriction(tenant, keys[0], keys[1], keys[2]);
+                }
+            });
+        }
+        apply_documents([&](const std::string &doc, bool removal) {
+            if (removal) {
+                filler.remove({doc});
+            } else {
+                filler.update({doc});
+            }
+        }, [&]() { filler.flush(); });
+    }
+
+    // each tenant must be equal to the one filled alone
+    for (size_t tenant = 0; tenant < num_tenants; ++tenant) {
+        assert(tenants[tenant]->get_num_docs() == docs.size());
+        _CollectionStats expected_stats(pair_windows, triple_windows);
+        {
+            _CollectionStatsFiller filler(&expected_stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2);
+            add_restrictions(tenant, [&](const std::vector<T> &keys) {
+                if (keys.size() == 1) {
+                    filler.add_restriction(keys[0]);
+                } else if (keys.size() == 2) {
+                    filler.add_restriction(keys[0], keys[1]);
+                } else {
+                    filler.add_restriction(keys[0], keys[1], keys[2]);
+                }
+            });
+            apply_documents([&](const std::string &doc, bool removal) {
+                if (removal) {
+                    filler.remove({doc});
+                } else {
+                    filler.update({doc});
+                }
+            }, [&]() { filler.flush(); });
+        }
+
+        for (size_t i = 0; i < pair_windows.size(); ++i) {
+            for (size_t j = 0; j < triple_windows.size(); ++j) {
+                std::unique_ptr<_CollectionStats> expected_window_stats(expected_stats.get_window_collection_stats(i, j));
+                std::unique_ptr<_CollectionStats> window_stats(tenants[tenant]->get_window_collection_stats(i, j));
+                _test_testCollectionStatsEqual(*expected_window_stats, *window_stats, (T) 4, true);
+            }
+        }
+    }
+
+    // the flushes concurrent with the updates of another thread must neither lose nor route twice any count
+    auto fill_tenants = [&](bool concurrent_flushes) {
+        std::vector<std::unique_ptr<_CollectionStats>> result;
+        std::vector<_CollectionStats *> tenant_pointers;
+        for (size_t tenant = 0; tenant < num_tenants; ++tenant) {
+            result.emplace_back(new _CollectionStats(pair_windows, triple_windows));
+            tenant_pointers.push_back(result.back().get());
+        }
+        _CollectionStatsMultiFiller filler(tenant_pointers, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2);
+        for (size_t tenant = 0; tenant < num_tenants; ++tenant) {
+            add_restrictions(tenant, [&](const std::vector<T> &keys) {
+                if (keys.size() == 1) {
+                    filler.add_restriction(tenant, keys[0]);
+                } else if (keys.size() == 2) {
+                    filler.add_restriction(tenant, keys[0], keys[1]);
+                } else {
+                    filler.add_restriction(tenant, keys[0], keys[1], keys[2]);
+                }
+            });
+        }
+        std::thread producer([&filler, &docs]() {
+            for (size_t round = 0; round < 50; ++round) {
+                for (const std::string &doc: docs) {
+                    filler.update({doc});
+                }
+            }
+        });
+        for (size_t round = 0; concurrent_flushes && round < 50; ++round) {
+            filler.flush();
+        }
+        producer.join();
+        filler.flush();
+        return result;
+    };
+    std::vector<std::unique_ptr<_CollectionStats>> expected_tenants = fill_tenants(false);
+    std::vector<std::unique_ptr<_CollectionStats>> concurrent_tenants = fill_tenants(true);
+    for (size_t tenant = 0; tenant < num_tenants; ++tenant) {
+        assert(concurrent_tenants[tenant]->get_num_docs() == 50 * docs.size());
+        _test_testCollectionStatsEqual(*expected_tenants[tenant], *concurrent_tenants[tenant], (T) 4, true);
+    }
+}
+
+
+void testCollectionStatsMultiFiller() {
+    testCollectionStatsMultiFiller_impl<false, false, false>();
+    testCollectionStatsMultiFiller_impl<true, false, false>();
+    testCollectionStatsMultiFiller_impl<false, true, true>();
+    testCollectionStatsMultiFiller_impl<true, true, true>();
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED, bool B_BUFFERED_WORKER, bool B_BUFFERED_COLLECTOR, typename T=uint16_t>
+void testCollectionStatsFieldChunks_impl() {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, B_RESTRICTED, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+
+    PatternMatcher<T> matcher;
+    matcher.add_pattern(0, "a");
+    matcher.add_pattern(1, "b");
+    matcher.add_pattern(2, "cc");
+    matcher.add_pattern(3, "d d");
+    matcher.compile();
+
+    // long fields with repeated keys and overlapping matches, mixed with short ones
+    const std::vector<std::string> words({"a", "b", "cc", "d", "x"});
+    std::vector<std::vector<std::string>> docs;
+    uint32_t seed = 7;
+    for (size_t i = 0; i < 6; ++i) {
+        std::string field;
+        for (size_t j = 0, len = i % 2 == 0 ? 300 : 4; j < len; ++j) {
+            seed = seed * 1103515245 + 12345;
+            field += (j > 0 ? " " : "") + words[(seed >> 16) % words.size()];
+        }
+        docs.push_back({field, "a b cc d d"});
+    }
+    const std::vector<distance_t> pair_windows({6, 3});
+    const std::vector<distance_t> triple_windows({8, 4});
+
+    auto fill = [&](_CollectionStats &stats, uint32_t num_threads, size_t field_chunk_size) {
+        _CollectionStatsFiller filler(&stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, num_threads, 2);
+        filler.set_field_chunk_size(field_chunk_size);
+        if (B_RESTRICTED) {
+            for (T i = 0; i < 4; ++i) {
+                filler.add_restriction(i);
+                filler.add_restriction(i, (i + 1) % 4);
+                filler.add_restriction(i, (i + 2) % 4, (i + 1) % 4);
+            }
+        }
+        for (const std::vector<std::string> &doc: docs) {
+            filler.update(doc);
+        }
+        filler.flush();
+        filler.remove(docs[0]);
+    };
+
+    _CollectionStats expected_stats(pair_windows, triple_windows);
+    fill(expected_stats, 1, 0);
+
+    // the chunks of the long fields must not change any count or minimum distance
+    for (size_t field_chunk_size: {1, 2, 7, 50}) {
+        _CollectionStats stats(pair_windows, triple_windows);
+        fill(stats, 3, field_chunk_size);
+        for (size_t i = 0; i < pair_windows.size(); ++i) {
+            for (size_t j = 0; j < triple_windows.size(); ++j) {
+                std::unique_ptr<_CollectionStats> expected_window_stats(expected_stats.get_window_collection_stats(i, j));
+                std::unique_ptr<_CollectionStats> window_stats(stats.get_window_collection_stats(i, j));
+                _test_testCollectionStatsEqual(*expected_window_stats, *window_stats, (T) 4, true);
+            }
+        }
+    }
+}
+
+
+void testCollectionStatsFieldChunks() {
+    testCollectionStatsFieldChunks_impl<false, false, false, false>();
+    testCollectionStatsFieldChunks_impl<true, false, false, true>();
+    testCollectionStatsFieldChunks_impl<false, true, true, false>();
+    testCollectionStatsFieldChunks_impl<true, true, true, true>();
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED, bool B_BUFFERED_WORKER, bool B_BUFFERED_COLLECTOR, typename T=uint16_t>
+void testCollectionStatsSampling_impl() {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, B_RESTRICTED, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+
+    PatternMatcher<T> matcher;
+    matcher.add_pattern(0, "a");
+    matcher.add_pattern(1, "b");
+    matcher.add_pattern(2, "cc");
+    matcher.add_pattern(3, "d d");
+    matcher.compile();
+
+    const std::vector<std::string> words({"a", "b", "cc", "d", "x"});
+    std::vector<std::string> docs;
+    uint32_t seed = 11;
+    for (size_t i = 0; i < 2000; ++i) {
+        std::string doc;
+        for (size_t j = 0, len = 1 + i % 9; j < len; ++j) {
+            seed = seed * 1103515245 + 12345;
+            doc += (j > 0 ? " " : "") + words[(seed >> 16) % words.size()];
+        }
+        docs.push_back(doc);
+    }
+
+    auto fill = [&](_CollectionStats &stats, double sampling_rate, uint64_t sampling_seed, bool remove_all) {
+        _CollectionStatsFiller filler(&stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2, 2);
+        filler.set_sampling_rate(sampling_rate, sampling_seed);
+        if (B_RESTRICTED) {
+            for (T i = 0; i < 4; ++i) {
+                filler.add_restriction(i);
+                filler.add_restriction(i, (i + 1) % 4);
+                filler.add_restriction(i, (i + 1) % 4, (i + 2) % 4);
+            }
+        }
+        for (const std::string &doc: docs) {
+            filler.update({doc});
+        }
+        // the sampling cannot change once the documents are counted
+        try {
+            filler.set_sampling_rate(1);
+            assert(false);
+        } catch (const std::runtime_error &) {}
+        if (remove_all) {
+            filler.flush();
+            for (const std::string &doc: docs) {
+                filler.remove({doc});
+            }
+        }
+    };
+
+    _CollectionStats exact_stats;
+    fill(exact_stats, 1, 0, false);
+    _CollectionStats sampled_stats;
+    fill(sampled_stats, 0.25, 3, false);
+    assert(sampled_stats.get_sampling_rate() == 0.25 && sampled_stats.get_sampling_seed() == 3);
+    assert(0 < sampled_stats.get_num_docs() && sampled_stats.get_num_docs() < exact_stats.get_num_docs());
+
+    // the sample depends only on the documents and on the seed
+    _CollectionStats sampled_stats_again;
+    fill(sampled_stats_again, 0.25, 3, false);
+    _test_testCollectionStatsEqual(sampled_stats, sampled_stats_again, (T) 4);
+    _CollectionStats removed_stats;
+    fill(removed_stats, 0.25, 3, true);
+    assert(removed_stats.get_num_docs() == 0);
+
+    // the estimates of the exact stats are exact, the other ones are close to them
+    auto check_estimate = [](const StatsEstimate &estimate, double exact_value, double sampling_rate) {
+        if (sampling_rate == 1) {
+            assert(estimate.value == exact_value && estimate.variance == 0);
+        } else {
+            assert(std::abs(estimate.value - exact_value) <= 4 * std::sqrt(estimate.variance) + 1 / sampling_rate);
+        }
+    };
+    for (const _CollectionStats *stats: {&exact_stats, &sampled_stats}) {
+        const double rate = stats->get_sampling_rate();
+        check_estimate(stats->estimate_num_docs(), exact_stats.get_num_docs(), rate);
+        for (T i = 0; i < 4; ++i) {
+            const EstimatedStatsKey estimatedStatsKey = stats->estimate_stats_key(i);
+            check_estimate(estimatedStatsKey.document_frequency, exact_stats.get_stats_key(i).document_frequency, rate);
+            check_estimate(estimatedStatsKey.frequency, exact_stats.get_stats_key(i).frequency, rate);
+
+            const StatsKeyPair statsKeyPair = exact_stats.get_stats_key_pair(i, (i + 1) % 4);
+            const EstimatedStatsKeyPair estimatedStatsKeyPair = stats->estimate_stats_key_pair(i, (i + 1) % 4);
+            check_estimate(estimatedStatsKeyPair.window_document_frequency, statsKeyPair.window_document_frequency, rate);
+            check_estimate(estimatedStatsKeyPair.window_frequency, statsKeyPair.window_frequency, rate);
+
+            const StatsKeyTriple statsKeyTriple = exact_stats.get_stats_key_triple(i, (i + 1) % 4, (i + 2) % 4);
+            const EstimatedStatsKeyTriple estimatedStatsKeyTriple =
+                    stats->estimate_stats_key_triple(i, (i + 1) % 4, (i + 2) % 4);
+            check_estimate(estimatedStatsKeyTriple.window_frequency, statsKeyTriple.window_frequency, rate);
+        }
+    }
+
+    // the stats of different samples cannot be merged or serialized
+    try {
+        exact_stats.update(sampled_stats);
+        assert(false);
+    } catch (const std::runtime_error &) {}
+    std::stringstream sstream;
+    try {
+        sampled_stats.dumps(&sstream);
+        assert(false);
+    } catch (const std::runtime_error &) {}
+}
+
+
+void testCollectionStatsSampling() {
+    testCollectionStatsSampling_impl<false, false, false, false>();
+    testCollectionStatsSampling_impl<true, false, true, true>();
+    testCollectionStatsSampling_impl<false, true, false, true>();
+    testCollectionStatsSampling_impl<true, true, true, false>();
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED, bool B_BUFFERED_WORKER, bool B_BUFFERED_COLLECTOR, typename T=uint16_t>
+void testCollectionStatsThreads_impl() {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, B_RESTRICTED, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+
+    PatternMatcher<T> matcher;
+    matcher.add_pattern(0, "a");
+    matcher.add_pattern(1, "b");
+    matcher.add_pattern(2, "cc");
+    matcher.add_pattern(3, "d d");
+    matcher.compile();
+
+    const std::vector<std::string> docs({"a b cc d d a", "d d cc b", "a a a", "b x cc x d d", "a b cc", "d d d d cc b a"});
+    auto add_restrictions = [](_CollectionStatsFiller &filler) {
+        if (B_RESTRICTED) {
+            for (T i = 0; i < 4; ++i) {
+                filler.add_restriction(i);
+                filler.add_restriction(i, (i + 1) % 4);
+                filler.add_restriction(i, (i + 1) % 4, (i + 2) % 4);
+            }
+        }
+    };
+
+    _CollectionStats expected_stats;
+    {
+        _CollectionStatsFiller filler(&expected_stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 1, 1);
+        add_restrictions(filler);
+        for (size_t round = 0; round < 20; ++round) {
+            for (const std::string &doc: docs) {
+                filler.update({doc});
+            }
+        }
+    }
+
+    // the workers change and the flushes run while the documents are pushed
+    _CollectionStats stats;
+    {
+        _CollectionStatsFiller filler(&stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 1, 1);
+        add_restrictions(filler);
+        std::vector<std::shared_future<void>> flushes;
+        for (size_t round = 0; round < 20; ++round) {
+            filler.set_num_threads(1 + (round * 7) % 4);
+            assert(filler.get_num_threads() == 1 + (round * 7) % 4);
+            for (const std::string &doc: docs) {
+                filler.update({doc});
+            }
+            flushes.push_back(filler.flush_async());
+        }
+        for (std::shared_future<void> &flush: flushes) {
+            flush.get();
+        }
+        filler.flush_async().get();
+        _test_testCollectionStatsEqual(expected_stats, stats, (T) 4);
+    }
+    _test_testCollectionStatsEqual(expected_stats, stats, (T) 4);
+}
+
+
+void testCollectionStatsThreads() {
+    testCollectionStatsThreads_impl<false, false, false, false>();
+    testCollectionStatsThreads_impl<true, false, true, true>();
+    testCollectionStatsThreads_impl<false, true, false, true>();
+    testCollectionStatsThreads_impl<true, true, true, false>();
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED, typename T=uint16_t>
+void testCollectionStatsCompressedDump_impl() {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, B_RESTRICTED, false, false>;
+
+    // enough keys to have several blocks of triples
+    const T num_keys = 48;
+    PatternMatcher<T> matcher;
+    for (T i = 0; i < num_keys; ++i) {
+        matcher.add_pattern(i, "w" + std::to_string(i));
+    }
+    matcher.compile();
+
+    std::vector<std::string> docs;
+    uint64_t state = 7;
+    for (size_t i = 0; i < 300; ++i) {
+        std::string doc;
+        for (size_t j = 0; j < 40; ++j) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            doc += (j > 0 ? " w" : "w") + std::to_string((state >> 33) % (num_keys + 8));
+        }
+        docs.push_back(doc);
+    }
+
+    _CollectionStats stats(std::vector<distance_t>({8, 3}), std::vector<distance_t>({10, 4}));
+    {
+        _CollectionStatsFiller filler(&stats, &matcher, 0, 2, 2);
+        filler.set_sampling_rate(0.5, 11);
+        if (B_RESTRICTED) {
+            for (T i = 0; i < num_keys; i += 2) {
+                filler.add_restriction(i);
+                filler.add_restriction(i, (i + 1) % num_keys);
+                filler.add_restriction(i, (i + 1) % num_keys, (i + 3) % num_keys);
+            }
+        }
+        for (const std::string &doc: docs) {
+            filler.update({doc});
+        }
+    }
+    assert(B_RESTRICTED || stats.get_num_key_triples() > StatsArchive::BLOCK_NUM_ENTRIES);
+
+    // the windows and the sampling are kept, whatever the number of threads
+    std::stringstream sstream;
+    stats.dumps_compressed(&sstream, 3);
+    const std::string compressed = sstream.str();
+    const size_t raw_size = stats.get_num_keys() * (sizeof(T) + sizeof(StatsKey)) +
+                            stats.get_num_key_pairs() * (sizeof(KeyPair<T>) + sizeof(StatsKeyPair)) +
+                            stats.get_num_key_triples() * (sizeof(KeyTriple<T>) + sizeof(StatsKeyTriple));
+    assert(compressed.size() < raw_size);
+
+    const std::string filename = "/tmp/testCollectionStatsCompressedDump.bin";
+    stats.dump_compressed(filename, 1);
+    for (uint32_t num_threads: {1u, 4u, 0u}) {
+        std::unique_ptr<_CollectionStats> loaded(
+                num_threads == 0 ? _CollectionStats::loads(&sstream) : _CollectionStats::load(filename, num_threads));
+        sstream.clear();
+        sstream.seekg(0);
+        assert(loaded->get_sampling_rate() == 0.5 && loaded->get_sampling_seed() == 11);
+        assert(loaded->window_sizes_key_pairs_co_occ == stats.window_sizes_key_pairs_co_occ);
+        assert(loaded->window_sizes_key_triples_co_occ == stats.window_sizes_key_triples_co_occ);
+        for (size_t i = 0; i < stats.window_sizes_key_pairs_co_occ.size(); ++i) {
+            for (size_t j = 0; j < stats.window_sizes_key_triples_co_occ.size(); ++j) {
+                std::unique_ptr<_CollectionStats> window_stats(stats.get_window_collection_stats(i, j));
+                std::unique_ptr<_CollectionStats> loaded_window_stats(loaded->get_window_collection_stats(i, j));
+                _test_testCollectionStatsEqual(*window_stats, *loaded_window_stats, num_keys);
+            }
+        }
+    }
+    std::remove(filename.c_str());
+
+    // the raw format is still detected
+    _CollectionStats plain_stats;
+    {
+        _CollectionStatsFiller filler(&plain_stats, &matcher, 0, 2);
+        for (size_t i = 0; i < 20; ++i) {
+            filler.update({docs[i]});
+        }
+    }
+    std::stringstream plain_stream;
+    plain_stats.dumps(&plain_stream);
+    std::unique_ptr<_CollectionStats> plain_loaded(_CollectionStats::loads(&plain_stream));
+    _test_testCollectionStatsEqual(plain_stats, *plain_loaded, num_keys);
+
+    // a truncated dump cannot be loaded
+    for (size_t size: {compressed.size() / 2, compressed.size() - 1}) {
+        std::stringstream truncated_stream(compressed.substr(0, size));
+        try {
+            delete _CollectionStats::loads(&truncated_stream);
+            assert(false);
+        } catch (const std::runtime_error &) {}
+    }
+}
+
+
+void testCollectionStatsCompressedDump() {
+    testCollectionStatsCompressedDump_impl<false, false>();
+    testCollectionStatsCompressedDump_impl<true, false>();
+    testCollectionStatsCompressedDump_impl<false, true>();
+    testCollectionStatsCompressedDump_impl<true, true>();
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED, typename T=uint16_t>
+void testCollectionStatsFilteredLoad_impl() {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, B_RESTRICTED, false, false>;
+
+    const T num_keys = 48;
+    PatternMatcher<T> matcher;
+    for (T i = 0; i < num_keys; ++i) {
+        matcher.add_pattern(i, "w" + std::to_string(i));
+    }
+    matcher.compile();
+
+    _CollectionStats stats(std::vector<distance_t>({8, 3}), std::vector<distance_t>({10}));
+    {
+        _CollectionStatsFiller filler(&stats, &matcher, 0, 2, 2);
+        if (B_RESTRICTED) {
+            for (T i = 0; i < num_keys; ++i) {
+                filler.add_restriction(i);
+                filler.add_restriction(i, (i + 1) % num_keys);
+                filler.add_restriction(i, (i + 1) % num_keys, (i + 2) % num_keys);
+            }
+        }
+        uint64_t state = 5;
+        for (size_t i = 0; i < 300; ++i) {
+            std::string doc;
+            for (size_t j = 0; j < 40; ++j) {
+                state = state * 6364136223846793005ull + 1442695040888963407ull;
+                doc += (j > 0 ? " w" : "w") + std::to_string((state >> 33) % num_keys);
+            }
+            filler.update({doc});
+        }
+    }
+
+    // a few keys, plus a pair and a triple whose keys are not selected
+    CollectionStatsFilter<T> filter(std::vector<T>({3, 4, 20, 45}));
+    filter.add_key_pair(30, 31);
+    filter.add_key_triple(33, 34, 35);
+    auto is_key_selected = [](T i) {
+        return i == 3 || i == 4 || i == 20 || i == 45;
+    };
+    auto is_pair_selected = [&](T i, T j) {
+        return (is_key_selected(i) && is_key_selected(j)) || (std::min(i, j) == 30 && std::max(i, j) == 31);
+    };
+    auto is_triple_selected = [&](T i, T j, T k) {
+        const KeyTriple<T> keyTriple(i, j, k);
+        return (is_key_selected(i) && is_key_selected(j) && is_key_selected(k)) ||
+               (keyTriple.first() == 33 && keyTriple.second() == 34 && keyTriple.third() == 35);
+    };
+
+    std::stringstream compressed_stream;
+    stats.dumps_compressed(&compressed_stream);
+    std::stringstream raw_stream;
+    std::unique_ptr<_CollectionStats> raw_stats(stats.get_window_collection_stats(0, 0));
+    raw_stats->dumps(&raw_stream);
+
+    std::unique_ptr<_CollectionStats> filtered_stats(_CollectionStats::loads(&compressed_stream, filter, 2));
+    std::unique_ptr<_CollectionStats> raw_filtered_stats(_CollectionStats::loads(&raw_stream, filter));
+    assert(filtered_stats->get_num_docs() == stats.get_num_docs());
+    assert(filtered_stats->get_key_frequency_sum() == stats.get_key_frequency_sum());
+    assert(filtered_stats->get_num_keys() == 4 && raw_filtered_stats->get_num_keys() == 4);
+    assert(filtered_stats->get_num_key_pairs() < stats.get_num_key_pairs());
+    assert(filtered_stats->get_num_key_pairs() == raw_filtered_stats->get_num_key_pairs());
+    assert(filtered_stats->get_num_key_triples() == raw_filtered_stats->get_num_key_triples());
+
+    for (T i = 0; i < num_keys; ++i) {
+        assert(filtered_stats->get_stats_key(i).frequency ==
+               (is_key_selected(i) ? stats.get_stats_key(i).frequency : 0));
+        for (T j = 0; j < num_keys; ++j) {
+            const bool pair_selected = is_pair_selected(i, j);
+            for (size_t window_index = 0; window_index < 2; ++window_index) {
+                assert(filtered_stats->get_stats_key_pair(i, j, window_index).window_frequency ==
+                       (pair_selected ? stats.get_stats_key_pair(i, j, window_index).window_frequency : 0));
+            }
+            assert(raw_filtered_stats->get_stats_key_pair(i, j).window_frequency ==
+                   (pair_selected ? stats.get_stats_key_pair(i, j).window_frequency : 0));
+            for (T k = 0; k < num_keys; ++k) {
+                assert(filtered_stats->get_stats_key_triple(i, j, k).window_frequency ==
+                       (is_triple_selected(i, j, k) ? stats.get_stats_key_triple(i, j, k).window_frequency : 0));
+            }
+        }
+    }
+
+    // an empty filter keeps only the sums
+    compressed_stream.clear();
+    compressed_stream.seekg(0);
+    std::unique_ptr<_CollectionStats> empty_stats(_CollectionStats::loads(&compressed_stream, CollectionStatsFilter<T>()));
+    assert(empty_stats->get_num_keys() == 0 && empty_stats->get_num_key_pairs() == 0);
+    assert(empty_stats->get_num_docs() == stats.get_num_docs());
+}
+
+
+void testCollectionStatsFilteredLoad() {
+    testCollectionStatsFilteredLoad_impl<false, false>();
+    testCollectionStatsFilteredLoad_impl<true, false>();
+    testCollectionStatsFilteredLoad_impl<false, true>();
+    testCollectionStatsFilteredLoad_impl<true, true>();
+}
+
+
+template<typename T>
+void testRestrictionIndex_impl(const std::vector<T> &keys) {
+    // the masks must be the same of a map, whatever the density of the keys
+    RestrictionIndex<T> index;
+    std::unordered_map<T, char> expected_key_masks;
+    std::unordered_map<KeyPair<T>, char> expected_key_pair_masks;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const char mask = (char) (1 << (i % 3));
+        index.update_key_mask(keys[i], mask);
+        expected_key_masks[keys[i]] |= mask;
+
+        const KeyPair<T> keyPair(keys[i], keys[(i * 7) % keys.size()]);
+        index.update_key_pair_mask(keyPair, mask);
+        expected_key_pair_masks[keyPair] |= mask;
+    }
+    for (const T &key: keys) {
+        assert(index.get_key_mask(key) == expected_key_masks.at(key));
+        for (const T &other: keys) {
+            const auto pair_it = expected_key_pair_masks.find(KeyPair<T>(key, other));
+            assert(index.get_key_pair_mask(KeyPair<T>(key, other)) ==
+                   (pair_it != expected_key_pair_masks.end() ? pair_it->second : 0));
+        }
+    }
+    assert(index.get_key_mask((T) (keys.back() + 1)) == 0);
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, typename T=uint32_t>
+void testRestrictionIndexFiller_impl() {
+    using _CollectionStats = CollectionStats<T, B_DISABLE_UNWINDOWED, true>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, B_DISABLE_UNWINDOWED, true, false, false>;
+
+    // dense ids and ids too sparse for the flat array of the masks
+    const std::vector<T> ids({0, 1, 2, 3000000000u, 4000000000u});
+    PatternMatcher<T> matcher;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        matcher.add_pattern(ids[i], std::string(1, 'a' + i));
+    }
+    matcher.compile();
+
+    const std::vector<std::string> docs({"a b c d e a", "e d c b", "a a e", "b x c x d e", "a b c", "d d e c b a"});
+    _CollectionStats unrestricted_stats;
+    _CollectionStats stats;
+    {
+        _CollectionStatsFiller unrestricted_filler(&unrestricted_stats, &matcher, 0, 2);
+        _CollectionStatsFiller filler(&stats, &matcher, 0, 2);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            for (_CollectionStatsFiller *f: {&unrestricted_filler, &filler}) {
+                f->add_restriction(ids[i]);
+                f->add_restriction(ids[i], ids[(i + 3) % ids.size()]);
+                f->add_restriction(ids[i], ids[(i + 1) % ids.size()], ids[(i + 2) % ids.size()]);
+            }
+        }
+        // the unrestricted counts of the other filler are the ones of the restricted keys, pairs and triples
+        for (size_t i = 0; i < ids.size(); ++i) {
+            for (size_t j = 0; j < ids.size(); ++j) {
+                unrestricted_filler.add_restriction(ids[i], ids[j]);
+                for (size_t k = 0; k < ids.size(); ++k) {
+                    unrestricted_filler.add_restriction(ids[i], ids[j], ids[k]);
+                }
+            }
+        }
+        for (const std::string &doc: docs) {
+            unrestricted_filler.update({doc});
+            filler.update({doc});
+        }
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+        assert(stats.get_stats_key(ids[i]).frequency == unrestricted_stats.get_stats_key(ids[i]).frequency);
+        const T pair_second = ids[(i + 3) % ids.size()];
+        assert(stats.get_stats_key_pair(ids[i], pair_second).window_frequency ==
+               unrestricted_stats.get_stats_key_pair(ids[i], pair_second).window_frequency);
+        const T triple_second = ids[(i + 1) % ids.size()], triple_third = ids[(i + 2) % ids.size()];
+        assert(stats.get_stats_key_triple(ids[i], triple_second, triple_third).window_frequency ==
+               unrestricted_stats.get_stats_key_triple(ids[i], triple_second, triple_third).window_frequency);
+        assert(stats.get_stats_key_triple(ids[i], triple_second, triple_third).document_frequency ==
+               unrestricted_stats.get_stats_key_triple(ids[i], triple_second, triple_third).document_frequency);
+    }
+    assert(stats.get_stats_key_triple(ids[0], ids[1], ids[1]).window_frequency == 0);
+}
+
+
+void testRestrictionIndex() {
+    testRestrictionIndex_impl<uint16_t>({0, 1, 2, 3, 5, 8, 13, 21, 34, 55});
+    testRestrictionIndex_impl<uint32_t>({7, 70000, 3000000000u, 3000000001u, 4000000000u});
+    testRestrictionIndex_impl<int32_t>({-5, -1, 0, 4, 1000000});
+    // a sparse key must keep its mask when the flat array grows past it
+    std::vector<uint32_t> out_of_order_keys({70000});
+    for (uint32_t i = 0; i < 2000; ++i) {
+        out_of_order_keys.push_back(i);
+    }
+    out_of_order_keys.push_back(71000);
+    testRestrictionIndex_impl<uint32_t>(out_of_order_keys);
+    testRestrictionIndexFiller_impl<false>();
+    testRestrictionIndexFiller_impl<true>();
+}
+
+
+template<bool B_RESTRICTED, bool B_BUFFERED_WORKER, bool B_BUFFERED_COLLECTOR, typename T=uint16_t>
+void testCollectionStatsSnapshotConcurrent_impl() {
+    using _CollectionStats = CollectionStats<T, false, B_RESTRICTED>;
+    using _CollectionStatsFiller = CollectionStatsFiller<T, false, B_RESTRICTED, B_BUFFERED_WORKER, B_BUFFERED_COLLECTOR>;
+
+    PatternMatcher<T> matcher;
+    matcher.add_pattern(0, "a");
+    matcher.add_pattern(1, "b");
+    matcher.add_pattern(2, "c");
+    // a long document with many distinct keys makes the copies slow enough to overlap the workers
+    std::string long_doc;
+    for (T i = 3; i < 40; ++i) {
+        matcher.add_pattern(i, "k" + std::to_string(i));
+        long_doc += "k" + std::to_string(i) + " ";
+    }
+    matcher.compile();
+
+    auto add_restrictions = [](_CollectionStatsFiller &filler) {
+        if (B_RESTRICTED) {
+            for (T i = 3; i < 40; ++i) {
+                filler.add_restriction(i, (T) (i + 1), (T) (i + 2));
+            }
+            filler.add_restriction(0);
+            filler.add_restriction(2);
+            filler.add_restriction(0, 1);
+            filler.add_restriction(0, 1, 2);
+        }
+    };
+
+    // the documents applied while a snapshot is copied go through its delta, which must not change the result
+    const std::vector<std::string> docs({"a b c a b", "c c a", "b x a", "a"});
+    _CollectionStats expected_stats(12, 15);
+    _CollectionStats stats(12, 15);
+    {
+        _CollectionStatsFiller expected_filler(&expected_stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 2);
+        _CollectionStatsFiller filler(&stats, &matcher, B_BUFFERED_COLLECTOR ? 4096 : 0, 4);
+        add_restrictions(expected_filler);
+        add_restrictions(filler);
+        expected_filler.update({long_doc});
+        filler.update({long_doc});
+        filler.set_snapshot_interval(7);
+
+        std::atomic<bool> publishing(true);
+        std::thread publisher([&filler, &publishing]() {
+            while (publishing) {
+                std::shared_ptr<_CollectionStats> snapshot = filler.snapshot();
+                assert(snapshot->get_num_docs() <= 301);
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+        for (size_t i = 0; i < 300; ++i) {
+            expected_filler.update({docs[i % docs.size()]});
+            filler.update({docs[i % docs.size()]});
+            if (i % 10 == 9) {
+                expected_filler.remove({docs[0]});
+                filler.remove({docs[0]});
+            }
+        }
+        filler.flush();
+        publishing = false;
+        publisher.join();
+        assert(filler.snapshot()->get_num_docs() == stats.get_num_docs());
+    }
+    _test_testCollectionStatsEqual(expected_stats, stats, (T) 3, false);
+}
+
+
+void testCollectionStatsSnapshotConcurrent() {
+    testCollectionStatsSnapshotConcurrent_impl<false, false, false>();
+    testCollectionStatsSnapshotConcurrent_impl<false, true, true>();
+    testCollectionStatsSnapshotConcurrent_impl<true, false, false>();
+    testCollectionStatsSnapshotConcurrent_impl<true, true, true>();
+}
+
+
 int main(int argc, char **argv) {
     std::cout << "1) testCollectionStatsDump_Basic" << std::endl;
     testCollectionStatsDump_Basic();
     std::cout << "2) testCollectionStats" << std::endl;
     testCollectionStats();
+    std::cout << "3) testCollectionStatsSnapshot" << std::endl;
+    testCollectionStatsSnapshot();
+    std::cout << "4) testCollectionStatsRemove" << std::endl;
+    testCollectionStatsRemove();
+    std::cout << "5) testCollectionStatsPlacement" << std::endl;
+    testCollectionStatsPlacement();
+    std::cout << "6) testRecordArena" << std::endl;
+    testRecordArena();
+    std::cout << "7) testCollectionStatsCache" << std::endl;
+    testCollectionStatsCache();
+    std::cout << "8) testCollectionStatsWindows" << std::endl;
+    testCollectionStatsWindows();
+    std::cout << "9) testCollectionStatsMultiFiller" << std::endl;
+    testCollectionStatsMultiFiller();
+    std::cout << "10) testCollectionStatsFieldChunks" << std::endl;
+    testCollectionStatsFieldChunks();
+    std::cout << "11) testCollectionStatsSampling" << std::endl;
+    testCollectionStatsSampling();
+    std::cout << "12) testLocalStatsTable" << std::endl;
+    testLocalStatsTable();
+    std::cout << "13) testCollectionStatsThreads" << std::endl;
+    testCollectionStatsThreads();
+    std::cout << "14) testCollectionStatsCompressedDump" << std::endl;
+    testCollectionStatsCompressedDump();
+    std::cout << "15) testCollectionStatsFilteredLoad" << std::endl;
+    testCollectionStatsFilteredLoad();
+    std::cout << "16) testRestrictionIndex" << std::endl;
+    testRestrictionIndex();
+    std::cout << "17) testCollectionStatsSnapshotConcurrent" << std::endl;
+    testCollectionStatsSnapshotConcurrent();
 
     // TODO test dumps and loads
 
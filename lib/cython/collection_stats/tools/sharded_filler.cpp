@@ -0,0 +1,395 @@
+/**
+ * Fill a CollectionStats from a corpus in the custom format (document id, title, content lines, empty line) using
+ * several processes, each one working on its own byte range of the corpus with its own CollectionStatsFiller.
+ * Every process is pinned to a NUMA node and dumps its own collection stats, which are finally merged together.
+ *
+ * Build (from this directory):
+ *   g++ -std=c++11 -O3 -fopenmp -pthread -I.. -I../../../cpp -I../../../cpp/pattern_matching \
+ *       sharded_filler.cpp -o sharded_filler
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "buffered_stream/BufferedReader.hpp"
+#include "buffered_stream/BufferedWriter.hpp"
+#include "pattern_matching/PatternMatcher.hpp"
+#include "CollectionStats.hpp"
+#include "NumaTopology.hpp"
+
+
+using Key = uint32_t;
+
+struct Config {
+    std::string corpus_filename;
+    std::string patterns_filename;
+    std::string restrictions_filename;
+    std::string output_filename;
+    uint32_t num_shards = 1;
+    uint32_t num_threads = 1;
+    distance_t window_size_key_pairs_co_occ = 12;
+    distance_t window_size_key_triples_co_occ = 15;
+    bool unwindowed = false;
+    bool numa = true;
+    bool keep_shards = false;
+    bool compressed = false;
+};
+
+
+static void
+print_usage(
+        const char *program
+) {
+    std::cerr << "Usage: " << program << " [options] <corpus_file> <patterns_file> <output_file>" << std::endl
+              << std::endl
+              << "  corpus_file     uncompressed corpus in the custom format" << std::endl
+              << "  patterns_file   one \"<id>\\t<pattern>\" per line" << std::endl
+              << "  output_file     where the merged collection stats are dumped" << std::endl
+              << std::endl
+              << "Options:" << std::endl
+              << "  --shards N              number of shards/processes (default: number of NUMA nodes)" << std::endl
+              << "  --threads N             filler threads per shard (default: 1)" << std::endl
+              << "  --pair-window N         window size of the key pairs co-occurrences (default: 12)" << std::endl
+              << "  --triple-window N       window size of the key triples co-occurrences (default: 15)" << std::endl
+              << "  --restrictions FILE     restrict the stats to the keys, pairs and triples in FILE," << std::endl
+              << "                          one whitespace separated list of 1 to 3 ids per line" << std::endl
+              << "  --unwindowed            collect also the unwindowed co-occurrences" << std::endl
+              << "  --no-numa               do not pin the shards to the NUMA nodes" << std::endl
+              << "  --keep-shards           do not delete the per shard dumps after the merge" << std::endl
+              << "  --compressed            write the shards and the output in the compressed format" << std::endl;
+}
+
+
+/**
+ * Return the offset of the first document starting at or after offset, i.e. the position following an empty line
+ */
+static std::streamoff
+align_to_document_start(
+        std::ifstream &infile,
+        std::streamoff offset,
+        std::streamoff file_size
+) {
+    if (offset <= 0) {
+        return 0;
+    }
+    infile.clear();
+    infile.seekg(offset - 1);
+
+    // an empty line is a '\n' following another '\n'
+    int prev = infile.get();
+    for (int curr = infile.get(); curr != EOF; prev = curr, curr = infile.get()) {
+        if (prev == '\n' && curr == '\n') {
+            return infile.tellg();
+        }
+    }
+    return file_size;
+}
+
+
+static std::vector<std::streamoff>
+compute_shard_offsets(
+        const std::string &corpus_filename,
+        uint32_t num_shards
+) {
+    std::ifstream infile(corpus_filename, std::ifstream::binary | std::ifstream::ate);
+    if (infile.fail() or !infile.is_open()) {
+        throw std::runtime_error("The corpus file cannot be opened");
+    }
+    std::streamoff file_size = infile.tellg();
+
+    std::vector<std::streamoff> offsets({0});
+    for (uint32_t i = 1; i < num_shards; ++i) {
+        std::streamoff offset = std::max(offsets.back(), file_size * i / num_shards);
+        offsets.push_back(align_to_document_start(infile, offset, file_size));
+    }
+    offsets.push_back(file_size);
+    return offsets;
+}
+
+
+static void
+load_patterns(
+        const std::string &patterns_filename,
+        PatternMatcher<Key> &matcher
+) {
+    std::ifstream infile(patterns_filename);
+    if (infile.fail() or !infile.is_open()) {
+        throw std::runtime_error("The patterns file cannot be opened");
+    }
+    std::string line;
+    while (std::getline(infile, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+            throw std::runtime_error("Malformed line in the patterns file: \"" + line + "\"");
+        }
+        matcher.add_pattern((Key) std::stoul(line.substr(0, tab)), line.substr(tab + 1));
+    }
+    matcher.compile();
+}
+
+
+template<typename Filler>
+static void
+load_restrictions(
+        const std::string &restrictions_filename,
+        Filler &filler
+) {
+    std::ifstream infile(restrictions_filename);
+    if (infile.fail() or !infile.is_open()) {
+        throw std::runtime_error("The restrictions file cannot be opened");
+    }
+    std::string line;
+    while (std::getline(infile, line)) {
+        std::stringstream ss(line);
+        std::vector<Key> keys;
+        for (Key key; ss >> key;) {
+            keys.push_back(key);
+        }
+        switch (keys.size()) {
+            case 0:
+                break;
+            case 1:
+                filler.add_restriction(keys[0]);
+                break;
+            case 2:
+                filler.add_restriction(keys[0], keys[1]);
+                break;
+            case 3:
+                filler.add_restriction(keys[0], keys[1], keys[2]);
+                break;
+            default:
+                throw std::runtime_error("Malformed line in the restrictions file: \"" + line + "\"");
+        }
+    }
+}
+
+
+/**
+ * Fill the collection stats with the documents in [begin, end) and dump them into output_filename.
+ * The title and every content line of a document are passed to the filler as separate fields
+ */
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED>
+static void
+fill_shard(
+        const Config &config,
+        std::streamoff begin,
+        std::streamoff end,
+        const std::string &output_filename
+) {
+    PatternMatcher<Key> matcher;
+    load_patterns(config.patterns_filename, matcher);
+
+    CollectionStats<Key, B_DISABLE_UNWINDOWED, B_RESTRICTED> collection_stats(
+            config.window_size_key_pairs_co_occ, config.window_size_key_triples_co_occ);
+    {
+        CollectionStatsFiller<Key, B_DISABLE_UNWINDOWED, B_RESTRICTED, false, false> filler(
+                &collection_stats, &matcher, 0, config.num_threads, 2 * config.num_threads);
+        if (B_RESTRICTED) {
+            load_restrictions(config.restrictions_filename, filler);
+        }
+
+        std::ifstream infile(config.corpus_filename, std::ifstream::binary);
+        if (infile.fail() or !infile.is_open()) {
+            throw std::runtime_error("The corpus file cannot be opened");
+        }
+        infile.seekg(begin);
+
+        std::vector<std::string> doc_fields;
+        std::string line;
+        int step = 0;
+        for (std::streamoff pos = begin; pos < end && std::getline(infile, line);) {
+            pos += line.size() + 1;
+
+            if (step == 0) {  // document start
+                if (line.compare(0, 5, "<doc ") == 0 ||
+                    (!line.empty() && line.find_first_not_of("0123456789 \t\r") == std::string::npos)) {
+                    step = 1;
+                } else if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                    throw std::runtime_error("A <doc> tag or a number was expected, instead a \"" + line +
+                                             "\" has been found");
+                }
+            } else if (step == 1) {  // document title, stripped as str.strip does
+                const char *whitespaces = " \t\n\r\f\v";
+                size_t first = line.find_first_not_of(whitespaces);
+                if (first == std::string::npos) {
+                    doc_fields.push_back(std::string());
+                } else {
+                    doc_fields.push_back(line.substr(first, line.find_last_not_of(whitespaces) - first + 1));
+                }
+                step = 2;
+            } else if (!line.empty()) {  // document content
+                doc_fields.push_back(line);
+            } else {  // document end
+                filler.update(doc_fields);
+                doc_fields.clear();
+                step = 0;
+            }
+        }
+        if (step != 0) {
+            throw std::runtime_error("A content was expected before the end of the shard");
+        }
+
+        filler.flush();
+    }
+    if (config.compressed) {
+        collection_stats.dump_compressed(output_filename, config.num_threads);
+    } else {
+        collection_stats.dump(output_filename);
+    }
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED>
+static void
+merge_shards(
+        const Config &config,
+        const std::vector<std::string> &shard_filenames
+) {
+    using _CollectionStats = CollectionStats<Key, B_DISABLE_UNWINDOWED, B_RESTRICTED>;
+
+    // the format of the shards is detected by load, the compressed ones are decoded on all the cores
+    std::unique_ptr<_CollectionStats> merged(_CollectionStats::load(shard_filenames[0]));
+    for (size_t i = 1; i < shard_filenames.size(); ++i) {
+        std::unique_ptr<_CollectionStats> shard(_CollectionStats::load(shard_filenames[i]));
+        merged->update(*shard);
+    }
+    if (config.compressed) {
+        merged->dump_compressed(config.output_filename);
+    } else {
+        merged->dump(config.output_filename);
+    }
+}
+
+
+template<bool B_DISABLE_UNWINDOWED, bool B_RESTRICTED>
+static int
+run(
+        const Config &config
+) {
+    NumaTopology topology;
+    std::vector<std::streamoff> offsets = compute_shard_offsets(config.corpus_filename, config.num_shards);
+
+    std::vector<std::string> shard_filenames;
+    std::vector<pid_t> pids;
+    for (uint32_t i = 0; i < config.num_shards; ++i) {
+        shard_filenames.push_back(config.output_filename + ".shard" + std::to_string(i));
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error("Unable to fork the shard process");
+        }
+        if (pid == 0) {
+            // the pinning is done before any allocation, so the memory of the shard is local to its node
+            if (config.numa && !NumaTopology::pin_current_thread(topology.get_node_cpus(i))) {
+                std::cerr << "Shard " << i << ": unable to pin the process to its NUMA node" << std::endl;
+            }
+            int status = 0;
+            try {
+                fill_shard<B_DISABLE_UNWINDOWED, B_RESTRICTED>(config, offsets[i], offsets[i + 1], shard_filenames[i]);
+            } catch (const std::exception &e) {
+                std::cerr << "Shard " << i << ": " << e.what() << std::endl;
+                status = 1;
+            }
+            _exit(status);
+        }
+        pids.push_back(pid);
+    }
+
+    bool failed = false;
+    for (uint32_t i = 0; i < pids.size(); ++i) {
+        int status;
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "Shard " << i << " failed" << std::endl;
+            failed = true;
+        }
+    }
+
+    if (!failed) {
+        merge_shards<B_DISABLE_UNWINDOWED, B_RESTRICTED>(config, shard_filenames);
+    }
+    if (!config.keep_shards) {
+        for (const std::string &shard_filename: shard_filenames) {
+            std::remove(shard_filename.c_str());
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+
+int
+main(
+        int argc,
+        char **argv
+) {
+    Config config;
+    config.num_shards = 0;
+
+    std::vector<std::string> positional;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg(argv[i]);
+            bool has_value = i + 1 < argc;
+            if (arg == "--shards" && has_value) {
+                config.num_shards = (uint32_t) std::stoul(argv[++i]);
+            } else if (arg == "--threads" && has_value) {
+                config.num_threads = (uint32_t) std::stoul(argv[++i]);
+            } else if (arg == "--pair-window" && has_value) {
+                config.window_size_key_pairs_co_occ = (distance_t) std::stoul(argv[++i]);
+            } else if (arg == "--triple-window" && has_value) {
+                config.window_size_key_triples_co_occ = (distance_t) std::stoul(argv[++i]);
+            } else if (arg == "--restrictions" && has_value) {
+                config.restrictions_filename = argv[++i];
+            } else if (arg == "--unwindowed") {
+                config.unwindowed = true;
+            } else if (arg == "--no-numa") {
+                config.numa = false;
+            } else if (arg == "--keep-shards") {
+                config.keep_shards = true;
+            } else if (arg == "--compressed") {
+                config.compressed = true;
+            } else if (arg.compare(0, 2, "--") == 0) {
+                throw std::invalid_argument(arg);
+            } else {
+                positional.push_back(arg);
+            }
+        }
+    } catch (const std::logic_error &e) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (positional.size() != 3 || config.num_threads == 0) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    config.corpus_filename = positional[0];
+    config.patterns_filename = positional[1];
+    config.output_filename = positional[2];
+    if (config.num_shards == 0) {
+        config.num_shards = (uint32_t) NumaTopology().get_num_nodes();
+    }
+
+    try {
+        bool restricted = !config.restrictions_filename.empty();
+        if (config.unwindowed) {
+            return restricted ? run<false, true>(config) : run<false, false>(config);
+        } else {
+            return restricted ? run<true, true>(config) : run<true, false>(config);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
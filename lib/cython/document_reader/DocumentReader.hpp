@@ -0,0 +1,994 @@
+#ifndef DOCUMENT_READER_HPP
+#define DOCUMENT_READER_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Corpus formats of documents_utils.doc_generator_from_file
+ */
+enum DocumentFormat {
+    DOCUMENT_FORMAT_CUSTOM,  // id (<doc ...> or a number), title, content lines, empty line
+    DOCUMENT_FORMAT_WIKI,  // <doc ...>, title, empty line, content lines, </doc>
+    DOCUMENT_FORMAT_XML  // <sphinx:document id='...'>, url/title/keywords/description tags, <content>...</content>
+};
+
+
+struct StringView {
+    const char *data;
+    size_t size;
+
+    inline std::string
+    str() const {
+        return std::string(this->data, this->size);
+    }
+};
+
+
+/**
+ * Document parsed by a DocumentReader, all the fields are views on the buffers of the DocumentBatch that contains it.
+ * The url, keywords and description fields are set only by the xml format
+ */
+struct DocumentView {
+    StringView id;
+    StringView title;
+    StringView url;
+    StringView keywords;
+    StringView description;
+    const StringView *content_lines;
+    size_t num_content_lines;
+};
+
+
+/**
+ * Documents parsed from a buffer, starting from a given step of the state machine of the format
+ */
+struct DocumentParseResult {
+    std::vector<DocumentView> documents;
+    std::vector<StringView> lines;
+    size_t tail_begin = 0;  // first byte not consumed: the start of the pending document or of the incomplete line
+    uint8_t resume_step = 0;  // step of the parser at tail_begin
+    bool failed = false;
+    std::string error;
+};
+
+
+/**
+ * Line by line port of the _custom_, _wiki_extractor_ and _xml_extractor_reader_to_doc_generator functions of
+ * documents_utils.py, with the same steps, field values and error messages
+ */
+class DocumentParser {
+private:
+    const DocumentFormat format;
+    const char *const data;
+    DocumentParseResult &result;
+
+    uint8_t step;
+    DocumentView document;
+    size_t document_begin = 0;
+    size_t document_lines_begin = 0;
+    bool pending = false;
+    std::vector<size_t> lines_begin;  // offset of the content lines of each document
+
+    DocumentParser(
+            DocumentFormat format,
+            const char *data,
+            uint8_t step,
+            DocumentParseResult &result
+    ) :
+            format(format),
+            data(data),
+            result(result),
+            step(step) {
+    }
+
+public:
+    /**
+     * Parse the complete lines of [data, data + size), and also the last incomplete one when final is true
+     */
+    static void
+    parse(
+            DocumentFormat format,
+            const char *data,
+            size_t size,
+            uint8_t step,
+            bool final,
+            DocumentParseResult &result
+    ) {
+        result.documents.clear();
+        result.lines.clear();
+        result.failed = false;
+        result.error.clear();
+
+        DocumentParser parser(format, data, step, result);
+        size_t pos = 0;
+        while (pos < size && !result.failed) {
+            const char *new_line = (const char *) memchr(data + pos, '\n', size - pos);
+            if (new_line == nullptr && !final) {
+                break;
+            }
+            const size_t line_end = new_line != nullptr ? new_line - data : size;
+            parser.parse_line(pos, StringView{data + pos, line_end - pos}, new_line != nullptr);
+            pos = new_line != nullptr ? line_end + 1 : size;
+        }
+
+        // the pending document is parsed again, from its first line, together with the following bytes
+        if (parser.pending) {
+            result.lines.resize(parser.document_lines_begin);
+            result.tail_begin = parser.document_begin;
+            result.resume_step = 0;
+        } else {
+            result.tail_begin = pos;
+            result.resume_step = parser.step;
+        }
+        for (size_t i = 0; i < result.documents.size(); ++i) {
+            result.documents[i].content_lines = result.lines.data() + parser.lines_begin[i];
+        }
+    }
+
+    /**
+     * Offset of the first line that probably starts a document, or size when there is none. A wrong guess is only
+     * slower: DocumentReader checks every boundary against the state of the parser on the previous bytes
+     */
+    static size_t
+    find_boundary(
+            DocumentFormat format,
+            const char *data,
+            size_t size
+    ) {
+        const char *found = nullptr;
+        switch (format) {
+            case DOCUMENT_FORMAT_CUSTOM:
+                found = (const char *) memmem(data, size, "\n\n", 2);
+                return found != nullptr ? found - data + 2 : size;
+            case DOCUMENT_FORMAT_WIKI:
+                found = (const char *) memmem(data, size, "\n</doc>", 7);
+                break;
+            case DOCUMENT_FORMAT_XML:
+                found = (const char *) memmem(data, size, "</sphinx:document", 17);
+                break;
+        }
+        if (found != nullptr) {
+            found = (const char *) memchr(found + 1, '\n', size - (found + 1 - data));
+        }
+        return found != nullptr ? found - data + 1 : size;
+    }
+
+private:
+    void
+    parse_line(
+            size_t line_begin,
+            StringView line,
+            bool has_new_line
+    ) {
+        switch (this->format) {
+            case DOCUMENT_FORMAT_CUSTOM:
+                this->parse_custom_line(line_begin, line);
+                break;
+            case DOCUMENT_FORMAT_WIKI:
+                this->parse_wiki_line(line_begin, line, has_new_line);
+                break;
+            case DOCUMENT_FORMAT_XML:
+                this->parse_xml_line(line_begin, line);
+                break;
+        }
+    }
+
+    void
+    parse_custom_line(
+            size_t line_begin,
+            StringView line
+    ) {
+        if (this->step == 0) {  // document start
+            if (starts_with(line, "<doc ") || is_digits(rstrip(line))) {
+                this->begin_document(line_begin, strip(line));
+                this->step = 1;
+            } else if (strip(line).size != 0) {
+                this->fail("A <doc> tag or a number was expected, instead a \"" + line.str() + "\" has been found");
+            }
+        } else if (this->step == 1) {  // document title
+            this->document.title = strip(line);
+            this->step = 2;
+        } else if (line.size != 0) {  // document content
+            this->result.lines.push_back(line);
+        } else {  // document end
+            this->end_document();
+            this->step = 0;
+        }
+    }
+
+    void
+    parse_wiki_line(
+            size_t line_begin,
+            StringView line,
+            bool has_new_line
+    ) {
+        if (this->step == 0) {  // document start
+            if (starts_with(line, "<doc ")) {
+                this->begin_document(line_begin, strip(line));
+                this->step = 1;
+            } else if (strip(line).size != 0) {
+                this->fail("A <doc> tag was expected, instead a \"" + line.str() + "\" has been found");
+            }
+        } else if (this->step == 1) {  // document title
+            this->document.title = strip(line);
+            this->step = 2;
+        } else if (this->step == 2) {  // empty line
+            if (line.size != 0 || !has_new_line) {
+                this->fail("An empty line was expected");
+            }
+            this->step = 3;
+        } else if (!starts_with(line, "</doc>")) {  // document content
+            this->result.lines.push_back(line);
+        } else {  // document end
+            this->end_document();
+            this->step = 0;
+        }
+    }
+
+    void
+    parse_xml_line(
+            size_t line_begin,
+            StringView original_line
+    ) {
+        const StringView line = strip(original_line);
+
+        if (this->step == 0) {  // document start
+            if (starts_with(line, "<sphinx:document id='")) {
+                this->begin_document(line_begin, py_slice(line, find(line, "'") + 1, rfind(line, "'")));
+                this->step = 1;
+            } else if (line.size != 0) {
+                this->fail("A <sphinx:document> tag was expected, instead a \"" + line.str() + "\" has been found");
+            }
+        } else if (this->step == 1) {  // document tags
+            const StringView content = py_slice(line, find(line, ">") + 1, rfind(line, "</"));
+            if (starts_with(line, "<url>")) {
+                this->document.url = content;
+            }
+            if (starts_with(line, "<title>")) {
+                this->document.title = content;
+            } else if (starts_with(line, "<keywords>")) {
+                this->document.keywords = content;
+            } else if (starts_with(line, "<description>")) {
+                this->document.description = content;
+            } else if (equals(line, "<content>")) {
+                this->step = 2;
+            } else if (starts_with(line, "</sphinx:document")) {
+                this->fail("A <title> tag was expected, instead a \"" + line.str() + "\" has been found");
+            }
+        } else if (this->step == 2) {  // document content
+            if (equals(line, "</content>")) {
+                this->end_document();
+                this->step = 4;
+            } else {
+                this->result.lines.push_back(original_line);
+            }
+        } else if (starts_with(line, "</sphinx:document")) {  // document end
+            this->step = 0;
+        }
+    }
+
+    inline void
+    begin_document(
+            size_t line_begin,
+            StringView id
+    ) {
+        this->document = DocumentView{id, {this->data, 0}, {this->data, 0}, {this->data, 0}, {this->data, 0}, nullptr, 0};
+        this->document_begin = line_begin;
+        this->document_lines_begin = this->result.lines.size();
+        this->pending = true;
+    }
+
+    inline void
+    end_document() {
+        this->document.num_content_lines = this->result.lines.size() - this->document_lines_begin;
+        this->result.documents.push_back(this->document);
+        this->lines_begin.push_back(this->document_lines_begin);
+        this->pending = false;
+    }
+
+    inline void
+    fail(
+            std::string error
+    ) {
+        // the pending document is dropped, as the Python generators do
+        this->result.lines.resize(this->pending ? this->document_lines_begin : this->result.lines.size());
+        this->pending = false;
+        this->result.failed = true;
+        this->result.error = std::move(error);
+    }
+
+    // str methods of Python 2
+    static inline bool
+    is_space(
+            char c
+    ) {
+        return c == ' ' || ('\t' <= c && c <= '\r');
+    }
+
+    static inline StringView
+    rstrip(
+            StringView s
+    ) {
+        while (s.size > 0 && is_space(s.data[s.size - 1])) {
+            --s.size;
+        }
+        return s;
+    }
+
+    static inline StringView
+    strip(
+            StringView s
+    ) {
+        s = rstrip(s);
+        while (s.size > 0 && is_space(*s.data)) {
+            ++s.data;
+            --s.size;
+        }
+        return s;
+    }
+
+    static inline bool
+    is_digits(
+            StringView s
+    ) {
+        if (s.size == 0) {
+            return false;
+        }
+        for (size_t i = 0; i < s.size; ++i) {
+            if (s.data[i] < '0' || s.data[i] > '9') {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<size_t N>
+    static inline bool
+    starts_with(
+            StringView s,
+            const char (&prefix)[N]
+    ) {
+        return s.size >= N - 1 && memcmp(s.data, prefix, N - 1) == 0;
+    }
+
+    template<size_t N>
+    static inline bool
+    equals(
+            StringView s,
+            const char (&other)[N]
+    ) {
+        return s.size == N - 1 && memcmp(s.data, other, N - 1) == 0;
+    }
+
+    template<size_t N>
+    static inline ptrdiff_t
+    find(
+            StringView s,
+            const char (&needle)[N]
+    ) {
+        const char *found = (const char *) memmem(s.data, s.size, needle, N - 1);
+        return found != nullptr ? found - s.data : -1;
+    }
+
+    template<size_t N>
+    static inline ptrdiff_t
+    rfind(
+            StringView s,
+            const char (&needle)[N]
+    ) {
+        for (ptrdiff_t i = (ptrdiff_t) s.size - (ptrdiff_t) (N - 1); i >= 0; --i) {
+            if (memcmp(s.data + i, needle, N - 1) == 0) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * s[begin:end] with the negative indices counted from the end
+     */
+    static inline StringView
+    py_slice(
+            StringView s,
+            ptrdiff_t begin,
+            ptrdiff_t end
+    ) {
+        const ptrdiff_t size = s.size;
+        begin = begin < 0 ? std::max<ptrdiff_t>(0, begin + size) : std::min(begin, size);
+        end = end < 0 ? std::max<ptrdiff_t>(0, end + size) : std::min(end, size);
+        return StringView{s.data + begin, (size_t) std::max<ptrdiff_t>(0, end - begin)};
+    }
+};
+
+
+/**
+ * Block of a file parsed by a worker of DocumentReader. The block is split at the first probable document boundary:
+ * the bytes before it complete the tail of the previous block, the others are parsed speculatively from step 0
+ */
+struct DocumentChunk {
+    std::vector<char> buffer;  // decompressed bytes, empty when the chunk is a view on a mapped file
+    const char *data = nullptr;
+    size_t size = 0;
+    bool first = false;  // first chunk of the file
+
+    // gzip members of a BGZF file, inflated into buffer by the worker
+    size_t members_begin = 0;
+    size_t members_end = 0;
+
+    size_t body_begin = 0;
+    DocumentParseResult body;
+    std::exception_ptr error;
+
+    bool taken = false;
+    bool ready = false;
+};
+
+
+/**
+ * Documents returned by DocumentReader::next_batch with the buffers they refer to
+ */
+struct DocumentBatch {
+    std::vector<DocumentView> documents;
+
+    std::vector<std::unique_ptr<DocumentChunk>> chunks;
+    std::vector<std::unique_ptr<std::string>> buffers;
+    std::vector<std::unique_ptr<DocumentParseResult>> results;
+
+    void
+    clear() {
+        this->documents.clear();
+        this->chunks.clear();
+        this->buffers.clear();
+        this->results.clear();
+    }
+};
+
+
+/**
+ * Parallel reader of the corpus files. A producer thread cuts the file into chunks of about chunk_size bytes: the
+ * plain files are memory mapped and the chunks are views on them, the gzip files are inflated by the producer, or by
+ * the workers when the file is BGZF (the gzip with independent blocks written by bgzip). The workers parse the chunks
+ * and next_batch returns their documents in the order of the file, as zero-copy views.
+ *
+ *     DocumentReader reader(DOCUMENT_FORMAT_CUSTOM, 8);
+ *     reader.open("corpus.gz");
+ *     for (DocumentBatch batch; reader.next_batch(batch);) {
+ *         ...
+ *     }
+ *
+ * A parse error is raised by the call of next_batch that follows the batch with the documents preceding it
+ */
+class DocumentReader {
+private:
+    struct GzipMember {
+        size_t offset;
+        size_t size;
+        size_t uncompressed_size;
+    };
+
+    const DocumentFormat format;
+    const uint32_t num_threads;
+    const size_t chunk_size;
+    const size_t max_in_flight;
+
+    // source of the current file
+    int fd = -1;
+    const char *mapped_data = nullptr;
+    size_t mapped_size = 0;
+    gzFile gz_file = nullptr;
+    std::vector<GzipMember> members;  // empty unless the file is BGZF
+
+    // pipeline
+    std::thread producer;
+    std::vector<std::thread> workers;
+    std::deque<std::unique_ptr<DocumentChunk>> in_flight;
+    bool producer_done = false;
+    std::atomic<bool> stopping{false};  // read without the lock by the producer loops
+    std::exception_ptr producer_error;
+    std::mutex mutex;
+    std::condition_variable producer_condition_variable;
+    std::condition_variable worker_condition_variable;
+    std::condition_variable consumer_condition_variable;
+
+    // consumer state
+    std::string carry;  // bytes of the previous chunks not parsed yet
+    uint8_t carry_step = 0;
+    bool at_end = true;
+    std::exception_ptr pending_error;
+
+public:
+    DocumentReader(
+            DocumentFormat format,
+            uint32_t num_threads = 0,
+            size_t chunk_size = 1 << 22
+    ) :
+            format(format),
+            num_threads(num_threads > 0 ? num_threads : std::max(1u, std::thread::hardware_concurrency())),
+            chunk_size(chunk_size),
+            max_in_flight(2 * this->num_threads + 2) {
+        if (chunk_size == 0) {
+            throw std::runtime_error("chunk_size must be greater than 0");
+        }
+    }
+
+    ~DocumentReader() {
+        this->close();
+    }
+
+    DocumentReader(const DocumentReader &) = delete;
+
+    DocumentReader &
+    operator=(const DocumentReader &) = delete;
+
+    /**
+     * Start reading filename, a gzip file when it ends with .gz, closing the previous one
+     */
+    void
+    open(
+            const std::string &filename
+    ) {
+        this->close();
+
+        this->fd = ::open(filename.c_str(), O_RDONLY);
+        if (this->fd < 0) {
+            throw std::runtime_error("File " + filename + " doesn't exist");
+        }
+        const bool gzip = filename.size() >= 3 && filename.compare(filename.size() - 3, 3, ".gz") == 0;
+        try {
+            this->map_file();
+            if (gzip && !this->find_bgzf_members()) {
+                this->unmap_file();
+                int gz_fd = dup(this->fd);
+                this->gz_file = gz_fd >= 0 ? gzdopen(gz_fd, "rb") : nullptr;
+                if (this->gz_file == nullptr) {
+                    if (gz_fd >= 0) {
+                        ::close(gz_fd);
+                    }
+                    throw std::runtime_error("File " + filename + " cannot be opened");
+                }
+                gzbuffer(this->gz_file, 1 << 20);
+            }
+        } catch (...) {
+            this->close();
+            throw;
+        }
+
+        this->carry.clear();
+        this->carry_step = 0;
+        this->at_end = false;
+        this->pending_error = nullptr;
+        this->producer_done = false;
+        this->stopping = false;
+        this->producer_error = nullptr;
+        this->producer = std::thread(&DocumentReader::produce, this);
+        for (uint32_t i = 0; i < this->num_threads; ++i) {
+            this->workers.emplace_back(&DocumentReader::work, this);
+        }
+    }
+
+    void
+    close() {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->producer_condition_variable.notify_all();
+        this->worker_condition_variable.notify_all();
+        if (this->producer.joinable()) {
+            this->producer.join();
+        }
+        for (std::thread &worker: this->workers) {
+            worker.join();
+        }
+        this->workers.clear();
+        this->in_flight.clear();
+        this->members.clear();
+
+        this->unmap_file();
+        if (this->gz_file != nullptr) {
+            gzclose(this->gz_file);
+            this->gz_file = nullptr;
+        }
+        if (this->fd >= 0) {
+            ::close(this->fd);
+            this->fd = -1;
+        }
+        this->at_end = true;
+    }
+
+    /**
+     * Fill batch with the next documents of the file, return false at the end of the file.
+     * The views of the previous batch are invalidated
+     */
+    bool
+    next_batch(
+            DocumentBatch &batch
+    ) {
+        batch.clear();
+        if (this->pending_error) {
+            std::exception_ptr error = this->pending_error;
+            this->pending_error = nullptr;
+            this->at_end = true;
+            std::rethrow_exception(error);
+        }
+
+        while (batch.documents.empty() && !this->at_end && !this->pending_error) {
+            std::unique_ptr<DocumentChunk> chunk = this->pop_chunk();
+            if (chunk) {
+                this->consume(std::move(chunk), batch);
+                continue;
+            }
+
+            // end of the file, the last line can miss its new line
+            std::string *tail = this->add_buffer(batch, std::move(this->carry));
+            DocumentParseResult *result = this->parse(batch, tail->data(), tail->size(), this->carry_step, true);
+            if (!result->failed && result->tail_begin != tail->size()) {
+                this->pending_error = std::make_exception_ptr(
+                        std::runtime_error("A content was expected before the end of file"));
+            }
+            this->carry.clear();
+            this->at_end = true;
+        }
+        if (batch.documents.empty() && this->pending_error) {
+            return this->next_batch(batch);
+        }
+        return !batch.documents.empty();
+    }
+
+private:
+    void
+    map_file() {
+        struct stat st;
+        if (fstat(this->fd, &st) != 0) {
+            throw std::runtime_error("Unable to stat the file");
+        }
+        this->mapped_size = st.st_size;
+        if (this->mapped_size == 0) {
+            return;
+        }
+        void *mapped = mmap(nullptr, this->mapped_size, PROT_READ, MAP_PRIVATE, this->fd, 0);
+        if (mapped == MAP_FAILED) {
+            this->mapped_size = 0;
+            throw std::runtime_error("Unable to map the file");
+        }
+        madvise(mapped, this->mapped_size, MADV_SEQUENTIAL);
+        this->mapped_data = (const char *) mapped;
+    }
+
+    void
+    unmap_file() {
+        if (this->mapped_data != nullptr) {
+            munmap((void *) this->mapped_data, this->mapped_size);
+        }
+        this->mapped_data = nullptr;
+        this->mapped_size = 0;
+    }
+
+    /**
+     * Fill members when the mapped file is a sequence of BGZF blocks, i.e. gzip members whose header stores their
+     * size in the "BC" extra subfield, so that they can be inflated in parallel
+     */
+    bool
+    find_bgzf_members() {
+        const unsigned char *data = (const unsigned char *) this->mapped_data;
+        for (size_t offset = 0; offset < this->mapped_size;) {
+            const unsigned char *header = data + offset;
+            const size_t remaining = this->mapped_size - offset;
+            if (remaining < 18 || header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || !(header[3] & 4) ||
+                header[12] != 'B' || header[13] != 'C' || header[14] != 2 || header[15] != 0) {
+                this->members.clear();
+                return false;
+            }
+            const size_t size = (size_t) (header[16] | (header[17] << 8)) + 1;
+            if (size > remaining || size < 26) {
+                this->members.clear();
+                return false;
+            }
+            const unsigned char *trailer = header + size - 4;
+            const size_t uncompressed_size = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((size_t) trailer[3] << 24);
+            this->members.push_back(GzipMember{offset, size, uncompressed_size});
+            offset += size;
+        }
+        return !this->members.empty();
+    }
+
+    void
+    push_chunk(
+            std::unique_ptr<DocumentChunk> chunk
+    ) {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (this->in_flight.size() >= this->max_in_flight && !this->stopping) {
+            this->producer_condition_variable.wait(lock);
+        }
+        if (this->stopping) {
+            return;
+        }
+        this->in_flight.push_back(std::move(chunk));
+        this->worker_condition_variable.notify_one();
+    }
+
+    void
+    produce() {
+        try {
+            bool first = true;
+            if (!this->members.empty()) {
+                // BGZF: each chunk is a run of members inflated by a worker
+                for (size_t begin = 0; begin < this->members.size() && !this->stopping;) {
+                    std::unique_ptr<DocumentChunk> chunk(new DocumentChunk());
+                    chunk->first = first;
+                    chunk->members_begin = begin;
+                    size_t size = 0;
+                    for (; begin < this->members.size() && (size < this->chunk_size || size == 0); ++begin) {
+                        size += this->members[begin].uncompressed_size;
+                    }
+                    chunk->members_end = begin;
+                    this->push_chunk(std::move(chunk));
+                    first = false;
+                }
+            } else if (this->gz_file != nullptr) {
+                // gzip: inflated here, while the workers parse the previous chunks
+                while (!this->stopping) {
+                    std::unique_ptr<DocumentChunk> chunk(new DocumentChunk());
+                    chunk->first = first;
+                    chunk->buffer.resize(this->chunk_size);
+                    int size = gzread(this->gz_file, chunk->buffer.data(), (unsigned) this->chunk_size);
+                    if (size < 0) {
+                        int errnum;
+                        throw std::runtime_error(std::string("Unable to inflate the file: ") + gzerror(this->gz_file, &errnum));
+                    }
+                    if (size == 0) {
+                        break;
+                    }
+                    chunk->buffer.resize(size);
+                    chunk->data = chunk->buffer.data();
+                    chunk->size = chunk->buffer.size();
+                    this->push_chunk(std::move(chunk));
+                    first = false;
+                }
+            } else {
+                // plain file: the chunks are views on the mapping
+                for (size_t offset = 0; offset < this->mapped_size && !this->stopping; offset += this->chunk_size) {
+                    std::unique_ptr<DocumentChunk> chunk(new DocumentChunk());
+                    chunk->first = first;
+                    chunk->data = this->mapped_data + offset;
+                    chunk->size = std::min(this->chunk_size, this->mapped_size - offset);
+                    this->push_chunk(std::move(chunk));
+                    first = false;
+                }
+            }
+        } catch (...) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->producer_error = std::current_exception();
+        }
+
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->producer_done = true;
+        this->consumer_condition_variable.notify_all();
+    }
+
+    void
+    work() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (true) {
+            DocumentChunk *chunk = nullptr;
+            while (!this->stopping) {
+                for (const std::unique_ptr<DocumentChunk> &c: this->in_flight) {
+                    if (!c->taken) {
+                        chunk = c.get();
+                        break;
+                    }
+                }
+                if (chunk != nullptr) {
+                    break;
+                }
+                this->worker_condition_variable.wait(lock);
+            }
+            if (chunk == nullptr) {
+                return;
+            }
+            chunk->taken = true;
+            lock.unlock();
+
+            try {
+                if (chunk->members_end > chunk->members_begin) {
+                    this->inflate_members(*chunk);
+                }
+                chunk->body_begin = chunk->first ? 0 : DocumentParser::find_boundary(this->format, chunk->data, chunk->size);
+                DocumentParser::parse(this->format, chunk->data + chunk->body_begin, chunk->size - chunk->body_begin, 0,
+                                      false, chunk->body);
+            } catch (...) {
+                chunk->error = std::current_exception();
+            }
+
+            lock.lock();
+            chunk->ready = true;
+            this->consumer_condition_variable.notify_all();
+        }
+    }
+
+    void
+    inflate_members(
+            DocumentChunk &chunk
+    ) {
+        size_t size = 0;
+        for (size_t i = chunk.members_begin; i < chunk.members_end; ++i) {
+            size += this->members[i].uncompressed_size;
+        }
+        chunk.buffer.resize(size);
+
+        size_t offset = 0;
+        for (size_t i = chunk.members_begin; i < chunk.members_end; ++i) {
+            const GzipMember &member = this->members[i];
+            if (member.uncompressed_size == 0) {
+                continue;  // e.g. the end of file marker
+            }
+            z_stream stream;
+            memset(&stream, 0, sizeof(stream));
+            if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+                throw std::runtime_error("Unable to initialize zlib");
+            }
+            stream.next_in = (Bytef *) this->mapped_data + member.offset;
+            stream.avail_in = (uInt) member.size;
+            stream.next_out = (Bytef *) chunk.buffer.data() + offset;
+            stream.avail_out = (uInt) member.uncompressed_size;
+            int status = inflate(&stream, Z_FINISH);
+            inflateEnd(&stream);
+            if (status != Z_STREAM_END || stream.avail_out != 0) {
+                throw std::runtime_error("Unable to inflate the file: corrupted BGZF block");
+            }
+            offset += member.uncompressed_size;
+        }
+        chunk.data = chunk.buffer.data();
+        chunk.size = chunk.buffer.size();
+    }
+
+    /**
+     * Return the next chunk of the file when it is ready, nullptr at the end of the file
+     */
+    std::unique_ptr<DocumentChunk>
+    pop_chunk() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while ((this->in_flight.empty() && !this->producer_done) ||
+               (!this->in_flight.empty() && !this->in_flight.front()->ready)) {
+            this->consumer_condition_variable.wait(lock);
+        }
+        if (this->in_flight.empty()) {
+            if (this->producer_error) {
+                std::rethrow_exception(this->producer_error);
+            }
+            return nullptr;
+        }
+        std::unique_ptr<DocumentChunk> chunk = std::move(this->in_flight.front());
+        this->in_flight.pop_front();
+        this->producer_condition_variable.notify_one();
+        return chunk;
+    }
+
+    void
+    consume(
+            std::unique_ptr<DocumentChunk> chunk,
+            DocumentBatch &batch
+    ) {
+        if (chunk->error) {
+            std::rethrow_exception(chunk->error);
+        }
+
+        // the bytes before the boundary complete the bytes left by the previous chunks
+        this->carry.append(chunk->data, chunk->body_begin);
+        if (chunk->body_begin == chunk->size) {
+            return;
+        }
+        std::string *head = this->add_buffer(batch, std::move(this->carry));
+        this->carry.clear();
+        DocumentParseResult *head_result = this->parse(batch, head->data(), head->size(), this->carry_step, false);
+        if (head_result->failed) {
+            return;
+        }
+
+        const DocumentParseResult &body = chunk->body;
+        if (head_result->tail_begin == head->size() && head_result->resume_step == 0) {
+            // the boundary is real: the speculative parsing of the body is the right one
+            this->append(batch, body);
+            this->carry.assign(chunk->data + chunk->body_begin + body.tail_begin,
+                               chunk->size - chunk->body_begin - body.tail_begin);
+            this->carry_step = body.resume_step;
+            batch.chunks.push_back(std::move(chunk));
+        } else {
+            // the boundary is not a document start, the body is parsed again from the actual step
+            std::string *rest = this->add_buffer(batch, head->substr(head_result->tail_begin));
+            rest->append(chunk->data + chunk->body_begin, chunk->size - chunk->body_begin);
+            DocumentParseResult *rest_result = this->parse(batch, rest->data(), rest->size(),
+                                                           head_result->resume_step, false);
+            this->carry.assign(rest->data() + rest_result->tail_begin, rest->size() - rest_result->tail_begin);
+            this->carry_step = rest_result->resume_step;
+        }
+    }
+
+    std::string *
+    add_buffer(
+            DocumentBatch &batch,
+            std::string buffer
+    ) {
+        batch.buffers.emplace_back(new std::string(std::move(buffer)));
+        return batch.buffers.back().get();
+    }
+
+    DocumentParseResult *
+    parse(
+            DocumentBatch &batch,
+            const char *data,
+            size_t size,
+            uint8_t step,
+            bool final
+    ) {
+        batch.results.emplace_back(new DocumentParseResult());
+        DocumentParser::parse(this->format, data, size, step, final, *batch.results.back());
+        this->append(batch, *batch.results.back());
+        return batch.results.back().get();
+    }
+
+    void
+    append(
+            DocumentBatch &batch,
+            const DocumentParseResult &result
+    ) {
+        batch.documents.insert(batch.documents.end(), result.documents.begin(), result.documents.end());
+        if (result.failed && !this->pending_error) {
+            this->pending_error = std::make_exception_ptr(std::runtime_error(result.error));
+        }
+    }
+};
+
+
+/**
+ * Update filler with the documents of filenames, the title and each content line are the fields of a document.
+ * Return the number of documents, the filler is not flushed
+ */
+template<typename Filler>
+size_t
+fill_from_documents(
+        DocumentReader &reader,
+        const std::vector<std::string> &filenames,
+        Filler &filler
+) {
+    size_t num_documents = 0;
+    std::vector<std::string> doc_fields;
+    DocumentBatch batch;
+    for (const std::string &filename: filenames) {
+        reader.open(filename);
+        while (reader.next_batch(batch)) {
+            for (const DocumentView &document: batch.documents) {
+                doc_fields.clear();
+                doc_fields.emplace_back(document.title.data, document.title.size);
+                for (size_t i = 0; i < document.num_content_lines; ++i) {
+                    doc_fields.emplace_back(document.content_lines[i].data, document.content_lines[i].size);
+                }
+                filler.update(doc_fields);
+            }
+            num_documents += batch.documents.size();
+        }
+        reader.close();
+    }
+    return num_documents;
+}
+
+#endif //DOCUMENT_READER_HPP
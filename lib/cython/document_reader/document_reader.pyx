@@ -0,0 +1,134 @@
+# distutils: language = c++
+
+from libc.stdint cimport uint32_t
+from libcpp cimport bool
+from libcpp.memory cimport unique_ptr
+from libcpp.string cimport string
+from libcpp.vector cimport vector
+
+cimport collection_stats.collection_stats as cs
+cimport collection_stats.collection_stats_restricted as csr
+
+
+cdef extern from "DocumentReader.hpp":
+    cdef enum DocumentFormat:
+        DOCUMENT_FORMAT_CUSTOM
+        DOCUMENT_FORMAT_WIKI
+        DOCUMENT_FORMAT_XML
+
+    cdef struct StringView:
+        const char *data
+        size_t size
+
+    cdef struct DocumentView:
+        StringView id
+        StringView title
+        StringView url
+        StringView keywords
+        StringView description
+        const StringView *content_lines
+        size_t num_content_lines
+
+    cdef cppclass DocumentBatch:
+        vector[DocumentView] documents
+
+    cdef cppclass DocumentReader:
+        DocumentReader(DocumentFormat, uint32_t, size_t) except +
+
+        void                                                        open(const string &) except + nogil
+        void                                                        close() nogil
+        bool                                                        next_batch(DocumentBatch &) except + nogil
+
+    size_t fill_from_documents[F](DocumentReader &, const vector[string] &, F &) except + nogil
+
+
+cdef inline bytes _c_str(const StringView &view):
+    return view.data[:view.size]
+
+
+cdef class PyDocumentReader:
+    """
+    Native reader of the corpus formats of documents_utils.doc_generator_from_file: "custom", "wiki" and "xml".
+    The files are split into chunks of chunk_size bytes that are parsed (and inflated, when they are BGZF) by
+    num_threads threads, 0 means all the cores. A reader reads one file at a time
+    """
+    cdef unique_ptr[DocumentReader] c_reader
+    cdef unique_ptr[DocumentBatch] c_batch
+    cdef readonly str file_format
+
+    def __cinit__(self, str file_format="custom", uint32_t num_threads=0, size_t chunk_size=1 << 22):
+        cdef DocumentFormat c_format
+        if file_format == "custom":
+            c_format = DOCUMENT_FORMAT_CUSTOM
+        elif file_format == "wiki":
+            c_format = DOCUMENT_FORMAT_WIKI
+        elif file_format == "xml":
+            c_format = DOCUMENT_FORMAT_XML
+        else:
+            raise ValueError("file_format must be one between 'custom', 'wiki' and 'xml'")
+
+        self.c_reader.reset(new DocumentReader(c_format, num_threads, chunk_size))
+        self.c_batch.reset(new DocumentBatch())
+        self.file_format = file_format
+
+    def read(self, filenames):
+        """
+        Yield the documents of the files as tuples (id, title, content_lines), or (id, title, content_lines, url,
+        keywords, description) for the xml format
+        """
+        if isinstance(filenames, (str, unicode)):
+            filenames = [filenames]
+        cdef bint xml = self.file_format == "xml"
+        cdef string c_filename
+        cdef bool has_batch
+        cdef size_t i, j
+        cdef const DocumentView *document
+        for filename in filenames:
+            c_filename = filename
+            with nogil:
+                self.c_reader.get().open(c_filename)
+            try:
+                while True:
+                    with nogil:
+                        has_batch = self.c_reader.get().next_batch(self.c_batch.get()[0])
+                    if not has_batch:
+                        break
+                    # the views are copied into the strings of a whole batch before yielding
+                    documents = []
+                    for i in range(self.c_batch.get().documents.size()):
+                        document = &self.c_batch.get().documents[i]
+                        content_lines = [_c_str(document.content_lines[j]) for j in range(document.num_content_lines)]
+                        if xml:
+                            documents.append((_c_str(document.id), _c_str(document.title), content_lines,
+                                              _c_str(document.url), _c_str(document.keywords), _c_str(document.description)))
+                        else:
+                            documents.append((_c_str(document.id), _c_str(document.title), content_lines))
+                    for document_tuple in documents:
+                        yield document_tuple
+            finally:
+                with nogil:
+                    self.c_reader.get().close()
+
+    def fill(self, filler, filenames):
+        """
+        Update filler, a PyCollectionStatsFiller or a PyCollectionStatsRestrictedFiller, with the documents of the
+        files without building any Python object: the title and each content line are the fields of a document.
+        Return the number of documents, the filler is not flushed
+        """
+        if isinstance(filenames, (str, unicode)):
+            filenames = [filenames]
+        cdef vector[string] c_filenames = filenames
+        cdef size_t num_documents
+        cdef cs._PyCollectionStatsFiller stats_filler
+        cdef csr._PyCollectionStatsFiller stats_filler_restricted
+        if isinstance(filler, cs._PyCollectionStatsFiller):
+            stats_filler = filler
+            with nogil:
+                num_documents = fill_from_documents(self.c_reader.get()[0], c_filenames, stats_filler.c_collection_stats_filler[0])
+        elif isinstance(filler, csr._PyCollectionStatsFiller):
+            stats_filler_restricted = filler
+            with nogil:
+                num_documents = fill_from_documents(self.c_reader.get()[0], c_filenames, stats_filler_restricted.c_collection_stats_filler[0])
+        else:
+            raise TypeError("filler must be a PyCollectionStatsFiller or a PyCollectionStatsRestrictedFiller")
+        return num_documents
@@ -0,0 +1,172 @@
+#include <assert.h>
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "DocumentReader.hpp"
+
+
+struct Document {
+    std::string id;
+    std::string title;
+    std::vector<std::string> content_lines;
+    std::string url;
+
+    bool
+    operator==(const Document &other) const {
+        return this->id == other.id && this->title == other.title && this->content_lines == other.content_lines &&
+               this->url == other.url;
+    }
+};
+
+
+std::vector<Document> readDocuments(DocumentFormat format, const std::string &filename, uint32_t num_threads,
+                                    size_t chunk_size, std::string *error = nullptr) {
+    std::vector<Document> result;
+    DocumentReader reader(format, num_threads, chunk_size);
+    reader.open(filename);
+    try {
+        for (DocumentBatch batch; reader.next_batch(batch);) {
+            for (const DocumentView &view: batch.documents) {
+                Document document{view.id.str(), view.title.str(), {}, view.url.str()};
+                for (size_t i = 0; i < view.num_content_lines; ++i) {
+                    document.content_lines.push_back(view.content_lines[i].str());
+                }
+                result.push_back(document);
+            }
+        }
+        assert(error == nullptr);
+    } catch (const std::runtime_error &e) {
+        assert(error != nullptr);
+        *error = e.what();
+    }
+    return result;
+}
+
+
+void writeFile(const std::string &filename, const std::string &text) {
+    FILE *file = fopen(filename.c_str(), "wb");
+    assert(file != nullptr);
+    assert(fwrite(text.data(), 1, text.size(), file) == text.size());
+    fclose(file);
+}
+
+
+void writeGzipFile(const std::string &filename, const std::string &text) {
+    gzFile file = gzopen(filename.c_str(), "wb");
+    assert(file != nullptr);
+    assert(gzwrite(file, text.data(), (unsigned) text.size()) == (int) text.size());
+    gzclose(file);
+}
+
+
+/**
+ * Write text as a BGZF file with blocks of block_size uncompressed bytes, followed by the end of file block
+ */
+void writeBgzfFile(const std::string &filename, const std::string &text, size_t block_size) {
+    std::string out;
+    for (size_t begin = 0; begin <= text.size(); begin += block_size) {
+        const std::string block = begin < text.size() ? text.substr(begin, block_size) : "";
+
+        z_stream stream = z_stream();
+        assert(deflateInit2(&stream, 6, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+        std::string compressed(deflateBound(&stream, block.size()), '\0');
+        stream.next_in = (Bytef *) block.data();
+        stream.avail_in = (uInt) block.size();
+        stream.next_out = (Bytef *) &compressed[0];
+        stream.avail_out = (uInt) compressed.size();
+        assert(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+        compressed.resize(stream.total_out);
+        deflateEnd(&stream);
+
+        const size_t bsize = 18 + compressed.size() + 8 - 1;
+        const uint32_t crc = crc32(0, (const Bytef *) block.data(), (uInt) block.size());
+        const unsigned char header[18] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0,
+                                          (unsigned char) (bsize & 0xff), (unsigned char) (bsize >> 8)};
+        out.append((const char *) header, 18);
+        out += compressed;
+        for (uint32_t value: {crc, (uint32_t) block.size()}) {
+            for (int i = 0; i < 4; ++i) {
+                out.push_back((char) ((value >> (8 * i)) & 0xff));
+            }
+        }
+        if (begin == text.size()) {
+            break;
+        }
+    }
+    writeFile(filename, out);
+}
+
+
+/**
+ * The documents and the errors must not depend on the compression, the chunk size and the number of threads
+ */
+void testReaderChunking(DocumentFormat format, const std::string &text, const std::vector<Document> &expected,
+                        const std::string &expected_error = "") {
+    const std::string filename = "/tmp/document_reader_test";
+    writeFile(filename, text);
+    writeGzipFile(filename + ".gz", text);
+    writeBgzfFile(filename + ".bgzf.gz", text, 7);
+
+    for (const std::string &name: {filename, filename + ".gz", filename + ".bgzf.gz"}) {
+        for (size_t chunk_size: {1, 2, 5, 13, 64, 1 << 20}) {
+            for (uint32_t num_threads: {1, 3}) {
+                std::string error;
+                std::vector<Document> documents = readDocuments(format, name, num_threads, chunk_size,
+                                                                expected_error.empty() ? nullptr : &error);
+                assert(documents == expected);
+                assert(error == expected_error);
+            }
+        }
+        remove(name.c_str());
+    }
+}
+
+
+void testReaderCustom() {
+    // the empty title makes the first "\n\n" a wrong document boundary
+    const std::string text = "\n<doc id=1>\n\nfirst line\n123\n\n  \n7 \n title \n\n42\nlast\nline\n\n99  \ntitle";
+    testReaderChunking(DOCUMENT_FORMAT_CUSTOM, text, {
+            {"<doc id=1>", "", {"first line", "123"}, ""},
+            {"7", "title", {}, ""},
+            {"42", "last", {"line"}, ""}
+    }, "A content was expected before the end of file");
+
+    testReaderChunking(DOCUMENT_FORMAT_CUSTOM, "1\na\nb\n\nwrong\n2\nc\n\n", {
+            {"1", "a", {"b"}, ""}
+    }, "A <doc> tag or a number was expected, instead a \"wrong\" has been found");
+}
+
+
+void testReaderWiki() {
+    const std::string text = "<doc id=\"1\">\nTitle\n\n  content\n</doc> x\n\n<doc id=\"2\">\nEmpty\n\n</doc>\n";
+    testReaderChunking(DOCUMENT_FORMAT_WIKI, text, {
+            {"<doc id=\"1\">", "Title", {"  content"}, ""},
+            {"<doc id=\"2\">", "Empty", {}, ""}
+    });
+
+    testReaderChunking(DOCUMENT_FORMAT_WIKI, "<doc id=\"1\">\nTitle\nno empty line\n</doc>\n", {},
+                       "An empty line was expected");
+}
+
+
+void testReaderXml() {
+    const std::string text =
+            "<sphinx:document id='1'>\n<url>http://a</url>\n  <title>A</title>\n<content>\n line \n</content>\n"
+            "</sphinx:document>\n<sphinx:document id='2'>\n<title>B\n<content>\n</content>\n</sphinx:document>";
+    testReaderChunking(DOCUMENT_FORMAT_XML, text, {
+            {"1", "A", {" line "}, "http://a"},
+            {"2", "", {}, ""}
+    });
+}
+
+
+int main() {
+    std::cout << "1) testReaderCustom" << std::endl;
+    testReaderCustom();
+    std::cout << "2) testReaderWiki" << std::endl;
+    testReaderWiki();
+    std::cout << "3) testReaderXml" << std::endl;
+    testReaderXml();
+    return 0;
+}
@@ -0,0 +1,270 @@
+#ifndef EMBEDDING_SIMILARITY_HPP
+#define EMBEDDING_SIMILARITY_HPP
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "FeaturizerBatch.hpp"
+
+
+/**
+ * Dot product with independent accumulators, so that the compiler can vectorize the loop
+ */
+inline float
+embedding_dot(
+        const float *__restrict__ x,
+        const float *__restrict__ y,
+        size_t size
+) {
+    float acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        for (size_t k = 0; k < 8; ++k) {
+            acc[k] += x[i + k] * y[i + k];
+        }
+    }
+    float result = ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+    for (; i < size; ++i) {
+        result += x[i] * y[i];
+    }
+    return result;
+}
+
+
+/**
+ * Scale the vector to unit length, the zero vector is left as it is
+ */
+inline void
+embedding_normalize(
+        float *x,
+        size_t size
+) {
+    double norm = 0;
+    for (size_t i = 0; i < size; ++i) {
+        norm += (double) x[i] * x[i];
+    }
+    if (norm > 0) {
+        const float inv_norm = 1.0 / sqrt(norm);
+        for (size_t i = 0; i < size; ++i) {
+            x[i] *= inv_norm;
+        }
+    }
+}
+
+
+/**
+ * Row-major float32 matrix with one embedding per row, e.g. a memory mapped numpy array
+ */
+struct EmbeddingMatrix {
+    const float *data;
+    size_t num_rows;
+    size_t dim;
+
+    inline const float *
+    row(uint32_t index) const {
+        return this->data + index * this->dim;
+    }
+};
+
+
+/**
+ * The matrices of a word2vec model trained with negative sampling, the norm matrices contain the unit length rows
+ */
+struct W2VEmbeddings {
+    EmbeddingMatrix syn0;
+    EmbeddingMatrix syn0norm;
+    EmbeddingMatrix syn1neg;
+    EmbeddingMatrix syn1negnorm;
+    bool cbow_mean;
+};
+
+// term id of the terms missing from the vocabulary
+const uint32_t W2V_MISSING_TERM = UINT32_MAX;
+
+
+/**
+ * Native version of featurizer_w2v.pyx, the term ids of the queries are rows of the embedding matrices.
+ * The features are the same up to the rounding of the float32 arithmetic
+ */
+class NativeFeaturizerW2V {
+public:
+    static const size_t num_features = 5;
+
+private:
+    std::vector<float> base_avg_syn0;  // average syn0 vector of each base synset
+    std::vector<float> base_avg_syn1;  // average syn1neg vector of each base synset
+    std::vector<float> base_avg_syn0norm;
+    std::vector<float> base_avg_syn1norm;
+    std::vector<float> base_avg_syn0_sum;
+    std::vector<float> base_context;
+    std::vector<size_t> base_size;  // number of terms with an embedding in each base synset
+    std::vector<double> sum_vec;
+
+public:
+    void
+    get_features(
+            const W2VEmbeddings &embeddings,
+            const FlatQueries &base,
+            const FlatQueries &exp,
+            uint32_t query,
+            float *features,
+            size_t row_stride
+    ) {
+        const size_t dim = embeddings.syn0.dim;
+
+        // loop over the expansions
+        for (uint32_t i_and = 0, num_ands = exp.and_size(query); i_and < num_ands; ++i_and) {
+            const uint32_t base_and_query = base.and_begin(query) + i_and;
+            const uint32_t exp_and_query = exp.and_begin(query) + i_and;
+            const size_t num_synsets = exp.synset_size(exp_and_query);
+            this->resize(num_synsets, dim);
+
+            // init the main query representations
+            size_t context_vectors = 0;
+            std::fill(this->base_avg_syn0_sum.begin(), this->base_avg_syn0_sum.begin() + dim, 0.0f);
+            for (size_t and_query_pos = 0; and_query_pos < num_synsets; ++and_query_pos) {
+                const uint32_t base_synset = base.synset_begin(base_and_query) + and_query_pos;
+                float *avg_syn0 = &this->base_avg_syn0[and_query_pos * dim];
+                float *avg_syn1 = &this->base_avg_syn1[and_query_pos * dim];
+
+                size_t synset_size = 0;
+                std::fill(this->sum_vec.begin(), this->sum_vec.end(), 0.0);
+                for (const uint32_t *b = base.terms_begin(base_synset); b != base.terms_end(base_synset); ++b) {
+                    if (*b != W2V_MISSING_TERM) {
+                        synset_size += 1;
+                        const float *syn0 = embeddings.syn0.row(*b);
+                        const float *syn1 = embeddings.syn1neg.row(*b);
+                        for (size_t i = 0; i < dim; ++i) {
+                            this->sum_vec[i] += syn0[i];
+                            this->sum_vec[dim + i] += syn1[i];
+                        }
+                    }
+                }
+                this->base_size[and_query_pos] = synset_size;
+                for (size_t i = 0; i < dim; ++i) {
+                    avg_syn0[i] = synset_size ? (float) this->sum_vec[i] / synset_size : 0.0f;
+                    avg_syn1[i] = synset_size ? (float) this->sum_vec[dim + i] / synset_size : 0.0f;
+                    this->base_avg_syn0_sum[i] += avg_syn0[i];
+                }
+                if (synset_size) {
+                    context_vectors += 1;
+                }
+
+                float *avg_syn0norm = &this->base_avg_syn0norm[and_query_pos * dim];
+                float *avg_syn1norm = &this->base_avg_syn1norm[and_query_pos * dim];
+                std::copy(avg_syn0, avg_syn0 + dim, avg_syn0norm);
+                std::copy(avg_syn1, avg_syn1 + dim, avg_syn1norm);
+                embedding_normalize(avg_syn0norm, dim);
+                embedding_normalize(avg_syn1norm, dim);
+            }
+
+            for (size_t and_query_pos = 0; and_query_pos < num_synsets; ++and_query_pos) {
+                const uint32_t base_synset = base.synset_begin(base_and_query) + and_query_pos;
+                const uint32_t exp_synset = exp.synset_begin(exp_and_query) + and_query_pos;
+                const float *avg_syn0 = &this->base_avg_syn0[and_query_pos * dim];
+                const float *avg_syn0norm = &this->base_avg_syn0norm[and_query_pos * dim];
+                const float *avg_syn1norm = &this->base_avg_syn1norm[and_query_pos * dim];
+
+                const size_t base_context_size = context_vectors - (this->base_size[and_query_pos] > 0);
+                for (size_t i = 0; i < dim; ++i) {
+                    this->base_context[i] = this->base_avg_syn0_sum[i] - avg_syn0[i];
+                    if (base_context_size > 0 && embeddings.cbow_mean) {
+                        this->base_context[i] /= base_context_size;
+                    }
+                }
+
+                float *synset_features = features;
+                float prob_sum = 0;
+                for (const uint32_t *e = exp.terms_begin(exp_synset); e != exp.terms_end(exp_synset); ++e) {
+                    float *it_features = features;
+                    features += row_stride;
+
+                    double max_syn0_sim = 0, avg_syn0_sim = 0, max_syn1_sim = 0, avg_syn1_sim = 0, prob_value = 0;
+                    if (*e != W2V_MISSING_TERM) {
+                        if (this->base_size[and_query_pos] > 0) {
+                            const float *term_syn0norm = embeddings.syn0norm.row(*e);
+                            const float *term_syn1norm = embeddings.syn1negnorm.row(*e);
+
+                            bool first = true;
+                            for (const uint32_t *b = base.terms_begin(base_synset); b != base.terms_end(base_synset); ++b) {
+                                if (*b == W2V_MISSING_TERM) {
+                                    continue;
+                                }
+                                const double syn0_sim = embedding_dot(term_syn0norm, embeddings.syn0norm.row(*b), dim);
+                                const double syn1_sim = embedding_dot(term_syn1norm, embeddings.syn1negnorm.row(*b), dim);
+                                if (first || syn0_sim > max_syn0_sim) {
+                                    max_syn0_sim = syn0_sim;
+                                }
+                                if (first || syn1_sim > max_syn1_sim) {
+                                    max_syn1_sim = syn1_sim;
+                                }
+                                first = false;
+                            }
+
+                            avg_syn0_sim = embedding_dot(term_syn0norm, avg_syn0norm, dim);
+                            avg_syn1_sim = embedding_dot(term_syn1norm, avg_syn1norm, dim);
+                        }
+                        if (base_context_size > 0) {
+                            prob_value = expf(embedding_dot(this->base_context.data(), embeddings.syn1neg.row(*e), dim));
+                        }
+                    }
+
+                    it_features[0] = max_syn0_sim;
+                    it_features[1] = avg_syn0_sim;
+                    it_features[2] = max_syn1_sim;
+                    it_features[3] = avg_syn1_sim;
+                    it_features[4] = prob_value;
+                    prob_sum += it_features[4];
+                }
+
+                // normalize the probabilities
+                const float prob_norm = std::max(prob_sum, 1.0f);
+                for (float *it_features = synset_features; it_features != features; it_features += row_stride) {
+                    it_features[4] /= prob_norm;
+                }
+            }
+        }
+    }
+
+private:
+    void
+    resize(
+            size_t num_synsets,
+            size_t dim
+    ) {
+        if (this->base_size.size() < num_synsets) {
+            this->base_size.resize(num_synsets);
+        }
+        for (std::vector<float> *vec: {&this->base_avg_syn0, &this->base_avg_syn1,
+                                       &this->base_avg_syn0norm, &this->base_avg_syn1norm}) {
+            if (vec->size() < num_synsets * dim) {
+                vec->resize(num_synsets * dim);
+            }
+        }
+        if (this->base_avg_syn0_sum.size() < dim) {
+            this->base_avg_syn0_sum.resize(dim);
+            this->base_context.resize(dim);
+            this->sum_vec.resize(2 * dim);
+        }
+    }
+};
+
+
+inline void
+featurize_w2v_batch(
+        const W2VEmbeddings &embeddings,
+        const FlatQueries &base,
+        const FlatQueries &exp,
+        uint32_t num_queries,
+        const uint32_t *row_offsets,
+        float *features,
+        size_t row_stride,
+        uint32_t num_threads = 1
+) {
+    featurize_parallel<NativeFeaturizerW2V>(embeddings, base, exp, num_queries, row_offsets, features, row_stride,
+                                            num_threads);
+}
+
+#endif //EMBEDDING_SIMILARITY_HPP
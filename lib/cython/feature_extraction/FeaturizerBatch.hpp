@@ -0,0 +1,118 @@
+#ifndef FEATURIZER_BATCH_HPP
+#define FEATURIZER_BATCH_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Batch of queries in conjunctive normal form, stored as flat arrays of offsets and term ids.
+ * The query q is made of the and_queries in [query_offsets[q], query_offsets[q + 1]), the and_query a of the synsets
+ * in [and_offsets[a], and_offsets[a + 1]) and the synset s of the terms term_ids[synset_offsets[s]:synset_offsets[s + 1]]
+ */
+struct FlatQueries {
+    const uint32_t *query_offsets;
+    const uint32_t *and_offsets;
+    const uint32_t *synset_offsets;
+    const uint32_t *term_ids;
+
+    inline uint32_t
+    and_begin(uint32_t query) const {
+        return this->query_offsets[query];
+    }
+
+    inline uint32_t
+    and_size(uint32_t query) const {
+        return this->query_offsets[query + 1] - this->query_offsets[query];
+    }
+
+    inline uint32_t
+    synset_begin(uint32_t and_query) const {
+        return this->and_offsets[and_query];
+    }
+
+    inline uint32_t
+    synset_size(uint32_t and_query) const {
+        return this->and_offsets[and_query + 1] - this->and_offsets[and_query];
+    }
+
+    inline const uint32_t *
+    terms_begin(uint32_t synset) const {
+        return this->term_ids + this->synset_offsets[synset];
+    }
+
+    inline const uint32_t *
+    terms_end(uint32_t synset) const {
+        return this->term_ids + this->synset_offsets[synset + 1];
+    }
+};
+
+
+/**
+ * Fill the features of the queries: the expansion terms of the query q are written in consecutive rows starting from
+ * the row row_offsets[q] of features, which points to the first feature column.
+ * The queries are spread in chunks among num_threads threads (0 means all the cores), which share the read-only
+ * source of the features (e.g. the collection stats) and own a NativeFeaturizer each
+ */
+template<typename NativeFeaturizer, typename SourceType>
+void
+featurize_parallel(
+        const SourceType &source,
+        const FlatQueries &base,
+        const FlatQueries &exp,
+        uint32_t num_queries,
+        const uint32_t *row_offsets,
+        float *features,
+        size_t row_stride,
+        uint32_t num_threads
+) {
+    const uint32_t chunk_size = 16;
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min(num_threads, (num_queries + chunk_size - 1) / chunk_size);
+
+    std::atomic<uint32_t> next_query(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        try {
+            NativeFeaturizer featurizer;
+            for (uint32_t query_begin = next_query.fetch_add(chunk_size); query_begin < num_queries;
+                 query_begin = next_query.fetch_add(chunk_size)) {
+                for (uint32_t query = query_begin, query_end = std::min(query_begin + chunk_size, num_queries);
+                     query < query_end; ++query) {
+                    featurizer.get_features(source, base, exp, query,
+                                            features + row_offsets[query] * row_stride, row_stride);
+                }
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            // stop the other threads
+            next_query = num_queries;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < num_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+    // the calling thread works as well
+    worker();
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif //FEATURIZER_BATCH_HPP
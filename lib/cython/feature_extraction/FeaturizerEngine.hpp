@@ -0,0 +1,699 @@
+#ifndef FEATURIZER_ENGINE_HPP
+#define FEATURIZER_ENGINE_HPP
+
+#include <math.h>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "CollectionStats.hpp"
+#include "FeaturizerBatch.hpp"
+
+
+/**
+ * Native version of featurizer_sigir08.pyx, it computes exactly the same features
+ */
+class NativeFeaturizerSigIR08 {
+public:
+    static const size_t num_features = 4;
+
+    template<typename CollectionStatsType>
+    void
+    get_features(
+            const CollectionStatsType &collection_stats,
+            const FlatQueries &base,
+            const FlatQueries &exp,
+            uint32_t query,
+            float *features,
+            size_t row_stride
+    ) {
+        // loop over the expansions
+        for (uint32_t i_and = 0, num_ands = exp.and_size(query); i_and < num_ands; ++i_and) {
+            const uint32_t base_and_query = base.and_begin(query) + i_and;
+            const uint32_t exp_and_query = exp.and_begin(query) + i_and;
+
+            // normalization factor
+            size_t sum_query_terms_tf = 0;
+            size_t num_base_terms = 0;
+            for (uint32_t s = base.synset_begin(base_and_query), s_end = s + base.synset_size(base_and_query);
+                 s < s_end; ++s) {
+                for (const uint32_t *t = base.terms_begin(s); t != base.terms_end(s); ++t) {
+                    num_base_terms += 1;
+                    sum_query_terms_tf += collection_stats.get_stats_key(*t).frequency;
+                }
+            }
+            size_t num_base_pairs = num_base_terms >= 2 ? num_base_terms * (num_base_terms - 1) : 0;
+
+            for (uint32_t s = exp.synset_begin(exp_and_query), s_end = s + exp.synset_size(exp_and_query);
+                 s < s_end; ++s) {
+                for (const uint32_t *e = exp.terms_begin(s); e != exp.terms_end(s); ++e) {
+                    float *it_features = features;
+                    features += row_stride;
+
+                    size_t exp_tf = collection_stats.get_stats_key(*e).frequency;
+
+                    // co_occ2 and co_occ2 weighted with all the query terms
+                    size_t exp_co_occ2 = 0;
+                    size_t exp_co_occ2_weighted = 0;
+                    this->for_each_base_term(base, base_and_query, [&](uint32_t b) {
+                        StatsKeyPair stats_pair = collection_stats.get_stats_key_pair(b, *e);
+                        exp_co_occ2 += stats_pair.window_frequency;
+                        exp_co_occ2_weighted += stats_pair.window_frequency * (size_t) stats_pair.window_min_dist;
+                    });
+
+                    // co_occ3 with all the query pairs
+                    size_t exp_co_occ3 = 0;
+                    if (exp_co_occ2 > 0 && num_base_pairs > 0) {
+                        this->for_each_base_term(base, base_and_query, [&](uint32_t b1) {
+                            this->for_each_base_term(base, base_and_query, [&](uint32_t b2) {
+                                exp_co_occ3 += collection_stats.get_stats_key_triple(*e, b1, b2).window_frequency;
+                            });
+                        });
+                        exp_co_occ3 = exp_co_occ3 / 2;
+                    }
+
+                    it_features[0] = fraction_log(exp_tf, sum_query_terms_tf);
+                    it_features[1] = fraction_log(exp_co_occ2, num_base_terms * sum_query_terms_tf);
+                    it_features[2] = fraction_log(exp_co_occ3, num_base_pairs * sum_query_terms_tf);
+                    it_features[3] = fraction_log(exp_co_occ2_weighted, exp_co_occ2);
+                }
+            }
+        }
+    }
+
+private:
+    /**
+     * The Cython version asserts numerator <= denominator and its result is 0 when the assertion fails
+     */
+    static inline float
+    fraction_log(
+            size_t numerator,
+            size_t denominator
+    ) {
+        if (numerator > denominator) {
+            return 0;
+        }
+        return log2(1.0 + 1.0 * numerator / (denominator > 0 ? (double) denominator : 1.0));
+    }
+
+    template<typename Function>
+    static inline void
+    for_each_base_term(
+            const FlatQueries &base,
+            uint32_t and_query,
+            Function function
+    ) {
+        for (uint32_t s = base.synset_begin(and_query), s_end = s + base.synset_size(and_query); s < s_end; ++s) {
+            for (const uint32_t *t = base.terms_begin(s); t != base.terms_end(s); ++t) {
+                function(*t);
+            }
+        }
+    }
+};
+
+
+/**
+ * Native version of featurizer_sigir08extended.pyx, it computes exactly the same features
+ */
+class NativeFeaturizerSigIR08extended {
+public:
+    static const size_t num_features = 42;
+
+private:
+    std::vector<uint64_t> base_co_occ2_vec, base_co_occ2_weighted_vec, base_co_occ3_vec, base_co_occ3_weighted_vec;
+    std::vector<uint64_t> exp_co_occ2_vec, exp_co_occ2_weighted_vec, exp_co_occ3_vec, exp_co_occ3_weighted_vec;
+
+public:
+    template<typename CollectionStatsType>
+    void
+    get_features(
+            const CollectionStatsType &collection_stats,
+            const FlatQueries &base,
+            const FlatQueries &exp,
+            uint32_t query,
+            float *features,
+            size_t row_stride
+    ) {
+        size_t base_tf = 0, base_df = 0;
+        size_t exp_tf = 0, exp_df = 0;
+        this->clear();
+
+        // loop over the expansions
+        for (uint32_t i_and = 0, num_ands = exp.and_size(query); i_and < num_ands; ++i_and) {
+            const uint32_t base_and_query = base.and_begin(query) + i_and;
+            const uint32_t exp_and_query = exp.and_begin(query) + i_and;
+            const size_t and_query_size = base.synset_size(base_and_query);
+            const size_t num_co_occ2 = and_query_size > 0 ? and_query_size - 1 : 0;
+            const size_t num_co_occ3 = and_query_size >= 2 ? (and_query_size - 1) * (and_query_size - 2) / 2 : 0;
+            this->resize(and_query_size, num_co_occ3);
+
+            for (uint32_t and_query_pos = 0, num_synsets = exp.synset_size(exp_and_query);
+                 and_query_pos < num_synsets; ++and_query_pos) {
+                base_tf = 0;
+                if (and_query_size > 0) {
+                    const uint32_t base_synset = base.synset_begin(base_and_query) + and_query_pos;
+                    bool reset = true;
+                    for (const uint32_t *b = base.terms_begin(base_synset); b != base.terms_end(base_synset); ++b) {
+                        StatsKey stats_key = collection_stats.get_stats_key(*b);
+                        if (reset) {
+                            base_tf = stats_key.frequency;
+                            base_df = stats_key.document_frequency;
+                        } else {
+                            if (stats_key.frequency > base_tf) {
+                                base_tf = stats_key.frequency;
+                            }
+                            if (stats_key.document_frequency > base_df) {
+                                base_df = stats_key.document_frequency;
+                            }
+                        }
+                        this->get_cooccurrences(
+                                collection_stats, base, base_and_query, and_query_pos, *b,
+                                this->base_co_occ2_vec, this->base_co_occ2_weighted_vec,
+                                this->base_co_occ3_vec, this->base_co_occ3_weighted_vec,
+                                reset
+                        );
+                        reset = false;
+                    }
+                }
+
+                const uint32_t exp_synset = exp.synset_begin(exp_and_query) + and_query_pos;
+                for (const uint32_t *e = exp.terms_begin(exp_synset); e != exp.terms_end(exp_synset); ++e) {
+                    float *it_features = features;
+                    features += row_stride;
+
+                    StatsKey stats_key = collection_stats.get_stats_key(*e);
+                    exp_tf = stats_key.frequency;
+                    exp_df = stats_key.document_frequency;
+
+                    this->get_cooccurrences(
+                            collection_stats, base, base_and_query, and_query_pos, *e,
+                            this->exp_co_occ2_vec, this->exp_co_occ2_weighted_vec,
+                            this->exp_co_occ3_vec, this->exp_co_occ3_weighted_vec,
+                            true
+                    );
+
+                    // df
+                    it_features[0] = exp_df;
+                    it_features[1] = base_df;
+                    it_features[2] = 1.0 * exp_df / (base_df ? base_df : 1);
+                    // tf
+                    it_features[3] = exp_tf;
+                    it_features[4] = base_tf;
+                    it_features[5] = 1.0 * exp_tf / (base_tf ? base_tf : 1);
+                    // co_occ2, co_occ2 weighted, co_occ3, co_occ3 weighted
+                    set_avg_min_max_features(it_features + 6, this->exp_co_occ2_vec, this->base_co_occ2_vec,
+                                             num_co_occ2);
+                    set_avg_min_max_features(it_features + 15, this->exp_co_occ2_weighted_vec,
+                                             this->base_co_occ2_weighted_vec, num_co_occ2);
+                    set_avg_min_max_features(it_features + 24, this->exp_co_occ3_vec, this->base_co_occ3_vec,
+                                             num_co_occ3);
+                    set_avg_min_max_features(it_features + 33, this->exp_co_occ3_weighted_vec,
+                                             this->base_co_occ3_weighted_vec, num_co_occ3);
+                }
+            }
+        }
+    }
+
+private:
+    /**
+     * The vectors start from zero at every query, the co_occ3 ones are not overwritten when co_occ3 is disabled
+     */
+    void
+    clear() {
+        for (std::vector<uint64_t> *vec: {&this->base_co_occ2_vec, &this->base_co_occ2_weighted_vec,
+                                          &this->base_co_occ3_vec, &this->base_co_occ3_weighted_vec,
+                                          &this->exp_co_occ2_vec, &this->exp_co_occ2_weighted_vec,
+                                          &this->exp_co_occ3_vec, &this->exp_co_occ3_weighted_vec}) {
+            std::fill(vec->begin(), vec->end(), 0);
+        }
+    }
+
+    void
+    resize(
+            size_t num_co_occ2,
+            size_t num_co_occ3
+    ) {
+        for (std::vector<uint64_t> *vec: {&this->base_co_occ2_vec, &this->base_co_occ2_weighted_vec,
+                                          &this->exp_co_occ2_vec, &this->exp_co_occ2_weighted_vec}) {
+            if (vec->size() < num_co_occ2) {
+                vec->resize(num_co_occ2);
+            }
+        }
+        for (std::vector<uint64_t> *vec: {&this->base_co_occ3_vec, &this->base_co_occ3_weighted_vec,
+                                          &this->exp_co_occ3_vec, &this->exp_co_occ3_weighted_vec}) {
+            if (vec->size() < num_co_occ3) {
+                vec->resize(num_co_occ3);
+            }
+        }
+    }
+
+    template<typename CollectionStatsType>
+    static void
+    get_cooccurrences(
+            const CollectionStatsType &collection_stats,
+            const FlatQueries &base,
+            uint32_t and_query,
+            uint32_t ref_andpos,
+            uint32_t ref_termid,
+            std::vector<uint64_t> &max_co_occ2_vec,
+            std::vector<uint64_t> &max_co_occ2_weighted_vec,
+            std::vector<uint64_t> &max_co_occ3_vec,
+            std::vector<uint64_t> &max_co_occ3_weighted_vec,
+            bool reset
+    ) {
+        const uint32_t synset_begin = base.synset_begin(and_query);
+        const uint32_t num_synsets = base.synset_size(and_query);
+        bool disable_co_occ3 = true;
+
+        // co-occ2
+        for (uint32_t andpos1 = 0, i = 0; andpos1 < num_synsets; ++andpos1) {
+            if (andpos1 == ref_andpos) {
+                continue;
+            }
+            size_t best_occ2_freq = 0, best_occ2_gap = 0;
+            for (const uint32_t *t = base.terms_begin(synset_begin + andpos1);
+                 t != base.terms_end(synset_begin + andpos1); ++t) {
+                StatsKeyPair stats_pair = collection_stats.get_stats_key_pair(*t, ref_termid);
+                size_t occ_2_freq = stats_pair.window_frequency;
+                size_t occ_2_min_gap = stats_pair.window_min_dist;
+                if (occ_2_freq > best_occ2_freq || (occ_2_freq == best_occ2_freq && occ_2_min_gap < best_occ2_gap)) {
+                    best_occ2_freq = occ_2_freq;
+                    best_occ2_gap = occ_2_min_gap;
+                }
+            }
+
+            // update the the coocc2 vectors
+            if (reset || best_occ2_freq > max_co_occ2_vec[i] ||
+                (best_occ2_freq == max_co_occ2_vec[i] &&
+                 best_occ2_freq * best_occ2_gap < max_co_occ2_weighted_vec[i])) {
+                max_co_occ2_vec[i] = best_occ2_freq;
+                max_co_occ2_weighted_vec[i] = best_occ2_freq * best_occ2_gap;
+            }
+            // enable the extraction of coocc3
+            if (best_occ2_freq > 0) {
+                disable_co_occ3 = false;
+            }
+            i += 1;
+        }
+
+        if (disable_co_occ3) {
+            return;
+        }
+
+        // co-occ3
+        for (uint32_t andpos1 = 0, i = 0; andpos1 < num_synsets; ++andpos1) {
+            if (andpos1 == ref_andpos) {
+                continue;
+            }
+            for (uint32_t andpos2 = andpos1 + 1; andpos2 < num_synsets; ++andpos2) {
+                if (andpos2 == ref_andpos) {
+                    continue;
+                }
+                size_t best_occ3_freq = 0, best_occ3_gap = 0;
+                for (const uint32_t *t1 = base.terms_begin(synset_begin + andpos1);
+                     t1 != base.terms_end(synset_begin + andpos1); ++t1) {
+                    for (const uint32_t *t2 = base.terms_begin(synset_begin + andpos2);
+                         t2 != base.terms_end(synset_begin + andpos2); ++t2) {
+                        StatsKeyTriple stats_triple = collection_stats.get_stats_key_triple(ref_termid, *t1, *t2);
+                        size_t occ_3_freq = stats_triple.window_frequency;
+                        size_t occ_3_min_gap = stats_triple.window_min_dist;
+                        if (occ_3_freq > best_occ3_freq ||
+                            (occ_3_freq == best_occ3_freq && occ_3_min_gap < best_occ3_gap)) {
+                            best_occ3_freq = occ_3_freq;
+                            best_occ3_gap = occ_3_min_gap;
+                        }
+                    }
+                }
+
+                // update the the coocc3 vector
+                if (reset || best_occ3_freq > max_co_occ3_vec[i] ||
+                    (best_occ3_freq == max_co_occ3_vec[i] &&
+                     best_occ3_freq * best_occ3_gap < max_co_occ3_weighted_vec[i])) {
+                    max_co_occ3_vec[i] = best_occ3_freq;
+                    max_co_occ3_weighted_vec[i] = best_occ3_freq * best_occ3_gap;
+                }
+                i += 1;
+            }
+        }
+    }
+
+    /**
+     * Fill avg, min and max of exp, base and exp/base, with the same accumulation of _c_set_avg_min_max_features
+     */
+    static void
+    set_avg_min_max_features(
+            float *features,
+            const std::vector<uint64_t> &exp_vec,
+            const std::vector<uint64_t> &base_vec,
+            size_t vec_size
+    ) {
+        float &avg_exp = features[0], &avg_base = features[1], &avg_ratio = features[2];
+        float &min_exp = features[3], &min_base = features[4], &min_ratio = features[5];
+        float &max_exp = features[6], &max_base = features[7], &max_ratio = features[8];
+
+        avg_exp = avg_base = avg_ratio = 0;
+        min_exp = min_base = min_ratio = 0;
+        max_exp = max_base = max_ratio = 0;
+
+        if (vec_size <= 0) {
+            return;
+        }
+
+        avg_exp = max_exp = min_exp = exp_vec[0];
+        avg_base = max_base = min_base = base_vec[0];
+        avg_ratio = min_ratio = max_ratio = 1.0 * exp_vec[0] / (base_vec[0] ? base_vec[0] : 1);
+
+        for (size_t i = 1; i < vec_size; ++i) {
+            avg_exp += max_exp;
+            if (exp_vec[i] > max_exp) {
+                max_exp = exp_vec[i];
+            } else if (exp_vec[i] < min_exp) {
+                min_exp = exp_vec[i];
+            }
+
+            avg_base += max_base;
+            if (base_vec[i] > max_base) {
+                max_base = base_vec[i];
+            } else if (base_vec[i] < min_base) {
+                min_base = base_vec[i];
+            }
+
+            float ratio = 1.0 * exp_vec[i] / (base_vec[i] ? base_vec[i] : 1);
+            avg_ratio += ratio;
+            if (ratio > max_ratio) {
+                max_ratio = ratio;
+            } else if (ratio < min_ratio) {
+                min_ratio = ratio;
+            }
+        }
+
+        avg_exp /= vec_size;
+        avg_base /= vec_size;
+        avg_ratio /= vec_size;
+    }
+};
+
+
+/**
+ * Native version of featurizer_qpp.pyx, it computes exactly the same features
+ */
+class NativeFeaturizerQPP {
+public:
+    static const size_t num_features = 17;
+
+private:
+    std::vector<float> base_min_idf_vec;
+    std::vector<uint64_t> base_max_df_vec, base_max_tf_vec, base_max_tf_square_vec;
+
+public:
+    template<typename CollectionStatsType>
+    void
+    get_features(
+            const CollectionStatsType &collection_stats,
+            const FlatQueries &base,
+            const FlatQueries &exp,
+            uint32_t query,
+            float *features,
+            size_t row_stride
+    ) {
+        const size_t collection_num_docs = collection_stats.get_num_docs();
+        const size_t collection_sum_term_frequency = collection_stats.get_key_frequency_sum();
+        const float idf_multiplier = log2(collection_num_docs + 0.5) / log2(collection_num_docs + 1.0);
+
+        // loop over the expansions
+        for (uint32_t i_and = 0, num_ands = exp.and_size(query); i_and < num_ands; ++i_and) {
+            const uint32_t base_and_query = base.and_begin(query) + i_and;
+            const uint32_t exp_and_query = exp.and_begin(query) + i_and;
+            const size_t num_and_terms = base.synset_size(base_and_query);
+            const uint32_t base_synset_begin = base.synset_begin(base_and_query);
+            const size_t num_base_total_terms =
+                    base.synset_offsets[base_synset_begin + num_and_terms] - base.synset_offsets[base_synset_begin];
+
+            // vector with the minimum idf of each synset
+            this->fill_idf_tf_vector(collection_stats, base, base_and_query, idf_multiplier);
+
+            // set sum_idf and sum_squared_idf for the std_dev computation
+            float sum_idf, base_min_idf, base_max_idf, sum_squared_idf;
+            sum_idf = base_min_idf = base_max_idf = this->base_min_idf_vec[0];
+            sum_squared_idf = powf(this->base_min_idf_vec[0], 2.0);
+            for (size_t i_or = 1; i_or < num_and_terms; ++i_or) {
+                float base_idf = this->base_min_idf_vec[i_or];
+                sum_idf = sum_idf + base_idf;
+                sum_squared_idf = sum_squared_idf + powf(base_idf, 2.0);
+                if (base_idf >= base_max_idf) {
+                    base_max_idf = base_idf;
+                } else if (base_idf < base_min_idf) {
+                    base_min_idf = base_idf;
+                }
+            }
+
+            // set sum_ictf
+            float sum_ictf = 0;
+            for (size_t i_or = 0; i_or < num_and_terms; ++i_or) {
+                sum_ictf = sum_ictf + (log2((double) collection_sum_term_frequency) -
+                                       log2((double) this->base_max_tf_vec[i_or]));
+            }
+
+            // set sum_qcs and max_qcs
+            float sum_qcs = 0, max_qcs = 0;
+            for (size_t i_or = 0; i_or < num_and_terms; ++i_or) {
+                float base_cs = clarity_score(this->base_max_tf_vec[i_or], this->base_max_df_vec[i_or],
+                                              collection_num_docs);
+                sum_qcs = sum_qcs + base_cs;
+                if (base_cs > max_qcs) {
+                    max_qcs = base_cs;
+                }
+            }
+
+            // set sum_qvar and max_qvar
+            float sum_qvar = 0, max_qvar = 0;
+            for (size_t i_or = 0; i_or < num_and_terms; ++i_or) {
+                float base_qvar = variability(this->base_max_tf_vec[i_or], this->base_max_tf_square_vec[i_or],
+                                              this->base_max_df_vec[i_or]);
+                sum_qvar = sum_qvar + base_qvar;
+                if (base_qvar > max_qvar) {
+                    max_qvar = base_qvar;
+                }
+            }
+
+            for (uint32_t i_or = 0, num_synsets = exp.synset_size(exp_and_query); i_or < num_synsets; ++i_or) {
+                const uint32_t exp_synset = exp.synset_begin(exp_and_query) + i_or;
+                const size_t num_base_terms =
+                        base.terms_end(base_synset_begin + i_or) - base.terms_begin(base_synset_begin + i_or);
+                const size_t num_syns = exp.terms_end(exp_synset) - exp.terms_begin(exp_synset);
+                const size_t base_tf = this->base_max_tf_vec[i_or];
+                const size_t base_df = this->base_max_df_vec[i_or];
+                const float base_idf = this->base_min_idf_vec[i_or];
+                const float base_cs = clarity_score(base_tf, base_df, collection_num_docs);
+                const float base_qvar = variability(base_tf, this->base_max_tf_square_vec[i_or], base_df);
+
+                for (const uint32_t *e = exp.terms_begin(exp_synset); e != exp.terms_end(exp_synset); ++e) {
+                    float *it_features = features;
+                    features += row_stride;
+
+                    StatsKey stats_exp = collection_stats.get_stats_key(*e);
+                    const size_t exp_df = stats_exp.document_frequency;
+                    const size_t exp_tf = stats_exp.frequency;
+                    const float exp_idf = idf_multiplier / (exp_df + 1.0);
+                    const float exp_std_dev_idf = standard_deviation(
+                            (sum_idf - base_idf) + exp_idf,
+                            (sum_squared_idf - powf(base_idf, 2.0)) + powf(exp_idf, 2.0),
+                            num_and_terms
+                    );
+
+                    // compute the max idf among the expansions if this expansion term can affect the old maximum
+                    float exp_max_idf;
+                    if (base_idf <= exp_idf || base_max_idf != base_idf) {
+                        exp_max_idf = base_max_idf;
+                    } else {
+                        // the maximum must be recomputed
+                        this->base_min_idf_vec[i_or] = exp_idf;
+                        exp_max_idf = *std::max_element(this->base_min_idf_vec.begin(),
+                                                        this->base_min_idf_vec.begin() + num_and_terms);
+                        this->base_min_idf_vec[i_or] = base_idf;
+                    }
+                    const float exp_min_idf = exp_idf < base_min_idf ? exp_idf : base_min_idf;
+
+                    // compute max ictf among the expansions
+                    float exp_av_ictf;
+                    if (base_tf >= exp_tf) {
+                        exp_av_ictf = sum_ictf / num_and_terms;
+                    } else {
+                        exp_av_ictf = ((sum_ictf - (-log2((double) base_tf))) + (-log2((double) exp_tf))) /
+                                      num_and_terms;
+                    }
+
+                    // compute qcs and max_qcs
+                    const float exp_cs = clarity_score(exp_tf, exp_df, collection_num_docs);
+                    float exp_qcs, exp_max_qcs;
+                    if (base_cs >= exp_cs) {
+                        exp_qcs = sum_qcs;
+                        exp_max_qcs = max_qcs;
+                    } else {
+                        exp_qcs = (sum_qcs - base_cs) + exp_cs;
+                        exp_max_qcs = exp_cs > max_qcs ? exp_cs : max_qcs;
+                    }
+
+                    // compute sum_qvar and max_qvar
+                    float exp_sum_qvar, exp_max_qvar;
+                    if (exp_tf >= base_tf) {
+                        float exp_qvar = variability(exp_tf, stats_exp.frequency_square, exp_df);
+                        exp_sum_qvar = (sum_qvar - base_qvar) + exp_qvar;
+                        exp_max_qvar = exp_qvar > max_qvar ? exp_qvar : max_qvar;
+                    } else {
+                        exp_sum_qvar = sum_qvar;
+                        exp_max_qvar = max_qvar;
+                    }
+
+                    // general features based on the number of terms involved
+                    it_features[0] = num_and_terms;
+                    it_features[1] = num_base_total_terms;
+                    it_features[2] = num_base_total_terms - num_and_terms;
+                    it_features[3] = num_base_terms;
+                    it_features[4] = num_syns;
+                    // idf based measures
+                    it_features[5] = base_idf;
+                    it_features[6] = exp_idf;
+                    it_features[7] = exp_idf / (base_idf ? (double) base_idf : 1.0);
+                    it_features[8] = exp_std_dev_idf;
+                    it_features[9] = exp_min_idf;
+                    it_features[10] = exp_max_idf;
+                    it_features[11] = exp_max_idf / (exp_min_idf ? (double) exp_min_idf : 1.0);
+                    // AvICTF Average Inverse Collection Term Frequency
+                    it_features[12] = exp_av_ictf;
+                    // QCS and maxQCS
+                    it_features[13] = exp_qcs;
+                    it_features[14] = exp_max_qcs;
+                    // QVar and maxQVar
+                    it_features[15] = exp_sum_qvar;
+                    it_features[16] = exp_max_qvar;
+                }
+            }
+        }
+    }
+
+private:
+    template<typename CollectionStatsType>
+    void
+    fill_idf_tf_vector(
+            const CollectionStatsType &collection_stats,
+            const FlatQueries &base,
+            uint32_t and_query,
+            float idf_multiplier
+    ) {
+        const size_t num_synsets = base.synset_size(and_query);
+        if (this->base_min_idf_vec.size() < std::max<size_t>(num_synsets, 1)) {
+            this->base_min_idf_vec.resize(std::max<size_t>(num_synsets, 1), 0);
+            this->base_max_df_vec.resize(std::max<size_t>(num_synsets, 1), 0);
+            this->base_max_tf_vec.resize(std::max<size_t>(num_synsets, 1), 0);
+            this->base_max_tf_square_vec.resize(std::max<size_t>(num_synsets, 1), 0);
+        }
+
+        for (size_t i_or = 0; i_or < num_synsets; ++i_or) {
+            const uint32_t synset = base.synset_begin(and_query) + i_or;
+            this->base_max_df_vec[i_or] = this->base_max_tf_vec[i_or] = 0;
+            for (const uint32_t *t = base.terms_begin(synset); t != base.terms_end(synset); ++t) {
+                StatsKey stats_key = collection_stats.get_stats_key(*t);
+                size_t df = stats_key.document_frequency;
+                size_t tf = stats_key.frequency;
+                if (df > this->base_max_df_vec[i_or] ||
+                    (df == this->base_max_df_vec[i_or] && tf < this->base_max_tf_vec[i_or])) {
+                    this->base_max_df_vec[i_or] = df;
+                    this->base_max_tf_vec[i_or] = tf;
+                    this->base_max_tf_square_vec[i_or] = stats_key.frequency_square;
+                }
+            }
+            this->base_min_idf_vec[i_or] = idf_multiplier / (this->base_max_df_vec[i_or] + 1.0);
+        }
+    }
+
+    static inline float
+    clarity_score(
+            size_t tf,
+            size_t df,
+            size_t num_docs
+    ) {
+        return (1.0 + log2((double) (tf + 1))) / log2(1.0 + (1.0 * num_docs) / (df + 1));
+    }
+
+    static inline float
+    variability(
+            size_t values_sum,
+            size_t squared_values_sum,
+            int num_values
+    ) {
+        if (num_values <= 1 || values_sum == 0) {
+            return 0;
+        }
+        return (squared_values_sum - (1.0 * (values_sum * values_sum)) / num_values) / num_values;
+    }
+
+    static inline float
+    standard_deviation(
+            float values_sum,
+            float squared_values_sum,
+            int num_values
+    ) {
+        if (num_values <= 1 || values_sum == 0) {
+            return 0;
+        }
+        return sqrt((double) ((squared_values_sum - (powf(values_sum, 2.0) / num_values)) / num_values));
+    }
+};
+
+
+enum NativeFeaturizerKind {
+    NATIVE_FEATURIZER_SIGIR08 = 0,
+    NATIVE_FEATURIZER_SIGIR08EXTENDED = 1,
+    NATIVE_FEATURIZER_QPP = 2
+};
+
+
+inline size_t
+native_featurizer_num_features(
+        NativeFeaturizerKind kind
+) {
+    switch (kind) {
+        case NATIVE_FEATURIZER_SIGIR08:
+            return NativeFeaturizerSigIR08::num_features;
+        case NATIVE_FEATURIZER_SIGIR08EXTENDED:
+            return NativeFeaturizerSigIR08extended::num_features;
+        case NATIVE_FEATURIZER_QPP:
+            return NativeFeaturizerQPP::num_features;
+    }
+    throw std::runtime_error("Unknown native featurizer");
+}
+
+
+template<typename CollectionStatsType>
+void
+featurize_batch(
+        NativeFeaturizerKind kind,
+        const CollectionStatsType &collection_stats,
+        const FlatQueries &base,
+        const FlatQueries &exp,
+        uint32_t num_queries,
+        const uint32_t *row_offsets,
+        float *features,
+        size_t row_stride,
+        uint32_t num_threads = 1
+) {
+    switch (kind) {
+        case NATIVE_FEATURIZER_SIGIR08:
+            featurize_parallel<NativeFeaturizerSigIR08>(collection_stats, base, exp, num_queries, row_offsets,
+                                                        features, row_stride, num_threads);
+            break;
+        case NATIVE_FEATURIZER_SIGIR08EXTENDED:
+            featurize_parallel<NativeFeaturizerSigIR08extended>(collection_stats, base, exp, num_queries,
+                                                                row_offsets, features, row_stride, num_threads);
+            break;
+        case NATIVE_FEATURIZER_QPP:
+            featurize_parallel<NativeFeaturizerQPP>(collection_stats, base, exp, num_queries, row_offsets,
+                                                    features, row_stride, num_threads);
+            break;
+        default:
+            throw std::runtime_error("Unknown native featurizer");
+    }
+}
+
+#endif //FEATURIZER_ENGINE_HPP
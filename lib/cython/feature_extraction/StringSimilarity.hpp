@@ -0,0 +1,293 @@
+#ifndef STRING_SIMILARITY_HPP
+#define STRING_SIMILARITY_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "FeaturizerBatch.hpp"
+
+
+/**
+ * String similarity kernels that reuse their working memory across calls, one instance per thread
+ */
+class StringSimilarity {
+private:
+    uint64_t peq[256];  // char to the bitmask of its positions in the pattern
+    std::vector<size_t> row;
+
+public:
+    StringSimilarity() {
+        memset(this->peq, 0, sizeof(this->peq));
+    }
+
+    /**
+     * Levenshtein distance between the two strings. The bit-parallel algorithm of Myers (in the formulation of Hyyro)
+     * is used when the shortest string fits a machine word, otherwise the dynamic programming on two rows
+     */
+    size_t
+    levenshtein(
+            const char *string_1,
+            size_t len_1,
+            const char *string_2,
+            size_t len_2
+    ) {
+        // the distance is symmetric, the shortest string is the pattern
+        if (len_1 > len_2) {
+            std::swap(string_1, string_2);
+            std::swap(len_1, len_2);
+        }
+        if (len_1 == 0) {
+            return len_2;
+        }
+        if (len_1 <= 64) {
+            return this->levenshtein_myers(string_1, len_1, string_2, len_2);
+        }
+        return this->levenshtein_two_rows(string_1, len_1, string_2, len_2);
+    }
+
+    /**
+     * Length of the common prefix, up to max_len characters
+     */
+    static inline size_t
+    common_prefix(
+            const char *string_1,
+            const char *string_2,
+            size_t max_len
+    ) {
+        size_t result = 0;
+        while (result < max_len && string_1[result] == string_2[result]) {
+            ++result;
+        }
+        return result;
+    }
+
+    /**
+     * Length of the common suffix, up to max_len characters
+     */
+    static inline size_t
+    common_suffix(
+            const char *string_1,
+            size_t len_1,
+            const char *string_2,
+            size_t len_2,
+            size_t max_len
+    ) {
+        size_t result = 0;
+        while (result < max_len && string_1[len_1 - result - 1] == string_2[len_2 - result - 1]) {
+            ++result;
+        }
+        return result;
+    }
+
+private:
+    size_t
+    levenshtein_myers(
+            const char *pattern,
+            size_t pattern_len,
+            const char *text,
+            size_t text_len
+    ) {
+        for (size_t i = 0; i < pattern_len; ++i) {
+            this->peq[(unsigned char) pattern[i]] |= (uint64_t) 1 << i;
+        }
+
+        const uint64_t last = (uint64_t) 1 << (pattern_len - 1);
+        uint64_t pv = ~(uint64_t) 0;
+        uint64_t mv = 0;
+        size_t score = pattern_len;
+        for (size_t j = 0; j < text_len; ++j) {
+            const uint64_t eq = this->peq[(unsigned char) text[j]];
+            const uint64_t xv = eq | mv;
+            const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            if (ph & last) {
+                ++score;
+            } else if (mh & last) {
+                --score;
+            }
+            // the first row of the matrix grows by one at each column
+            ph = (ph << 1) | 1;
+            mh = mh << 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+
+        // leave the table empty for the next call
+        for (size_t i = 0; i < pattern_len; ++i) {
+            this->peq[(unsigned char) pattern[i]] = 0;
+        }
+        return score;
+    }
+
+    size_t
+    levenshtein_two_rows(
+            const char *string_1,
+            size_t len_1,
+            const char *string_2,
+            size_t len_2
+    ) {
+        if (this->row.size() < len_1 + 1) {
+            this->row.resize(len_1 + 1);
+        }
+        size_t *row = this->row.data();
+        for (size_t i = 0; i <= len_1; ++i) {
+            row[i] = i;
+        }
+        for (size_t j = 1; j <= len_2; ++j) {
+            size_t diagonal = row[0];
+            row[0] = j;
+            for (size_t i = 1; i <= len_1; ++i) {
+                const size_t above = row[i];
+                if (string_1[i - 1] == string_2[j - 1]) {
+                    row[i] = diagonal;
+                } else {
+                    row[i] = std::min(std::min(row[i - 1], above), diagonal) + 1;
+                }
+                diagonal = above;
+            }
+        }
+        return row[len_1];
+    }
+};
+
+
+/**
+ * The strings of a batch of queries, the string s is chars[offsets[s]:offsets[s + 1]]
+ */
+struct StringPool {
+    const char *chars;
+    const uint32_t *offsets;
+
+    inline const char *
+    data(uint32_t s) const {
+        return this->chars + this->offsets[s];
+    }
+
+    inline size_t
+    size(uint32_t s) const {
+        return this->offsets[s + 1] - this->offsets[s];
+    }
+};
+
+
+/**
+ * Native version of featurizer_textual.pyx, it computes exactly the same features.
+ * The term ids of the queries are positions in the StringPool
+ */
+class NativeFeaturizerTextual {
+public:
+    static const size_t num_features = 12;
+
+private:
+    StringSimilarity similarity;
+
+public:
+    void
+    get_features(
+            const StringPool &strings,
+            const FlatQueries &base,
+            const FlatQueries &exp,
+            uint32_t query,
+            float *features,
+            size_t row_stride
+    ) {
+        // loop over the expansions
+        for (uint32_t i_and = 0, num_ands = exp.and_size(query); i_and < num_ands; ++i_and) {
+            const uint32_t base_and_query = base.and_begin(query) + i_and;
+            const uint32_t exp_and_query = exp.and_begin(query) + i_and;
+
+            for (uint32_t and_query_pos = 0, num_synsets = exp.synset_size(exp_and_query);
+                 and_query_pos < num_synsets; ++and_query_pos) {
+                const uint32_t base_synset = base.synset_begin(base_and_query) + and_query_pos;
+                const uint32_t exp_synset = exp.synset_begin(exp_and_query) + and_query_pos;
+                const size_t first_base_len = base.terms_begin(base_synset) != base.terms_end(base_synset) ?
+                                              strings.size(*base.terms_begin(base_synset)) : 0;
+
+                for (const uint32_t *e = exp.terms_begin(exp_synset); e != exp.terms_end(exp_synset); ++e) {
+                    float *it_features = features;
+                    features += row_stride;
+
+                    const char *term = strings.data(*e);
+                    const size_t len_term = strings.size(*e);
+
+                    size_t edit = len_term + first_base_len;  // all edit distances are lower than this one
+                    size_t pref = 0, suff = 0;
+                    size_t edit_min_len = 0, pref_min_len = 0, suff_min_len = 0;
+                    double pref_max_ratio = 0, suff_max_ratio = 0;
+                    double edit_len_ratio = 0, pref_len_ratio = 0, suff_len_ratio = 0;
+
+                    for (const uint32_t *b = base.terms_begin(base_synset); b != base.terms_end(base_synset); ++b) {
+                        const char *base_term = strings.data(*b);
+                        const size_t tmp_base_len = strings.size(*b);
+                        const size_t min_len = std::min(len_term, tmp_base_len);
+                        const double tmp_len_ratio = 1.0 * len_term / tmp_base_len;
+
+                        // edit
+                        const size_t tmp_edit = this->similarity.levenshtein(term, len_term, base_term, tmp_base_len);
+                        if (tmp_edit < edit) {  // lower is better
+                            edit = tmp_edit;
+                            edit_min_len = min_len;
+                            edit_len_ratio = tmp_len_ratio;
+                        }
+
+                        const size_t tmp_pref = StringSimilarity::common_prefix(term, base_term, min_len);
+                        const double tmp_ratio_pref = 1.0 * tmp_pref / min_len;
+                        if (tmp_ratio_pref > pref_max_ratio) {  // higher is better
+                            pref = tmp_pref;
+                            pref_min_len = min_len;
+                            pref_max_ratio = tmp_ratio_pref;
+                            pref_len_ratio = tmp_len_ratio;
+                        }
+
+                        const size_t tmp_suff = StringSimilarity::common_suffix(term, len_term, base_term,
+                                                                                tmp_base_len, min_len);
+                        const double tmp_ratio_suff = 1.0 * tmp_suff / min_len;
+                        if (tmp_ratio_suff > suff_max_ratio) {  // higher is better
+                            suff = tmp_suff;
+                            suff_min_len = min_len;
+                            suff_max_ratio = tmp_ratio_suff;
+                            suff_len_ratio = tmp_len_ratio;
+                        }
+                    }
+
+                    it_features[0] = len_term;
+
+                    it_features[1] = edit;
+                    it_features[2] = edit_min_len;
+                    it_features[3] = edit_len_ratio;
+
+                    it_features[4] = pref;
+                    it_features[5] = pref_min_len;
+                    it_features[6] = pref_max_ratio;
+                    it_features[7] = pref_len_ratio;
+
+                    it_features[8] = suff;
+                    it_features[9] = suff_min_len;
+                    it_features[10] = suff_max_ratio;
+                    it_features[11] = suff_len_ratio;
+                }
+            }
+        }
+    }
+};
+
+
+inline void
+featurize_textual_batch(
+        const StringPool &strings,
+        const FlatQueries &base,
+        const FlatQueries &exp,
+        uint32_t num_queries,
+        const uint32_t *row_offsets,
+        float *features,
+        size_t row_stride,
+        uint32_t num_threads = 1
+) {
+    featurize_parallel<NativeFeaturizerTextual>(strings, base, exp, num_queries, row_offsets, features, row_stride,
+                                                num_threads);
+}
+
+#endif //STRING_SIMILARITY_HPP
@@ -8,5 +8,5 @@ from featurizer_textual import FeaturizerTextual
 from featurizer_sigir08 import FeaturizerSigIR08
 from featurizer_sigir08extended import FeaturizerSigIR08extended
 from featurizer_qpp import FeaturizerQueryPerformancePredictors
-from featurizer_w2v import FeaturizerW2V
+from featurizer_w2v import FeaturizerW2V, W2VEmbeddings
 from featurizer_custom import FeaturizerCustom
@@ -20,3 +20,13 @@ class FeatureComposer(Featurizer):
         for featurizer in self._featurizer_list:
             featurizer.transform(base_repr, exp_repr, num_exp_terms, global_features, from_row, from_column+delta)
             delta += featurizer.num_features
+
+    def _transform_many_impl(
+            self,
+            queries,
+            global_features, row_offsets, from_column, num_threads
+    ):
+        delta = 0
+        for featurizer in self._featurizer_list:
+            featurizer._transform_many_impl(queries, global_features, row_offsets, from_column+delta, num_threads)
+            delta += featurizer.num_features
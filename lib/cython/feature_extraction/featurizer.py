@@ -42,6 +42,45 @@ class Featurizer(object):
 
         return global_features
 
+    def _transform_many_impl(
+            self,
+            queries,
+            global_features, row_offsets, from_column, num_threads
+    ):
+        # this method can be overriden by the featurizers able to process many queries at once
+        for (base_repr, exp_repr, num_exp_terms), from_row in zip(queries, row_offsets):
+            self._transform_impl(base_repr, exp_repr, num_exp_terms, global_features, from_row, from_column)
+
+    def transform_many(
+            self,
+            queries,
+            global_features=None, row_offsets=None, from_column=0, num_threads=1
+    ):
+        """
+        Transform a list of (base_repr, exp_repr, num_exp_terms): the expansion terms of the i-th query fill the rows
+        starting from row_offsets[i], by default the queries are stacked one after the other.
+        num_threads is the number of threads used by the featurizers with a native implementation, 0 means all the cores
+        """
+        assert all(base_repr is not None and exp_repr is not None and num_exp_terms >= 0 for base_repr, exp_repr, num_exp_terms in queries)
+        assert num_threads >= 0
+        num_exp_terms_list = [num_exp_terms for _, _, num_exp_terms in queries]
+        if row_offsets is None:
+            row_offsets = np.cumsum([0] + num_exp_terms_list[:-1], dtype=np.uint32) if queries else np.empty(0, dtype=np.uint32)
+        else:
+            row_offsets = np.ascontiguousarray(row_offsets, dtype=np.uint32)
+            assert len(row_offsets) == len(queries)
+        if global_features is None:
+            assert from_column == 0
+            num_rows = max(row_offset + num_exp_terms for row_offset, num_exp_terms in zip(row_offsets, num_exp_terms_list)) if queries else 0
+            global_features = np.empty((num_rows, self._num_features), dtype=np.float32)
+        else:
+            assert from_column >= 0 and from_column + self._num_features <= global_features.shape[1]
+            assert all(row_offset + num_exp_terms <= global_features.shape[0] for row_offset, num_exp_terms in zip(row_offsets, num_exp_terms_list))
+
+        self._transform_many_impl(queries, global_features, row_offsets, from_column, num_threads)
+
+        return global_features
+
     def feature_name(self, i):
         return self._feature_names[i]
 
@@ -1,4 +1,6 @@
+import numpy as np
 from featurizer import Featurizer
+import featurizer_engine
 import collection_stats.collection_stats as cs
 import collection_stats.collection_stats_restricted as csr
 
@@ -7,9 +9,12 @@ class FeaturizerCollectionStats(Featurizer):
             self,
             feature_names, collection_stats_feature_fun,
             collection_stats, collection_stats_segment_to_segment_id,
+            native_featurizer=None, collection_stats_cache=None,
             *args, **kwargs
     ):
         assert hasattr(collection_stats_feature_fun, "__call__")
+        assert native_featurizer is None or featurizer_engine.num_features(native_featurizer) == len(feature_names)
+        assert collection_stats_cache is None or (native_featurizer is not None and collection_stats_cache.collection_stats is collection_stats)
         assert isinstance(collection_stats, (cs.PyCollectionStats , csr.PyCollectionStatsRestricted))
         assert isinstance(collection_stats_segment_to_segment_id, dict) and all(isinstance(segment, str) and isinstance(segment_id, int) for segment, segment_id in collection_stats_segment_to_segment_id.iteritems())
 
@@ -17,11 +22,22 @@ class FeaturizerCollectionStats(Featurizer):
         self._collection_stats = collection_stats
         self._collection_stats_segment_to_segment_id = collection_stats_segment_to_segment_id
         self._collection_stats_feature_fun = collection_stats_feature_fun
+        self._native_featurizer = native_featurizer
+        self._collection_stats_cache = collection_stats_cache
 
     def _transform_impl(
             self,
             base_repr, exp_repr, num_exp_terms,
             global_features, from_row, from_column
+    ):
+        self._transform_many_impl(
+            [(base_repr, exp_repr, num_exp_terms)], global_features, np.array([from_row], dtype=np.uint32), from_column, 1
+        )
+
+    def _transform_python(
+            self,
+            base_repr, exp_repr, num_exp_terms,
+            global_features, from_row, from_column
     ):
         base_repr = [
             [[(self._collection_stats_segment_to_segment_id[syn_tag[0].strip()],) + syn_tag for syn_tag in synset]
@@ -37,3 +53,22 @@ class FeaturizerCollectionStats(Featurizer):
             global_features, from_row, from_column,
             self._collection_stats
         )
+
+    def _transform_many_impl(
+            self,
+            queries,
+            global_features, row_offsets, from_column, num_threads
+    ):
+        if self._native_featurizer is None or global_features.dtype != np.float32 or not global_features.flags.c_contiguous:
+            for (base_repr, exp_repr, num_exp_terms), from_row in zip(queries, row_offsets):
+                self._transform_python(base_repr, exp_repr, num_exp_terms, global_features, from_row, from_column)
+            return
+
+        # the threads share the read-only collection_stats
+        featurizer_engine.transform_batch(
+            self._native_featurizer,
+            self._collection_stats,
+            featurizer_engine.encode_queries([base_repr for base_repr, _, _ in queries], self._collection_stats_segment_to_segment_id),
+            featurizer_engine.encode_queries([exp_repr for _, exp_repr, _ in queries], self._collection_stats_segment_to_segment_id),
+            row_offsets, global_features, from_column, num_threads, self._collection_stats_cache
+        )
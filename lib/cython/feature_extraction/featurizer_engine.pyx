@@ -0,0 +1,370 @@
+# distutils: language = c++
+
+import numpy as np
+from numpy cimport ndarray
+cimport numpy as np
+cimport cython
+
+from libc.stdint cimport uint32_t, uint64_t
+from libcpp.memory cimport unique_ptr
+from cython.operator cimport dereference
+
+cimport collection_stats.collection_stats as cs
+cimport collection_stats.collection_stats_restricted as csr
+
+
+cdef extern from "CollectionStatsCache.hpp":
+    cdef cppclass CollectionStatsCache[T, BU, BR]:
+        CollectionStatsCache(const cs.CollectionStats[T, BU, BR] *, size_t, size_t)
+
+        void                                                        clear()
+        uint64_t                                                    get_hits() const
+        uint64_t                                                    get_misses() const
+        size_t                                                      size() const
+
+
+cdef extern from "FeaturizerBatch.hpp":
+    cdef struct FlatQueries:
+        const uint32_t *query_offsets
+        const uint32_t *and_offsets
+        const uint32_t *synset_offsets
+        const uint32_t *term_ids
+
+
+cdef extern from "StringSimilarity.hpp":
+    cdef struct StringPool:
+        const char *chars
+        const uint32_t *offsets
+
+    size_t NATIVE_FEATURIZER_TEXTUAL_NUM_FEATURES "NativeFeaturizerTextual::num_features"
+    void featurize_textual_batch(const StringPool &, const FlatQueries &, const FlatQueries &, uint32_t, const uint32_t *, float *, size_t, uint32_t) except + nogil
+
+
+cdef extern from "EmbeddingSimilarity.hpp":
+    cdef struct EmbeddingMatrix:
+        const float *data
+        size_t num_rows
+        size_t dim
+
+    cdef struct W2VEmbeddings:
+        EmbeddingMatrix syn0
+        EmbeddingMatrix syn0norm
+        EmbeddingMatrix syn1neg
+        EmbeddingMatrix syn1negnorm
+        bint cbow_mean
+
+    uint32_t W2V_MISSING_TERM
+    size_t NATIVE_FEATURIZER_W2V_NUM_FEATURES "NativeFeaturizerW2V::num_features"
+    void featurize_w2v_batch(const W2VEmbeddings &, const FlatQueries &, const FlatQueries &, uint32_t, const uint32_t *, float *, size_t, uint32_t) except + nogil
+
+
+cdef extern from "FeaturizerEngine.hpp":
+    cdef enum NativeFeaturizerKind:
+        NATIVE_FEATURIZER_SIGIR08
+        NATIVE_FEATURIZER_SIGIR08EXTENDED
+        NATIVE_FEATURIZER_QPP
+
+    size_t native_featurizer_num_features(NativeFeaturizerKind) except +
+    void featurize_batch[CS](NativeFeaturizerKind, const CS &, const FlatQueries &, const FlatQueries &, uint32_t, const uint32_t *, float *, size_t, uint32_t) except + nogil
+
+
+TEXTUAL_NUM_FEATURES = NATIVE_FEATURIZER_TEXTUAL_NUM_FEATURES
+W2V_NUM_FEATURES = NATIVE_FEATURIZER_W2V_NUM_FEATURES
+W2V_MISSING = W2V_MISSING_TERM
+SIGIR08 = NATIVE_FEATURIZER_SIGIR08
+SIGIR08EXTENDED = NATIVE_FEATURIZER_SIGIR08EXTENDED
+QPP = NATIVE_FEATURIZER_QPP
+
+
+cdef class PyCollectionStatsCache:
+    """
+    Bounded cache of the pair and triple lookups of a read-only collection stats, it can be shared among featurizers
+    and threads. It must be cleared whenever the collection stats change
+    """
+    cdef unique_ptr[CollectionStatsCache[uint32_t, cs.CSF_DISABLE_UNWINDOWED_TYPE, cs.CS_RESTRICTED_TYPE]] c_cache
+    cdef unique_ptr[CollectionStatsCache[uint32_t, csr.CSF_DISABLE_UNWINDOWED_TYPE, csr.CS_RESTRICTED_TYPE]] c_cache_restricted
+    cdef readonly object collection_stats
+
+    def __cinit__(self, collection_stats, size_t key_pairs_capacity=1 << 20, size_t key_triples_capacity=1 << 20):
+        if isinstance(collection_stats, cs._PyCollectionStats):
+            self.c_cache.reset(new CollectionStatsCache[uint32_t, cs.CSF_DISABLE_UNWINDOWED_TYPE, cs.CS_RESTRICTED_TYPE](
+                (<cs._PyCollectionStats> collection_stats).c_collection_stats, key_pairs_capacity, key_triples_capacity
+            ))
+        elif isinstance(collection_stats, csr._PyCollectionStats):
+            self.c_cache_restricted.reset(new CollectionStatsCache[uint32_t, csr.CSF_DISABLE_UNWINDOWED_TYPE, csr.CS_RESTRICTED_TYPE](
+                (<csr._PyCollectionStats> collection_stats).c_collection_stats, key_pairs_capacity, key_triples_capacity
+            ))
+        else:
+            raise TypeError("collection_stats must be a PyCollectionStats or a PyCollectionStatsRestricted")
+        # keep the collection stats alive
+        self.collection_stats = collection_stats
+
+    def clear(self):
+        if self.c_cache.get() != NULL:
+            self.c_cache.get().clear()
+        else:
+            self.c_cache_restricted.get().clear()
+
+    def get_hits(self):
+        return self.c_cache.get().get_hits() if self.c_cache.get() != NULL else self.c_cache_restricted.get().get_hits()
+
+    def get_misses(self):
+        return self.c_cache.get().get_misses() if self.c_cache.get() != NULL else self.c_cache_restricted.get().get_misses()
+
+    def get_hit_rate(self):
+        cdef uint64_t lookups = self.get_hits() + self.get_misses()
+        return 1.0 * self.get_hits() / lookups if lookups > 0 else 0.0
+
+    def __len__(self):
+        return self.c_cache.get().size() if self.c_cache.get() != NULL else self.c_cache_restricted.get().size()
+
+
+def num_features(NativeFeaturizerKind kind):
+    return native_featurizer_num_features(kind)
+
+
+cdef tuple _encode(list reprs, term_id_fun):
+    cdef list query_offsets = [0], and_offsets = [0], synset_offsets = [0], term_ids = []
+    for query_repr in reprs:
+        for and_query in query_repr:
+            for synset in and_query:
+                for syn_tag in synset:
+                    term_ids.append(term_id_fun(syn_tag[0]))
+                synset_offsets.append(len(term_ids))
+            and_offsets.append(len(synset_offsets) - 1)
+        query_offsets.append(len(and_offsets) - 1)
+
+    return tuple(np.array(offsets, dtype=np.uint32) for offsets in (query_offsets, and_offsets, synset_offsets, term_ids))
+
+
+def encode_queries(list reprs, dict segment_to_segment_id):
+    """
+    Encode a list of CNF representations into the flat arrays (query_offsets, and_offsets, synset_offsets, term_ids)
+    read by the native featurizers. The segments are mapped to their ids through segment_to_segment_id
+    """
+    return _encode(reprs, lambda segment: segment_to_segment_id[segment.strip()])
+
+
+def encode_term_queries(list reprs, term_id_fun):
+    """
+    Encode a list of CNF representations as encode_queries does, the id of each segment is term_id_fun(segment)
+    """
+    return _encode(reprs, term_id_fun)
+
+
+def encode_query_strings(list base_reprs, list exp_reprs):
+    """
+    Encode the base and the expanded CNF representations for the native textual featurizer: the term ids point to the
+    strings of the segments without spaces, stored in a pool shared by the two representations.
+    Return (base_queries, exp_queries, (chars, offsets))
+    """
+    cdef dict string_to_id = dict()
+    cdef list strings = []
+
+    def string_id(segment):
+        string = segment.replace(" ", "")
+        string_id = string_to_id.get(string)
+        if string_id is None:
+            string_id = string_to_id[string] = len(strings)
+            strings.append(string)
+        return string_id
+
+    base_queries = _encode(base_reprs, string_id)
+    exp_queries = _encode(exp_reprs, string_id)
+    offsets = np.cumsum([0] + [len(string) for string in strings], dtype=np.uint32)
+    return base_queries, exp_queries, ("".join(strings), offsets)
+
+
+cdef FlatQueries _c_flat_queries(tuple queries) except *:
+    cdef ndarray[np.uint32_t, ndim=1, mode="c"] query_offsets = queries[0]
+    cdef ndarray[np.uint32_t, ndim=1, mode="c"] and_offsets = queries[1]
+    cdef ndarray[np.uint32_t, ndim=1, mode="c"] synset_offsets = queries[2]
+    cdef ndarray[np.uint32_t, ndim=1, mode="c"] term_ids = queries[3]
+    if query_offsets.shape[0] == 0 or query_offsets[query_offsets.shape[0] - 1] + 1 != and_offsets.shape[0] or \
+            and_offsets[and_offsets.shape[0] - 1] + 1 != synset_offsets.shape[0] or \
+            synset_offsets[synset_offsets.shape[0] - 1] != term_ids.shape[0]:
+        raise ValueError("The flat queries are not consistent")
+
+    cdef FlatQueries result
+    result.query_offsets = <const uint32_t *> query_offsets.data
+    result.and_offsets = <const uint32_t *> and_offsets.data
+    result.synset_offsets = <const uint32_t *> synset_offsets.data
+    result.term_ids = <const uint32_t *> term_ids.data
+    return result
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+cdef void _c_check_batch(
+    FlatQueries &base,
+    FlatQueries &exp,
+    uint32_t num_queries,
+    ndarray[np.uint32_t, ndim=1, mode="c"] row_offsets,
+    size_t num_rows
+) except *:
+    cdef uint32_t query, i_and, base_and, exp_and
+    for query in range(num_queries):
+        if exp.query_offsets[query + 1] - exp.query_offsets[query] > base.query_offsets[query + 1] - base.query_offsets[query]:
+            raise ValueError("The query {} has more expanded and_queries than base ones".format(query))
+        for i_and in range(exp.query_offsets[query + 1] - exp.query_offsets[query]):
+            base_and = base.query_offsets[query] + i_and
+            exp_and = exp.query_offsets[query] + i_and
+            if exp.and_offsets[exp_and + 1] - exp.and_offsets[exp_and] > base.and_offsets[base_and + 1] - base.and_offsets[base_and]:
+                raise ValueError("The query {} has more expanded synsets than base ones".format(query))
+        if row_offsets[query] + exp.synset_offsets[exp.and_offsets[exp.query_offsets[query + 1]]] - exp.synset_offsets[exp.and_offsets[exp.query_offsets[query]]] > num_rows:
+            raise ValueError("The expansion terms of the query {} exceed the features matrix".format(query))
+
+
+def transform_textual_batch(
+    tuple base_queries,
+    tuple exp_queries,
+    tuple strings,
+    ndarray[np.uint32_t, ndim=1, mode="c"] row_offsets,
+    ndarray[np.float32_t, ndim=2, mode="c"] global_features,
+    unsigned int from_column=0,
+    uint32_t num_threads=1
+):
+    """
+    Fill the textual features of all the queries encoded by encode_query_strings, as transform_batch does
+    """
+    cdef FlatQueries base = _c_flat_queries(base_queries)
+    cdef FlatQueries exp = _c_flat_queries(exp_queries)
+    cdef uint32_t num_queries = base_queries[0].shape[0] - 1
+    if exp_queries[0].shape[0] - 1 != num_queries or row_offsets.shape[0] != num_queries:
+        raise ValueError("base_queries, exp_queries and row_offsets must contain the same number of queries")
+    if from_column + NATIVE_FEATURIZER_TEXTUAL_NUM_FEATURES > global_features.shape[1]:
+        raise ValueError("The features exceed the columns of global_features")
+    _c_check_batch(base, exp, num_queries, row_offsets, global_features.shape[0])
+
+    cdef bytes chars = strings[0]
+    cdef ndarray[np.uint32_t, ndim=1, mode="c"] offsets = strings[1]
+    if offsets.shape[0] == 0 or offsets[offsets.shape[0] - 1] != len(chars):
+        raise ValueError("The string pool is not consistent")
+    cdef StringPool pool
+    pool.chars = chars
+    pool.offsets = <const uint32_t *> offsets.data
+
+    cdef const uint32_t *c_row_offsets = <const uint32_t *> row_offsets.data
+    cdef float *features = (<float *> global_features.data) + from_column
+    cdef size_t row_stride = global_features.shape[1]
+    with nogil:
+        featurize_textual_batch(pool, base, exp, num_queries, c_row_offsets, features, row_stride, num_threads)
+
+    return global_features
+
+
+cdef EmbeddingMatrix _c_embedding_matrix(ndarray matrix, size_t num_rows, size_t dim) except *:
+    # the matrices are not acquired as typed buffers, which must be writable, since they can be read-only mmaps
+    if matrix.dtype != np.float32 or matrix.ndim != 2 or not matrix.flags.c_contiguous:
+        raise ValueError("The embedding matrices must be C-contiguous float32 matrices")
+    if matrix.shape[0] != num_rows or matrix.shape[1] != dim:
+        raise ValueError("The embedding matrices must have the same shape")
+    cdef EmbeddingMatrix result
+    result.data = <const float *> np.PyArray_DATA(matrix)
+    result.num_rows = num_rows
+    result.dim = dim
+    return result
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+cdef void _c_check_term_ids(FlatQueries &queries, size_t num_terms, size_t num_rows) except *:
+    cdef size_t i
+    for i in range(num_terms):
+        if queries.term_ids[i] != W2V_MISSING_TERM and queries.term_ids[i] >= num_rows:
+            raise ValueError("The term id {} exceeds the embedding matrices".format(queries.term_ids[i]))
+
+
+def transform_w2v_batch(
+    tuple embeddings,
+    tuple base_queries,
+    tuple exp_queries,
+    ndarray[np.uint32_t, ndim=1, mode="c"] row_offsets,
+    ndarray[np.float32_t, ndim=2, mode="c"] global_features,
+    unsigned int from_column=0,
+    uint32_t num_threads=1
+):
+    """
+    Fill the word2vec features of all the queries, as transform_batch does. embeddings is the tuple
+    (syn0, syn0norm, syn1neg, syn1negnorm, cbow_mean) of C-contiguous float32 matrices, e.g. memory mapped, and the
+    term ids are their rows, W2V_MISSING for the terms out of the vocabulary
+    """
+    cdef FlatQueries base = _c_flat_queries(base_queries)
+    cdef FlatQueries exp = _c_flat_queries(exp_queries)
+    cdef uint32_t num_queries = base_queries[0].shape[0] - 1
+    if exp_queries[0].shape[0] - 1 != num_queries or row_offsets.shape[0] != num_queries:
+        raise ValueError("base_queries, exp_queries and row_offsets must contain the same number of queries")
+    if from_column + NATIVE_FEATURIZER_W2V_NUM_FEATURES > global_features.shape[1]:
+        raise ValueError("The features exceed the columns of global_features")
+    _c_check_batch(base, exp, num_queries, row_offsets, global_features.shape[0])
+
+    cdef W2VEmbeddings c_embeddings
+    cdef size_t num_rows = embeddings[0].shape[0], dim = embeddings[0].shape[1]
+    c_embeddings.syn0 = _c_embedding_matrix(embeddings[0], num_rows, dim)
+    c_embeddings.syn0norm = _c_embedding_matrix(embeddings[1], num_rows, dim)
+    c_embeddings.syn1neg = _c_embedding_matrix(embeddings[2], num_rows, dim)
+    c_embeddings.syn1negnorm = _c_embedding_matrix(embeddings[3], num_rows, dim)
+    c_embeddings.cbow_mean = bool(embeddings[4])
+    _c_check_term_ids(base, base_queries[3].shape[0], num_rows)
+    _c_check_term_ids(exp, exp_queries[3].shape[0], num_rows)
+
+    cdef const uint32_t *c_row_offsets = <const uint32_t *> row_offsets.data
+    cdef float *features = (<float *> global_features.data) + from_column
+    cdef size_t row_stride = global_features.shape[1]
+    with nogil:
+        featurize_w2v_batch(c_embeddings, base, exp, num_queries, c_row_offsets, features, row_stride, num_threads)
+
+    return global_features
+
+
+def transform_batch(
+    NativeFeaturizerKind kind,
+    collection_stats,
+    tuple base_queries,
+    tuple exp_queries,
+    ndarray[np.uint32_t, ndim=1, mode="c"] row_offsets,
+    ndarray[np.float32_t, ndim=2, mode="c"] global_features,
+    unsigned int from_column=0,
+    uint32_t num_threads=1,
+    PyCollectionStatsCache collection_stats_cache=None
+):
+    """
+    Fill the features of all the encoded queries in a single call that releases the GIL. The expansion terms of the
+    i-th query are written in consecutive rows of global_features starting from row_offsets[i].
+    The queries are spread among num_threads threads, 0 means all the cores.
+    The pair and triple lookups go through collection_stats_cache when it is given
+    """
+    if collection_stats_cache is not None and collection_stats_cache.collection_stats is not collection_stats:
+        raise ValueError("collection_stats_cache must be built over collection_stats")
+    cdef FlatQueries base = _c_flat_queries(base_queries)
+    cdef FlatQueries exp = _c_flat_queries(exp_queries)
+    cdef uint32_t num_queries = base_queries[0].shape[0] - 1
+    if exp_queries[0].shape[0] - 1 != num_queries or row_offsets.shape[0] != num_queries:
+        raise ValueError("base_queries, exp_queries and row_offsets must contain the same number of queries")
+    if from_column + native_featurizer_num_features(kind) > global_features.shape[1]:
+        raise ValueError("The features exceed the columns of global_features")
+    _c_check_batch(base, exp, num_queries, row_offsets, global_features.shape[0])
+
+    cdef const uint32_t *c_row_offsets = <const uint32_t *> row_offsets.data
+    cdef float *features = (<float *> global_features.data) + from_column
+    cdef size_t row_stride = global_features.shape[1]
+    cdef cs._PyCollectionStats stats
+    cdef csr._PyCollectionStats stats_restricted
+    if collection_stats_cache is not None and collection_stats_cache.c_cache.get() != NULL:
+        with nogil:
+            featurize_batch(kind, dereference(collection_stats_cache.c_cache), base, exp, num_queries, c_row_offsets, features, row_stride, num_threads)
+    elif collection_stats_cache is not None:
+        with nogil:
+            featurize_batch(kind, dereference(collection_stats_cache.c_cache_restricted), base, exp, num_queries, c_row_offsets, features, row_stride, num_threads)
+    elif isinstance(collection_stats, cs._PyCollectionStats):
+        stats = collection_stats
+        with nogil:
+            featurize_batch(kind, dereference(stats.c_collection_stats), base, exp, num_queries, c_row_offsets, features, row_stride, num_threads)
+    elif isinstance(collection_stats, csr._PyCollectionStats):
+        stats_restricted = collection_stats
+        with nogil:
+            featurize_batch(kind, dereference(stats_restricted.c_collection_stats), base, exp, num_queries, c_row_offsets, features, row_stride, num_threads)
+    else:
+        raise TypeError("collection_stats must be a PyCollectionStats or a PyCollectionStatsRestricted")
+
+    return global_features
@@ -1,4 +1,5 @@
 from featurizer_collection_stats import FeaturizerCollectionStats
+import featurizer_engine
 import numpy as np
 from numpy cimport ndarray
 cimport numpy as np
@@ -14,6 +15,7 @@ class FeaturizerSigIR08extended(FeaturizerCollectionStats):
             collection_stats_feature_fun=_c_get_features,
             collection_stats=collection_stats,
             collection_stats_segment_to_segment_id=collection_stats_segment_to_segment_id,
+            native_featurizer=featurizer_engine.SIGIR08EXTENDED,
             *args, **kwargs
         )
 
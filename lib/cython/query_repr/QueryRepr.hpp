@@ -0,0 +1,340 @@
+#ifndef QUERY_REPR_HPP
+#define QUERY_REPR_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+
+/**
+ * Terms of the CNF queries, each term id refers to its textual form in the query string (quoted when it contains
+ * spaces) and to the 64-bit hash of that form
+ */
+class TermDictionary {
+private:
+    std::vector<std::string> terms;
+    std::vector<uint64_t> hashes;
+
+public:
+    uint32_t
+    add(
+            const char *term,
+            size_t len
+    ) {
+        const bool quoted = std::find(term, term + len, ' ') != term + len;
+        std::string text;
+        text.reserve(len + 2);
+        if (quoted) {
+            text.push_back('"');
+        }
+        text.append(term, len);
+        if (quoted) {
+            text.push_back('"');
+        }
+
+        this->hashes.push_back(hash_bytes(text.data(), text.size()));
+        this->terms.push_back(std::move(text));
+        return (uint32_t) (this->terms.size() - 1);
+    }
+
+    inline const std::string &
+    get_term(
+            uint32_t term_id
+    ) const {
+        return this->terms[term_id];
+    }
+
+    inline uint64_t
+    get_hash(
+            uint32_t term_id
+    ) const {
+        return this->hashes[term_id];
+    }
+
+    inline size_t
+    size() const noexcept {
+        return this->terms.size();
+    }
+
+    /**
+     * FNV-1a followed by a finalizer, stable across processes and runs
+     */
+    static inline uint64_t
+    hash_bytes(
+            const char *data,
+            size_t len
+    ) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < len; ++i) {
+            h = (h ^ (unsigned char) data[i]) * 0x100000001b3ull;
+        }
+        return mix(h);
+    }
+
+    static inline uint64_t
+    mix(
+            uint64_t h
+    ) {
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        return h ^ (h >> 31);
+    }
+};
+
+
+/**
+ * CNF query stored as flat arrays: the OR of and_queries, each the AND of synsets, each the OR of terms.
+ * The and_query a contains the synsets [and_offsets[a], and_offsets[a + 1]) and the synset s contains the terms
+ * term_ids[synset_offsets[s]:synset_offsets[s + 1]]
+ */
+struct CNFQuery {
+    std::vector<uint32_t> and_offsets;
+    std::vector<uint32_t> synset_offsets;
+    std::vector<uint32_t> term_ids;
+    uint64_t hash = 0;
+
+    CNFQuery() :
+            and_offsets(1, 0),
+            synset_offsets(1, 0) {
+    }
+
+    inline size_t
+    num_and_queries() const noexcept {
+        return this->and_offsets.size() - 1;
+    }
+
+    inline void
+    add_term(
+            uint32_t term_id
+    ) {
+        this->term_ids.push_back(term_id);
+    }
+
+    inline void
+    end_synset() {
+        this->synset_offsets.push_back(this->term_ids.size());
+    }
+
+    inline void
+    end_and_query() {
+        this->and_offsets.push_back(this->synset_offsets.size() - 1);
+    }
+
+    bool
+    operator==(
+            const CNFQuery &other
+    ) const {
+        return this->hash == other.hash && this->and_offsets == other.and_offsets &&
+               this->synset_offsets == other.synset_offsets && this->term_ids == other.term_ids;
+    }
+};
+
+
+/**
+ * Canonicalization, hashing and serialization of the CNF queries. One instance per thread, it reuses its buffers
+ */
+class CNFQueryCanonicalizer {
+private:
+    // [begin, end) ranges of a level of the query with the hash of their content
+    struct Range {
+        uint32_t begin;
+        uint32_t end;
+        uint64_t hash;
+    };
+
+    std::vector<uint32_t> terms;
+    std::vector<Range> synsets;
+    std::vector<Range> and_queries;
+    std::vector<Range> tmp_synsets;
+    std::vector<std::string> synset_strings;
+    std::vector<std::string> and_strings;
+    std::vector<const std::string *> sorted_terms;
+
+public:
+    /**
+     * Sort and deduplicate the terms of each synset, the synsets of each and_query and the and_queries, then compute
+     * the hash of the query. Two queries are equal as sets (of sets of sets) of terms iff their canonical forms are
+     * equal, the hash does not depend on the term ids so it can be used as a persistent key
+     */
+    void
+    canonicalize(
+            CNFQuery &query,
+            const TermDictionary &dictionary
+    ) {
+        // sort the terms of each synset by hash, the ties between different terms are broken by their text
+        auto term_less = [&dictionary](uint32_t x, uint32_t y) {
+            const uint64_t hx = dictionary.get_hash(x), hy = dictionary.get_hash(y);
+            return hx < hy || (hx == hy && x != y && dictionary.get_term(x) < dictionary.get_term(y));
+        };
+        this->synsets.clear();
+        for (size_t s = 0; s + 1 < query.synset_offsets.size(); ++s) {
+            auto begin = query.term_ids.begin() + query.synset_offsets[s];
+            auto end = query.term_ids.begin() + query.synset_offsets[s + 1];
+            std::sort(begin, end, term_less);
+            end = std::unique(begin, end);
+
+            uint64_t h = 0x9e3779b97f4a7c15ull;
+            for (auto it = begin; it != end; ++it) {
+                h = combine(h, dictionary.get_hash(*it));
+            }
+            this->synsets.push_back(Range{
+                    query.synset_offsets[s],
+                    (uint32_t) (end - query.term_ids.begin()),
+                    TermDictionary::mix(h ^ 0x5)
+            });
+        }
+
+        // sort the synsets of each and_query and the and_queries by hash, the ties are broken by content
+        this->and_queries.clear();
+        this->tmp_synsets.clear();
+        for (size_t a = 0; a < query.num_and_queries(); ++a) {
+            auto begin = this->synsets.begin() + query.and_offsets[a];
+            auto end = this->synsets.begin() + query.and_offsets[a + 1];
+            std::sort(begin, end, [&query](const Range &x, const Range &y) {
+                return x.hash < y.hash || (x.hash == y.hash && terms_less(query, x, y));
+            });
+
+            const uint32_t and_begin = this->tmp_synsets.size();
+            uint64_t h = 0x9e3779b97f4a7c15ull;
+            for (auto it = begin; it != end; ++it) {
+                if (it != begin && !terms_less(query, *(it - 1), *it) && !terms_less(query, *it, *(it - 1))) {
+                    continue;
+                }
+                this->tmp_synsets.push_back(*it);
+                h = combine(h, it->hash);
+            }
+            this->and_queries.push_back(Range{and_begin, (uint32_t) this->tmp_synsets.size(), TermDictionary::mix(h ^ 0x7)});
+        }
+        auto and_less = [this, &query](const Range &x, const Range &y) {
+            return x.hash < y.hash || (x.hash == y.hash && this->synsets_less(query, x, y));
+        };
+        std::sort(this->and_queries.begin(), this->and_queries.end(), and_less);
+
+        // rewrite the query
+        this->terms.clear();
+        std::vector<uint32_t> and_offsets(1, 0), synset_offsets(1, 0);
+        uint64_t h = 0x9e3779b97f4a7c15ull;
+        for (auto it = this->and_queries.begin(); it != this->and_queries.end(); ++it) {
+            if (it != this->and_queries.begin() && !and_less(*(it - 1), *it)) {
+                continue;
+            }
+            for (uint32_t s = it->begin; s < it->end; ++s) {
+                const Range &synset = this->tmp_synsets[s];
+                this->terms.insert(this->terms.end(), query.term_ids.begin() + synset.begin,
+                                   query.term_ids.begin() + synset.end);
+                synset_offsets.push_back(this->terms.size());
+            }
+            and_offsets.push_back(synset_offsets.size() - 1);
+            h = combine(h, it->hash);
+        }
+        query.and_offsets.swap(and_offsets);
+        query.synset_offsets.swap(synset_offsets);
+        query.term_ids.swap(this->terms);
+        query.hash = TermDictionary::mix(h);
+    }
+
+    /**
+     * Serialize the query as utils.query_repr_to_sql_query does, i.e. with the terms, the synsets and the and_queries
+     * sorted by their text: "((a | b) (c)) | ((d))"
+     */
+    std::string
+    to_string(
+            const CNFQuery &query,
+            const TermDictionary &dictionary
+    ) {
+        this->and_strings.clear();
+        for (size_t a = 0; a < query.num_and_queries(); ++a) {
+            this->synset_strings.clear();
+            for (uint32_t s = query.and_offsets[a]; s < query.and_offsets[a + 1]; ++s) {
+                this->sorted_terms.clear();
+                for (uint32_t t = query.synset_offsets[s]; t < query.synset_offsets[s + 1]; ++t) {
+                    this->sorted_terms.push_back(&dictionary.get_term(query.term_ids[t]));
+                }
+                std::sort(this->sorted_terms.begin(), this->sorted_terms.end(),
+                          [](const std::string *x, const std::string *y) { return *x < *y; });
+                this->sorted_terms.erase(std::unique(this->sorted_terms.begin(), this->sorted_terms.end(),
+                                                     [](const std::string *x, const std::string *y) { return *x == *y; }),
+                                         this->sorted_terms.end());
+                this->synset_strings.push_back(join(this->sorted_terms, " | "));
+            }
+            sort_unique(this->synset_strings);
+            // the and_queries are sorted along with their parentheses
+            this->and_strings.push_back("(" + join(this->synset_strings, ") (") + ")");
+        }
+        sort_unique(this->and_strings);
+        return "(" + join(this->and_strings, ") | (") + ")";
+    }
+
+private:
+    static inline uint64_t
+    combine(
+            uint64_t h,
+            uint64_t value
+    ) {
+        return TermDictionary::mix(h ^ value) + 0x9e3779b97f4a7c15ull;
+    }
+
+    static inline bool
+    terms_less(
+            const CNFQuery &query,
+            const Range &x,
+            const Range &y
+    ) {
+        return std::lexicographical_compare(query.term_ids.begin() + x.begin, query.term_ids.begin() + x.end,
+                                            query.term_ids.begin() + y.begin, query.term_ids.begin() + y.end);
+    }
+
+    bool
+    synsets_less(
+            const CNFQuery &query,
+            const Range &x,
+            const Range &y
+    ) const {
+        return std::lexicographical_compare(
+                this->tmp_synsets.begin() + x.begin, this->tmp_synsets.begin() + x.end,
+                this->tmp_synsets.begin() + y.begin, this->tmp_synsets.begin() + y.end,
+                [&query](const Range &sx, const Range &sy) {
+                    return sx.hash < sy.hash || (sx.hash == sy.hash && terms_less(query, sx, sy));
+                }
+        );
+    }
+
+    static void
+    sort_unique(
+            std::vector<std::string> &strings
+    ) {
+        std::sort(strings.begin(), strings.end());
+        strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+    }
+
+    template<typename Container>
+    static std::string
+    join(
+            const Container &strings,
+            const char *separator
+    ) {
+        std::string result;
+        bool first = true;
+        for (const auto &s: strings) {
+            if (!first) {
+                result += separator;
+            }
+            result += deref(s);
+            first = false;
+        }
+        return result;
+    }
+
+    static inline const std::string &
+    deref(const std::string &s) {
+        return s;
+    }
+
+    static inline const std::string &
+    deref(const std::string *s) {
+        return *s;
+    }
+};
+
+#endif //QUERY_REPR_HPP
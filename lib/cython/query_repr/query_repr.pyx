@@ -0,0 +1,103 @@
+# distutils: language = c++
+
+from libc.stdint cimport uint32_t, uint64_t
+from libcpp.string cimport string
+from libcpp.vector cimport vector
+
+
+cdef extern from "QueryRepr.hpp":
+    cdef cppclass TermDictionary:
+        uint32_t                                                    add(const char *, size_t) except +
+        size_t                                                      size() const
+
+    cdef cppclass CNFQuery:
+        vector[uint32_t] and_offsets
+        vector[uint32_t] synset_offsets
+        vector[uint32_t] term_ids
+        uint64_t hash
+
+        void                                                        add_term(uint32_t) except +
+        void                                                        end_synset() except +
+        void                                                        end_and_query() except +
+        size_t                                                      num_and_queries() const
+        bint                                                        operator==(const CNFQuery &) const
+
+    cdef cppclass CNFQueryCanonicalizer:
+        void                                                        canonicalize(CNFQuery &, const TermDictionary &) except +
+        string                                                      to_string(const CNFQuery &, const TermDictionary &) except +
+
+
+cdef class QueryReprEncoder:
+    """
+    Encode the CNF query representations (lists of and_queries, each a list of synsets, each a list of syn_tags) into
+    canonical PyCNFQuery objects. The encoder owns the dictionary of the terms, so it is meant to be long lived
+    """
+    cdef TermDictionary c_dictionary
+    cdef CNFQueryCanonicalizer c_canonicalizer
+    cdef dict term_to_id
+
+    def __cinit__(self):
+        self.term_to_id = dict()
+
+    def __len__(self):
+        return self.c_dictionary.size()
+
+    cpdef PyCNFQuery encode(self, query_repr):
+        cdef PyCNFQuery result = PyCNFQuery.__new__(PyCNFQuery)
+        result.encoder = self
+
+        cdef str term
+        for and_query in query_repr:
+            for synset in and_query:
+                for syn_tag in synset:
+                    term = syn_tag[0]
+                    term_id = self.term_to_id.get(term)
+                    if term_id is None:
+                        term_id = self.term_to_id[term] = self.c_dictionary.add(term, len(term))
+                    result.c_query.add_term(term_id)
+                result.c_query.end_synset()
+            result.c_query.end_and_query()
+
+        self.c_canonicalizer.canonicalize(result.c_query, self.c_dictionary)
+        return result
+
+    def hash(self, query_repr):
+        """
+        64-bit hash of the query, equal for the representations that differ only by order and repetitions
+        """
+        return self.encode(query_repr).hash()
+
+    def to_sql_query(self, query_repr):
+        """
+        Same result of utils.query_repr_to_sql_query(query_repr)
+        """
+        return self.encode(query_repr).to_sql_query()
+
+
+cdef class PyCNFQuery:
+    """
+    Canonical CNF query as flat arrays of term ids, see QueryReprEncoder
+    """
+    cdef CNFQuery c_query
+    cdef QueryReprEncoder encoder
+
+    def hash(self):
+        return self.c_query.hash
+
+    def to_sql_query(self):
+        return self.encoder.c_canonicalizer.to_string(self.c_query, self.encoder.c_dictionary)
+
+    def __len__(self):
+        return self.c_query.num_and_queries()
+
+    def __hash__(self):
+        return <Py_ssize_t> self.c_query.hash
+
+    def __richcmp__(PyCNFQuery self, other, int op):
+        if op not in (2, 3):  # == and !=
+            return NotImplemented
+        if not isinstance(other, PyCNFQuery):
+            return op == 3
+        cdef PyCNFQuery other_query = other
+        cdef bint equal = self.encoder is other_query.encoder and self.c_query == other_query.c_query
+        return equal if op == 2 else not equal
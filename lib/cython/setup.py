@@ -47,6 +47,14 @@ if __name__ ==  "__main__":
     add_extension(e, 'feature_extraction.featurizer_sigir08extended', **kwargs)
     add_extension(e, 'feature_extraction.featurizer_custom', **kwargs)
     add_extension(e, 'feature_extraction.featurizer_qpp', **kwargs)
+    kwargs["include_dirs"].append(cfg.lib_dir + "cython/collection_stats")
+    add_extension(e, 'feature_extraction.featurizer_engine', **kwargs)
+    # query representations
+    add_extension(e, 'query_repr.query_repr')
+    # text normalization
+    add_extension(e, 'text_normalization.text_normalizer')
+    # corpus reader
+    add_extension(e, 'document_reader.document_reader', libraries=['z'], **kwargs)
 
     # setup
     setup(
@@ -0,0 +1,350 @@
+#ifndef TEXT_NORMALIZER_HPP
+#define TEXT_NORMALIZER_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NfdAsciiTable.hpp"
+
+
+/**
+ * Native version of normalize_text.py, it produces exactly the same bytes. Each regular expression of the Python
+ * version is a linear pass over the text driven by a table of byte classes, the passes work in place and copy a
+ * word at a time the spans where no match can start
+ */
+class TextNormalizer {
+private:
+    enum : uint8_t {
+        CONTROL_START = 1,  // [\x00-\x09\x0E-\x19]
+        CONTROL_CONTINUE = 2,  // [\x00-\x09\x0E-\x20]
+        NEW_LINE = 4,  // [\n\x0A-\x0D]
+        WHITESPACE = 8,  // the characters removed by str.strip
+        ALPHANUMERIC = 16  // [0-9a-zA-Z]
+    };
+
+    struct Tables {
+        uint8_t byte_class[256];
+        char nfd_ascii[NFD_ASCII_MAX_CODE_POINT + 1];  // 0 when the code point leaves no ASCII character
+
+        Tables() {
+            memset(this->byte_class, 0, sizeof(this->byte_class));
+            for (int c = 0; c < 256; ++c) {
+                uint8_t &byte_class = this->byte_class[c];
+                if (c <= 0x09 || (0x0E <= c && c <= 0x19)) {
+                    byte_class |= CONTROL_START;
+                }
+                if (c <= 0x09 || (0x0E <= c && c <= 0x20)) {
+                    byte_class |= CONTROL_CONTINUE;
+                }
+                if (0x0A <= c && c <= 0x0D) {
+                    byte_class |= NEW_LINE;
+                }
+                if ((0x09 <= c && c <= 0x0D) || c == ' ') {
+                    byte_class |= WHITESPACE;
+                }
+                if (('0' <= c && c <= '9') || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')) {
+                    byte_class |= ALPHANUMERIC;
+                }
+            }
+
+            memset(this->nfd_ascii, 0, sizeof(this->nfd_ascii));
+            for (const NfdAsciiEntry &entry: NFD_ASCII_ENTRIES) {
+                this->nfd_ascii[entry.code_point] = entry.ascii;
+            }
+        }
+    };
+
+    static const Tables &
+    tables() {
+        static const Tables result;
+        return result;
+    }
+
+public:
+    /**
+     * unicodedata.normalize('NFD', text).encode('ascii', 'ignore') of the UTF-8 encoded text.
+     * The runs of ASCII bytes are copied 8 bytes at a time
+     */
+    static void
+    ascii_fold(
+            const char *data,
+            size_t len,
+            std::string &out
+    ) {
+        const char *nfd_ascii = tables().nfd_ascii;
+        out.resize(len);
+        char *it_out = &out[0];
+        const unsigned char *it = (const unsigned char *) data;
+        const unsigned char *end = it + len;
+        while (it != end) {
+            uint64_t word;
+            if (end - it >= 8 && (memcpy(&word, it, 8), (word & 0x8080808080808080ull) == 0)) {
+                memcpy(it_out, it, 8);
+                it += 8;
+                it_out += 8;
+                continue;
+            }
+            if (*it < 0x80) {
+                *it_out++ = *it++;
+                continue;
+            }
+
+            // decode the code point, the malformed bytes are skipped
+            uint32_t code_point;
+            size_t length;
+            if ((*it & 0xE0) == 0xC0) {
+                code_point = *it & 0x1F;
+                length = 2;
+            } else if ((*it & 0xF0) == 0xE0) {
+                code_point = *it & 0x0F;
+                length = 3;
+            } else if ((*it & 0xF8) == 0xF0) {
+                code_point = *it & 0x07;
+                length = 4;
+            } else {
+                ++it;
+                continue;
+            }
+            size_t i = 1;
+            for (; i < length && it + i != end && (it[i] & 0xC0) == 0x80; ++i) {
+                code_point = (code_point << 6) | (it[i] & 0x3F);
+            }
+            it += i;
+            if (i == length && code_point <= NFD_ASCII_MAX_CODE_POINT && nfd_ascii[code_point]) {
+                *it_out++ = nfd_ascii[code_point];
+            }
+        }
+        out.resize(it_out - out.data());
+    }
+
+    /**
+     * normalize_text_step_1 of a text already folded to ASCII
+     */
+    static void
+    step_1(
+            std::string &text
+    ) {
+        const uint8_t *byte_class = tables().byte_class;
+        // remove ascii control characters
+        replace_runs(text, [byte_class](const char *t, size_t len, size_t i) {
+            if (!(byte_class[(unsigned char) t[i]] & CONTROL_START)) {
+                return i;
+            }
+            for (++i; i < len && (byte_class[(unsigned char) t[i]] & CONTROL_CONTINUE); ++i);
+            return i;
+        }, [](const char *t) {
+            return control_bytes(load_word(t)) == 0;
+        }, ' ');
+        // reduce the number of spaces
+        replace_runs(text, [](const char *t, size_t len, size_t i) {
+            if (t[i] != ' ' || i + 1 == len || t[i + 1] != ' ') {
+                return i;
+            }
+            for (i += 2; i < len && t[i] == ' '; ++i);
+            return i;
+        }, [](const char *t) {
+            return (space_bytes(load_word(t)) & space_bytes(load_word(t + 1))) == 0;
+        }, ' ');
+        // remove trailing space from the lines and reduce the number of new lines
+        replace_runs(text, [byte_class](const char *t, size_t len, size_t i) {
+            if (t[i] == ' ' && i + 1 != len && (byte_class[(unsigned char) t[i + 1]] & NEW_LINE)) {
+                ++i;
+            } else if (!(byte_class[(unsigned char) t[i]] & NEW_LINE)) {
+                return i;
+            }
+            for (++i; i < len && (t[i] == ' ' || (byte_class[(unsigned char) t[i]] & NEW_LINE)); ++i);
+            return i;
+        }, [](const char *t) {
+            return (control_bytes(load_word(t)) | control_bytes(load_word(t + 1))) == 0;
+        }, '\n');
+        // remove trailing spaces from the first and the last line
+        strip(text);
+    }
+
+    /**
+     * normalize_text_step_2 of an ASCII text
+     */
+    static void
+    step_2(
+            std::string &text
+    ) {
+        const uint8_t *byte_class = tables().byte_class;
+        // remove non alphanumeric characters collapsing near spaces
+        replace_runs(text, [byte_class](const char *t, size_t len, size_t i) {
+            if (t[i] == ' ' && i + 1 != len && t[i + 1] != ' ' && !(byte_class[(unsigned char) t[i + 1]] & ALPHANUMERIC)) {
+                ++i;
+            } else if (t[i] == ' ' || (byte_class[(unsigned char) t[i]] & ALPHANUMERIC)) {
+                return i;
+            }
+            for (++i; i < len && !(byte_class[(unsigned char) t[i]] & ALPHANUMERIC); ++i);
+            return i;
+        }, [](const char *t) {
+            return word_is_alphanumeric_or_space(load_word(t)) && word_is_alphanumeric_or_space(load_word(t + 1));
+        }, ' ');
+        // make the text lower and remove trailing spaces
+        for (char &c: text) {
+            if ('A' <= c && c <= 'Z') {
+                c += 'a' - 'A';
+            }
+        }
+        strip(text);
+    }
+
+    static void
+    normalize(
+            const char *data,
+            size_t len,
+            std::string &out
+    ) {
+        ascii_fold(data, len, out);
+        step_1(out);
+        step_2(out);
+    }
+
+    /**
+     * Normalize the texts on num_threads threads, 0 means all the cores
+     */
+    static void
+    normalize_many(
+            const std::vector<std::string> &texts,
+            std::vector<std::string> &out,
+            uint32_t num_threads = 0
+    ) {
+        out.resize(texts.size());
+        if (num_threads == 0) {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        num_threads = std::min<size_t>(num_threads, std::max<size_t>(1, texts.size()));
+
+        std::atomic<size_t> next_text(0);
+        std::exception_ptr error;
+        std::atomic<bool> failed(false);
+        auto worker = [&]() {
+            try {
+                for (size_t i = next_text++; i < texts.size() && !failed; i = next_text++) {
+                    normalize(texts[i].data(), texts[i].size(), out[i]);
+                }
+            } catch (...) {
+                if (!failed.exchange(true)) {
+                    error = std::current_exception();
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (uint32_t i = 1; i < num_threads; ++i) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (std::thread &thread: threads) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    static inline uint64_t
+    load_word(
+            const char *data
+    ) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        return word;
+    }
+
+    /**
+     * High bit set in each byte of the word that is lower than 0x20. The low 7 bits are added without carries
+     * between the bytes, so the result is exact for every byte
+     */
+    static inline uint64_t
+    control_bytes(
+            uint64_t word
+    ) {
+        return ~((word & 0x7F7F7F7F7F7F7F7Full) + 0x6060606060606060ull) & ~word & 0x8080808080808080ull;
+    }
+
+    /**
+     * High bit set in each byte of the word that is a space, exact for every byte as control_bytes
+     */
+    static inline uint64_t
+    space_bytes(
+            uint64_t word
+    ) {
+        const uint64_t x = word ^ 0x2020202020202020ull;
+        return ~(((x & 0x7F7F7F7F7F7F7F7Full) + 0x7F7F7F7F7F7F7F7Full) | x) & 0x8080808080808080ull;
+    }
+
+    /**
+     * True when all the bytes of the word are ASCII alphanumeric characters or spaces
+     */
+    static inline bool
+    word_is_alphanumeric_or_space(
+            uint64_t word
+    ) {
+        const uint64_t high = 0x8080808080808080ull;
+        if (word & high) {
+            return false;
+        }
+        // the bytes are lower than 0x80, so (x | 0x80) - lo and (hi | 0x80) - x never borrow across bytes
+        const uint64_t digit = ((word | high) - 0x3030303030303030ull) & (0xB9B9B9B9B9B9B9B9ull - word);
+        const uint64_t lower = word | 0x2020202020202020ull;
+        const uint64_t letter = ((lower | high) - 0x6161616161616161ull) & (0xFAFAFAFAFAFAFAFAull - lower);
+        return ((digit | letter | space_bytes(word)) & high) == high;
+    }
+
+    /**
+     * Replace with replacement every run [i, match(text, i)) found scanning the text from left to right, as re.sub
+     * does. match returns i when no run starts at i. skip(t + i) is true when no run starts in [i, i + 8), it reads
+     * the 9 bytes from t + i so that most of the text is copied a word at a time
+     */
+    template<typename Match, typename Skip>
+    static void
+    replace_runs(
+            std::string &text,
+            Match match,
+            Skip skip,
+            char replacement
+    ) {
+        char *t = &text[0];
+        const size_t len = text.size();
+        size_t out = 0;
+        for (size_t i = 0; i < len;) {
+            if (i + 9 <= len && skip(t + i)) {
+                memmove(t + out, t + i, 8);
+                out += 8;
+                i += 8;
+                continue;
+            }
+            const size_t run_end = match(t, len, i);
+            if (run_end == i) {
+                t[out++] = t[i++];
+            } else {
+                t[out++] = replacement;
+                i = run_end;
+            }
+        }
+        text.resize(out);
+    }
+
+    static void
+    strip(
+            std::string &text
+    ) {
+        const uint8_t *byte_class = tables().byte_class;
+        size_t begin = 0, end = text.size();
+        for (; begin < end && (byte_class[(unsigned char) text[begin]] & WHITESPACE); ++begin);
+        for (; end > begin && (byte_class[(unsigned char) text[end - 1]] & WHITESPACE); --end);
+        text.erase(end);
+        text.erase(0, begin);
+    }
+};
+
+#endif //TEXT_NORMALIZER_HPP
@@ -0,0 +1,87 @@
+# This Python file uses the following encoding: utf-8
+"""
+Bit-exact equivalence of the native text normalizer with the Python reference of normalize_text.py, run it after
+building the extensions:
+
+    python lib/cython/text_normalization/tests/equivalence.py
+"""
+import os
+import random
+import sys
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "../../../../"))
+import cfg
+
+from efficient_query_expansion import normalize_text as nt
+from text_normalization import text_normalizer
+
+
+_ascii_pool = [chr(c) for c in range(128)] + list("aB3 ") * 20 + ["\n", "  ", "\r\n", "\t", "-", ".", ","] * 5
+_unicode_pool = [unichr(c) for c in (
+    0x00C0, 0x00E9, 0x00DF, 0x00A0, 0x0301, 0x037E, 0x1E9B, 0x1FEF, 0x2022, 0x2028, 0x2126, 0x212A,
+    0x2260, 0x226E, 0x226F, 0x4E2D, 0xFB01, 0xFFFF, 0x1D400, 0x1F600
+)]
+
+
+def random_str(max_len):
+    return "".join(random.choice(_ascii_pool) for _ in xrange(random.randint(0, max_len)))
+
+
+def random_unicode(max_len):
+    return u"".join(
+        random.choice(_ascii_pool).decode("ascii") if random.random() < 0.7 else random.choice(_unicode_pool)
+        for _ in xrange(random.randint(0, max_len))
+    )
+
+
+def check(text):
+    step_1 = nt._py_normalize_text_step_1(text)
+    assert text_normalizer.normalize_text_step_1(text) == step_1, repr(text)
+    assert text_normalizer.normalize_text(text) == nt._py_normalize_text(text), repr(text)
+    assert text_normalizer.normalize_text_step_2(step_1) == nt._py_normalize_text_step_2(step_1), repr(text)
+    if isinstance(text, str):
+        assert text_normalizer.normalize_text_step_2(text) == nt._py_normalize_text_step_2(text), repr(text)
+
+
+def testRandomTexts():
+    random.seed(0)
+    for max_len in (8, 40, 400):
+        for _ in xrange(20000):
+            check(random_str(max_len))
+            check(random_unicode(max_len))
+
+
+def testAllCodePoints():
+    # every code point leaves the same ASCII characters, alone and between ASCII characters
+    text = u"".join(unichr(c) for c in xrange(0x80, sys.maxunicode + 1) if not 0xD800 <= c < 0xE000)
+    check(text)
+    check(u"a".join(text[i:i + 64] for i in xrange(0, len(text), 64)))
+
+
+def testErrors():
+    # the non ASCII byte strings are rejected as by str.encode('ascii', 'ignore')
+    for function in (nt._py_normalize_text, text_normalizer.normalize_text):
+        try:
+            function("caf\xc3\xa9")
+            assert False
+        except UnicodeDecodeError as e:
+            assert str(e) == "'ascii' codec can't decode byte 0xc3 in position 3: ordinal not in range(128)"
+
+
+def testNormalizeTexts():
+    random.seed(1)
+    texts = [random_unicode(400) for _ in xrange(1000)] + [random_str(400) for _ in xrange(1000)]
+    expected = [nt._py_normalize_text(text) for text in texts]
+    for num_threads in (1, 4, 0):
+        assert text_normalizer.normalize_texts(texts, num_threads) == expected
+
+
+if __name__ == "__main__":
+    print "1) testRandomTexts"
+    testRandomTexts()
+    print "2) testAllCodePoints"
+    testAllCodePoints()
+    print "3) testErrors"
+    testErrors()
+    print "4) testNormalizeTexts"
+    testNormalizeTexts()
@@ -0,0 +1,61 @@
+# distutils: language = c++
+
+from libc.stdint cimport uint32_t
+from libcpp.string cimport string
+from libcpp.vector cimport vector
+
+
+cdef extern from "TextNormalizer.hpp" namespace "TextNormalizer":
+    void ascii_fold(const char *, size_t, string &) except + nogil
+    void step_1(string &) except + nogil
+    void step_2(string &) except + nogil
+    void normalize(const char *, size_t, string &) except + nogil
+    void normalize_many(const vector[string] &, vector[string] &, uint32_t) except + nogil
+
+
+cdef bytes _c_ascii_bytes(text):
+    # the byte strings must be ASCII, as in text.encode('ascii', 'ignore') that decodes them first
+    if isinstance(text, unicode):
+        return (<unicode> text).encode("utf-8")
+    cdef bytes result = text
+    cdef const unsigned char *data = result
+    cdef size_t i
+    for i in range(len(result)):
+        if data[i] >= 0x80:
+            result.decode("ascii")  # raise the same UnicodeDecodeError
+    return result
+
+
+def normalize_text_step_1(text):
+    cdef bytes data = _c_ascii_bytes(text)
+    cdef string result
+    ascii_fold(data, len(data), result)
+    step_1(result)
+    return <bytes> result
+
+
+def normalize_text_step_2(bytes text):
+    cdef string result = text
+    step_2(result)
+    return <bytes> result
+
+
+def normalize_text(text):
+    cdef bytes data = _c_ascii_bytes(text)
+    cdef string result
+    normalize(data, len(data), result)
+    return <bytes> result
+
+
+def normalize_texts(list texts, uint32_t num_threads=0):
+    """
+    normalize_text of each text, the texts are normalized in parallel without the GIL (0 threads means all the cores)
+    """
+    cdef vector[string] c_texts
+    cdef vector[string] c_result
+    c_texts.reserve(len(texts))
+    for text in texts:
+        c_texts.push_back(_c_ascii_bytes(text))
+    with nogil:
+        normalize_many(c_texts, c_result, num_threads)
+    return [<bytes> result for result in c_result]
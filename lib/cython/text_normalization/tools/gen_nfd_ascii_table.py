@@ -0,0 +1,44 @@
+"""
+Generate NfdAsciiTable.hpp: the ASCII character left by unicodedata.normalize('NFD', c).encode('ascii', 'ignore') for
+each non-ASCII code point c that leaves one. Run it with the Python interpreter that runs the pipeline, so that the
+table follows its version of the Unicode database:
+
+    python tools/gen_nfd_ascii_table.py > NfdAsciiTable.hpp
+"""
+import sys
+import unicodedata
+
+try:
+    unichr
+except NameError:
+    unichr = chr
+
+
+def main():
+    entries = []
+    for code_point in xrange(0x80, 0x110000) if sys.version_info[0] == 2 else range(0x80, 0x110000):
+        if 0xD800 <= code_point < 0xE000:
+            continue
+        ascii_chars = [c for c in unicodedata.normalize('NFD', unichr(code_point)) if ord(c) < 0x80]
+        # the canonical decompositions contain at most one starter from the ASCII block
+        assert len(ascii_chars) <= 1
+        if ascii_chars:
+            entries.append((code_point, ord(ascii_chars[0])))
+
+    out = sys.stdout
+    out.write("#ifndef NFD_ASCII_TABLE_HPP\n#define NFD_ASCII_TABLE_HPP\n\n#include <stdint.h>\n\n")
+    out.write("// generated by tools/gen_nfd_ascii_table.py with the Unicode database {}, do not edit\n\n".format(
+        unicodedata.unidata_version))
+    out.write("struct NfdAsciiEntry {\n    uint32_t code_point;\n    char ascii;\n};\n\n")
+    out.write("const uint32_t NFD_ASCII_MAX_CODE_POINT = 0x{:X};\n\n".format(entries[-1][0]))
+    out.write("const NfdAsciiEntry NFD_ASCII_ENTRIES[] = {\n")
+    for i in range(0, len(entries), 6):
+        out.write("        " + " ".join(
+            "{{0x{:04X}, '{}'}},".format(code_point, ("\\" if chr(ascii_char) in "\\'" else "") + chr(ascii_char))
+            for code_point, ascii_char in entries[i:i + 6]
+        ) + "\n")
+    out.write("};\n\n#endif //NFD_ASCII_TABLE_HPP\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -4,6 +4,7 @@ import nltk
 import os.path
 import sys
 
+from document_reader.document_reader import PyDocumentReader
 from normalize_text import normalize_text, normalize_text_step_1
 from parallel_stream.utils import get_emitter_from_iterable
 
@@ -187,7 +188,22 @@ def get_reader(infilename, encoding=None):
     return codecs.getreader(encoding)(reader)
 
 
-def doc_generator_from_file(infilenames, encoding=None, file_format="custom"):
+def _native_doc_generator(infilename, file_format, num_threads):
+    # the ASCII files are parsed by the native reader, which yields the same documents and raises the same errors
+    if file_format == "xml":
+        doc_class = ExtendedDoc
+    else:
+        doc_class = Doc
+
+    for doc_tuple in PyDocumentReader(file_format, num_threads).read(infilename):
+        yield doc_class(*doc_tuple)
+
+
+def doc_generator_from_file(infilenames, encoding=None, file_format="custom", num_threads=0):
+    """
+    Yield the documents of the files. The files read without decoding are parsed on num_threads threads (0 means all
+    the cores) by the native reader, the others line by line in Python
+    """
     if isinstance(infilenames, (str, unicode)):
         infilenames = [infilenames]
     elif hasattr(infilenames, "__iter__"):
@@ -206,7 +222,15 @@ def doc_generator_from_file(infilenames, encoding=None, file_format="custom"):
         raise Exception(
             "The file_format parameter must be one between 'custom' or 'wiki'")
 
+    native = encoding is None or encoding.upper() == "ASCII"
     for infilename in infilenames:
+        if native and infilename != "-":
+            if not os.path.isfile(infilename):
+                raise Exception("File {} doesn't exist".format(infilename))
+            for doc in _native_doc_generator(infilename, file_format, num_threads):
+                yield doc
+            continue
+
         with get_reader(infilename, encoding) as reader:
             for doc in generator(reader):
                 yield doc
@@ -1,10 +1,14 @@
 import cPickle
 import collections
 import json
+import Queue
 import socket
 import struct
+import threading
 
-from utils import query_repr_to_sql_query
+from index_cache_store import IndexCacheStore
+from query_repr.query_repr import QueryReprEncoder
+from utils import sql_query_to_query_repr
 
 
 QueryPerformanceSubset = collections.namedtuple(
@@ -35,6 +39,17 @@ class SocketChannel(object):
     def receive_reply(self):
         return json.loads(self._recv_msg())
 
+    def send_requests(self, requests):
+        # pipeline the requests in a single write, the replies are received in the same order
+        assert all(isinstance(request, dict) for request in requests)
+        self._sock.sendall(b''.join(
+            struct.pack(SocketChannel._length_format, len(msg)) + msg
+            for msg in (json.dumps(request) for request in requests)
+        ))
+
+    def receive_replies(self, num_replies):
+        return [self.receive_reply() for _ in xrange(num_replies)]
+
     def _recvall(self, n):
         # Helper function to recv n bytes or return None if EOF is hit
         data = b''
@@ -72,45 +87,98 @@ class IndexCursor(object):
         return self
 
     def __exit__(self, *exc_info):
+        if exc_info[0] is not None and isinstance(self._db_cursor, PooledChannel):
+            self._db_cursor.discard()
         self.close()
 
     def get_performance(self, query_repr, document_id_list=None, document_id_list_key=None,
-                         include_time=True, force=False):
+                        include_time=True, force=False):
+        return self.get_performance_many(
+            [query_repr], document_id_list, document_id_list_key, include_time, force
+        )[0]
+
+    def get_performance_many(self, query_reprs, document_id_list=None, document_id_list_key=None,
+                             include_time=True, force=False, max_in_flight=64):
+        """
+        Return the performance of each query of query_reprs against the same document_id_list.
+        The queries missing from the cache are sent max_in_flight at a time, either pipelined on the connection or
+        as a single batch message when the index cache uses batch requests
+        """
         # check parameters
-        assert isinstance(query_repr, (list, tuple))
+        assert isinstance(query_reprs, (list, tuple))
+        assert all(isinstance(query_repr, (list, tuple)) for query_repr in query_reprs)
         assert document_id_list is None or (isinstance(document_id_list, (list, tuple)) and len(document_id_list) > 0 and all(isinstance(doc_id, (int, long)) for doc_id in document_id_list))
         assert document_id_list_key is None or isinstance(document_id_list_key, (int, long))
         assert (document_id_list_key is None) == (document_id_list is None)
         assert isinstance(include_time, bool)
         assert isinstance(force, bool)
+        assert isinstance(max_in_flight, int) and max_in_flight > 0
 
         zero_document_id_list = (document_id_list is None) or (len(document_id_list) == 0)
 
-        # transform the query representation in a query string
-        sql_str = query_repr_to_sql_query(query_repr)
-
-        # get the entry from the cache
-        key = sql_str if zero_document_id_list else (sql_str, document_id_list_key)
-        if not force:
-            query_performance = self._index_cache._get(key)
+        # the entries are found by the hash of the canonical queries, the query strings are built only for the
+        # queries sent to the server. The encoder lives for this call, so its term dictionary does not grow
+        query_encoder = QueryReprEncoder()
+        keys = []
+        missing_keys = []
+        missing_queries = []
+        results = dict()
+        for query_repr in query_reprs:
+            query = query_encoder.encode(query_repr)
+            key = query.hash() if zero_document_id_list else (query.hash(), document_id_list_key)
+            keys.append(key)
+            if key in results:
+                continue
+            query_performance = None if force else self._index_cache._get(key)
             if query_performance is not None and (not include_time or query_performance.exe_time is not None):
-                return query_performance
+                results[key] = query_performance
+            else:
+                results[key] = None
+                missing_keys.append(key)
+                missing_queries.append(query)
 
         # transform the document_id_list
         document_id_list = [] if document_id_list is None else list(set(document_id_list))
 
-        request = {
-            "query": sql_str,
-            "query_type": "cnf"
-        }
-        if not zero_document_id_list:
-            request["rel"] = document_id_list
-        self._db_cursor.send_request(request)
+        for from_pos in xrange(0, len(missing_keys), max_in_flight):
+            window_keys = missing_keys[from_pos:from_pos + max_in_flight]
+            requests = []
+            for query in missing_queries[from_pos:from_pos + max_in_flight]:
+                request = {
+                    "query": query.to_sql_query(),
+                    "query_type": "cnf"
+                }
+                if not zero_document_id_list:
+                    request["rel"] = document_id_list
+                requests.append(request)
+
+            replies = self._exchange(requests)
 
-        result = self._db_cursor.receive_reply()
-        if "error" in result:
-            raise Exception(result["error"])
+            # all the replies are read before raising, so that the connection stays in sync
+            errors = [result["error"] for result in replies if "error" in result]
+            if errors:
+                raise Exception(errors[0])
 
+            for key, result in zip(window_keys, replies):
+                results[key] = self._put_performance(key, result, zero_document_id_list, include_time)
+
+        # return
+        return [results[key] for key in keys]
+
+    def _exchange(self, requests):
+        if self._index_cache._batch_requests:
+            self._db_cursor.send_request({"batch": requests})
+            result = self._db_cursor.receive_reply()
+            if "error" in result:
+                raise Exception(result["error"])
+            replies = result["batch"]
+        else:
+            self._db_cursor.send_requests(requests)
+            replies = self._db_cursor.receive_replies(len(requests))
+        assert len(replies) == len(requests)
+        return replies
+
+    def _put_performance(self, key, result, zero_document_id_list, include_time):
         # compose the resulting object
         if zero_document_id_list:
             query_performance = QueryPerformanceSubset(
@@ -136,27 +204,102 @@ class IndexCursor(object):
                 )
                 self._index_cache._put(key[0], qps)
 
-        # return
         return query_performance
 
 
+class ConnectionPool(object):
+    """
+    Thread safe pool of the connections to the query server, at most max_size idle connections are kept open
+    """
+    def __init__(self, host, port, max_size):
+        assert isinstance(max_size, int) and max_size > 0
+
+        self._host = host
+        self._port = port
+        self._idle = Queue.LifoQueue(maxsize=max_size)
+
+    def acquire(self):
+        try:
+            return self._idle.get_nowait()
+        except Queue.Empty:
+            return SocketChannel(host=self._host, port=self._port)
+
+    def release(self, connection):
+        try:
+            self._idle.put_nowait(connection)
+        except Queue.Full:
+            connection.close()
+
+    def close(self):
+        while True:
+            try:
+                self._idle.get_nowait().close()
+            except Queue.Empty:
+                return
+
+
+class PooledChannel(object):
+    """
+    SocketChannel borrowed from a ConnectionPool, closing it gives the connection back to the pool
+    """
+    def __init__(self, pool):
+        self._pool = pool
+        self._connection = pool.acquire()
+
+    def close(self):
+        if self._connection is not None:
+            self._pool.release(self._connection)
+            self._connection = None
+
+    def discard(self):
+        # the connection can be out of sync, e.g. after an exception in the middle of a pipeline
+        if self._connection is not None:
+            self._connection.close()
+            self._connection = None
+
+    def __getattr__(self, name):
+        return getattr(self._connection, name)
+
+
 class IndexCache(object):
-    def __init__(self, host, port):
+    def __init__(self, host, port, pool_size=0, batch_requests=False, store_path=None):
+        """
+        pool_size is the number of idle connections kept open for the cursors, 0 disables the pool.
+        When batch_requests is True the queries are sent to the server as a single {"batch": [...]} message,
+        otherwise they are pipelined as independent messages.
+        When store_path is given the performances are kept in the persistent IndexCacheStore at that path, which can be
+        shared with other processes, instead of an in-memory dict
+        """
         assert isinstance(host, str)
         assert isinstance(port, int)
+        assert isinstance(pool_size, int) and pool_size >= 0
+        assert isinstance(batch_requests, bool)
+        assert store_path is None or isinstance(store_path, str)
 
         self._host = host
         self._port = port
         self._cache = dict()
+        self._store = IndexCacheStore(store_path) if store_path is not None else None
+        self._batch_requests = batch_requests
+        self._pool = ConnectionPool(host, port, pool_size) if pool_size > 0 else None
 
     @staticmethod
-    def load(file_path):
+    def load(file_path, store_path=None):
+        """
+        Load a dumped index cache, its entries are appended to the store at store_path when it is given
+        """
         host, port, cache = cPickle.load(open(file_path, "rb"))
-        index_cache = IndexCache(host, port)
-        index_cache._cache = cache
+        cache = IndexCache._migrate_keys(cache)
+        index_cache = IndexCache(host, port, store_path=store_path)
+        if index_cache._store is not None:
+            index_cache._store.put_many(cache.iteritems())
+        else:
+            index_cache._cache = cache
         return index_cache
 
     def dump(self, file_path):
+        # the store keeps only the digests of the keys, it is persistent already
+        assert self._store is None, "The index cache is stored in {}".format(self._store._path)
         cPickle.dump(
             (self._host, self._port, self._cache),
             open(file_path, "wb"),
@@ -164,14 +307,86 @@ class IndexCache(object):
         )
 
     def __len__(self):
+        if self._store is not None:
+            return len(self._store)
         return len(self._cache)
 
+    @staticmethod
+    def _migrate_keys(cache):
+        # the caches dumped before the keys were the query hashes are keyed by the query strings
+        query_encoder = QueryReprEncoder()
+
+        def migrate_key(key):
+            if isinstance(key, tuple):
+                return migrate_key(key[0]), key[1]
+            if isinstance(key, basestring):
+                return query_encoder.hash(sql_query_to_query_repr(key))
+            return key
+
+        return dict((migrate_key(key), value) for key, value in cache.iteritems())
+
     def _get(self, key):
+        if self._store is not None:
+            value = self._store.get(key)
+            if value is None:
+                return None
+            num_ret, num_rel, num_rel_ret, exe_time = value
+            if isinstance(key, tuple):
+                return QueryPerformance(num_ret=num_ret, num_rel=num_rel, num_rel_ret=num_rel_ret, exe_time=exe_time)
+            return QueryPerformanceSubset(num_ret=num_ret, exe_time=exe_time)
         return self._cache.get(key, None)
 
     def _put(self, key, value):
+        if self._store is not None:
+            self._store.put_many([(key, value)])
+            return
         self._cache[key] = value
 
     def cursor(self):
-        connection = SocketChannel(host=self._host, port=self._port)
+        if self._pool is not None:
+            connection = PooledChannel(self._pool)
+        else:
+            connection = SocketChannel(host=self._host, port=self._port)
         return IndexCursor(self, connection)
+
+    def close(self):
+        if self._pool is not None:
+            self._pool.close()
+        if self._store is not None:
+            self._store.close()
+
+    def get_performance_many(self, query_reprs, document_id_list=None, document_id_list_key=None,
+                             include_time=True, force=False, max_in_flight=64, num_threads=1):
+        """
+        As IndexCursor.get_performance_many, the queries are split among num_threads threads each with its own cursor
+        """
+        assert isinstance(num_threads, int) and num_threads > 0
+
+        if num_threads == 1 or len(query_reprs) <= max_in_flight:
+            with self.cursor() as cursor:
+                return cursor.get_performance_many(
+                    query_reprs, document_id_list, document_id_list_key, include_time, force, max_in_flight
+                )
+
+        results = [None] * len(query_reprs)
+        errors = []
+        chunk_size = (len(query_reprs) + num_threads - 1) // num_threads
+
+        def worker(from_pos):
+            try:
+                with self.cursor() as cursor:
+                    results[from_pos:from_pos + chunk_size] = cursor.get_performance_many(
+                        query_reprs[from_pos:from_pos + chunk_size], document_id_list, document_id_list_key,
+                        include_time, force, max_in_flight
+                    )
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=worker, args=(from_pos,)) for from_pos in xrange(0, len(query_reprs), chunk_size)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        if errors:
+            raise errors[0]
+        return results
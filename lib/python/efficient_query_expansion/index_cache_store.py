@@ -0,0 +1,257 @@
+import fcntl
+import hashlib
+import math
+import mmap
+import os
+import struct
+import threading
+
+
+class IndexCacheStore(object):
+    """
+    Persistent key-value store of the query performances, shared by many processes.
+    The records are appended to the log file path, they are never rewritten; the last record of a key wins.
+    The file path.idx is an open addressing hash table that maps the digest of each key to its last record, so the
+    lookups are O(1) and nothing is loaded up front: both files are memory mapped.
+    The writers are serialized by an exclusive lock on path.lock, the readers never lock the files. A reader sees a
+    slot only after its record has been appended, and each record is checked against the full digest of the key.
+    The threads of a process share the mappings, so they are serialized by a process-local lock
+    """
+    _log_magic = b"EQECLOG1"
+    _idx_magic = b"EQECIDX1"
+
+    # magic, number of slots, number of distinct keys, moved flag (the table has been replaced by a larger one)
+    _idx_header_format = "<8sQQQ"
+    _idx_header_size = struct.calcsize(_idx_header_format)
+    # first 8 bytes of the digest, position of the record + 1 (0 means empty)
+    _slot_format = "<QQ"
+    _slot_size = struct.calcsize(_slot_format)
+    # digest, num_ret, num_rel (-1 for the performance of the whole collection), num_rel_ret, exe_time (nan for None)
+    _record_format = "<16sqqqd"
+    _record_size = struct.calcsize(_record_format)
+
+    _initial_num_slots = 1 << 16
+    _max_load_factor = 0.5
+
+    def __init__(self, path, readonly=False):
+        self._path = path
+        self._readonly = readonly
+        self._log_mm = None
+        self._idx_mm = None
+        self._idx_file = None
+        self._thread_lock = threading.RLock()
+
+        if not readonly:
+            self._lock_file = open(path + ".lock", "a")
+            with self._locked():
+                if not os.path.exists(path):
+                    with open(path, "wb") as f_out:
+                        f_out.write(IndexCacheStore._log_magic)
+                if not os.path.exists(path + ".idx"):
+                    self._create_idx(path + ".idx", IndexCacheStore._initial_num_slots)
+        self._log_file = open(path, "rb" if readonly else "ab+")
+        self._open_idx()
+        self._remap_log()
+        assert self._log_mm[:len(IndexCacheStore._log_magic)] == IndexCacheStore._log_magic
+
+    def close(self):
+        for attr in ("_log_mm", "_idx_mm", "_log_file", "_idx_file"):
+            if getattr(self, attr) is not None:
+                getattr(self, attr).close()
+                setattr(self, attr, None)
+        if not self._readonly:
+            self._lock_file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+    def __len__(self):
+        with self._thread_lock:
+            self._check_moved()
+            return struct.unpack_from(IndexCacheStore._idx_header_format, self._idx_mm, 0)[2]
+
+    def __contains__(self, key):
+        return self.get(key) is not None
+
+    def get(self, key):
+        """
+        Return the tuple (num_ret, num_rel, num_rel_ret, exe_time) of key, num_rel and num_rel_ret are None for the
+        performance of the whole collection, exe_time is None when it is unknown. Return None for the missing keys
+        """
+        digest = IndexCacheStore._digest(key)
+        with self._thread_lock:
+            self._check_moved()
+            position = self._find(digest)[1]
+            if position is None:
+                return None
+            _, num_ret, num_rel, num_rel_ret, exe_time = self._read_record(position)
+        return (
+            num_ret,
+            None if num_rel < 0 else num_rel,
+            None if num_rel < 0 else num_rel_ret,
+            None if math.isnan(exe_time) else exe_time
+        )
+
+    def put(self, key, num_ret, num_rel=None, num_rel_ret=None, exe_time=None):
+        self.put_many([(key, (num_ret, num_rel, num_rel_ret, exe_time))])
+
+    def put_many(self, items):
+        """
+        Append the (key, performance) items under a single lock, performance is (num_ret, num_rel, num_rel_ret, exe_time)
+        or (num_ret, exe_time) for the performance of the whole collection
+        """
+        assert not self._readonly
+        with self._thread_lock, self._locked():
+            self._check_moved()
+            self._log_file.seek(0, os.SEEK_END)
+            position = self._log_file.tell()
+            records = []
+            for key, performance in items:
+                if len(performance) == 2:
+                    num_ret, exe_time = performance
+                    num_rel = num_rel_ret = None
+                else:
+                    num_ret, num_rel, num_rel_ret, exe_time = performance
+                digest = IndexCacheStore._digest(key)
+                records.append((digest, position))
+                position += IndexCacheStore._record_size
+                self._log_file.write(struct.pack(
+                    IndexCacheStore._record_format,
+                    digest,
+                    num_ret,
+                    -1 if num_rel is None else num_rel,
+                    -1 if num_rel_ret is None else num_rel_ret,
+                    float("nan") if exe_time is None else exe_time
+                ))
+            # the records must be visible before their slots
+            self._log_file.flush()
+
+            for digest, position in records:
+                self._insert(digest, position)
+
+    def items_digest(self):
+        """
+        Yield the (digest, record position) of the last record of each key, the caller holds the locks
+        """
+        num_slots = struct.unpack_from(IndexCacheStore._idx_header_format, self._idx_mm, 0)[1]
+        for slot in xrange(num_slots):
+            _, position = self._read_slot(slot)
+            if position:
+                yield self._read_record(position - 1)[0], position - 1
+
+    @staticmethod
+    def _digest(key):
+        # the key is the hash of a query or a pair (hash of the query, document list key)
+        if isinstance(key, tuple):
+            query_hash, document_id_list_key = key
+            key = "{}\0{}".format(query_hash, document_id_list_key)
+        elif isinstance(key, (int, long)):
+            key = str(key)
+        if isinstance(key, unicode):
+            key = key.encode("utf-8")
+        return hashlib.md5(key).digest()
+
+    def _locked(self):
+        return _FileLock(self._lock_file)
+
+    @staticmethod
+    def _create_idx(path, num_slots):
+        with open(path, "wb") as f_out:
+            f_out.write(struct.pack(IndexCacheStore._idx_header_format, IndexCacheStore._idx_magic, num_slots, 0, 0))
+            f_out.truncate(IndexCacheStore._idx_header_size + num_slots * IndexCacheStore._slot_size)
+
+    def _open_idx(self):
+        if self._idx_mm is not None:
+            self._idx_mm.close()
+            self._idx_file.close()
+        self._idx_file = open(self._path + ".idx", "rb" if self._readonly else "r+b")
+        self._idx_mm = mmap.mmap(
+            self._idx_file.fileno(), 0, access=mmap.ACCESS_READ if self._readonly else mmap.ACCESS_WRITE
+        )
+        assert self._idx_mm[:len(IndexCacheStore._idx_magic)] == IndexCacheStore._idx_magic
+
+    def _check_moved(self):
+        if struct.unpack_from(IndexCacheStore._idx_header_format, self._idx_mm, 0)[3]:
+            self._open_idx()
+
+    def _remap_log(self):
+        if self._log_mm is not None:
+            self._log_mm.close()
+        self._log_mm = mmap.mmap(self._log_file.fileno(), 0, access=mmap.ACCESS_READ)
+
+    def _read_slot(self, slot):
+        return struct.unpack_from(
+            IndexCacheStore._slot_format, self._idx_mm, IndexCacheStore._idx_header_size + slot * IndexCacheStore._slot_size
+        )
+
+    def _read_record(self, position):
+        if position + IndexCacheStore._record_size > len(self._log_mm):
+            # appended by another process after the last mapping
+            self._remap_log()
+        return struct.unpack_from(IndexCacheStore._record_format, self._log_mm, position)
+
+    def _find(self, digest):
+        """
+        Return (slot, record position) of digest, or (first empty slot, None) when it is missing
+        """
+        num_slots = struct.unpack_from(IndexCacheStore._idx_header_format, self._idx_mm, 0)[1]
+        digest_prefix = struct.unpack_from("<Q", digest)[0]
+        slot = digest_prefix & (num_slots - 1)
+        while True:
+            slot_prefix, position = self._read_slot(slot)
+            if not position:
+                return slot, None
+            if slot_prefix == digest_prefix and self._read_record(position - 1)[0] == digest:
+                return slot, position - 1
+            slot = (slot + 1) & (num_slots - 1)
+
+    def _write_slot(self, slot, digest, position):
+        # the prefix is written before the position, which makes the slot visible to the readers
+        offset = IndexCacheStore._idx_header_size + slot * IndexCacheStore._slot_size
+        self._idx_mm[offset:offset + 8] = digest[:8]
+        self._idx_mm[offset + 8:offset + 16] = struct.pack("<Q", position + 1)
+
+    def _insert(self, digest, position):
+        slot, old_position = self._find(digest)
+        if old_position is not None:
+            self._write_slot(slot, digest, position)
+            return
+
+        _, num_slots, num_keys, _ = struct.unpack_from(IndexCacheStore._idx_header_format, self._idx_mm, 0)
+        if num_keys + 1 > num_slots * IndexCacheStore._max_load_factor:
+            self._grow(num_slots * 2)
+            slot = self._find(digest)[0]
+        self._write_slot(slot, digest, position)
+        struct.pack_into("<Q", self._idx_mm, 16, num_keys + 1)
+
+    def _grow(self, num_slots):
+        # build the larger table aside, then replace the old one and flag it as moved for the other processes
+        tmp_path = self._path + ".idx.tmp"
+        IndexCacheStore._create_idx(tmp_path, num_slots)
+        entries = list(self.items_digest())
+        old_idx_mm = self._idx_mm
+        with open(tmp_path, "r+b") as f_tmp:
+            self._idx_mm = mmap.mmap(f_tmp.fileno(), 0, access=mmap.ACCESS_WRITE)
+            for digest, position in entries:
+                self._write_slot(self._find(digest)[0], digest, position)
+            struct.pack_into("<Q", self._idx_mm, 16, len(entries))
+            self._idx_mm.flush()
+            self._idx_mm.close()
+        os.rename(tmp_path, self._path + ".idx")
+        self._idx_mm = old_idx_mm
+        struct.pack_into("<Q", self._idx_mm, 24, 1)
+        self._open_idx()
+
+
+class _FileLock(object):
+    def __init__(self, lock_file):
+        self._lock_file = lock_file
+
+    def __enter__(self):
+        fcntl.flock(self._lock_file.fileno(), fcntl.LOCK_EX)
+
+    def __exit__(self, *exc_info):
+        fcntl.flock(self._lock_file.fileno(), fcntl.LOCK_UN)
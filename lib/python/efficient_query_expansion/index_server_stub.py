@@ -0,0 +1,117 @@
+import json
+import SocketServer
+import struct
+import threading
+import time
+import zlib
+
+from index_cache import SocketChannel
+
+
+def default_performance(request):
+    """
+    Deterministic and fake performance of a request, it only depends on the query string and on the document ids
+    """
+    query = request["query"].encode("utf-8") if isinstance(request["query"], unicode) else request["query"]
+    query_hash = zlib.crc32(query) & 0xffffffff
+    result = {
+        "num_ret": query_hash % 10000,
+        "exe_time": (query_hash % 1000) / 1000.0
+    }
+    if "rel" in request:
+        result["num_rel"] = len(request["rel"])
+        result["num_rel_ret"] = sum(
+            1 for doc_id in request["rel"] if (zlib.crc32(query + str(doc_id)) & 0xffffffff) % 2 == 0
+        )
+    return result
+
+
+class _StubRequestHandler(SocketServer.BaseRequestHandler):
+    def handle(self):
+        while True:
+            raw_msglen = self._recvall(SocketChannel._length_size)
+            if raw_msglen is None:
+                return
+            msglen = struct.unpack(SocketChannel._length_format, raw_msglen)[0]
+            msg = self._recvall(msglen)
+            if msg is None:
+                return
+
+            request = json.loads(msg)
+            if "batch" in request:
+                reply = {"batch": [self._reply(sub_request) for sub_request in request["batch"]]}
+            else:
+                reply = self._reply(request)
+
+            msg = json.dumps(reply)
+            self.request.sendall(struct.pack(SocketChannel._length_format, len(msg)) + msg)
+
+    def _reply(self, request):
+        # the requests of a connection are served one after the other, as the real server does
+        server = self.server
+        if server.latency > 0:
+            time.sleep(server.latency)
+        with server.lock:
+            server.num_requests += 1
+        if request.get("query_type") != "cnf" or "query" not in request:
+            return {"error": "Unsupported request"}
+        return server.performance_fun(request)
+
+    def _recvall(self, n):
+        data = b''
+        while len(data) < n:
+            packet = self.request.recv(n - len(data))
+            if not packet:
+                return None
+            data += packet
+        return data
+
+
+class StubIndexServer(SocketServer.ThreadingMixIn, SocketServer.TCPServer):
+    """
+    Local stand-in for the ds2i query server that speaks the same length-prefixed JSON protocol, including the batch
+    messages, with latency seconds of delay per query. Useful for the tests and to benchmark the clients offline:
+
+        with StubIndexServer(latency=0.001) as server:
+            index_cache = IndexCache(*server.address, pool_size=4)
+    """
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, host="127.0.0.1", port=0, latency=0.0, performance_fun=default_performance):
+        SocketServer.TCPServer.__init__(self, (host, port), _StubRequestHandler)
+        self.latency = latency
+        self.performance_fun = performance_fun
+        self.num_requests = 0
+        self.lock = threading.Lock()
+        self._thread = None
+
+    @property
+    def address(self):
+        return self.server_address[0], self.server_address[1]
+
+    def start(self):
+        self._thread = threading.Thread(target=self.serve_forever)
+        self._thread.daemon = True
+        self._thread.start()
+        return self
+
+    def stop(self):
+        self.shutdown()
+        self.server_close()
+        self._thread.join()
+
+    def __enter__(self):
+        return self.start()
+
+    def __exit__(self, *exc_info):
+        self.stop()
+
+
+def benchmark(index_cache, query_reprs, max_in_flight=64, num_threads=1):
+    """
+    Return the number of queries per second answered through index_cache, the queries are always sent to the server
+    """
+    start_time = time.time()
+    index_cache.get_performance_many(query_reprs, force=True, max_in_flight=max_in_flight, num_threads=num_threads)
+    return len(query_reprs) / (time.time() - start_time)
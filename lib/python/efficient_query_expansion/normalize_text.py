@@ -2,6 +2,8 @@
 import unicodedata
 import re
 
+from text_normalization import text_normalizer
+
 _rex_control_characters = re.compile(
     r'[\x00-\x09\x0E-\x19][\x00-\x09\x0E-\x20]*')
 _rex_spaces = re.compile(
@@ -15,6 +17,26 @@ _rex_hyphens = re.compile(
 
 
 def normalize_text_step_1(text):
+    return text_normalizer.normalize_text_step_1(text)
+
+
+def normalize_text_step_2(text):
+    if isinstance(text, unicode):
+        return _py_normalize_text_step_2(text)
+    return text_normalizer.normalize_text_step_2(text)
+
+
+def normalize_text(text):
+    return text_normalizer.normalize_text(text)
+
+
+def normalize_texts(texts, num_threads=0):
+    # normalize_text of many texts in parallel
+    return text_normalizer.normalize_texts(texts, num_threads)
+
+
+# Reference implementations, the native normalizer must produce exactly the same output
+def _py_normalize_text_step_1(text):
     if isinstance(text, unicode):
         # normalize the UTF8 characters
         text = unicodedata.normalize('NFD', text)
@@ -31,15 +53,15 @@ def normalize_text_step_1(text):
     return text.strip()
 
 
-def normalize_text_step_2(text):
+def _py_normalize_text_step_2(text):
     # remove non alphanumeric characters collapsing near spaces
     text = _rex_alphanumeric_characters.sub(' ', text)
     # make the text lower and remove trailing spaces
     return text.lower().strip()
 
 
-def normalize_text(text):
-    return normalize_text_step_2(normalize_text_step_1(text))
+def _py_normalize_text(text):
+    return _py_normalize_text_step_2(_py_normalize_text_step_1(text))
 
 
 def normalize_hyphens(text):